@@ -1,710 +1,3086 @@
-//smain.c
-//this is the main server program for a file management system, it handles various file operations like uploading, downloading, removing files,
-//and creating tar archives. The server can handle .c files directly and communicates with other servers (Stext and Spdf) for .txt and .pdf files.
-#define _XOPEN_SOURCE 500
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/socket.h>
-#include <sys/stat.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <errno.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <fcntl.h>
-#include <dirent.h>
-#include <pwd.h>
-#include <ftw.h>
-#include <stdbool.h>
-#include <limits.h>
-
-//port numbers for different servers
-#define PORT 3001
-#define SPDF_PORT 3002
-#define STEXT_PORT 3003
-#define BUFFER_SIZE 1024
-#define MAX_FILENAME 256
-
-//global variables to store directory paths
-char SMAIN_DIR[256];
-char SPDF_DIR[256];
-char STEXT_DIR[256];
-
-//function prototypes
-void prcclient(int client_socket);
-void expand_path_for_home(const char* path, char* expanded_path);
-int open_file_for_writing(int client_socket, char* filename, char* expanded_path);
-int transfer_file_from_client(int source_fd, int dest_fd);
-int transfer_file_to_from_txt_pdf(int source_fd, int dest_fd);
-int transfer_data_from_fd(int source_fd, int dest_fd);
-void function_to_process_ufile(int client_socket, char* filename, char* destination_path);
-void function_to_process_dfile(int client_socket, char* filename);
-void function_to_process_rmfile(int client_socket, char* filename);
-void function_to_process_dtar(int client_socket, char* filetype);
-void function_to_process_display(int client_socket, char* pathname);
-int function_for_server_communications(int port, char* request, char* response);
-
-//main function: Sets up the server, creates necessary directories,
-//and enters an infinite loop to accept client connections.
-int main() {
-    int server_fd, client_socket;
-    struct sockaddr_in address;
-    int opt = 1;
-    int addrlen = sizeof(address);
-
-    //get home directory
-    const char *homedir = getenv("HOME");
-
-    //set up directories
-    snprintf(SMAIN_DIR, sizeof(SMAIN_DIR), "%s/smain", homedir);
-    snprintf(SPDF_DIR, sizeof(SPDF_DIR), "%s/spdf", homedir);
-    snprintf(STEXT_DIR, sizeof(STEXT_DIR), "%s/stext", homedir);
-
-    //create directories if they don't exist
-    mkdir(SMAIN_DIR, 0755);
-    mkdir(SPDF_DIR, 0755);
-    mkdir(STEXT_DIR, 0755);
-
-    //create socket file descriptor
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        perror("socket failed");
-        exit(EXIT_FAILURE);
-    }
-
-    //set socket options to reuse address and port
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEADDR, &opt, sizeof(opt))) {
-        perror("setsockopt");
-        close(server_fd);
-        exit(EXIT_FAILURE);
-    }
-
-    //set up server address structure
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
-
-    //bind the socket to the network address and port
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        perror("bind failed");
-        close(server_fd);
-        exit(EXIT_FAILURE);
-    }
-
-    //start listening for connections
-    if (listen(server_fd, 3) < 0) {
-        perror("listen");
-        close(server_fd);
-        exit(EXIT_FAILURE);
-    }
-
-    printf("Smain server is running on port %d\n", PORT);
-
-    //main server loop
-    while(1) {
-        //accept incoming connection
-        if ((client_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
-            perror("accept");
-            continue;
-        }
-
-        //fork a new process to handle the client
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("fork failed");
-            close(client_socket);
-            continue;
-        } else if (pid == 0) {
-            //child process
-            close(server_fd);
-            prcclient(client_socket);
-            exit(0);
-        } else {
-            //parent process
-            close(client_socket);
-            //wait for child processes to avoid zombies
-            waitpid(-1, NULL, WNOHANG);
-        }
-    }
-
-    close(server_fd);
-    return 0;
-}
-
-//prcclient: Processes client requests in a loop until the client disconnects.
-//it reads commands from the client and calls appropriate functions to handle them.
-void prcclient(int client_socket) {
-    char buffer[BUFFER_SIZE] = {0};
-    int valread;
-
-    while (1) {
-        //clear buffer and read client request
-        memset(buffer, 0, BUFFER_SIZE);
-        valread = read(client_socket, buffer, BUFFER_SIZE);
-        if (valread <= 0) {
-            //client disconnected or error occurred
-            break;
-        }
-
-        printf("Received command: %s\n", buffer);
-        //parse command and arguments
-        char command[10] = {0};
-        char arg1[256] = {0};
-        char arg2[256] = {0};
-        sscanf(buffer, "%s %s %s", command, arg1, arg2);
-
-        //process different commands
-        switch(command[0]) {
-            case 'u':
-                if (strcmp(command, "ufile") == 0) {
-                    function_to_process_ufile(client_socket, arg1, arg2);
-                } else {
-                    send(client_socket, "Invalid command", 15, 0);
-                }
-                break;
-            case 'd':
-                if (strcmp(command, "dfile") == 0) {
-                    function_to_process_dfile(client_socket, arg1);
-                } else if (strcmp(command, "dtar") == 0) {
-                    function_to_process_dtar(client_socket, arg1);
-                } else if (strcmp(command, "display") == 0) {
-                    function_to_process_display(client_socket, arg1);
-                } else {
-                    send(client_socket, "Invalid command", 15, 0);
-                }
-                break;
-            case 'r':
-                if (strcmp(command, "rmfile") == 0) {
-                    function_to_process_rmfile(client_socket, arg1);
-                } else {
-                    send(client_socket, "Invalid command", 15, 0);
-                }
-                break;
-            default:
-                send(client_socket, "Invalid command", 15, 0);
-        }
-    }
-    close(client_socket);
-}
-
-//expand_path_for_home: Expands the '~' in a path to the user's home directory.
-//this function is used to convert relative paths to absolute paths.
-void expand_path_for_home(const char* path, char* expanded_path) {
-    if (path[0] == '~') {
-        //if path starts with '~', replace it with the home directory
-        const char *homedir = getenv("HOME");
-        snprintf(expanded_path, PATH_MAX, "%s%s", homedir, path + 1);
-    } else {
-        //otherwise, just copy the path as is
-        strncpy(expanded_path, path, PATH_MAX);
-    }
-}
-
-//open_file_for_writing: Opens a file for writing in the specified path.
-//it creates the file if it doesn't exist and truncates it if it does.
-int open_file_for_writing(int client_socket, char* filename, char* expanded_path) {
-    char filepath[PATH_MAX];
-    snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
-
-    //open file with write, create, and truncate flags
-    int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
-        perror("Failed to create file");
-        send(client_socket, "Failed to upload file", 21, 0);
-        return -1; 
-    }
-    return fd;
-}
-
-//transfer_file_from_client: Transfers file data from the client to a file descriptor.
-//it reads data in chunks and writes it to the destination file descriptor.
-int transfer_file_from_client(int source_fd, int dest_fd) {
-    char buffer[BUFFER_SIZE];
-    int bytes_read, bytes_written;
-    int total_bytes = 0;
-
-    //read data from source and write to destination
-    while ((bytes_read = recv(source_fd, buffer, BUFFER_SIZE, 0)) >= 0) {
-        bytes_written = write(dest_fd, buffer, bytes_read);
-        if (bytes_written != bytes_read) {
-            send(source_fd, "Failed to write file", 20, 0);
-            return -1;
-        }
-        //break the loop if we've received the entire file
-        if (bytes_read < BUFFER_SIZE) {
-            break;
-        }
-        total_bytes += bytes_written;
-    }
-
-    //check for receive error
-    if (bytes_read < 0) {
-        send(source_fd, "Failed to receive file", 22, 0);
-        return -1;
-    }
-    return total_bytes;
-}
-
-//transfer_file_to_from_txt_pdf: Transfers file data between sockets.
-//this function is used to forward data between the client and Stext/Spdf servers.
-int transfer_file_to_from_txt_pdf(int source_fd, int dest_fd) {
-    char buffer[BUFFER_SIZE];
-    int bytes_received;
-    int total_bytes_forwarded = 0;
-
-    //continue receiving and forwarding data until connection closes
-    while (1) {
-        bytes_received = recv(source_fd, buffer, BUFFER_SIZE, 0);
-        if (bytes_received > 0) {
-            //forward received data to destination
-            int bytes_sent = send(dest_fd, buffer, bytes_received, 0);
-            if (bytes_sent != bytes_received) {
-                printf("Failed to forward all data to Spdf\n");
-                break;
-            }
-            total_bytes_forwarded += bytes_sent;
-        } else if (bytes_received == 0) {
-            //connection closed by client
-            printf("File was empty\n");
-            break;
-        } else {
-            //error in receiving data
-            perror("recv failed");
-            break;
-        }
-    }
-    return total_bytes_forwarded;
-}
-
-//transfer_data_from_fd: Transfers data from a file descriptor to a socket.
-//this function is used to send file contents to the client.
-int transfer_data_from_fd(int source_fd, int dest_fd) {
-    char buffer[BUFFER_SIZE];
-    int bytes_read;
-    int total_bytes_sent = 0;
-
-    //read from source and send to destination
-    while ((bytes_read = read(source_fd, buffer, BUFFER_SIZE)) > 0) {
-        int sent = send(dest_fd, buffer, bytes_read, 0);
-        if (sent < 0) {
-            perror("Failed to send data");
-            close(source_fd);
-            return -1;
-        }
-        total_bytes_sent += sent;
-    }
-    return total_bytes_sent;
-}
-
-//function_to_process_ufile: Handles the 'ufile' command to upload a file.
-//it determines the file type and processes it accordingly.
-void function_to_process_ufile(int client_socket, char* filename, char* destination_path) {
-    char expanded_path[PATH_MAX];
-    expand_path_for_home(destination_path, expanded_path);
-
-    //get file extension
-    char *file_extension = strrchr(filename, '.');
-    if (!file_extension || (strcmp(file_extension, ".c") != 0 && strcmp(file_extension, ".txt") != 0 && strcmp(file_extension, ".pdf") != 0)) {
-        send(client_socket, "Invalid file type", 17, 0);
-        return;
-    }
-
-    //send acceptance message to client
-    send(client_socket, "File type accepted", 18, 0);
-
-    //process .c files
-    if (file_extension && strcmp(file_extension, ".c") == 0) {
-        //create directories if they don't exist
-        char *p = strchr(expanded_path + 1, '/');
-        while (p) {
-            *p = '\0';
-            if (mkdir(expanded_path, 0755) == -1 && errno != EEXIST) {
-                send(client_socket, "Failed to create directory", 26, 0);
-                return;
-            }
-            *p = '/';
-            p = strchr(p + 1, '/');
-        }
-        if (mkdir(expanded_path, 0755) == -1 && errno != EEXIST) {
-            send(client_socket, "Failed to create directory", 26, 0);
-            return;
-        }
-
-        //open file and transfer data
-        int fd = open_file_for_writing(client_socket, filename, expanded_path);
-        int bytes_transferred = transfer_file_from_client(client_socket, fd);
-        close(fd);
-
-        //send response to client
-        if (bytes_transferred < 0) {
-            send(client_socket, "Failed to upload file", 21, 0);
-        } else {
-            char response[BUFFER_SIZE];
-            snprintf(response, BUFFER_SIZE, "File %s uploaded successfully.", filename);
-            send(client_socket, response, strlen(response), 0);
-        }
-    } 
-    //process .txt files
-    else if (file_extension && strcmp(file_extension, ".txt") == 0) {
-        //transfer .txt files to Stext
-        char request[BUFFER_SIZE];
-        char response[BUFFER_SIZE];
-        snprintf(request, sizeof(request), "ufile %s %s", filename, expanded_path);
-        
-        //connect to Stext server
-        int stext_sock = function_for_server_communications(STEXT_PORT, NULL, NULL);
-        if (stext_sock < 0) {
-            send(client_socket, "Failed to connect to Stext server", 33, 0);
-            return;
-        }
-
-        //send the request to Stext and forward data
-        send(stext_sock, request, strlen(request), 0);
-        int total_bytes_forwarded = transfer_file_to_from_txt_pdf(client_socket, stext_sock);
-        printf("Total bytes forwarded to Stext: %d\n", total_bytes_forwarded);
-
-        //signal end of file to Stext
-        shutdown(stext_sock, SHUT_WR);
-
-        //get response from Stext and send to client
-        memset(response, 0, BUFFER_SIZE);
-        int response_len = recv(stext_sock, response, BUFFER_SIZE - 1, 0);
-        if (response_len > 0) {
-            response[response_len] = '\0';
-            printf("Response from Stext: %s\n", response);
-            send(client_socket, response, response_len, 0);
-        } else {
-            send(client_socket, "No response from Stext server", 30, 0);
-        }
-        close(stext_sock);
-    } 
-    //process .pdf files
-    else if (file_extension && strcmp(file_extension, ".pdf") == 0) {
-        //transfer .pdf files to Spdf
-        char request[BUFFER_SIZE];
-        char response[BUFFER_SIZE];
-        snprintf(request, sizeof(request), "ufile %s %s", filename, expanded_path);
-        
-        //connect to Spdf server
-        int spdf_sock = function_for_server_communications(SPDF_PORT, NULL, NULL);
-        if (spdf_sock < 0) {
-            send(client_socket, "Failed to connect to Spdf server", 32, 0);
-            return;
-        }
-
-        //send the request to Spdf
-        send(spdf_sock, request, strlen(request), 0);
-
-        //forward the file content from client to Spdf
-        int total_bytes_forwarded = transfer_file_to_from_txt_pdf(client_socket, spdf_sock);
-        printf("Total bytes forwarded to Spdf: %d\n", total_bytes_forwarded);
-
-        //signal end of file to Spdf
-        shutdown(spdf_sock, SHUT_WR);
-
-        //get response from Spdf and send to client
-        memset(response, 0, BUFFER_SIZE);
-        int response_len = recv(spdf_sock, response, BUFFER_SIZE - 1, 0);
-        if (response_len > 0) {
-            response[response_len] = '\0';
-            printf("Response from Spdf: %s\n", response);
-            send(client_socket, response, response_len, 0);
-        } else {
-            send(client_socket, "No response from Spdf server", 29, 0);
-        }
-
-        close(spdf_sock);
-        return;
-    }
-    //add this line to ensure a response is always sent
-    send(client_socket, "Upload processed", 16, 0);
-}
-
-//function_to_process_dfile: Handles the 'dfile' command to download a file.
-//it determines the file type and processes the download accordingly.
-void function_to_process_dfile(int client_socket, char* filename) {
-    //get file extension
-    char *file_extension = strrchr(filename, '.');
-    if (!file_extension || (strcmp(file_extension, ".c") != 0 && strcmp(file_extension, ".txt") != 0 && strcmp(file_extension, ".pdf") != 0)) {
-        send(client_socket, "Invalid file type", 17, 0);
-        return;
-    }
-
-    //send acceptance message to client
-    send(client_socket, "File type accepted", 18, 0);
-
-    //process .c files
-    if (file_extension && strcmp(file_extension, ".c") == 0) {
-        char filepath[PATH_MAX];
-        expand_path_for_home(filename, filepath);
-
-        //open the file
-        int fd = open(filepath, O_RDONLY);
-        if (fd < 0) {
-            char error_msg[BUFFER_SIZE];
-            snprintf(error_msg, BUFFER_SIZE, "Failed to open file: %s", strerror(errno));
-            send(client_socket, error_msg, strlen(error_msg), 0);
-            return;
-        }
-
-        //transfer file data to client
-        int total_data_sent = transfer_data_from_fd(fd, client_socket);
-        close(fd);
-        send(client_socket, "", 0, 0);
-        printf("Total data sent to client: %d\n", total_data_sent);
-    } 
-    //process .txt and .pdf files
-    else if (file_extension && (strcmp(file_extension, ".txt") == 0 || strcmp(file_extension, ".pdf") == 0)) {
-        //determine appropriate server
-        int port = (strcmp(file_extension, ".txt") == 0) ? STEXT_PORT : SPDF_PORT;
-        char request[BUFFER_SIZE];
-        char response[BUFFER_SIZE];
-
-        //prepare request for Stext/Spdf server
-        snprintf(request, sizeof(request), "dfile %s", filename);
-        int sock = function_for_server_communications(port, request, response);
-        if (sock < 0) {
-            printf("Failed to communicate with server\n");
-            send(client_socket, "Failed to retrieve file from server", 35, 0);
-            return;
-        }
-        send(client_socket, response, strlen(response), 0);
-
-        //forward the file content from Stext/Spdf to client
-        int total_bytes_sent = transfer_file_to_from_txt_pdf(sock, client_socket);
-        printf("Total file bytes sent to client: %d\n", total_bytes_sent);
-        close(sock);
-    }
-}
-
-//function_to_process_rmfile: Handles the 'rmfile' command to remove a file.
-//it determines the file type and processes the removal accordingly.
-void function_to_process_rmfile(int client_socket, char* filename) {
-    //get file extension
-    char *file_extension = strrchr(filename, '.');
-    if (!file_extension || (strcmp(file_extension, ".c") != 0 && strcmp(file_extension, ".txt") != 0 && strcmp(file_extension, ".pdf") != 0)) {
-        send(client_socket, "Invalid file type", 17, 0);
-        return;
-    }
-
-    //send acceptance message to client
-    send(client_socket, "File type accepted", 18, 0);
-
-    //process .c files
-    if (file_extension && strcmp(file_extension, ".c") == 0) {
-        //remove .c files locally
-        char filepath[PATH_MAX];
-        expand_path_for_home(filename, filepath);
-
-        if (remove(filepath) == 0) {
-            char response[BUFFER_SIZE];
-            snprintf(response, BUFFER_SIZE, "File %s removed\n", filename);
-            send(client_socket, response, strlen(response), 0);
-        } else {
-            perror("Failed to remove file");
-            send(client_socket, "Failed to remove file", 21, 0);
-        }
-    } 
-    //process .txt and .pdf files
-    else if (file_extension && (strcmp(file_extension, ".txt") == 0 || strcmp(file_extension, ".pdf") == 0)) {
-        //request file removal from appropriate server
-        int server_port = (strcmp(file_extension, ".txt") == 0) ? STEXT_PORT : SPDF_PORT;
-        char request[BUFFER_SIZE];
-        char response[BUFFER_SIZE];
-        snprintf(request, sizeof(request), "rmfile %s", filename);
-        int server_sock = function_for_server_communications(server_port, request, response);
-        if (server_sock < 0) {
-            send(client_socket, "Failed to connect to server", 27, 0);
-        } else {
-            send(client_socket, response, strlen(response), 0);
-            close(server_sock);
-        }
-    }
-    //add this line to ensure a response is always sent
-    send(client_socket, "Remove processed", 16, 0);
-}
-
-//function_to_process_dtar: Handles the 'dtar' command to create and download a tar archive.
-//it creates a tar archive of files based on the specified file type.
-void function_to_process_dtar(int client_socket, char* filetype) {
-    char request[BUFFER_SIZE];
-    char response[BUFFER_SIZE];
-
-    //get file extension
-    if (!filetype || (strcmp(filetype, ".c") != 0 && strcmp(filetype, ".txt") != 0 && strcmp(filetype, ".pdf") != 0)) {
-        send(client_socket, "Invalid file type", 17, 0);
-        return;
-    }
-
-    //send acceptance message to client
-    send(client_socket, "File type accepted", 18, 0);
-
-    //process .c files
-    if (strcmp(filetype, ".c") == 0) {
-        char tar_file_path[MAX_FILENAME];
-        //create tar of .c files locally
-        snprintf(tar_file_path, sizeof(tar_file_path), "%s/cfiles.tar", SMAIN_DIR);
-        //remove existing tar file if any
-        remove(tar_file_path);
-        char command[BUFFER_SIZE];
-        snprintf(command, BUFFER_SIZE, "tar -cf %s -C %s .", tar_file_path, SMAIN_DIR);
-        system(command);
-
-        //send tar file to client
-        int fd = open(tar_file_path, O_RDONLY);
-        if (fd < 0) {
-            perror("Failed to open tar file");
-            send(client_socket, "Failed to create tar file", 25, 0);
-            return;
-        }
-
-        //get file size for logging
-        struct stat file_stat;
-        if (fstat(fd, &file_stat) < 0) {
-            perror("Failed to get file size");
-            close(fd);
-            send(client_socket, "Failed to get file size", 23, 0);
-            return;
-        }
-
-        int total_data_sent = transfer_data_from_fd(fd, client_socket);
-        printf("Total data sent to client: %d\n", total_data_sent);
-
-        //send end-of-file marker
-        char eof_marker[8] = "EOF\n";
-        send(client_socket, eof_marker, strlen(eof_marker), 0);
-
-        close(fd);
-        //clean up the tar file after sending
-        remove(tar_file_path);
-    } 
-    //process .txt files
-    else if (strcmp(filetype, ".txt") == 0) {
-        snprintf(request, sizeof(request), "dtar %s", filetype);
-        int stext_sock = function_for_server_communications(STEXT_PORT, request, response);
-        if (stext_sock < 0) {
-            send(client_socket, "Failed to communicate with Stext server", 39, 0);
-            return;
-        }
-        //transfer data from stext to client
-        int total_bytes_sent = transfer_file_to_from_txt_pdf(stext_sock, client_socket);
-        printf("Total bytes sent to client: %zu\n", total_bytes_sent);
-        close(stext_sock);
-    } 
-    //process .pdf files
-    else if (strcmp(filetype, ".pdf") == 0) {
-        snprintf(request, sizeof(request), "dtar %s", filetype);
-        int spdf_sock = function_for_server_communications(SPDF_PORT, request, response);
-        if (spdf_sock < 0) {
-            send(client_socket, "Failed to communicate with Spdf server", 38, 0);
-            return;
-        }
-        //transfer data from spdf to client
-        int total_bytes_sent = transfer_file_to_from_txt_pdf(spdf_sock, client_socket);
-        printf("Total bytes sent to client: %zu\n", total_bytes_sent);
-        close(spdf_sock);
-    }
-}
-
-//function_to_process_display: Handles the 'display' command to list files in a directory.
-//it gathers file lists from local storage and remote servers.
-void function_to_process_display(int client_socket, char* pathname) {
-    //send acceptance message to client
-    send(client_socket, "In display function", 19, 0);
-
-    char response[BUFFER_SIZE] = "";
-    char c_files[BUFFER_SIZE] = "";
-    char pdf_files[BUFFER_SIZE] = "";
-    char txt_files[BUFFER_SIZE] = "";
-    char full_path[PATH_MAX];
-    
-    expand_path_for_home(pathname, full_path);
-
-    //get list of .c files locally
-    DIR *dir;
-    struct dirent *ent;
-    struct stat st;
-    if ((dir = opendir(full_path)) != NULL) {
-        while ((ent = readdir(dir)) != NULL) {
-            char file_path[PATH_MAX];
-            snprintf(file_path, PATH_MAX, "%s/%s", full_path, ent->d_name);
-            if (stat(file_path, &st) == 0 && S_ISREG(st.st_mode) && strstr(ent->d_name, ".c") != NULL) {
-                strcat(c_files, ent->d_name);
-                strcat(c_files, "\n");
-            }
-        }
-        closedir(dir);
-    }
-
-    //get list of .pdf files from Spdf
-    char request[BUFFER_SIZE];
-    snprintf(request, sizeof(request), "display %s", pathname);
-    int spdf_sock = function_for_server_communications(SPDF_PORT, request, pdf_files);
-    if (spdf_sock < 0) {
-        strcat(pdf_files, "Failed to get PDF files\n");
-    }
-    close(spdf_sock);
-
-    //get list of .txt files from Stext
-    int stext_sock = function_for_server_communications(STEXT_PORT, request, txt_files);
-    if (stext_sock < 0) {
-        strcat(txt_files, "Failed to get TXT files\n");
-    }
-    close(stext_sock);
-
-    //combine all lists
-    strcat(response, c_files);
-    strcat(response, pdf_files);
-    strcat(response, txt_files);
-
-    if (response == 0) {
-        strcpy(response, "No files found in the directory");
-    }
-
-    send(client_socket, response, strlen(response), 0);
-    printf("Display request processed\n");
-}
-
-//function_for_server_communications: Establishes a connection with a server and sends/receives data.
-//it's used for communicating with Stext and Spdf servers.
-int function_for_server_communications(int port, char* request, char* response) {
-    int sock = 0;
-    struct sockaddr_in serv_addr;
-
-    //create socket
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        printf("\n Socket creation error \n");
-        return -1;
-    }
-
-    //set up server address structure
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
-
-    //convert IPv4 and IPv6 addresses from text to binary form
-    if(inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0) {
-        printf("\nInvalid address/ Address not supported \n");
-        close(sock);
-        return -1;
-    }
-
-    //connect to the server
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        printf("\nConnection Failed \n");
-        close(sock);
-        return -1;
-    }
-
-    //send request if provided
-    if (request && strlen(request) > 0) {
-        send(sock, request, strlen(request), 0);
-    }
-
-    //read response if buffer provided
-    if (response) {
-        read(sock, response, BUFFER_SIZE);
-    }
-    return sock;
-}
\ No newline at end of file
+//smain.c
+//this is the main server program for a file management system, it handles various file operations like uploading, downloading, removing files,
+//and creating tar archives. The server can handle .c files directly and communicates with other servers (Stext and Spdf) for .txt and .pdf files.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "dfs_frame.h"
+#include "dfs_xfer.h"
+#include "dfs_backend.h"
+#include "dfs_tar.h"
+#include "dfs_list.h"
+#include "dfs_index.h"
+#include "dfs_stage.h"
+#include "dfs_delta.h"
+#include "dfs_compress.h"
+#include "dfs_cache.h"
+#include "dfs_config.h"
+#include "dfs_metrics.h"
+
+//port numbers for different servers, set by DFS_SMAIN_PORT / DFS_SPDF_PORT / DFS_STEXT_PORT
+#define PORT (dfs_config_net()->smain_port)
+#define SPDF_PORT (dfs_config_net()->spdf_port)
+#define STEXT_PORT (dfs_config_net()->stext_port)
+#define BUFFER_SIZE 1024
+
+//global variables to store directory paths
+char SMAIN_DIR[256];
+char SPDF_DIR[256];
+char STEXT_DIR[256];
+//codecs a client may choose for compressed transfers, from DFS_COMPRESS; "none" turns compression off
+const char* SMAIN_CODECS = "lz";
+//clients are served by one epoll event loop rather than a process each
+bool SMAIN_EPOLL = false;
+
+//candidate names of one server for a page of a display listing, stored one NUL-terminated name after another.
+//a server returns at most one page of names, so a part never holds more than that.
+struct display_part {
+    char* names;
+    size_t length;
+    size_t capacity;
+    long count;
+    bool more;                 //the server has names after these
+};
+
+//one storage server's part of a display listing, fetched while Smain lists its own files
+struct display_fetch {
+    int port;
+    const char* server_name;
+    const char* failure;       //line added to the listing if the server does not answer
+    struct display_part* part; //where a page's names are gathered; NULL forwards them to the client
+    int sock;
+    uint32_t backend_id;
+    bool status_received;
+    bool retried;
+    unsigned long long started_us;
+};
+
+//function prototypes
+void prcclient(int client_socket);
+void expand_path_for_home(const char* path, char* expanded_path);
+int open_file_for_writing(int client_socket, uint32_t request_id, char* filename, char* expanded_path);
+long long transfer_file_from_client(int source_fd, int dest_fd, char* error_message, size_t error_capacity);
+long long transfer_file_to_from_txt_pdf(int source_fd, int dest_fd, uint32_t request_id);
+long long transfer_data_from_fd(int source_fd, int dest_fd, uint32_t request_id, off_t offset, long long length);
+void function_to_process_ufile(int client_socket, uint32_t request_id, char* filename, char* destination_path);
+void function_to_process_ufile_resume(int client_socket, uint32_t request_id, char* filename, char* destination_path, const char* offset_text);
+void function_to_process_ufile_part(int client_socket, uint32_t request_id, uint8_t opcode, char* filename, char* destination_path, char* token, const char* number_text);
+void function_to_process_ufile_delta(int client_socket, uint32_t request_id, uint8_t opcode, char* filename, char* destination_path, const char* size_text, const char* sha256_text);
+void function_to_relay_upload(int client_socket, uint32_t request_id, int port, uint8_t opcode, const char* const* args, int argc);
+void function_to_process_dfile(int client_socket, uint32_t request_id, char* filename, char** range, int range_count, uint16_t flags);
+void function_to_send_file(int client_socket, uint32_t request_id, int fd, uint64_t size, char** range, int range_count);
+void function_to_process_compress(int client_socket, uint32_t request_id, const char* offered);
+void function_to_process_rmfile(int client_socket, uint32_t request_id, char* filename);
+void function_to_process_dtar(int client_socket, uint32_t request_id, char* filetype, const char* options_text);
+void function_to_process_display(int client_socket, uint32_t request_id, char* pathname, const char* options_text);
+int function_for_server_communications(int port, uint8_t opcode, uint32_t backend_id, const char* arg1, const char* arg2, char* response, size_t response_size, int* status_ok);
+int function_for_server_request(int port, uint8_t opcode, uint16_t flags, uint32_t backend_id, const char* const* args, int argc, char* response, size_t response_size, int* status_ok);
+int function_to_create_directories(char* expanded_path);
+int function_to_get_part_options(const struct dfs_list_options* options, int part, struct dfs_list_options* part_options);
+int function_to_add_display_name(void* part, const char* name);
+void function_to_add_display_names(struct display_part* part, const char* payload, size_t length);
+void function_to_merge_display_parts(struct display_part parts[3], const struct dfs_list_options* options, struct dfs_list_writer* writer);
+void function_to_start_display_fetch(struct display_fetch* fetch, const char* pathname, const char* options_text);
+bool function_to_read_display_fetch(struct display_fetch* fetch, int client_socket, uint32_t request_id, const char* pathname, const char* options_text);
+unsigned long long function_to_get_time_us(void);
+void function_to_reap_children(int signo);
+void run_fork_server(int server_fd);
+void run_epoll_server(int server_fd);
+void function_to_write_metrics(FILE* out);
+
+//main function: Sets up the server, creates necessary directories,
+//and enters an infinite loop to accept client connections.
+int main() {
+    int server_fd;
+    struct sockaddr_in address;
+    int opt = 1;
+
+    //settings from the configuration file join the environment before anything reads it
+    if (dfs_config_load("Smain") < 0) {
+        fprintf(stderr, "Ignoring the configuration file\n");
+    }
+
+    //get home directory
+    const char *homedir = getenv("HOME");
+
+    //set up directories
+    snprintf(SMAIN_DIR, sizeof(SMAIN_DIR), "%s/smain", homedir);
+    snprintf(SPDF_DIR, sizeof(SPDF_DIR), "%s/spdf", homedir);
+    snprintf(STEXT_DIR, sizeof(STEXT_DIR), "%s/stext", homedir);
+
+    //create directories if they don't exist
+    mkdir(SMAIN_DIR, 0755);
+    mkdir(SPDF_DIR, 0755);
+    mkdir(STEXT_DIR, 0755);
+
+    //index the .c files so listings and lookups are answered from memory
+    long indexed_files = dfs_index_build(SMAIN_DIR);
+    if (indexed_files < 0) {
+        fprintf(stderr, "Failed to index %s, serving it from disk\n", SMAIN_DIR);
+    } else {
+        printf("Indexed %ld files in %s\n", indexed_files, SMAIN_DIR);
+    }
+
+    //configure how data is relayed to and from Spdf/Stext; counters are shared by all child processes
+    dfs_xfer_set_relay_mode(dfs_xfer_parse_relay_mode(getenv("DFS_RELAY_MODE")));
+    if (getenv("DFS_COMPRESS")) {
+        SMAIN_CODECS = getenv("DFS_COMPRESS");
+    }
+    if (getenv("DFS_RELAY_PIPE_SIZE")) {
+        dfs_xfer_set_pipe_size(atoi(getenv("DFS_RELAY_PIPE_SIZE")));
+    }
+    if (dfs_xfer_share_stats() < 0) {
+        perror("Failed to share relay counters");
+    }
+
+    //limits for the keep-alive connections to Spdf/Stext
+    dfs_backend_config_from_env();
+
+    //reader threads, compression threads and gzip level for dtar archives of the Smain directory
+    dfs_tar_config_from_env();
+
+    //cache for .txt and .pdf downloads, shared by all child processes
+    dfs_cache_config_from_env();
+    if (dfs_cache_init(SMAIN_DIR) < 0) {
+        printf("Download cache disabled\n");
+    }
+
+    //create socket file descriptor
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+        perror("socket failed");
+        exit(EXIT_FAILURE);
+    }
+
+    //set socket options to reuse address and port
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEADDR, &opt, sizeof(opt))) {
+        perror("setsockopt");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    //connections inherit the socket buffer sizes of the listening socket
+    dfs_config_tune_socket(server_fd);
+
+    //set up server address structure
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(PORT);
+
+    //bind the socket to the network address and port
+    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        perror("bind failed");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    //start listening for connections; the backlog absorbs bursts of clients connecting at once
+    if (listen(server_fd, dfs_config_net()->listen_backlog) < 0) {
+        perror("listen");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    //select the connection model: one process per client (default) or a single epoll event loop
+    const char *mode = getenv("DFS_SMAIN_MODE");
+    bool use_epoll = mode && strcmp(mode, "epoll") == 0;
+    SMAIN_EPOLL = use_epoll;
+    printf("Smain server is running on port %d (%s mode, relay mode: %s)\n", PORT, use_epoll ? "epoll" : "fork", dfs_xfer_relay_mode_name(dfs_xfer_get_relay_mode()));
+
+    //client processes pass their index updates to each other
+    if (!use_epoll && dfs_index_share_updates() < 0) {
+        perror("Failed to share index updates");
+    }
+
+    //request metrics, shared by all child processes and served at DFS_METRICS_PORT
+    dfs_metrics_add_backend("Spdf", SPDF_PORT);
+    dfs_metrics_add_backend("Stext", STEXT_PORT);
+    dfs_metrics_add_source(function_to_write_metrics);
+    if (dfs_metrics_start_server("Smain") < 0) {
+        fprintf(stderr, "Metrics endpoint disabled\n");
+    }
+
+    //a client that disconnects mid-transfer must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    //reap client processes as soon as they exit
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = function_to_reap_children;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    if (use_epoll) {
+        run_epoll_server(server_fd);
+    } else {
+        run_fork_server(server_fd);
+    }
+
+    close(server_fd);
+    return 0;
+}
+
+//function_to_reap_children: SIGCHLD handler that collects every finished child so none are left as zombies.
+void function_to_reap_children(int signo) {
+    (void)signo;
+    int saved_errno = errno;
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+    }
+    errno = saved_errno;
+}
+
+//run_fork_server: Accepts clients and forks a new process to handle each one.
+void run_fork_server(int server_fd) {
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof(address);
+
+    //main server loop
+    while(1) {
+        //accept incoming connection
+        int client_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
+        if (client_socket < 0) {
+            perror("accept");
+            continue;
+        }
+        dfs_config_tune_socket(client_socket);
+        dfs_metrics_connection_opened();
+
+        //fork a new process to handle the client, starting from a current index
+        dfs_index_refresh();
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            close(client_socket);
+            dfs_metrics_connection_closed();
+            continue;
+        } else if (pid == 0) {
+            //child process; restore the default SIGCHLD disposition inherited from the parent.
+            //its storage server connections are pooled for this client session only
+            signal(SIGCHLD, SIG_DFL);
+            close(server_fd);
+            prcclient(client_socket);
+            exit(0);
+        } else {
+            //parent process
+            close(client_socket);
+        }
+    }
+}
+
+//prcclient: Processes client requests in a loop until the client disconnects.
+//it reads request frames from the client and calls appropriate functions to handle them.
+void prcclient(int client_socket) {
+    char payload[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame request;
+    struct dfs_metrics_request metrics;
+
+    while (1) {
+        //read the next request frame
+        dfs_metrics_begin(&metrics, client_socket);
+        if (dfs_recv_control(client_socket, &request, payload, sizeof(payload)) < 0) {
+            //client disconnected or sent a malformed frame
+            break;
+        }
+        dfs_metrics_start(&metrics, request.opcode);
+
+        //parse command arguments
+        char *args[DFS_MAX_ARGS];
+        int argc = dfs_parse_args(payload, request.length, args, DFS_MAX_ARGS);
+        printf("Received command: %s %s %s\n", dfs_opcode_name(request.opcode), argc > 0 ? args[0] : "", argc > 1 ? args[1] : "");
+
+        //process different commands
+        switch(request.opcode) {
+            case DFS_OP_UFILE:
+                if (argc == 2) {
+                    function_to_process_ufile(client_socket, request.request_id, args[0], args[1]);
+                } else {
+                    dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+                }
+                break;
+            case DFS_OP_UFILE_QUERY:
+            case DFS_OP_UFILE_RESUME:
+                //a resumable upload names the offset it continues at
+                if (argc == (request.opcode == DFS_OP_UFILE_RESUME ? 3 : 2)) {
+                    function_to_process_ufile_resume(client_socket, request.request_id, args[0], args[1], request.opcode == DFS_OP_UFILE_RESUME ? args[2] : NULL);
+                } else {
+                    dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+                }
+                break;
+            case DFS_OP_UFILE_PART:
+            case DFS_OP_UFILE_COMMIT:
+                //a parallel upload names its token and the part's offset, or the file size to commit
+                if (argc == 4) {
+                    function_to_process_ufile_part(client_socket, request.request_id, request.opcode, args[0], args[1], args[2], args[3]);
+                } else {
+                    dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+                }
+                break;
+            case DFS_OP_UFILE_CHUNKS:
+            case DFS_OP_UFILE_DELTA:
+                //a delta upload names the file size and its SHA-256
+                if (argc == 4) {
+                    function_to_process_ufile_delta(client_socket, request.request_id, request.opcode, args[0], args[1], args[2], args[3]);
+                } else {
+                    dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+                }
+                break;
+            case DFS_OP_DISPLAY:
+                //the optional second argument carries the page size, sort order and cursor
+                if (argc == 1 || argc == 2) {
+                    function_to_process_display(client_socket, request.request_id, args[0], argc == 2 ? args[1] : NULL);
+                } else {
+                    dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+                }
+                break;
+            case DFS_OP_DFILE:
+                //a ranged download adds the offset and optionally the length of the slice
+                if (argc >= 1 && argc <= 3) {
+                    function_to_process_dfile(client_socket, request.request_id, args[0], args + 1, argc - 1, request.flags);
+                } else {
+                    dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+                }
+                break;
+            case DFS_OP_DTAR:
+                //an optional codec after the file type asks for a compressed archive
+                if (argc == 1 || argc == 2) {
+                    function_to_process_dtar(client_socket, request.request_id, args[0], argc == 2 ? args[1] : NULL);
+                } else {
+                    dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+                }
+                break;
+            case DFS_OP_RMFILE:
+                if (argc != 1) {
+                    dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+                } else {
+                    function_to_process_rmfile(client_socket, request.request_id, args[0]);
+                }
+                break;
+            case DFS_OP_COMPRESS:
+                //the argument lists the codecs the client can decode, preferred first
+                if (argc == 1) {
+                    function_to_process_compress(client_socket, request.request_id, args[0]);
+                } else {
+                    dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+                }
+                break;
+            default:
+                dfs_send_status(client_socket, request.request_id, 0, "Invalid command");
+        }
+        dfs_metrics_end(&metrics, client_socket);
+    }
+    close(client_socket);
+    dfs_metrics_connection_closed();
+}
+
+//expand_path_for_home: Expands the '~' in a path to the user's home directory.
+//this function is used to convert relative paths to absolute paths.
+void expand_path_for_home(const char* path, char* expanded_path) {
+    if (path[0] == '~') {
+        //if path starts with '~', replace it with the home directory
+        const char *homedir = getenv("HOME");
+        snprintf(expanded_path, PATH_MAX, "%s%s", homedir, path + 1);
+    } else {
+        //otherwise, just copy the path as is
+        strncpy(expanded_path, path, PATH_MAX);
+    }
+}
+
+//open_file_for_writing: Opens a file for writing in the specified path.
+//it creates the file if it doesn't exist and truncates it if it does.
+int open_file_for_writing(int client_socket, uint32_t request_id, char* filename, char* expanded_path) {
+    char filepath[PATH_MAX];
+    snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+
+    //open file with write, create, and truncate flags
+    int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create file");
+        dfs_send_status(client_socket, request_id, 0, "Failed to upload file");
+        return -1;
+    }
+    return fd;
+}
+
+//transfer_file_from_client: Transfers an uploaded data stream from the client to a file descriptor.
+//the stream ends at the frame flagged DFS_FLAG_END, so the whole file is received regardless of read sizes.
+long long transfer_file_from_client(int source_fd, int dest_fd, char* error_message, size_t error_capacity) {
+    return dfs_recv_stream_to_fd(source_fd, dest_fd, error_message, error_capacity);
+}
+
+//transfer_file_to_from_txt_pdf: Transfers a data stream between sockets.
+//this function is used to forward data between the client and Stext/Spdf servers.
+//in splice mode only frame headers are read by Smain; payloads move between the sockets inside the kernel.
+long long transfer_file_to_from_txt_pdf(int source_fd, int dest_fd, uint32_t request_id) {
+    long long total_bytes_forwarded = dfs_relay_stream(source_fd, dest_fd, request_id, 1);
+    if (total_bytes_forwarded < 0) {
+        printf("Failed to forward data stream\n");
+    }
+
+    //report how the relayed bytes were moved so far
+    struct dfs_relay_stats stats;
+    dfs_xfer_get_stats(&stats);
+    printf("Relay totals: %llu bytes spliced, %llu bytes copied, %llu splice fallbacks\n", stats.spliced_bytes, stats.copied_bytes, stats.splice_fallbacks);
+    return total_bytes_forwarded;
+}
+
+//transfer_data_from_fd: Transfers data from a file descriptor to a socket.
+//this function is used to send file contents to the client as a framed data stream, `length` bytes
+//from `offset` on (-1 for the rest of the file).
+//regular files go through sendfile() so the kernel copies pages straight into the socket.
+long long transfer_data_from_fd(int source_fd, int dest_fd, uint32_t request_id, off_t offset, long long length) {
+    return dfs_sendfile_stream(dest_fd, source_fd, offset, length, request_id);
+}
+
+//function_to_process_ufile: Handles the 'ufile' command to upload a file.
+//it determines the file type and processes it accordingly.
+void function_to_process_ufile(int client_socket, uint32_t request_id, char* filename, char* destination_path) {
+    char expanded_path[PATH_MAX];
+    expand_path_for_home(destination_path, expanded_path);
+
+    //get file extension
+    char *file_extension = strrchr(filename, '.');
+    if (!file_extension || (strcmp(file_extension, ".c") != 0 && strcmp(file_extension, ".txt") != 0 && strcmp(file_extension, ".pdf") != 0)) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid file type");
+        return;
+    }
+
+    //process .c files
+    if (strcmp(file_extension, ".c") == 0) {
+        //create directories if they don't exist
+        if (function_to_create_directories(expanded_path) < 0) {
+            dfs_send_status(client_socket, request_id, 0, "Failed to create directory");
+            return;
+        }
+
+        //open file, then tell the client to start sending
+        int fd = open_file_for_writing(client_socket, request_id, filename, expanded_path);
+        if (fd < 0) {
+            return;
+        }
+        dfs_send_status(client_socket, request_id, 1, "File type accepted");
+
+        char error_msg[BUFFER_SIZE] = "Failed to upload file";
+        long long bytes_transferred = transfer_file_from_client(client_socket, fd, error_msg, sizeof(error_msg));
+        close(fd);
+
+        //send response to client
+        if (bytes_transferred < 0) {
+            char filepath[PATH_MAX];
+            snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+            remove(filepath);
+            dfs_index_remove(filepath);
+            dfs_send_status(client_socket, request_id, 0, error_msg);
+        } else {
+            char filepath[PATH_MAX];
+            snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+            dfs_index_update(filepath);
+            char response[BUFFER_SIZE];
+            snprintf(response, BUFFER_SIZE, "File %s uploaded successfully.", filename);
+            dfs_send_status(client_socket, request_id, 1, response);
+        }
+    }
+    //process .txt and .pdf files
+    else {
+        //transfer .txt files to Stext and .pdf files to Spdf
+        int port = strcmp(file_extension, ".txt") == 0 ? STEXT_PORT : SPDF_PORT;
+        const char *args[2] = {filename, expanded_path};
+        function_to_relay_upload(client_socket, request_id, port, DFS_OP_UFILE, args, 2);
+    }
+}
+
+//function_to_relay_upload: Forwards an upload request to Spdf or Stext and relays the client's data stream to it.
+//the storage server's first status is passed on to the client, who starts sending once it is accepted.
+void function_to_relay_upload(int client_socket, uint32_t request_id, int port, uint8_t opcode, const char* const* args, int argc) {
+    const char *server_name = port == STEXT_PORT ? "Stext" : "Spdf";
+    char response[BUFFER_SIZE];
+    int status_ok = 0;
+    uint32_t backend_id = dfs_next_request_id();
+
+    //connect to the storage server and send the request
+    int server_sock = function_for_server_request(port, opcode, 0, backend_id, args, argc, response, sizeof(response), &status_ok);
+    if (server_sock < 0) {
+        snprintf(response, sizeof(response), "Failed to connect to %s server", server_name);
+        dfs_send_status(client_socket, request_id, 0, response);
+        return;
+    }
+    if (!status_ok) {
+        dfs_send_status(client_socket, request_id, 0, response);
+        dfs_backend_release(port, server_sock, 1);
+        return;
+    }
+
+    //tell the client to start sending and forward the data stream
+    dfs_send_status(client_socket, request_id, 1, "File type accepted");
+    long long total_bytes_forwarded = transfer_file_to_from_txt_pdf(client_socket, server_sock, backend_id);
+    printf("Total bytes forwarded to %s: %lld\n", server_name, total_bytes_forwarded);
+    char filepath[PATH_MAX];
+    snprintf(filepath, sizeof(filepath), "%s/%s", args[1], args[0]);
+    if (total_bytes_forwarded < 0) {
+        //the client aborted; closing the connection makes the storage server discard the partial file,
+        //or keep it staged if the upload is resumable
+        dfs_backend_release(port, server_sock, 0);
+        dfs_send_status(client_socket, request_id, 0, "Failed to upload file");
+        return;
+    }
+
+    //get response from the storage server and send to client; by then a cached copy of the file may be out of date
+    struct dfs_frame reply;
+    int replied = dfs_recv_control(server_sock, &reply, response, sizeof(response)) == 0;
+    dfs_cache_invalidate(filepath);
+    if (replied && reply.opcode == DFS_OP_STATUS && reply.request_id == backend_id) {
+        printf("Response from %s: %s\n", server_name, response);
+        dfs_send_status(client_socket, request_id, !(reply.flags & DFS_FLAG_ERROR), response);
+        dfs_backend_release(port, server_sock, 1);
+    } else {
+        snprintf(response, sizeof(response), "No response from %s server", server_name);
+        dfs_send_status(client_socket, request_id, 0, response);
+        dfs_backend_release(port, server_sock, 0);
+    }
+}
+
+//function_to_process_ufile_resume: Handles an upload query and a resumable upload.
+//a query (no offset) reports how many bytes of the file are already staged. a resumable upload stores the stream
+//in a staging file from `offset_text` on, checkpointing as it goes, and renames it into place once it is complete;
+//.pdf and .txt uploads are staged by Spdf and Stext.
+void function_to_process_ufile_resume(int client_socket, uint32_t request_id, char* filename, char* destination_path, const char* offset_text) {
+    char expanded_path[PATH_MAX];
+    expand_path_for_home(destination_path, expanded_path);
+
+    //get file extension
+    char *file_extension = strrchr(filename, '.');
+    if (!file_extension || (strcmp(file_extension, ".c") != 0 && strcmp(file_extension, ".txt") != 0 && strcmp(file_extension, ".pdf") != 0)) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid file type");
+        return;
+    }
+
+    //.txt and .pdf files are staged by the storage server
+    if (strcmp(file_extension, ".c") != 0) {
+        int port = strcmp(file_extension, ".txt") == 0 ? STEXT_PORT : SPDF_PORT;
+        const char *args[3] = {filename, expanded_path, offset_text};
+        if (offset_text) {
+            function_to_relay_upload(client_socket, request_id, port, DFS_OP_UFILE_RESUME, args, 3);
+            return;
+        }
+        char response[BUFFER_SIZE];
+        int status_ok = 0;
+        int server_sock = function_for_server_request(port, DFS_OP_UFILE_QUERY, 0, dfs_next_request_id(), args, 2, response, sizeof(response), &status_ok);
+        if (server_sock < 0) {
+            dfs_send_status(client_socket, request_id, 0, "Failed to connect to server");
+            return;
+        }
+        dfs_send_status(client_socket, request_id, status_ok, response);
+        dfs_backend_release(port, server_sock, 1);
+        return;
+    }
+
+    char filepath[PATH_MAX];
+    char response[BUFFER_SIZE];
+    struct dfs_stage stage;
+    snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+    if (dfs_stage_init(&stage, SMAIN_DIR, filepath) < 0) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid destination path");
+        return;
+    }
+    if (!offset_text) {
+        snprintf(response, BUFFER_SIZE, "%llu", (unsigned long long)dfs_stage_query(&stage));
+        dfs_send_status(client_socket, request_id, 1, response);
+        return;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long offset = strtoull(offset_text, &end, 10);
+    if (errno != 0 || end == offset_text || *end != '\0') {
+        dfs_send_status(client_socket, request_id, 0, "Invalid upload offset");
+        return;
+    }
+    if (function_to_create_directories(expanded_path) < 0) {
+        dfs_send_status(client_socket, request_id, 0, "Failed to create directory");
+        return;
+    }
+    if (dfs_stage_open(&stage, offset, DFS_STAGE_LOCK_WAIT_MS) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to resume upload: %s", errno == ERANGE ? "offset is past the staged data" : errno == EBUSY ? "upload already in progress" : strerror(errno));
+        dfs_send_status(client_socket, request_id, 0, response);
+        return;
+    }
+    dfs_send_status(client_socket, request_id, 1, "File type accepted");
+
+    //receive the rest of the file; what arrived before a failure stays staged for the next attempt
+    char error_msg[BUFFER_SIZE] = "Failed to upload file";
+    long long bytes_transferred = dfs_stage_receive(client_socket, &stage, error_msg, sizeof(error_msg));
+    printf("Total bytes received and staged: %lld (resumed at %llu)\n", bytes_transferred, offset);
+    if (bytes_transferred < 0) {
+        dfs_stage_close(&stage);
+        dfs_send_status(client_socket, request_id, 0, error_msg);
+    } else if (dfs_stage_commit(&stage) < 0) {
+        perror("Failed to move upload into place");
+        dfs_send_status(client_socket, request_id, 0, "Failed to upload file");
+    } else {
+        dfs_index_update(filepath);
+        snprintf(response, BUFFER_SIZE, "File %s uploaded successfully.", filename);
+        dfs_send_status(client_socket, request_id, 1, response);
+    }
+}
+
+//function_to_process_ufile_part: Handles one part of a parallel upload and the commit that ends it.
+//a part (`number_text` is its offset) is written with pwrite() into the upload's assembly file and logged once
+//flushed; the commit (`number_text` is the file size) renames the assembly file into place if every part arrived.
+//.pdf and .txt uploads are assembled by Spdf and Stext.
+void function_to_process_ufile_part(int client_socket, uint32_t request_id, uint8_t opcode, char* filename, char* destination_path, char* token, const char* number_text) {
+    char expanded_path[PATH_MAX];
+    expand_path_for_home(destination_path, expanded_path);
+
+    //get file extension
+    char *file_extension = strrchr(filename, '.');
+    if (!file_extension || (strcmp(file_extension, ".c") != 0 && strcmp(file_extension, ".txt") != 0 && strcmp(file_extension, ".pdf") != 0)) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid file type");
+        return;
+    }
+
+    //.txt and .pdf files are assembled by the storage server
+    const char *args[4] = {filename, expanded_path, token, number_text};
+    if (strcmp(file_extension, ".c") != 0) {
+        int port = strcmp(file_extension, ".txt") == 0 ? STEXT_PORT : SPDF_PORT;
+        if (opcode == DFS_OP_UFILE_PART) {
+            function_to_relay_upload(client_socket, request_id, port, opcode, args, 4);
+            return;
+        }
+        char response[BUFFER_SIZE];
+        int status_ok = 0;
+        int server_sock = function_for_server_request(port, opcode, 0, dfs_next_request_id(), args, 4, response, sizeof(response), &status_ok);
+        if (server_sock < 0) {
+            dfs_send_status(client_socket, request_id, 0, "Failed to connect to server");
+            return;
+        }
+        char filepath[PATH_MAX];
+        snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+        dfs_cache_invalidate(filepath);
+        dfs_send_status(client_socket, request_id, status_ok, response);
+        dfs_backend_release(port, server_sock, 1);
+        return;
+    }
+
+    char filepath[PATH_MAX];
+    char response[BUFFER_SIZE];
+    struct dfs_stage stage;
+    char *end;
+    errno = 0;
+    unsigned long long number = strtoull(number_text, &end, 10);
+    snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+    if (dfs_stage_init(&stage, SMAIN_DIR, filepath) < 0 || errno != 0 || end == number_text || *end != '\0') {
+        dfs_send_status(client_socket, request_id, 0, "Invalid upload part");
+        return;
+    }
+    if (function_to_create_directories(expanded_path) < 0) {
+        dfs_send_status(client_socket, request_id, 0, "Failed to create directory");
+        return;
+    }
+    if (opcode == DFS_OP_UFILE_COMMIT) {
+        if (dfs_stage_commit_parts(&stage, token, number) < 0) {
+            snprintf(response, BUFFER_SIZE, "Failed to upload file: %s", errno == EAGAIN ? "parts are missing" : strerror(errno));
+            dfs_send_status(client_socket, request_id, 0, response);
+            return;
+        }
+        dfs_index_update(filepath);
+        snprintf(response, BUFFER_SIZE, "File %s uploaded successfully.", filename);
+        dfs_send_status(client_socket, request_id, 1, response);
+        return;
+    }
+
+    if (dfs_stage_open_part(&stage, token, number) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to upload file: %s", strerror(errno));
+        dfs_send_status(client_socket, request_id, 0, response);
+        return;
+    }
+    dfs_send_status(client_socket, request_id, 1, "File type accepted");
+
+    //a part that fails is not logged and is sent again by the client
+    char error_msg[BUFFER_SIZE] = "Failed to upload file";
+    long long bytes_transferred = dfs_stage_receive_part(client_socket, &stage, error_msg, sizeof(error_msg));
+    printf("Total bytes received for part at %llu: %lld\n", number, bytes_transferred);
+    if (bytes_transferred < 0) {
+        dfs_stage_close(&stage);
+        dfs_send_status(client_socket, request_id, 0, error_msg);
+    } else if (dfs_stage_finish_part(&stage) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to upload file: %s", strerror(errno));
+        dfs_send_status(client_socket, request_id, 0, response);
+    } else {
+        snprintf(response, BUFFER_SIZE, "Part of %s stored", filename);
+        dfs_send_status(client_socket, request_id, 1, response);
+    }
+}
+
+//function_to_process_ufile_delta: Handles the chunk list query and the upload of the chunks it found missing.
+//both requests are shaped like an upload: the chunk list (and for a delta upload the missing chunks) follows the
+//first status, and the answer or the outcome comes last. .pdf and .txt uploads are assembled by Spdf and Stext.
+void function_to_process_ufile_delta(int client_socket, uint32_t request_id, uint8_t opcode, char* filename, char* destination_path, const char* size_text, const char* sha256_text) {
+    char expanded_path[PATH_MAX];
+    expand_path_for_home(destination_path, expanded_path);
+
+    //get file extension
+    char *file_extension = strrchr(filename, '.');
+    if (!file_extension || (strcmp(file_extension, ".c") != 0 && strcmp(file_extension, ".txt") != 0 && strcmp(file_extension, ".pdf") != 0)) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid file type");
+        return;
+    }
+    if (strcmp(file_extension, ".c") != 0) {
+        int port = strcmp(file_extension, ".txt") == 0 ? STEXT_PORT : SPDF_PORT;
+        const char *args[4] = {filename, expanded_path, size_text, sha256_text};
+        function_to_relay_upload(client_socket, request_id, port, opcode, args, 4);
+        return;
+    }
+
+    char filepath[PATH_MAX];
+    char response[BUFFER_SIZE];
+    struct dfs_stage stage;
+    snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+    if (dfs_stage_init(&stage, SMAIN_DIR, filepath) < 0) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid destination path");
+        return;
+    }
+    if (opcode == DFS_OP_UFILE_CHUNKS) {
+        dfs_send_status(client_socket, request_id, 1, "Ready to receive chunk list");
+        int ok = dfs_delta_query(client_socket, 1, filepath, size_text, sha256_text, response, sizeof(response)) == 0;
+        dfs_send_status(client_socket, request_id, ok, response);
+        return;
+    }
+    if (function_to_create_directories(expanded_path) < 0) {
+        dfs_send_status(client_socket, request_id, 0, "Failed to create directory");
+        return;
+    }
+    dfs_send_status(client_socket, request_id, 1, "File type accepted");
+
+    struct dfs_delta_stats stats;
+    char error_msg[BUFFER_SIZE];
+    if (dfs_delta_apply(client_socket, 1, &stage, size_text, sha256_text, DFS_STAGE_LOCK_WAIT_MS, &stats, error_msg, sizeof(error_msg)) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to upload file: %s", error_msg);
+        dfs_send_status(client_socket, request_id, 0, response);
+        return;
+    }
+    printf("Stored %s from %llu of %llu chunks sent (%llu of %llu bytes)\n", filepath, stats.sent_chunks, stats.chunks, stats.sent_bytes, stats.bytes);
+    dfs_index_update(filepath);
+    snprintf(response, BUFFER_SIZE, "File %s uploaded successfully.", filename);
+    dfs_send_status(client_socket, request_id, 1, response);
+}
+
+//function_to_create_directories: Creates every missing directory along an absolute path.
+//returns 0 on success and -1 if a directory could not be created.
+int function_to_create_directories(char* expanded_path) {
+    char *p = strchr(expanded_path + 1, '/');
+    while (p) {
+        *p = '\0';
+        if (mkdir(expanded_path, 0755) == -1 && errno != EEXIST) {
+            *p = '/';
+            return -1;
+        }
+        *p = '/';
+        p = strchr(p + 1, '/');
+    }
+    if (mkdir(expanded_path, 0755) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+//function_to_process_dfile: Handles the 'dfile' command to download a file.
+//it determines the file type and processes the download accordingly.
+//`range` holds the offset and optional length of a ranged download; Spdf and Stext apply it themselves.
+//DFS_FLAG_COMPRESSED in `flags` is passed on, so Stext and Spdf compress the data frames Smain relays;
+//local .c files are always sent plain.
+void function_to_process_dfile(int client_socket, uint32_t request_id, char* filename, char** range, int range_count, uint16_t flags) {
+    //get file extension
+    char *file_extension = strrchr(filename, '.');
+    if (!file_extension || (strcmp(file_extension, ".c") != 0 && strcmp(file_extension, ".txt") != 0 && strcmp(file_extension, ".pdf") != 0)) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid file type");
+        return;
+    }
+
+    //process .c files
+    if (strcmp(file_extension, ".c") == 0) {
+        char filepath[PATH_MAX];
+        expand_path_for_home(filename, filepath);
+
+        //a file the index does not know is refused without touching the disk
+        if (dfs_index_lookup(filepath, NULL) == 0) {
+            char error_msg[BUFFER_SIZE];
+            snprintf(error_msg, BUFFER_SIZE, "Failed to open file: %s", strerror(ENOENT));
+            dfs_send_status(client_socket, request_id, 0, error_msg);
+            return;
+        }
+
+        //open the file
+        int fd = open(filepath, O_RDONLY);
+        struct stat file_stat;
+        if (fd < 0 || fstat(fd, &file_stat) < 0) {
+            char error_msg[BUFFER_SIZE];
+            snprintf(error_msg, BUFFER_SIZE, "Failed to open file: %s", strerror(errno));
+            dfs_send_status(client_socket, request_id, 0, error_msg);
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+        function_to_send_file(client_socket, request_id, fd, file_stat.st_size, range, range_count);
+        close(fd);
+    }
+    //process .txt and .pdf files
+    else {
+        //a cached copy is sent by Smain itself, without asking the storage server
+        char filepath[PATH_MAX];
+        uint64_t cached_size;
+        int tier;
+        expand_path_for_home(filename, filepath);
+        int cached_fd = dfs_cache_open(filepath, &cached_size, &tier);
+        if (cached_fd >= 0) {
+            printf("Serving %s from the %s cache\n", filepath, tier == DFS_CACHE_MEMORY ? "memory" : "disk");
+            function_to_send_file(client_socket, request_id, cached_fd, cached_size, range, range_count);
+            close(cached_fd);
+            return;
+        }
+
+        //determine appropriate server
+        int port = (strcmp(file_extension, ".txt") == 0) ? STEXT_PORT : SPDF_PORT;
+        char response[BUFFER_SIZE];
+        int status_ok = 0;
+
+        //send the request, with its range, to Stext/Spdf server
+        const char *args[3] = {filename, range_count > 0 ? range[0] : NULL, range_count > 1 ? range[1] : NULL};
+        int sock = function_for_server_request(port, DFS_OP_DFILE, flags & DFS_FLAG_COMPRESSED, dfs_next_request_id(), args, 1 + range_count, response, sizeof(response), &status_ok);
+        if (sock < 0) {
+            printf("Failed to communicate with server\n");
+            dfs_send_status(client_socket, request_id, 0, "Failed to retrieve file from server");
+            return;
+        }
+        dfs_send_status(client_socket, request_id, status_ok, response);
+
+        //forward the file content from Stext/Spdf to client; the connection is reused only if the stream completed.
+        //a full plain download is copied into the cache on its way
+        long long total_bytes_sent = 0;
+        struct dfs_cache_fill fill;
+        if (status_ok && range_count == 0 && !(flags & DFS_FLAG_COMPRESSED) && dfs_cache_fill_begin(&fill, filepath) == 0) {
+            total_bytes_sent = dfs_cache_relay(sock, client_socket, request_id, &fill);
+            dfs_cache_fill_end(&fill, total_bytes_sent >= 0);
+            printf("Total file bytes sent to client: %lld (stored in the cache)\n", total_bytes_sent);
+        } else if (status_ok) {
+            total_bytes_sent = transfer_file_to_from_txt_pdf(sock, client_socket, request_id);
+            printf("Total file bytes sent to client: %lld\n", total_bytes_sent);
+        }
+        dfs_backend_release(port, sock, total_bytes_sent >= 0);
+    }
+}
+
+//function_to_send_file: Sends a file Smain holds itself, a local .c file or a cached copy, as a download.
+//a ranged request is answered with the slice it names, clipped to the end of the file.
+void function_to_send_file(int client_socket, uint32_t request_id, int fd, uint64_t size, char** range, int range_count) {
+    uint64_t offset = 0;
+    uint64_t length = size;
+    char response[BUFFER_SIZE] = "File type accepted";
+    if (range_count > 0) {
+        if (dfs_parse_range(range, range_count, size, &offset, &length) < 0) {
+            dfs_send_status(client_socket, request_id, 0, "Requested range not satisfiable");
+            return;
+        }
+        snprintf(response, BUFFER_SIZE, DFS_RANGE_STATUS_FORMAT, (unsigned long long)length, (unsigned long long)offset, (unsigned long long)size);
+    }
+
+    //send acceptance message and transfer file data to client
+    dfs_send_status(client_socket, request_id, 1, response);
+    long long total_data_sent = transfer_data_from_fd(fd, client_socket, request_id, offset, range_count > 0 ? (long long)length : -1);
+    printf("Total data sent to client: %lld\n", total_data_sent);
+}
+
+//function_to_process_compress: Handles a client's codec negotiation for compressed transfers.
+//the reply names the first codec the client offered that DFS_COMPRESS allows, or "none".
+void function_to_process_compress(int client_socket, uint32_t request_id, const char* offered) {
+    int codec = dfs_codec_choose(offered, SMAIN_CODECS);
+    printf("Compression: client offered %s, using %s\n", offered, dfs_codec_name(codec));
+    dfs_send_status(client_socket, request_id, 1, dfs_codec_name(codec));
+}
+
+//function_to_process_rmfile: Handles the 'rmfile' command to remove a file.
+//it determines the file type and processes the removal accordingly.
+void function_to_process_rmfile(int client_socket, uint32_t request_id, char* filename) {
+    //get file extension
+    char *file_extension = strrchr(filename, '.');
+    if (!file_extension || (strcmp(file_extension, ".c") != 0 && strcmp(file_extension, ".txt") != 0 && strcmp(file_extension, ".pdf") != 0)) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid file type");
+        return;
+    }
+
+    //process .c files
+    if (strcmp(file_extension, ".c") == 0) {
+        //remove .c files locally
+        char filepath[PATH_MAX];
+        expand_path_for_home(filename, filepath);
+
+        if (dfs_index_lookup(filepath, NULL) == 0) {
+            dfs_send_status(client_socket, request_id, 0, "Failed to remove file");
+        } else if (remove(filepath) == 0) {
+            dfs_index_remove(filepath);
+            char response[BUFFER_SIZE];
+            snprintf(response, BUFFER_SIZE, "File %s removed", filename);
+            dfs_send_status(client_socket, request_id, 1, response);
+        } else {
+            perror("Failed to remove file");
+            dfs_send_status(client_socket, request_id, 0, "Failed to remove file");
+        }
+    }
+    //process .txt and .pdf files
+    else {
+        //request file removal from appropriate server
+        int server_port = (strcmp(file_extension, ".txt") == 0) ? STEXT_PORT : SPDF_PORT;
+        char response[BUFFER_SIZE];
+        int status_ok = 0;
+        int server_sock = function_for_server_communications(server_port, DFS_OP_RMFILE, dfs_next_request_id(), filename, NULL, response, sizeof(response), &status_ok);
+        if (server_sock < 0) {
+            dfs_send_status(client_socket, request_id, 0, "Failed to connect to server");
+        } else {
+            char filepath[PATH_MAX];
+            expand_path_for_home(filename, filepath);
+            dfs_cache_invalidate(filepath);
+            dfs_send_status(client_socket, request_id, status_ok, response);
+            dfs_backend_release(server_port, server_sock, 1);
+        }
+    }
+}
+
+//function_to_process_dtar: Handles the 'dtar' command to create and download a tar archive.
+//it creates a tar archive of files based on the specified file type.
+//`options_text` asks for a compressed or incremental archive, e.g. "gz,manifest", or is NULL for a plain tar.
+//with "manifest" the client sends the manifest of its last archive after the acceptance status.
+void function_to_process_dtar(int client_socket, uint32_t request_id, char* filetype, const char* options_text) {
+    char response[BUFFER_SIZE];
+
+    //get file extension
+    if (!filetype || (strcmp(filetype, ".c") != 0 && strcmp(filetype, ".txt") != 0 && strcmp(filetype, ".pdf") != 0)) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid file type");
+        return;
+    }
+    //options after the file type ask for a compressed or incremental archive
+    struct dfs_tar_options options;
+    if (dfs_tar_parse_options(options_text, &options) < 0) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid archive options");
+        return;
+    }
+
+    //process .c files
+    if (strcmp(filetype, ".c") == 0) {
+        //the archive of the Smain directory is generated while it is sent, so no tar file is written
+        struct stat dir_stat;
+        if (stat(SMAIN_DIR, &dir_stat) < 0 || !S_ISDIR(dir_stat.st_mode)) {
+            perror("Failed to create tar file");
+            dfs_send_status(client_socket, request_id, 0, "Failed to create tar file");
+            return;
+        }
+
+        //send acceptance message, receive the client's manifest if one was announced, then stream the archive
+        dfs_send_status(client_socket, request_id, 1, "File type accepted");
+        if (options.send_manifest && dfs_tar_recv_manifest(client_socket, &options, response, sizeof(response)) < 0) {
+            printf("Failed to receive manifest: %s\n", response);
+            dfs_send_status(client_socket, request_id, 0, response);
+            return;
+        }
+        struct dfs_tar_summary summary;
+        long long total_data_sent = dfs_tar_stream_options(client_socket, request_id, SMAIN_DIR, &options, &summary);
+        printf("Total data sent to client: %lld (archive of %lld bytes%s, %ld files, %ld unchanged, %ld deleted)\n", total_data_sent,
+               summary.archive_bytes, options.format == DFS_TAR_GZIP ? ", gzip" : "", summary.files, summary.unchanged, summary.deleted);
+        dfs_tar_free_manifest(options.manifest);
+    }
+    //process .txt and .pdf files
+    else {
+        bool is_txt = strcmp(filetype, ".txt") == 0;
+        int port = is_txt ? STEXT_PORT : SPDF_PORT;
+        int status_ok = 0;
+        uint32_t backend_id = dfs_next_request_id();
+        int server_sock = function_for_server_communications(port, DFS_OP_DTAR, backend_id, filetype, options_text, response, sizeof(response), &status_ok);
+        if (server_sock < 0) {
+            snprintf(response, sizeof(response), "Failed to communicate with %s server", is_txt ? "Stext" : "Spdf");
+            dfs_send_status(client_socket, request_id, 0, response);
+            return;
+        }
+        dfs_send_status(client_socket, request_id, status_ok, response);
+
+        //forward the client's manifest, then transfer the archive stream from the storage server to client
+        long long total_bytes_sent = 0;
+        if (status_ok && options.send_manifest) {
+            //a manifest the client aborted is not followed by an archive, and the storage server connection is dropped
+            total_bytes_sent = transfer_file_to_from_txt_pdf(client_socket, server_sock, backend_id);
+            if (total_bytes_sent < 0) {
+                dfs_send_status(client_socket, request_id, 0, "Failed to receive manifest");
+            }
+        }
+        if (status_ok && total_bytes_sent >= 0) {
+            total_bytes_sent = transfer_file_to_from_txt_pdf(server_sock, client_socket, request_id);
+            printf("Total bytes sent to client: %lld\n", total_bytes_sent);
+        }
+        dfs_backend_release(port, server_sock, total_bytes_sent >= 0);
+    }
+}
+
+//function_to_process_display: Handles the 'display' command to list files in a directory.
+//Spdf and Stext are asked for their lists first, so they scan their directories while Smain scans its own.
+//a full listing is forwarded part by part as it arrives; a page is merged from each server's first page
+//of candidates once all three have answered. either way memory stays bounded however large the directory is.
+void function_to_process_display(int client_socket, uint32_t request_id, char* pathname, const char* options_text) {
+    unsigned long long started_us = function_to_get_time_us();
+
+    //check the page size, sort order and cursor before accepting
+    struct dfs_list_options options;
+    struct dfs_list_options part_options[3];
+    if (dfs_list_parse_options(options_text, &options) < 0 || function_to_get_part_options(&options, 0, &part_options[0]) < 0) {
+        dfs_send_status(client_socket, request_id, 0, "Invalid display options");
+        return;
+    }
+    function_to_get_part_options(&options, 1, &part_options[1]);
+    function_to_get_part_options(&options, 2, &part_options[2]);
+    bool paged = options.page_size > 0;
+
+    //send acceptance message to client
+    dfs_send_status(client_socket, request_id, 1, "In display function");
+
+    //ask Spdf for its .pdf files and Stext for its .txt files
+    struct display_part parts[3];
+    memset(parts, 0, sizeof(parts));
+    struct display_fetch fetches[2] = {
+        {SPDF_PORT, "Spdf", "Failed to get PDF files\n", paged ? &parts[1] : NULL, -1, 0, false, false, 0},
+        {STEXT_PORT, "Stext", "Failed to get TXT files\n", paged ? &parts[2] : NULL, -1, 0, false, false, 0}
+    };
+    char fetch_options[2][DFS_MAX_CONTROL_PAYLOAD];
+    for (int i = 0; i < 2; i++) {
+        dfs_list_format_options(&part_options[i + 1], part_options[i + 1].after, fetch_options[i], sizeof(fetch_options[i]));
+        function_to_start_display_fetch(&fetches[i], pathname, fetch_options[i]);
+    }
+
+    //list the .c files locally, straight to the client or into the first part of a page
+    char full_path[PATH_MAX];
+    char cursor[PATH_MAX];
+    struct dfs_list_writer writer;
+    expand_path_for_home(pathname, full_path);
+    dfs_list_writer_init(&writer, client_socket, request_id);
+    if (paged) {
+        dfs_list_directory(full_path, ".c", &part_options[0], function_to_add_display_name, &parts[0], cursor, sizeof(cursor));
+        parts[0].more = cursor[0] != '\0';
+    } else {
+        dfs_list_directory(full_path, ".c", &part_options[0], dfs_list_writer_add, &writer, cursor, sizeof(cursor));
+        dfs_list_writer_flush(&writer);
+    }
+    printf("Display: Smain listed in %.1f ms\n", (function_to_get_time_us() - started_us) / 1000.0);
+
+    //collect the remote lists in whatever order the servers answer
+    for (int i = 0; i < 2; i++) {
+        if (fetches[i].sock < 0) {
+            dfs_send_frame(client_socket, DFS_OP_DATA, 0, request_id, fetches[i].failure, strlen(fetches[i].failure));
+        }
+    }
+    while (fetches[0].sock >= 0 || fetches[1].sock >= 0) {
+        struct pollfd fds[2];
+        struct display_fetch *polled[2];
+        int count = 0;
+        for (int i = 0; i < 2; i++) {
+            if (fetches[i].sock >= 0) {
+                fds[count].fd = fetches[i].sock;
+                fds[count].events = POLLIN;
+                fds[count].revents = 0;
+                polled[count++] = &fetches[i];
+            }
+        }
+        if (poll(fds, count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            for (int i = 0; i < count; i++) {
+                dfs_backend_release(polled[i]->port, polled[i]->sock, 0);
+                polled[i]->sock = -1;
+            }
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            int index = polled[i] == &fetches[0] ? 0 : 1;
+            if (fds[i].revents && !function_to_read_display_fetch(polled[i], client_socket, request_id, pathname, fetch_options[index])) {
+                printf("Display: %s finished in %.1f ms\n", polled[i]->server_name, (function_to_get_time_us() - polled[i]->started_us) / 1000.0);
+            }
+        }
+    }
+
+    //terminate the combined listing; a page ends with the cursor of the next one
+    if (paged) {
+        function_to_merge_display_parts(parts, &options, &writer);
+    } else {
+        dfs_list_writer_end(&writer, NULL);
+    }
+    for (int i = 0; i < 3; i++) {
+        free(parts[i].names);
+    }
+    printf("Display request processed in %.1f ms\n", (function_to_get_time_us() - started_us) / 1000.0);
+}
+
+//function_to_get_part_options: Derives the listing options Smain (part 0), Spdf (1) or Stext (2) uses for a display request.
+//a sorted cursor is a name and applies to every part; a cursor in directory order holds one count per part.
+//returns -1 if the cursor is malformed.
+int function_to_get_part_options(const struct dfs_list_options* options, int part, struct dfs_list_options* part_options) {
+    *part_options = *options;
+    if (options->order != DFS_LIST_UNSORTED || options->after[0] == '\0') {
+        return 0;
+    }
+    long counts[3];
+    char extra;
+    if (sscanf(options->after, "%ld:%ld:%ld%c", &counts[0], &counts[1], &counts[2], &extra) != 3 || counts[0] < 0 || counts[1] < 0 || counts[2] < 0) {
+        return -1;
+    }
+    snprintf(part_options->after, sizeof(part_options->after), "%ld", counts[part]);
+    return 0;
+}
+
+//function_to_add_display_name: Adds one name to a part of a page; matches dfs_list_emit.
+int function_to_add_display_name(void* part, const char* name) {
+    struct display_part *p = part;
+    size_t length = strlen(name) + 1;
+    if (p->length + length > p->capacity) {
+        size_t capacity = p->capacity ? p->capacity : 4096;
+        while (capacity < p->length + length) {
+            capacity *= 2;
+        }
+        char *grown = realloc(p->names, capacity);
+        if (!grown) {
+            return -1;
+        }
+        p->names = grown;
+        p->capacity = capacity;
+    }
+    memcpy(p->names + p->length, name, length);
+    p->length += length;
+    p->count++;
+    return 0;
+}
+
+//function_to_add_display_names: Adds the newline-separated names of a listing frame to a part of a page.
+void function_to_add_display_names(struct display_part* part, const char* payload, size_t length) {
+    char name[NAME_MAX + 1];
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (payload[i] != '\n') {
+            continue;
+        }
+        size_t name_length = i - start;
+        if (name_length > 0 && name_length < sizeof(name)) {
+            memcpy(name, payload + start, name_length);
+            name[name_length] = '\0';
+            function_to_add_display_name(part, name);
+        }
+        start = i + 1;
+    }
+}
+
+//function_to_merge_display_parts: Sends one page picked from the candidates of Smain, Spdf and Stext and ends the stream.
+//a sorted page takes the first names across all parts; a page in directory order takes the parts one after another.
+//the END frame carries the cursor of the next page if any server has names left.
+void function_to_merge_display_parts(struct display_part parts[3], const struct dfs_list_options* options, struct dfs_list_writer* writer) {
+    long skipped[3] = {0, 0, 0};
+    if (options->order == DFS_LIST_UNSORTED && options->after[0]) {
+        sscanf(options->after, "%ld:%ld:%ld", &skipped[0], &skipped[1], &skipped[2]);
+    }
+
+    const char *next[3];
+    long taken[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++) {
+        next[i] = parts[i].names;
+    }
+    const char *last = NULL;
+    long listed = 0;
+    while (listed < options->page_size) {
+        int pick = -1;
+        for (int i = 0; i < 3; i++) {
+            if (taken[i] < parts[i].count && (pick < 0 || dfs_list_compare(options->order, next[i], next[pick]) < 0)) {
+                pick = i;
+            }
+        }
+        if (pick < 0) {
+            break;
+        }
+        dfs_list_writer_add(writer, next[pick]);
+        last = next[pick];
+        next[pick] += strlen(next[pick]) + 1;
+        taken[pick]++;
+        listed++;
+    }
+
+    bool more = false;
+    for (int i = 0; i < 3; i++) {
+        if (taken[i] < parts[i].count || parts[i].more) {
+            more = true;
+        }
+    }
+    char cursor[PATH_MAX] = "";
+    if (more && last) {
+        if (options->order == DFS_LIST_UNSORTED) {
+            snprintf(cursor, sizeof(cursor), "%ld:%ld:%ld", skipped[0] + taken[0], skipped[1] + taken[1], skipped[2] + taken[2]);
+        } else {
+            snprintf(cursor, sizeof(cursor), "%s", last);
+        }
+    }
+    dfs_list_writer_end(writer, cursor);
+}
+
+//function_to_start_display_fetch: Sends a display request to a storage server without waiting for the answer.
+//on failure `fetch->sock` is left at -1.
+void function_to_start_display_fetch(struct display_fetch* fetch, const char* pathname, const char* options_text) {
+    fetch->started_us = function_to_get_time_us();
+    fetch->backend_id = dfs_next_request_id();
+    fetch->sock = function_for_server_communications(fetch->port, DFS_OP_DISPLAY, fetch->backend_id, pathname, options_text, NULL, 0, NULL);
+}
+
+//function_to_read_display_fetch: Reads the next frame a storage server sent for a display request.
+//listing data is forwarded to the client, or gathered into the fetch's part when a page was requested.
+//returns true while more frames are expected; once it returns false the connection has been released.
+bool function_to_read_display_fetch(struct display_fetch* fetch, int client_socket, uint32_t request_id, const char* pathname, const char* options_text) {
+    struct dfs_frame frame;
+    char payload[DFS_MAX_CONTROL_PAYLOAD];
+    bool failed = dfs_recv_control(fetch->sock, &frame, payload, sizeof(payload)) < 0 || frame.request_id != fetch->backend_id;
+
+    //a parked connection closed by the server fails before its status frame; ask again once on a new connection
+    if (failed && !fetch->status_received && !fetch->retried) {
+        dfs_backend_release(fetch->port, fetch->sock, 0);
+        fetch->retried = true;
+        fetch->backend_id = dfs_next_request_id();
+        fetch->sock = function_for_server_communications(fetch->port, DFS_OP_DISPLAY, fetch->backend_id, pathname, options_text, NULL, 0, NULL);
+        if (fetch->sock >= 0) {
+            return true;
+        }
+    } else if (!failed && !fetch->status_received) {
+        //the status frame comes first; a refusal ends the exchange cleanly
+        if (frame.opcode != DFS_OP_STATUS || (frame.flags & DFS_FLAG_ERROR)) {
+            dfs_send_frame(client_socket, DFS_OP_DATA, 0, request_id, fetch->failure, strlen(fetch->failure));
+            dfs_backend_release(fetch->port, fetch->sock, frame.opcode == DFS_OP_STATUS);
+            fetch->sock = -1;
+            return false;
+        }
+        fetch->status_received = true;
+        return true;
+    } else if (!failed && frame.opcode == DFS_OP_DATA) {
+        //the END frame of a page carries a cursor rather than names
+        if (frame.flags & DFS_FLAG_CURSOR) {
+            if (fetch->part) {
+                fetch->part->more = true;
+            }
+        } else if (fetch->part) {
+            function_to_add_display_names(fetch->part, payload, frame.length);
+        } else if (frame.length > 0) {
+            //merge the listing into the client's stream without its END flag
+            dfs_send_frame(client_socket, DFS_OP_DATA, 0, request_id, payload, frame.length);
+        }
+        if (!(frame.flags & DFS_FLAG_END)) {
+            return true;
+        }
+        dfs_backend_release(fetch->port, fetch->sock, 1);
+        fetch->sock = -1;
+        return false;
+    } else {
+        //a lost connection, or an error status frame that cut the listing short
+        dfs_backend_release(fetch->port, fetch->sock, 0);
+    }
+    dfs_send_frame(client_socket, DFS_OP_DATA, 0, request_id, fetch->failure, strlen(fetch->failure));
+    fetch->sock = -1;
+    return false;
+}
+
+//function_to_get_time_us: Returns a monotonic timestamp in microseconds, used to time display requests.
+unsigned long long function_to_get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//function_for_server_communications: Gets a connection to a server from the keep-alive pool and sends a request frame.
+//if `response` is given, the server's status frame is read into it and `status_ok` reports whether it succeeded.
+//the caller hands the connection back with dfs_backend_release() once the exchange is finished.
+//it's used for communicating with Stext and Spdf servers.
+int function_for_server_communications(int port, uint8_t opcode, uint32_t backend_id, const char* arg1, const char* arg2, char* response, size_t response_size, int* status_ok) {
+    const char *args[2] = {arg1, arg2};
+    return function_for_server_request(port, opcode, 0, backend_id, args, arg2 ? 2 : 1, response, response_size, status_ok);
+}
+
+//function_for_server_request: Like function_for_server_communications, for a request with any number of arguments
+//and frame flags such as DFS_FLAG_COMPRESSED.
+int function_for_server_request(int port, uint8_t opcode, uint16_t flags, uint32_t backend_id, const char* const* args, int argc, char* response, size_t response_size, int* status_ok) {
+    //a parked connection may have been closed by the server since its last use, so a failure on one is retried once on a new connection
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int reused = 0;
+        unsigned long long connect_started_us = function_to_get_time_us();
+        int sock = dfs_backend_acquire(port, &reused);
+        if (!reused) {
+            dfs_metrics_backend_connect(port, function_to_get_time_us() - connect_started_us, sock >= 0);
+        }
+        if (sock < 0) {
+            printf("\nConnection Failed \n");
+            dfs_metrics_fail(NULL, DFS_METRICS_BACKEND);
+            return -1;
+        }
+
+        //send the request frame
+        if (dfs_send_request_flags(sock, opcode, flags, backend_id, args, argc) < 0) {
+            dfs_backend_release(port, sock, 0);
+            if (reused) {
+                continue;
+            }
+            perror("Failed to send request");
+            dfs_metrics_fail(NULL, DFS_METRICS_BACKEND);
+            return -1;
+        }
+
+        //read the status frame if a buffer was provided; it must answer this request
+        if (response) {
+            struct dfs_frame reply;
+            if (dfs_recv_control(sock, &reply, response, response_size) < 0 || reply.opcode != DFS_OP_STATUS || reply.request_id != backend_id) {
+                dfs_backend_release(port, sock, 0);
+                if (reused) {
+                    continue;
+                }
+                printf("\nInvalid response from server \n");
+                dfs_metrics_fail(NULL, DFS_METRICS_BACKEND);
+                return -1;
+            }
+            if (status_ok) {
+                *status_ok = !(reply.flags & DFS_FLAG_ERROR);
+            }
+        }
+        return sock;
+    }
+    return -1;
+}
+
+//epoll event loop: one process serves every client with non-blocking sockets.
+//each connection is a small state machine that is advanced whenever one of its descriptors becomes ready;
+//every step runs until the operation it waits on returns EAGAIN, as edge-triggered epoll requires.
+
+#define REACTOR_MAX_EVENTS 256
+//local names listed per step of a display listing, and how far a listing's queued output may grow
+//before display fetches stop reading from Spdf/Stext until the client catches up
+#define REACTOR_LIST_BATCH 256
+#define REACTOR_DISPLAY_BACKLOG (64 * 1024)
+
+//states of a client connection in the epoll event loop
+enum reactor_state {
+    REACTOR_READ_REQUEST,     //waiting for the next request frame from the client
+    REACTOR_UPLOAD_LOCAL,     //writing a .c upload stream into a local file
+    REACTOR_SEND_FILE,        //sending a local .c file with sendfile()
+    REACTOR_SEND_PIPE,        //sending the archive produced by a tar writer thread
+    REACTOR_BACKEND_WAIT,     //waiting for a free connection slot to Spdf/Stext
+    REACTOR_BACKEND_CONNECT,  //connecting to Spdf/Stext and sending the request frame
+    REACTOR_BACKEND_STATUS,   //waiting for the storage server's status frame
+    REACTOR_RELAY_UPLOAD,     //relaying the client's data stream to the storage server
+    REACTOR_BACKEND_FINAL,    //waiting for the storage server's final status after an upload
+    REACTOR_RELAY_DOWNLOAD,   //relaying the storage server's data stream to the client
+    REACTOR_LIST_LOCAL,       //listing the local .c files of a display request a batch at a time
+    REACTOR_DISPLAY_WAIT,     //waiting for Spdf and Stext to deliver their parts of a display listing
+    REACTOR_COLLECT_LISTING   //display fetch: forwarding a storage server's listing into its client's stream
+};
+
+//incremental reader for request and status frames on a non-blocking socket
+struct frame_reader {
+    unsigned char header[DFS_FRAME_HEADER_SIZE];
+    size_t header_len;
+    struct dfs_frame frame;
+    char payload[DFS_MAX_CONTROL_PAYLOAD];
+    size_t payload_len;
+};
+
+//bytes waiting to be written to a non-blocking socket
+struct out_buffer {
+    char *data;
+    size_t len;
+    size_t off;
+    size_t cap;
+    unsigned long status_errors;  //error statuses queued since the request began, for the request metrics
+};
+
+//frame-aware relay of one data stream between non-blocking descriptors.
+//headers are parsed and rewritten in user space, payloads move through a pipe (splice mode) or a buffer (copy mode).
+struct relay_pump {
+    int forward_headers;   //write rewritten headers (socket relays) or only payloads (uploads into a file)
+    int forward_end;       //keep the END flag and forward error status frames
+    uint32_t request_id;   //request id written into forwarded headers
+    unsigned char header[DFS_FRAME_HEADER_SIZE];
+    size_t header_len;
+    unsigned char out_header[DFS_FRAME_HEADER_SIZE];
+    size_t out_header_len;
+    size_t out_header_off;
+    uint64_t payload_left; //payload bytes of the current frame not yet read from the source
+    int in_frame;
+    int discard;           //the current frame's payload is read and dropped
+    int last;              //the current frame ends the stream
+    int error;             //the stream was ended by an error status frame
+    int pipe_fds[2];
+    char *buffer;
+    size_t buffered;       //bytes read from the source but not yet written to the destination
+    size_t buffer_off;
+    uint64_t written;      //payload bytes written to the destination
+    struct dfs_cache_fill *fill; //download copied into the cache as it is read, in copy mode only
+};
+
+//one client connection and whatever storage server connection, file or tar pipe it is currently using.
+//a display fetch is a connection without a client socket that queries one storage server for its client's listing.
+struct reactor_conn {
+    int client_fd;
+    int backend_fd;
+    int file_fd;
+    enum reactor_state state;
+    uint8_t opcode;
+    uint16_t request_flags;             //flags passed on to the storage server, DFS_FLAG_COMPRESSED for a dfile
+    uint32_t request_id;
+    uint32_t backend_id;
+    int backend_port;
+    bool backend_reused;
+    int display_pending;                //parts of a display listing not yet delivered
+    struct dfs_list_options list_options;
+    struct display_part parts[3];       //candidates of a paged listing from Smain, Spdf and Stext
+    struct dfs_list_iter list_iter;     //local directory of a full listing
+    long list_skip;
+    struct dfs_list_writer list_writer;
+    struct reactor_conn *parent;        //client connection a display fetch works for
+    struct reactor_conn *fetches[2];    //running display fetches to Spdf and Stext
+    unsigned long long started_us;
+    unsigned long long backend_connect_us;  //when the new storage server connection was started
+    struct dfs_metrics_request metrics;     //request being served, for the request metrics
+    off_t file_offset;
+    off_t file_end;
+    uint32_t frame_left;
+    char path[PATH_MAX];
+    bool staged;                        //the local upload is resumable and goes through `stage`
+    struct dfs_stage stage;
+    char delta_size[32];                //file size and SHA-256 of a local delta upload, used once its stream is in
+    char delta_sha256[DFS_SHA256_HEX_SIZE + 1];
+    struct dfs_tar_options tar_options; //options of a dtar, whose manifest is received before the archive is sent
+    bool cacheable;                     //the relayed download is full and plain, so it can be stored in the cache
+    struct dfs_cache_fill cache_fill;
+    struct frame_reader reader;
+    struct frame_reader backend_reader;
+    struct out_buffer out;
+    struct out_buffer backend_out;
+    struct out_buffer backend_request;  //the encoded request, kept so it can be resent on a new connection
+    struct relay_pump pump;
+    bool closed;
+    struct reactor_conn *next_closed;
+    struct reactor_conn *next_waiting;
+    bool ready_queued;
+    struct reactor_conn *next_ready;
+};
+
+static int reactor_epoll_fd = -1;
+static struct reactor_conn *reactor_closed_list = NULL;
+//connections waiting for a storage server connection slot, oldest first,
+//and connections that were given a slot and are started after the current batch of events
+static struct reactor_conn *reactor_waiting_head = NULL;
+static struct reactor_conn *reactor_waiting_tail = NULL;
+static struct reactor_conn *reactor_woken_list = NULL;
+//connections that another connection queued output for, advanced after the current batch of events
+static struct reactor_conn *reactor_ready_list = NULL;
+
+//reader_reset: Prepares a frame reader for the next frame.
+static void reader_reset(struct frame_reader* r) {
+    r->header_len = 0;
+    r->payload_len = 0;
+}
+
+//reader_step: Reads as much of a control frame as is available.
+//returns 1 when the frame is complete, 0 if the socket would block and -1 on error or end of connection.
+static int reader_step(int fd, struct frame_reader* r) {
+    while (r->header_len < DFS_FRAME_HEADER_SIZE) {
+        ssize_t n = read(fd, r->header + r->header_len, DFS_FRAME_HEADER_SIZE - r->header_len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        r->header_len += n;
+        if (r->header_len == DFS_FRAME_HEADER_SIZE) {
+            if (dfs_decode_header(r->header, &r->frame) < 0 || r->frame.length >= sizeof(r->payload)) {
+                return -1;
+            }
+        }
+    }
+    while (r->payload_len < r->frame.length) {
+        ssize_t n = read(fd, r->payload + r->payload_len, r->frame.length - r->payload_len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        r->payload_len += n;
+    }
+    r->payload[r->payload_len] = '\0';
+    return 1;
+}
+
+//out_append: Queues bytes on an output buffer, growing it as needed.
+static int out_append(struct out_buffer* b, const void* data, size_t length) {
+    if (b->off == b->len) {
+        b->off = b->len = 0;
+    }
+    if (b->len + length > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + length) {
+            cap *= 2;
+        }
+        char *grown = realloc(b->data, cap);
+        if (!grown) {
+            return -1;
+        }
+        b->data = grown;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, length);
+    b->len += length;
+    return 0;
+}
+
+//out_frame: Queues a frame on an output buffer. a NULL payload queues only the header,
+//for frames whose payload is written separately (e.g. by sendfile).
+static int out_frame(struct out_buffer* b, uint8_t opcode, uint16_t flags, uint32_t request_id, const void* payload, uint32_t length) {
+    unsigned char header[DFS_FRAME_HEADER_SIZE];
+    dfs_encode_header(header, opcode, flags, request_id, length);
+    if (out_append(b, header, sizeof(header)) < 0) {
+        return -1;
+    }
+    return payload && length > 0 ? out_append(b, payload, length) : 0;
+}
+
+//out_status: Queues a status frame.
+static int out_status(struct out_buffer* b, uint32_t request_id, int ok, const char* message) {
+    if (!ok) {
+        b->status_errors++;
+    }
+    return out_frame(b, DFS_OP_STATUS, ok ? 0 : DFS_FLAG_ERROR, request_id, message, strlen(message));
+}
+
+//out_request: Queues a request frame with `count` NUL-separated arguments.
+static int out_request(struct out_buffer* b, uint8_t opcode, uint16_t flags, uint32_t request_id, const char* const* args, int count) {
+    char payload[DFS_MAX_CONTROL_PAYLOAD];
+    size_t length = 0;
+    for (int i = 0; i < count && args[i]; i++) {
+        size_t arg_length = strlen(args[i]) + 1;
+        if (length + arg_length > sizeof(payload)) {
+            return -1;
+        }
+        memcpy(payload + length, args[i], arg_length);
+        length += arg_length;
+    }
+    return out_frame(b, opcode, flags, request_id, payload, length);
+}
+
+//out_flush: Writes queued bytes until the buffer is empty or the socket would block.
+//returns 1 when everything was written, 0 if the socket would block and -1 on error.
+static int out_flush(int fd, struct out_buffer* b) {
+    while (b->off < b->len) {
+        ssize_t n = send(fd, b->data + b->off, b->len - b->off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        b->off += n;
+    }
+    b->off = b->len = 0;
+    return 1;
+}
+
+//pump_start: Prepares a relay pump for a new stream.
+static void pump_start(struct relay_pump* p, int forward_headers, int forward_end, uint32_t request_id) {
+    memset(p, 0, sizeof(*p));
+    p->forward_headers = forward_headers;
+    p->forward_end = forward_end;
+    p->request_id = request_id;
+    p->pipe_fds[0] = p->pipe_fds[1] = -1;
+    if (dfs_xfer_get_relay_mode() == DFS_RELAY_SPLICE) {
+        dfs_xfer_open_pipe(p->pipe_fds, 1);
+    }
+}
+
+//pump_release: Frees the pipe or buffer held by a relay pump.
+static void pump_release(struct relay_pump* p) {
+    if (p->pipe_fds[0] >= 0) {
+        close(p->pipe_fds[0]);
+        close(p->pipe_fds[1]);
+    }
+    p->pipe_fds[0] = p->pipe_fds[1] = -1;
+    free(p->buffer);
+    p->buffer = NULL;
+}
+
+//pump_use_buffer: Switches a pump to copy mode, e.g. when splice() is not supported for its descriptors.
+static int pump_use_buffer(struct relay_pump* p) {
+    if (p->pipe_fds[0] >= 0) {
+        close(p->pipe_fds[0]);
+        close(p->pipe_fds[1]);
+        p->pipe_fds[0] = p->pipe_fds[1] = -1;
+    }
+    if (!p->buffer && !(p->buffer = malloc(dfs_data_chunk_size()))) {
+        return -1;
+    }
+    return 0;
+}
+
+//pump_step: Moves as much of the stream from `source` to `dest` as the descriptors allow.
+//returns 1 when the stream has ended, 0 if a descriptor would block and -1 on error.
+static int pump_step(int source, int dest, struct relay_pump* p) {
+    while (1) {
+        //forward a pending header
+        if (p->out_header_off < p->out_header_len) {
+            ssize_t n = send(dest, p->out_header + p->out_header_off, p->out_header_len - p->out_header_off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            }
+            p->out_header_off += n;
+            continue;
+        }
+
+        //write payload bytes that were already read from the source
+        if (p->buffered > 0) {
+            ssize_t n;
+            if (p->pipe_fds[0] >= 0) {
+                n = splice(p->pipe_fds[0], NULL, dest, NULL, p->buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+            } else {
+                n = write(dest, p->buffer + p->buffer_off, p->buffered);
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            }
+            if (n == 0) {
+                return -1;
+            }
+            if (p->pipe_fds[0] >= 0) {
+                dfs_xfer_count(n, 0);
+            } else {
+                dfs_xfer_count(0, n);
+                p->buffer_off += n;
+            }
+            p->buffered -= n;
+            p->written += n;
+            continue;
+        }
+
+        //read the rest of the current payload
+        if (p->payload_left > 0) {
+            ssize_t n;
+            if (p->discard) {
+                char scratch[4096];
+                n = read(source, scratch, p->payload_left < sizeof(scratch) ? p->payload_left : sizeof(scratch));
+            } else if (p->pipe_fds[0] >= 0) {
+                n = splice(source, NULL, p->pipe_fds[1], NULL, p->payload_left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n < 0 && errno == EINVAL) {
+                    //splice is not supported for this source, fall back to copying
+                    if (pump_use_buffer(p) < 0) {
+                        return -1;
+                    }
+                    continue;
+                }
+            } else {
+                if (!p->buffer && pump_use_buffer(p) < 0) {
+                    return -1;
+                }
+                n = read(source, p->buffer, p->payload_left < dfs_data_chunk_size() ? p->payload_left : dfs_data_chunk_size());
+                p->buffer_off = 0;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            }
+            if (n == 0) {
+                return -1;
+            }
+            p->payload_left -= n;
+            if (!p->discard) {
+                p->buffered = n;
+                if (p->fill) {
+                    dfs_cache_fill_write(p->fill, p->buffer, n);
+                }
+            }
+            continue;
+        }
+
+        //the current frame has been forwarded completely
+        if (p->in_frame) {
+            p->in_frame = 0;
+            if (p->last) {
+                return 1;
+            }
+        }
+
+        //read the next frame header
+        ssize_t n = read(source, p->header + p->header_len, DFS_FRAME_HEADER_SIZE - p->header_len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (n == 0) {
+            return -1;
+        }
+        p->header_len += n;
+        if (p->header_len < DFS_FRAME_HEADER_SIZE) {
+            continue;
+        }
+
+        struct dfs_frame frame;
+        p->header_len = 0;
+        if (dfs_decode_header(p->header, &frame) < 0 || (frame.opcode != DFS_OP_DATA && frame.opcode != DFS_OP_STATUS)) {
+            return -1;
+        }
+        if (!p->forward_headers && (frame.flags & DFS_FLAG_COMPRESSED)) {
+            //payloads written straight into a file must be plain data
+            return -1;
+        }
+        int is_error = frame.opcode == DFS_OP_STATUS;
+        if (p->fill && (is_error || (frame.flags & DFS_FLAG_COMPRESSED))) {
+            //only the file's own bytes may be stored
+            p->fill->failed = 1;
+        }
+        p->in_frame = 1;
+        p->last = is_error || (frame.flags & DFS_FLAG_END);
+        p->error = is_error;
+        p->discard = is_error && !p->forward_end;
+        p->payload_left = frame.length;
+        p->out_header_off = p->out_header_len = 0;
+        if (p->forward_headers && !p->discard && (frame.length > 0 || (p->last && p->forward_end))) {
+            uint16_t flags = p->forward_end ? frame.flags : (frame.flags & ~DFS_FLAG_END);
+            dfs_encode_header(p->out_header, frame.opcode, flags, p->request_id, frame.length);
+            p->out_header_len = DFS_FRAME_HEADER_SIZE;
+        }
+    }
+}
+
+//reactor_file_type: Returns the supported extension of a file name or file type argument, or NULL.
+static const char* reactor_file_type(const char* name) {
+    const char *extension = strrchr(name, '.');
+    if (!extension || (strcmp(extension, ".c") != 0 && strcmp(extension, ".txt") != 0 && strcmp(extension, ".pdf") != 0)) {
+        return NULL;
+    }
+    return extension;
+}
+
+//reactor_watch: Registers a descriptor of a connection with the epoll instance.
+static int reactor_watch(struct reactor_conn* c, int fd, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.ptr = c;
+    return epoll_ctl(reactor_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+//reactor_wake_waiter: Hands a freed connection slot to the oldest connection waiting for the same storage server.
+static void reactor_wake_waiter(int port) {
+    struct reactor_conn **link = &reactor_waiting_head;
+    struct reactor_conn *prev = NULL;
+    while (*link && (*link)->backend_port != port) {
+        prev = *link;
+        link = &(*link)->next_waiting;
+    }
+    struct reactor_conn *w = *link;
+    if (!w) {
+        return;
+    }
+    *link = w->next_waiting;
+    if (reactor_waiting_tail == w) {
+        reactor_waiting_tail = prev;
+    }
+    w->next_waiting = reactor_woken_list;
+    reactor_woken_list = w;
+}
+
+//reactor_stop_waiting: Removes a connection from the wait list.
+static void reactor_stop_waiting(struct reactor_conn* c) {
+    struct reactor_conn *prev = NULL;
+    for (struct reactor_conn *w = reactor_waiting_head; w; prev = w, w = w->next_waiting) {
+        if (w == c) {
+            if (prev) {
+                prev->next_waiting = w->next_waiting;
+            } else {
+                reactor_waiting_head = w->next_waiting;
+            }
+            if (reactor_waiting_tail == w) {
+                reactor_waiting_tail = prev;
+            }
+            return;
+        }
+    }
+}
+
+//reactor_release_backend: Gives the storage server connection back to the keep-alive pool.
+//only a connection whose exchange completed cleanly is kept for reuse; any other is closed.
+static void reactor_release_backend(struct reactor_conn* c, bool reusable) {
+    if (c->backend_fd >= 0) {
+        epoll_ctl(reactor_epoll_fd, EPOLL_CTL_DEL, c->backend_fd, NULL);
+        dfs_backend_release(c->backend_port, c->backend_fd, reusable);
+        c->backend_fd = -1;
+        reactor_wake_waiter(c->backend_port);
+    }
+    c->backend_out.off = c->backend_out.len = 0;
+    reader_reset(&c->backend_reader);
+    pump_release(&c->pump);
+}
+
+//reactor_close_backend: Drops the connection to the storage server.
+static void reactor_close_backend(struct reactor_conn* c) {
+    reactor_release_backend(c, false);
+}
+
+//reactor_close: Closes a client connection and everything it owns. the memory is freed after the current batch of events.
+static void reactor_close(struct reactor_conn* c) {
+    if (c->closed) {
+        return;
+    }
+    c->closed = true;
+    if (c->metrics.active) {
+        dfs_metrics_fail(&c->metrics, DFS_METRICS_CLIENT_LOST);
+        dfs_metrics_end(&c->metrics, c->client_fd);
+    }
+    if (c->client_fd >= 0) {
+        close(c->client_fd);
+        dfs_metrics_connection_closed();
+    }
+    dfs_list_close(&c->list_iter);
+    for (int i = 0; i < 2; i++) {
+        if (c->fetches[i]) {
+            reactor_close(c->fetches[i]);
+        }
+    }
+    if (c->state == REACTOR_BACKEND_WAIT) {
+        reactor_stop_waiting(c);
+    }
+    reactor_close_backend(c);
+    dfs_cache_fill_end(&c->cache_fill, 0);
+    if (c->staged) {
+        //a resumable upload keeps what it received
+        dfs_stage_close(&c->stage);
+    } else if (c->file_fd >= 0) {
+        close(c->file_fd);
+        if (c->state == REACTOR_UPLOAD_LOCAL && c->opcode == DFS_OP_UFILE) {
+            //discard the partial upload
+            remove(c->path);
+            dfs_index_remove(c->path);
+        }
+    }
+    c->next_closed = reactor_closed_list;
+    reactor_closed_list = c;
+}
+
+//reactor_finish_request: Returns the connection to waiting for the next request.
+//the storage server exchange, if any, completed cleanly, so its connection is kept for reuse.
+static void reactor_finish_request(struct reactor_conn* c) {
+    reactor_release_backend(c, true);
+    c->state = REACTOR_READ_REQUEST;
+}
+
+//reactor_start_backend: Queues a request for Spdf/Stext and sends it on a pooled or new connection.
+static void reactor_start_backend(struct reactor_conn* c, int port, uint8_t opcode, const char* arg1, const char* arg2);
+static void reactor_start_backend_args(struct reactor_conn* c, int port, uint8_t opcode, const char* const* args, int count);
+
+//reactor_mark_ready: Schedules a connection to be advanced after the current batch of events.
+static void reactor_mark_ready(struct reactor_conn* c) {
+    if (!c->ready_queued) {
+        c->ready_queued = true;
+        c->next_ready = reactor_ready_list;
+        reactor_ready_list = c;
+    }
+}
+
+//reactor_display_part_done: Counts one delivered part of a display listing and ends the listing after the last.
+//a page is merged from the candidates of all three parts and ends with the cursor of the next page.
+static void reactor_display_part_done(struct reactor_conn* c) {
+    if (--c->display_pending > 0) {
+        return;
+    }
+    if (c->list_options.page_size > 0) {
+        function_to_merge_display_parts(c->parts, &c->list_options, &c->list_writer);
+        for (int i = 0; i < 3; i++) {
+            free(c->parts[i].names);
+        }
+        memset(c->parts, 0, sizeof(c->parts));
+    } else {
+        out_frame(&c->out, DFS_OP_DATA, DFS_FLAG_END, c->request_id, NULL, 0);
+    }
+    reactor_finish_request(c);
+    printf("Display request processed in %.1f ms\n", (function_to_get_time_us() - c->started_us) / 1000.0);
+}
+
+//reactor_resume_fetches: Lets display fetches that paused while the client was behind read again.
+static void reactor_resume_fetches(struct reactor_conn* c) {
+    for (int i = 0; i < 2; i++) {
+        if (c->fetches[i] && c->fetches[i]->state == REACTOR_COLLECT_LISTING) {
+            reactor_mark_ready(c->fetches[i]);
+        }
+    }
+}
+
+//reactor_queue_listing: Queues a listing frame for the client; the send_frame hook of its dfs_list_writer.
+static int reactor_queue_listing(void* target, uint16_t flags, uint32_t request_id, const char* payload, uint32_t length) {
+    struct reactor_conn *c = target;
+    return out_frame(&c->out, DFS_OP_DATA, flags, request_id, payload, length);
+}
+
+//reactor_fetch_done: Ends a display fetch and hands its part of the listing over to the client connection.
+//a fetch that failed adds a note to the listing instead of the server's files.
+static void reactor_fetch_done(struct reactor_conn* f, bool ok) {
+    struct reactor_conn *c = f->parent;
+    bool is_pdf = f->backend_port == SPDF_PORT;
+    if (!ok) {
+        const char *failure = is_pdf ? "Failed to get PDF files\n" : "Failed to get TXT files\n";
+        out_frame(&c->out, DFS_OP_DATA, 0, c->request_id, failure, strlen(failure));
+    }
+    printf("Display: %s finished in %.1f ms\n", is_pdf ? "Spdf" : "Stext", (function_to_get_time_us() - f->started_us) / 1000.0);
+
+    c->fetches[is_pdf ? 0 : 1] = NULL;
+    reactor_release_backend(f, ok);
+    reactor_close(f);
+    reactor_display_part_done(c);
+    reactor_mark_ready(c);
+}
+
+//reactor_backend_failed: Reports a failed storage server exchange to the client.
+//a display fetch notes the failure in its client's listing instead.
+static void reactor_backend_failed(struct reactor_conn* c, const char* message) {
+    dfs_metrics_fail(c->parent ? &c->parent->metrics : &c->metrics, DFS_METRICS_BACKEND);
+    reactor_close_backend(c);
+    if (c->parent) {
+        reactor_fetch_done(c, false);
+        return;
+    }
+    out_status(&c->out, c->request_id, 0, message);
+    c->state = REACTOR_READ_REQUEST;
+}
+
+//reactor_connect_backend: Sends the queued request on a parked connection or a new non-blocking one.
+//when the storage server's connection limit is reached the client waits for a slot to be released.
+static void reactor_connect_backend(struct reactor_conn* c, bool allow_reuse) {
+    int fd = allow_reuse ? dfs_backend_take_idle(c->backend_port) : -1;
+    c->backend_reused = fd >= 0;
+    if (fd < 0) {
+        c->backend_connect_us = function_to_get_time_us();
+        fd = dfs_backend_connect(c->backend_port, 1);
+    }
+    if (fd < 0 && errno == EAGAIN) {
+        c->next_waiting = NULL;
+        if (reactor_waiting_tail) {
+            reactor_waiting_tail->next_waiting = c;
+        } else {
+            reactor_waiting_head = c;
+        }
+        reactor_waiting_tail = c;
+        c->state = REACTOR_BACKEND_WAIT;
+        return;
+    }
+
+    const char *failure = c->backend_port == SPDF_PORT ? "Failed to connect to Spdf server" : "Failed to connect to Stext server";
+    if (fd < 0) {
+        dfs_metrics_backend_connect(c->backend_port, 0, 0);
+        reactor_backend_failed(c, failure);
+        return;
+    }
+    c->backend_fd = fd;
+    if (reactor_watch(c, c->backend_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP) < 0) {
+        reactor_backend_failed(c, failure);
+        return;
+    }
+    out_append(&c->backend_out, c->backend_request.data, c->backend_request.len);
+    c->state = REACTOR_BACKEND_CONNECT;
+}
+
+//reactor_retry_backend: Resends the request on a new connection if a parked one turned out to be stale.
+//returns false if the failed connection was new, so the failure is real.
+static bool reactor_retry_backend(struct reactor_conn* c) {
+    if (!c->backend_reused) {
+        return false;
+    }
+    reactor_close_backend(c);
+    reactor_connect_backend(c, false);
+    return true;
+}
+
+static void reactor_start_backend(struct reactor_conn* c, int port, uint8_t opcode, const char* arg1, const char* arg2) {
+    const char *args[2] = {arg1, arg2};
+    reactor_start_backend_args(c, port, opcode, args, arg2 ? 2 : 1);
+}
+
+static void reactor_start_backend_args(struct reactor_conn* c, int port, uint8_t opcode, const char* const* args, int count) {
+    c->backend_port = port;
+    c->backend_id = dfs_next_request_id();
+    c->backend_request.off = c->backend_request.len = 0;
+    out_request(&c->backend_request, opcode, c->request_flags, c->backend_id, args, count);
+    reactor_connect_backend(c, true);
+}
+
+//reactor_start_fetch: Starts a display fetch that asks a storage server for its part of the client's listing.
+static void reactor_start_fetch(struct reactor_conn* c, int port, const char* options_text) {
+    struct reactor_conn *f = calloc(1, sizeof(*f));
+    if (!f) {
+        const char *failure = port == SPDF_PORT ? "Failed to get PDF files\n" : "Failed to get TXT files\n";
+        out_frame(&c->out, DFS_OP_DATA, 0, c->request_id, failure, strlen(failure));
+        reactor_display_part_done(c);
+        return;
+    }
+    f->client_fd = -1;
+    f->backend_fd = -1;
+    f->file_fd = -1;
+    f->pump.pipe_fds[0] = f->pump.pipe_fds[1] = -1;
+    f->parent = c;
+    f->opcode = DFS_OP_DISPLAY;
+    f->request_id = c->request_id;
+    f->started_us = function_to_get_time_us();
+    c->fetches[port == SPDF_PORT ? 0 : 1] = f;
+    reactor_start_backend(f, port, DFS_OP_DISPLAY, c->path, options_text);
+}
+
+//the pipe a tar writer thread fills and the options of the archive it writes
+struct reactor_tar_job {
+    int fd;
+    struct dfs_tar_options options;
+};
+
+//reactor_tar_writer: Thread that writes the archive of the Smain directory into a pipe.
+//if the client goes away the event loop closes the read end and the next write fails with EPIPE.
+static void* reactor_tar_writer(void* arg) {
+    struct reactor_tar_job job = *(struct reactor_tar_job *)arg;
+    free(arg);
+    struct dfs_tar_summary summary;
+    if (dfs_tar_write_options(job.fd, SMAIN_DIR, &job.options, &summary) < 0) {
+        perror("Failed to write tar stream");
+    } else {
+        printf("Archive of %lld bytes written (%ld files, %ld unchanged, %ld deleted)\n", summary.archive_bytes, summary.files, summary.unchanged, summary.deleted);
+    }
+    dfs_tar_free_manifest(job.options.manifest);
+    close(job.fd);
+    return NULL;
+}
+
+//reactor_start_tar: Starts a writer thread for the archive of the Smain directory; the thread takes over
+//the manifest in `options`. the thread blocks on its end of the pipe while the event loop reads the other
+//end without blocking. returns the read end of the pipe or -1 on error.
+static int reactor_start_tar(const struct dfs_tar_options* options) {
+    int fds[2];
+    struct reactor_tar_job *job = malloc(sizeof(*job));
+    if (!job || pipe2(fds, O_CLOEXEC) < 0) {
+        free(job);
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    job->fd = fds[1];
+    job->options = *options;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reactor_tar_writer, job) != 0) {
+        free(job);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    pthread_detach(thread);
+    return fds[0];
+}
+
+//reactor_send_tar: Starts sending the archive of the Smain directory once the request and any manifest are in.
+static void reactor_send_tar(struct reactor_conn* c, bool accept) {
+    c->file_fd = reactor_start_tar(&c->tar_options);
+    if (c->file_fd < 0) {
+        dfs_tar_free_manifest(c->tar_options.manifest);
+    }
+    c->tar_options.manifest = NULL;
+    if (c->file_fd < 0 || reactor_watch(c, c->file_fd, EPOLLIN) < 0) {
+        out_status(&c->out, c->request_id, 0, "Failed to create tar file");
+        c->state = REACTOR_READ_REQUEST;
+        return;
+    }
+    if (accept) {
+        out_status(&c->out, c->request_id, 1, "File type accepted");
+    }
+    c->state = REACTOR_SEND_PIPE;
+}
+
+//reactor_dispatch: Starts processing a complete request frame.
+static void reactor_dispatch(struct reactor_conn* c) {
+    char *args[DFS_MAX_ARGS];
+    int argc = dfs_parse_args(c->reader.payload, c->reader.frame.length, args, DFS_MAX_ARGS);
+    c->opcode = c->reader.frame.opcode;
+    c->request_id = c->reader.frame.request_id;
+    c->request_flags = c->opcode == DFS_OP_DFILE ? c->reader.frame.flags & DFS_FLAG_COMPRESSED : 0;
+    c->out.status_errors = 0;
+    dfs_metrics_start(&c->metrics, c->opcode);
+    printf("Received command: %s %s %s\n", dfs_opcode_name(c->opcode), argc > 0 ? args[0] : "", argc > 1 ? args[1] : "");
+
+    //display takes an optional second argument with its page size, sort order and cursor and dtar one with
+    //its archive options; a resumable upload names the offset it continues at and a ranged download its offset and length;
+    //a part of a parallel upload names the upload's token and its offset, and the commit the file size
+    //and a delta upload or its chunk list query the file size and SHA-256
+    int expected_args = c->opcode == DFS_OP_UFILE || c->opcode == DFS_OP_UFILE_QUERY || ((c->opcode == DFS_OP_DISPLAY || c->opcode == DFS_OP_DTAR) && argc == 2) ? 2 : 1;
+    if (c->opcode == DFS_OP_UFILE_RESUME || (c->opcode == DFS_OP_DFILE && argc == 3)) {
+        expected_args = 3;
+    } else if (c->opcode == DFS_OP_DFILE && argc == 2) {
+        expected_args = 2;
+    } else if (c->opcode == DFS_OP_UFILE_PART || c->opcode == DFS_OP_UFILE_COMMIT || c->opcode == DFS_OP_UFILE_CHUNKS || c->opcode == DFS_OP_UFILE_DELTA) {
+        expected_args = 4;
+    }
+    if (c->opcode < DFS_OP_UFILE || c->opcode > DFS_OP_COMPRESS || argc != expected_args) {
+        out_status(&c->out, c->request_id, 0, "Invalid command");
+        return;
+    }
+
+    //the argument of a codec negotiation lists the codecs the client can decode, preferred first
+    if (c->opcode == DFS_OP_COMPRESS) {
+        int codec = dfs_codec_choose(args[0], SMAIN_CODECS);
+        printf("Compression: client offered %s, using %s\n", args[0], dfs_codec_name(codec));
+        out_status(&c->out, c->request_id, 1, dfs_codec_name(codec));
+        return;
+    }
+
+    //display takes a directory; every other command needs a supported file type
+    if (c->opcode == DFS_OP_DISPLAY) {
+        struct dfs_list_options part_options[3];
+        if (dfs_list_parse_options(argc == 2 ? args[1] : NULL, &c->list_options) < 0) {
+            out_status(&c->out, c->request_id, 0, "Invalid display options");
+            return;
+        }
+        for (int i = 0; i < 3; i++) {
+            if (function_to_get_part_options(&c->list_options, i, &part_options[i]) < 0) {
+                out_status(&c->out, c->request_id, 0, "Invalid display options");
+                return;
+            }
+        }
+
+        //Spdf and Stext are queried first so they scan their directories while Smain scans its own;
+        //the listing ends once all three parts have been queued
+        c->started_us = function_to_get_time_us();
+        out_status(&c->out, c->request_id, 1, "In display function");
+        snprintf(c->path, sizeof(c->path), "%s", args[0]);
+        c->state = REACTOR_DISPLAY_WAIT;
+        c->display_pending = 3;
+        dfs_list_writer_init(&c->list_writer, -1, c->request_id);
+        c->list_writer.send_frame = reactor_queue_listing;
+        c->list_writer.target = c;
+        char fetch_options[DFS_MAX_CONTROL_PAYLOAD];
+        dfs_list_format_options(&part_options[1], part_options[1].after, fetch_options, sizeof(fetch_options));
+        reactor_start_fetch(c, SPDF_PORT, fetch_options);
+        dfs_list_format_options(&part_options[2], part_options[2].after, fetch_options, sizeof(fetch_options));
+        reactor_start_fetch(c, STEXT_PORT, fetch_options);
+
+        //a page's local candidates are bounded by the page size and gathered at once;
+        //a full listing is read a batch at a time as the client takes it
+        char full_path[PATH_MAX];
+        char cursor[PATH_MAX];
+        expand_path_for_home(args[0], full_path);
+        if (c->list_options.page_size > 0) {
+            dfs_list_directory(full_path, ".c", &part_options[0], function_to_add_display_name, &c->parts[0], cursor, sizeof(cursor));
+            c->parts[0].more = cursor[0] != '\0';
+        } else if (dfs_list_open(&c->list_iter, full_path, ".c") == 0) {
+            c->list_skip = strtol(part_options[0].after, NULL, 10);
+            c->state = REACTOR_LIST_LOCAL;
+            return;
+        }
+        printf("Display: Smain listed in %.1f ms\n", (function_to_get_time_us() - c->started_us) / 1000.0);
+        reactor_display_part_done(c);
+        return;
+    }
+    const char *file_type = reactor_file_type(args[0]);
+    if (!file_type || (c->opcode == DFS_OP_DTAR && file_type != args[0])) {
+        out_status(&c->out, c->request_id, 0, "Invalid file type");
+        return;
+    }
+    bool is_local = strcmp(file_type, ".c") == 0;
+    int port = strcmp(file_type, ".txt") == 0 ? STEXT_PORT : SPDF_PORT;
+    char expanded_path[PATH_MAX];
+    char message[BUFFER_SIZE];
+
+    //the file a relayed request names, so a download can be cached and an upload or removal can invalidate it
+    if (!is_local && (c->opcode == DFS_OP_DFILE || c->opcode == DFS_OP_RMFILE)) {
+        expand_path_for_home(args[0], c->path);
+    } else if (!is_local && c->opcode != DFS_OP_DTAR) {
+        expand_path_for_home(args[1], expanded_path);
+        snprintf(c->path, sizeof(c->path), "%s/%s", expanded_path, args[0]);
+    }
+
+    switch (c->opcode) {
+        case DFS_OP_UFILE:
+            expand_path_for_home(args[1], expanded_path);
+            if (!is_local) {
+                reactor_start_backend(c, port, DFS_OP_UFILE, args[0], expanded_path);
+                return;
+            }
+            if (function_to_create_directories(expanded_path) < 0) {
+                out_status(&c->out, c->request_id, 0, "Failed to create directory");
+                return;
+            }
+            snprintf(c->path, sizeof(c->path), "%s/%s", expanded_path, args[0]);
+            c->file_fd = open(c->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (c->file_fd < 0) {
+                perror("Failed to create file");
+                out_status(&c->out, c->request_id, 0, "Failed to upload file");
+                return;
+            }
+            out_status(&c->out, c->request_id, 1, "File type accepted");
+            pump_start(&c->pump, 0, 0, c->request_id);
+            c->state = REACTOR_UPLOAD_LOCAL;
+            return;
+        case DFS_OP_UFILE_QUERY:
+        case DFS_OP_UFILE_RESUME: {
+            //.txt and .pdf files are staged by the storage server
+            expand_path_for_home(args[1], expanded_path);
+            if (!is_local) {
+                const char *backend_args[3] = {args[0], expanded_path, argc == 3 ? args[2] : NULL};
+                reactor_start_backend_args(c, port, c->opcode, backend_args, argc);
+                return;
+            }
+            snprintf(c->path, sizeof(c->path), "%s/%s", expanded_path, args[0]);
+            if (dfs_stage_init(&c->stage, SMAIN_DIR, c->path) < 0) {
+                out_status(&c->out, c->request_id, 0, "Invalid destination path");
+                return;
+            }
+            if (c->opcode == DFS_OP_UFILE_QUERY) {
+                snprintf(message, sizeof(message), "%llu", (unsigned long long)dfs_stage_query(&c->stage));
+                out_status(&c->out, c->request_id, 1, message);
+                return;
+            }
+            char *end;
+            errno = 0;
+            unsigned long long offset = strtoull(args[2], &end, 10);
+            if (errno != 0 || end == args[2] || *end != '\0') {
+                out_status(&c->out, c->request_id, 0, "Invalid upload offset");
+                return;
+            }
+            if (function_to_create_directories(expanded_path) < 0) {
+                out_status(&c->out, c->request_id, 0, "Failed to create directory");
+                return;
+            }
+            if (dfs_stage_open(&c->stage, offset, 0) < 0) {
+                snprintf(message, sizeof(message), "Failed to resume upload: %s", errno == ERANGE ? "offset is past the staged data" : errno == EBUSY ? "upload already in progress" : strerror(errno));
+                out_status(&c->out, c->request_id, 0, message);
+                return;
+            }
+            //the pump writes into the staging file, which the stage closes
+            c->staged = true;
+            c->file_fd = c->stage.fd;
+            out_status(&c->out, c->request_id, 1, "File type accepted");
+            pump_start(&c->pump, 0, 0, c->request_id);
+            c->state = REACTOR_UPLOAD_LOCAL;
+            return;
+        }
+        case DFS_OP_UFILE_PART:
+        case DFS_OP_UFILE_COMMIT: {
+            //.txt and .pdf files are assembled by the storage server
+            expand_path_for_home(args[1], expanded_path);
+            if (!is_local) {
+                const char *backend_args[4] = {args[0], expanded_path, args[2], args[3]};
+                reactor_start_backend_args(c, port, c->opcode, backend_args, 4);
+                return;
+            }
+            char *end;
+            errno = 0;
+            unsigned long long number = strtoull(args[3], &end, 10);
+            snprintf(c->path, sizeof(c->path), "%s/%s", expanded_path, args[0]);
+            if (dfs_stage_init(&c->stage, SMAIN_DIR, c->path) < 0 || errno != 0 || end == args[3] || *end != '\0') {
+                out_status(&c->out, c->request_id, 0, "Invalid upload part");
+                return;
+            }
+            if (function_to_create_directories(expanded_path) < 0) {
+                out_status(&c->out, c->request_id, 0, "Failed to create directory");
+                return;
+            }
+            if (c->opcode == DFS_OP_UFILE_COMMIT) {
+                if (dfs_stage_commit_parts(&c->stage, args[2], number) < 0) {
+                    snprintf(message, sizeof(message), "Failed to upload file: %s", errno == EAGAIN ? "parts are missing" : strerror(errno));
+                    out_status(&c->out, c->request_id, 0, message);
+                    return;
+                }
+                dfs_index_update(c->path);
+                snprintf(message, sizeof(message), "File %s uploaded successfully.", args[0]);
+                out_status(&c->out, c->request_id, 1, message);
+                return;
+            }
+            //the part's own descriptor starts at its offset, so the pump's sequential writes land in place
+            if (dfs_stage_open_part(&c->stage, args[2], number) < 0 || lseek(c->stage.fd, number, SEEK_SET) < 0) {
+                snprintf(message, sizeof(message), "Failed to upload file: %s", strerror(errno));
+                out_status(&c->out, c->request_id, 0, message);
+                dfs_stage_close(&c->stage);
+                return;
+            }
+            c->staged = true;
+            c->file_fd = c->stage.fd;
+            out_status(&c->out, c->request_id, 1, "File type accepted");
+            pump_start(&c->pump, 0, 0, c->request_id);
+            c->state = REACTOR_UPLOAD_LOCAL;
+            return;
+        }
+        case DFS_OP_UFILE_CHUNKS:
+        case DFS_OP_UFILE_DELTA: {
+            //.txt and .pdf files are assembled by the storage server
+            expand_path_for_home(args[1], expanded_path);
+            if (!is_local) {
+                const char *backend_args[4] = {args[0], expanded_path, args[2], args[3]};
+                reactor_start_backend_args(c, port, c->opcode, backend_args, 4);
+                return;
+            }
+            snprintf(c->path, sizeof(c->path), "%s/%s", expanded_path, args[0]);
+            if (dfs_stage_init(&c->stage, SMAIN_DIR, c->path) < 0 || strlen(args[2]) >= sizeof(c->delta_size) || strlen(args[3]) >= sizeof(c->delta_sha256)) {
+                out_status(&c->out, c->request_id, 0, "Invalid upload");
+                return;
+            }
+            if (c->opcode == DFS_OP_UFILE_DELTA && function_to_create_directories(expanded_path) < 0) {
+                out_status(&c->out, c->request_id, 0, "Failed to create directory");
+                return;
+            }
+            //the stream is collected in an unnamed file and handled once it is complete,
+            //so the loop never waits on the client in the middle of assembling a file
+            c->file_fd = open(SMAIN_DIR, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+            if (c->file_fd < 0) {
+                perror("Failed to create upload buffer file");
+                out_status(&c->out, c->request_id, 0, "Failed to upload file");
+                return;
+            }
+            snprintf(c->delta_size, sizeof(c->delta_size), "%s", args[2]);
+            snprintf(c->delta_sha256, sizeof(c->delta_sha256), "%s", args[3]);
+            out_status(&c->out, c->request_id, 1, c->opcode == DFS_OP_UFILE_CHUNKS ? "Ready to receive chunk list" : "File type accepted");
+            pump_start(&c->pump, 0, 0, c->request_id);
+            c->state = REACTOR_UPLOAD_LOCAL;
+            return;
+        }
+        case DFS_OP_DFILE: {
+            //a cached copy of a .txt or .pdf file is sent like a local file
+            uint64_t size;
+            int tier;
+            if (!is_local) {
+                c->file_fd = dfs_cache_open(c->path, &size, &tier);
+                if (c->file_fd < 0) {
+                    c->cacheable = argc == 1 && !(c->request_flags & DFS_FLAG_COMPRESSED);
+                    reactor_start_backend_args(c, port, DFS_OP_DFILE, (const char* const*)args, argc);
+                    return;
+                }
+                printf("Serving %s from the %s cache\n", c->path, tier == DFS_CACHE_MEMORY ? "memory" : "disk");
+            } else {
+                expand_path_for_home(args[0], expanded_path);
+                if (dfs_index_lookup(expanded_path, NULL) == 0) {
+                    snprintf(message, sizeof(message), "Failed to open file: %s", strerror(ENOENT));
+                    out_status(&c->out, c->request_id, 0, message);
+                    return;
+                }
+                struct stat st;
+                c->file_fd = open(expanded_path, O_RDONLY | O_CLOEXEC);
+                if (c->file_fd < 0 || fstat(c->file_fd, &st) < 0) {
+                    snprintf(message, sizeof(message), "Failed to open file: %s", strerror(errno));
+                    out_status(&c->out, c->request_id, 0, message);
+                    if (c->file_fd >= 0) {
+                        close(c->file_fd);
+                        c->file_fd = -1;
+                    }
+                    return;
+                }
+                size = st.st_size;
+            }
+            //a ranged request is answered with the slice it names, clipped to the end of the file
+            uint64_t offset = 0;
+            uint64_t length = size;
+            snprintf(message, sizeof(message), "File type accepted");
+            if (argc > 1) {
+                if (dfs_parse_range(args + 1, argc - 1, size, &offset, &length) < 0) {
+                    close(c->file_fd);
+                    c->file_fd = -1;
+                    out_status(&c->out, c->request_id, 0, "Requested range not satisfiable");
+                    return;
+                }
+                snprintf(message, sizeof(message), DFS_RANGE_STATUS_FORMAT, (unsigned long long)length, (unsigned long long)offset, (unsigned long long)size);
+            }
+            out_status(&c->out, c->request_id, 1, message);
+            c->file_offset = offset;
+            c->file_end = offset + length;
+            c->frame_left = 0;
+            c->state = REACTOR_SEND_FILE;
+            return;
+        }
+        case DFS_OP_RMFILE:
+            if (!is_local) {
+                reactor_start_backend(c, port, DFS_OP_RMFILE, args[0], NULL);
+                return;
+            }
+            expand_path_for_home(args[0], expanded_path);
+            if (dfs_index_lookup(expanded_path, NULL) == 0) {
+                out_status(&c->out, c->request_id, 0, "Failed to remove file");
+            } else if (remove(expanded_path) == 0) {
+                dfs_index_remove(expanded_path);
+                snprintf(message, sizeof(message), "File %s removed", args[0]);
+                out_status(&c->out, c->request_id, 1, message);
+            } else {
+                perror("Failed to remove file");
+                out_status(&c->out, c->request_id, 0, "Failed to remove file");
+            }
+            return;
+        case DFS_OP_DTAR:
+            if (dfs_tar_parse_options(argc == 2 ? args[1] : NULL, &c->tar_options) < 0) {
+                out_status(&c->out, c->request_id, 0, "Invalid archive options");
+                return;
+            }
+            if (!is_local) {
+                reactor_start_backend(c, port, DFS_OP_DTAR, args[0], argc == 2 ? args[1] : NULL);
+                return;
+            }
+            if (!c->tar_options.send_manifest) {
+                reactor_send_tar(c, true);
+                return;
+            }
+            //the client's manifest is collected in memory and parsed once its stream has ended
+            c->file_fd = memfd_create("dfs-manifest", MFD_CLOEXEC);
+            if (c->file_fd < 0) {
+                perror("Failed to receive manifest");
+                out_status(&c->out, c->request_id, 0, "Failed to create tar file");
+                return;
+            }
+            out_status(&c->out, c->request_id, 1, "File type accepted");
+            pump_start(&c->pump, 0, 0, c->request_id);
+            c->state = REACTOR_UPLOAD_LOCAL;
+            return;
+    }
+}
+
+//reactor_backend_status: Handles the storage server's first status frame for the current request.
+static void reactor_backend_status(struct reactor_conn* c) {
+    struct frame_reader *r = &c->backend_reader;
+    if (r->frame.opcode != DFS_OP_STATUS) {
+        reactor_backend_failed(c, "Invalid response from server");
+        return;
+    }
+    bool ok = !(r->frame.flags & DFS_FLAG_ERROR);
+
+    switch (c->opcode) {
+        case DFS_OP_UFILE:
+        case DFS_OP_UFILE_RESUME:
+        case DFS_OP_UFILE_PART:
+        case DFS_OP_UFILE_CHUNKS:
+        case DFS_OP_UFILE_DELTA:
+            if (!ok) {
+                out_status(&c->out, c->request_id, 0, r->payload);
+                reactor_finish_request(c);
+                return;
+            }
+            //tell the client to start sending and relay its stream to the storage server
+            out_status(&c->out, c->request_id, 1, "File type accepted");
+            pump_start(&c->pump, 1, 1, c->backend_id);
+            c->state = REACTOR_RELAY_UPLOAD;
+            break;
+        case DFS_OP_DFILE:
+        case DFS_OP_DTAR:
+            out_status(&c->out, c->request_id, ok, r->payload);
+            if (!ok) {
+                reactor_finish_request(c);
+                return;
+            }
+            if (c->opcode == DFS_OP_DTAR && c->tar_options.send_manifest) {
+                //the client's manifest goes to the storage server before the archive comes back
+                pump_start(&c->pump, 1, 1, c->backend_id);
+                c->state = REACTOR_RELAY_UPLOAD;
+                break;
+            }
+            pump_start(&c->pump, 1, 1, c->request_id);
+            if (c->opcode == DFS_OP_DFILE && c->cacheable && dfs_cache_fill_begin(&c->cache_fill, c->path) == 0 && pump_use_buffer(&c->pump) == 0) {
+                //the payloads are read into the pump's buffer, where they are copied into the cache
+                c->pump.fill = &c->cache_fill;
+            }
+            c->state = REACTOR_RELAY_DOWNLOAD;
+            break;
+        case DFS_OP_RMFILE:
+        case DFS_OP_UFILE_QUERY:
+        case DFS_OP_UFILE_COMMIT:
+            if (c->opcode != DFS_OP_UFILE_QUERY) {
+                dfs_cache_invalidate(c->path);
+            }
+            out_status(&c->out, c->request_id, ok, r->payload);
+            reactor_finish_request(c);
+            return;
+        case DFS_OP_DISPLAY:
+            if (!ok) {
+                reactor_backend_failed(c, r->payload);
+                return;
+            }
+            c->state = REACTOR_COLLECT_LISTING;
+            break;
+    }
+    reader_reset(r);
+}
+
+//reactor_finish_delta: Answers a chunk list query or assembles a delta upload once its stream is in file_fd.
+static void reactor_finish_delta(struct reactor_conn* c) {
+    char response[BUFFER_SIZE] = "Failed to upload file";
+    char error_msg[BUFFER_SIZE];
+    struct dfs_delta_stats stats;
+    int ok = 0;
+    if (c->pump.error || lseek(c->file_fd, 0, SEEK_SET) < 0) {
+        //the client aborted the upload
+    } else if (c->opcode == DFS_OP_UFILE_CHUNKS) {
+        ok = dfs_delta_query(c->file_fd, 0, c->path, c->delta_size, c->delta_sha256, response, sizeof(response)) == 0;
+    } else if (dfs_delta_apply(c->file_fd, 0, &c->stage, c->delta_size, c->delta_sha256, 0, &stats, error_msg, sizeof(error_msg)) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to upload file: %s", error_msg);
+    } else {
+        printf("Stored %s from %llu of %llu chunks sent (%llu of %llu bytes)\n", c->path, stats.sent_chunks, stats.chunks, stats.sent_bytes, stats.bytes);
+        dfs_index_update(c->path);
+        snprintf(response, BUFFER_SIZE, "File %s uploaded successfully.", strrchr(c->path, '/') + 1);
+        ok = 1;
+    }
+    close(c->file_fd);
+    c->file_fd = -1;
+    out_status(&c->out, c->request_id, ok, response);
+}
+
+//reactor_send_file: Sends the rest of a local file as DATA frames using sendfile().
+//returns 1 when the whole file was sent, 0 if the socket would block and -1 on error.
+static int reactor_send_file(struct reactor_conn* c) {
+    while (c->file_offset < c->file_end || c->frame_left > 0) {
+        if (c->frame_left == 0) {
+            off_t remaining = c->file_end - c->file_offset;
+            c->frame_left = remaining < DFS_SENDFILE_FRAME_SIZE ? remaining : DFS_SENDFILE_FRAME_SIZE;
+            out_frame(&c->out, DFS_OP_DATA, 0, c->request_id, NULL, c->frame_left);
+            int r = out_flush(c->client_fd, &c->out);
+            if (r <= 0) {
+                return r;
+            }
+        }
+        ssize_t n = sendfile(c->client_fd, c->file_fd, &c->file_offset, c->frame_left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (n == 0) {
+            //the file shrank while being sent; the frame cannot be completed
+            return -1;
+        }
+        c->frame_left -= n;
+    }
+    return 1;
+}
+
+//reactor_advance: Runs a connection's state machine until it has to wait for one of its descriptors.
+static void reactor_advance(struct reactor_conn* c) {
+    while (!c->closed) {
+        //queued frames always go out before anything else is written to the client
+        int r = out_flush(c->client_fd, &c->out);
+        if (r < 0) {
+            reactor_close(c);
+            return;
+        }
+        if (r == 0) {
+            return;
+        }
+
+        //a request ends once its reply has been sent and the connection waits for the next one
+        if (c->state == REACTOR_READ_REQUEST && c->metrics.active) {
+            if (c->out.status_errors > 0) {
+                dfs_metrics_fail(&c->metrics, DFS_METRICS_REJECTED);
+            }
+            dfs_metrics_end(&c->metrics, c->client_fd);
+            dfs_metrics_begin(&c->metrics, c->client_fd);
+        }
+
+        switch (c->state) {
+            case REACTOR_READ_REQUEST:
+                r = reader_step(c->client_fd, &c->reader);
+                if (r < 0) {
+                    reactor_close(c);
+                    return;
+                }
+                if (r == 0) {
+                    return;
+                }
+                reactor_dispatch(c);
+                reader_reset(&c->reader);
+                break;
+
+            case REACTOR_UPLOAD_LOCAL:
+                r = pump_step(c->client_fd, c->file_fd, &c->pump);
+                //everything read has been written when the pump stops, so a full chunk can be checkpointed;
+                //the flush blocks the loop briefly once per chunk
+                if (c->staged && c->stage.part) {
+                    c->stage.offset += c->pump.written;
+                    c->pump.written = 0;
+                } else if (c->staged) {
+                    if (dfs_stage_advance(&c->stage, c->pump.written) < 0) {
+                        perror("Failed to save upload checkpoint");
+                    }
+                    c->pump.written = 0;
+                }
+                if (r == 0) {
+                    return;
+                }
+                if (r < 0) {
+                    reactor_close(c);
+                    return;
+                }
+                pump_release(&c->pump);
+                if (c->staged) {
+                    c->staged = false;
+                    c->file_fd = -1;
+                    if (c->pump.error) {
+                        dfs_stage_close(&c->stage);
+                        out_status(&c->out, c->request_id, 0, "Failed to upload file");
+                    } else if (c->stage.part) {
+                        char response[BUFFER_SIZE];
+                        bool stored = dfs_stage_finish_part(&c->stage) == 0;
+                        if (!stored) {
+                            snprintf(response, BUFFER_SIZE, "Failed to upload file: %s", strerror(errno));
+                        } else {
+                            snprintf(response, BUFFER_SIZE, "Part of %s stored", strrchr(c->path, '/') + 1);
+                        }
+                        out_status(&c->out, c->request_id, stored, response);
+                    } else if (dfs_stage_commit(&c->stage) < 0) {
+                        perror("Failed to move upload into place");
+                        out_status(&c->out, c->request_id, 0, "Failed to upload file");
+                    } else {
+                        dfs_index_update(c->path);
+                        char response[BUFFER_SIZE];
+                        snprintf(response, BUFFER_SIZE, "File %s uploaded successfully.", strrchr(c->path, '/') + 1);
+                        out_status(&c->out, c->request_id, 1, response);
+                    }
+                    c->state = REACTOR_READ_REQUEST;
+                    break;
+                }
+                if (c->opcode == DFS_OP_DTAR) {
+                    lseek(c->file_fd, 0, SEEK_SET);
+                    c->tar_options.manifest = c->pump.error ? NULL : dfs_tar_read_manifest(c->file_fd);
+                    close(c->file_fd);
+                    c->file_fd = -1;
+                    if (!c->tar_options.manifest) {
+                        out_status(&c->out, c->request_id, 0, c->pump.error ? "Failed to receive manifest" : "Invalid manifest");
+                        c->state = REACTOR_READ_REQUEST;
+                        break;
+                    }
+                    reactor_send_tar(c, false);
+                    break;
+                }
+                if (c->opcode != DFS_OP_UFILE) {
+                    reactor_finish_delta(c);
+                    c->state = REACTOR_READ_REQUEST;
+                    break;
+                }
+                close(c->file_fd);
+                c->file_fd = -1;
+                if (c->pump.error) {
+                    //the client aborted the upload
+                    remove(c->path);
+                    dfs_index_remove(c->path);
+                    out_status(&c->out, c->request_id, 0, "Failed to upload file");
+                } else {
+                    dfs_index_update(c->path);
+                    char response[BUFFER_SIZE];
+                    snprintf(response, BUFFER_SIZE, "File %s uploaded successfully.", strrchr(c->path, '/') + 1);
+                    out_status(&c->out, c->request_id, 1, response);
+                }
+                c->state = REACTOR_READ_REQUEST;
+                break;
+
+            case REACTOR_SEND_FILE:
+                r = reactor_send_file(c);
+                if (r == 0) {
+                    return;
+                }
+                if (r < 0) {
+                    reactor_close(c);
+                    return;
+                }
+                out_frame(&c->out, DFS_OP_DATA, DFS_FLAG_END, c->request_id, NULL, 0);
+                close(c->file_fd);
+                c->file_fd = -1;
+                c->state = REACTOR_READ_REQUEST;
+                break;
+
+            case REACTOR_SEND_PIPE: {
+                char buffer[DFS_DATA_CHUNK_SIZE];
+                ssize_t n = read(c->file_fd, buffer, sizeof(buffer));
+                if (n < 0 && errno == EINTR) {
+                    break;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    return;
+                }
+                if (n > 0) {
+                    out_frame(&c->out, DFS_OP_DATA, 0, c->request_id, buffer, n);
+                    break;
+                }
+                //tar finished (or failed); the END frame closes the archive stream
+                out_frame(&c->out, DFS_OP_DATA, DFS_FLAG_END, c->request_id, NULL, 0);
+                close(c->file_fd);
+                c->file_fd = -1;
+                c->state = REACTOR_READ_REQUEST;
+                break;
+            }
+
+            case REACTOR_BACKEND_WAIT:
+                //resumed once another request releases a connection to this storage server
+                return;
+
+            case REACTOR_BACKEND_CONNECT: {
+                //SO_ERROR reports whether the non-blocking connect failed
+                int error = 0;
+                socklen_t error_length = sizeof(error);
+                getsockopt(c->backend_fd, SOL_SOCKET, SO_ERROR, &error, &error_length);
+                if (error != 0) {
+                    if (!c->backend_reused) {
+                        dfs_metrics_backend_connect(c->backend_port, 0, 0);
+                    }
+                    if (!reactor_retry_backend(c)) {
+                        reactor_backend_failed(c, c->opcode == DFS_OP_UFILE ? "Failed to connect to storage server" : "Failed to communicate with server");
+                    }
+                    break;
+                }
+                r = out_flush(c->backend_fd, &c->backend_out);
+                if (r < 0 && errno == ENOTCONN) {
+                    return;
+                }
+                if (r < 0) {
+                    if (!reactor_retry_backend(c)) {
+                        reactor_backend_failed(c, "Failed to communicate with server");
+                    }
+                    break;
+                }
+                if (r == 0) {
+                    return;
+                }
+                if (!c->backend_reused) {
+                    dfs_metrics_backend_connect(c->backend_port, function_to_get_time_us() - c->backend_connect_us, 1);
+                }
+                c->state = REACTOR_BACKEND_STATUS;
+                break;
+            }
+
+            case REACTOR_BACKEND_STATUS:
+                r = reader_step(c->backend_fd, &c->backend_reader);
+                if (r == 0) {
+                    return;
+                }
+                if (r < 0 || c->backend_reader.frame.request_id != c->backend_id) {
+                    //a parked connection closed by the server fails here on first use
+                    if (!reactor_retry_backend(c)) {
+                        reactor_backend_failed(c, "Failed to communicate with server");
+                    }
+                    break;
+                }
+                reactor_backend_status(c);
+                break;
+
+            case REACTOR_RELAY_UPLOAD:
+                r = pump_step(c->client_fd, c->backend_fd, &c->pump);
+                if (r == 0) {
+                    return;
+                }
+                if (r < 0) {
+                    reactor_close(c);
+                    return;
+                }
+                pump_release(&c->pump);
+                if (c->opcode == DFS_OP_DTAR) {
+                    //the manifest is in; the storage server answers with the archive or an error
+                    pump_start(&c->pump, 1, 1, c->request_id);
+                    c->state = REACTOR_RELAY_DOWNLOAD;
+                    break;
+                }
+                c->state = REACTOR_BACKEND_FINAL;
+                break;
+
+            case REACTOR_BACKEND_FINAL:
+                r = reader_step(c->backend_fd, &c->backend_reader);
+                if (r == 0) {
+                    return;
+                }
+                //by now a cached copy of the uploaded file may be out of date
+                dfs_cache_invalidate(c->path);
+                if (r < 0 || c->backend_reader.frame.opcode != DFS_OP_STATUS || c->backend_reader.frame.request_id != c->backend_id) {
+                    out_status(&c->out, c->request_id, 0, "No response from storage server");
+                    reactor_close_backend(c);
+                    c->state = REACTOR_READ_REQUEST;
+                    break;
+                }
+                printf("Response from storage server: %s\n", c->backend_reader.payload);
+                out_status(&c->out, c->request_id, !(c->backend_reader.frame.flags & DFS_FLAG_ERROR), c->backend_reader.payload);
+                reactor_finish_request(c);
+                break;
+
+            case REACTOR_RELAY_DOWNLOAD:
+                r = pump_step(c->backend_fd, c->client_fd, &c->pump);
+                if (r == 0) {
+                    return;
+                }
+                if (r < 0) {
+                    //the client's stream was cut mid-frame and cannot be resynchronised
+                    reactor_close(c);
+                    return;
+                }
+                dfs_cache_fill_end(&c->cache_fill, !c->pump.error);
+                reactor_finish_request(c);
+                break;
+
+            case REACTOR_LIST_LOCAL: {
+                //the queued output has been sent, so fetches that paused for the client can read again
+                reactor_resume_fetches(c);
+                const char *name = NULL;
+                for (int i = 0; i < REACTOR_LIST_BATCH && (name = dfs_list_next(&c->list_iter)) != NULL; i++) {
+                    if (c->list_skip > 0) {
+                        c->list_skip--;
+                        continue;
+                    }
+                    dfs_list_writer_add(&c->list_writer, name);
+                }
+                if (name) {
+                    break;
+                }
+                dfs_list_close(&c->list_iter);
+                dfs_list_writer_flush(&c->list_writer);
+                printf("Display: Smain listed in %.1f ms\n", (function_to_get_time_us() - c->started_us) / 1000.0);
+                c->state = REACTOR_DISPLAY_WAIT;
+                reactor_display_part_done(c);
+                break;
+            }
+
+            case REACTOR_DISPLAY_WAIT:
+                //resumed once a display fetch queues its part of the listing
+                reactor_resume_fetches(c);
+                return;
+
+            case REACTOR_COLLECT_LISTING: {
+                //a full listing is forwarded as it arrives; stop reading while the client is behind,
+                //the client connection resumes the fetch once its output has been sent
+                struct reactor_conn *parent = c->parent;
+                struct display_part *part = parent->list_options.page_size > 0 ? &parent->parts[c->backend_port == SPDF_PORT ? 1 : 2] : NULL;
+                if (!part && parent->out.len - parent->out.off > REACTOR_DISPLAY_BACKLOG) {
+                    return;
+                }
+                r = reader_step(c->backend_fd, &c->backend_reader);
+                if (r == 0) {
+                    return;
+                }
+                if (r < 0 || c->backend_reader.frame.opcode != DFS_OP_DATA || c->backend_reader.frame.request_id != c->backend_id) {
+                    //a lost connection, or an error status frame that cut the listing short
+                    reactor_backend_failed(c, "Failed to get listing");
+                    break;
+                }
+                //the END frame of a page carries a cursor rather than names
+                if (c->backend_reader.frame.flags & DFS_FLAG_CURSOR) {
+                    if (part) {
+                        part->more = true;
+                    }
+                } else if (part) {
+                    function_to_add_display_names(part, c->backend_reader.payload, c->backend_reader.frame.length);
+                } else if (c->backend_reader.frame.length > 0) {
+                    //merge the listing into the client's stream without its END flag
+                    out_frame(&parent->out, DFS_OP_DATA, 0, c->request_id, c->backend_reader.payload, c->backend_reader.frame.length);
+                    reactor_mark_ready(parent);
+                }
+                if (c->backend_reader.frame.flags & DFS_FLAG_END) {
+                    reactor_fetch_done(c, true);
+                    break;
+                }
+                reader_reset(&c->backend_reader);
+                break;
+            }
+        }
+    }
+}
+
+//reactor_accept: Accepts every pending client connection.
+static void reactor_accept(int server_fd) {
+    while (1) {
+        int client_socket = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+
+        dfs_config_tune_socket(client_socket);
+        struct reactor_conn *c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(client_socket);
+            continue;
+        }
+        c->client_fd = client_socket;
+        c->backend_fd = -1;
+        c->file_fd = -1;
+        c->pump.pipe_fds[0] = c->pump.pipe_fds[1] = -1;
+        c->state = REACTOR_READ_REQUEST;
+        if (reactor_watch(c, client_socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP) < 0) {
+            perror("epoll_ctl");
+            close(client_socket);
+            free(c);
+            continue;
+        }
+        dfs_metrics_connection_opened();
+        dfs_metrics_begin(&c->metrics, client_socket);
+    }
+}
+
+//run_epoll_server: Serves every client from a single edge-triggered epoll event loop.
+void run_epoll_server(int server_fd) {
+    reactor_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor_epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    //the listening socket is the only descriptor registered without a connection
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+    fcntl(server_fd, F_SETFD, FD_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(reactor_epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(reactor_epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            struct reactor_conn *c = events[i].data.ptr;
+            if (!c) {
+                reactor_accept(server_fd);
+            } else if (!c->closed) {
+                reactor_advance(c);
+            }
+        }
+
+        //start the requests that were given a storage server connection slot during this batch,
+        //and send the output other connections queued; either step can lead to more of the other
+        while (reactor_woken_list || reactor_ready_list) {
+            while (reactor_woken_list) {
+                struct reactor_conn *c = reactor_woken_list;
+                reactor_woken_list = c->next_waiting;
+                if (!c->closed) {
+                    reactor_connect_backend(c, true);
+                    reactor_advance(c);
+                }
+            }
+            while (reactor_ready_list) {
+                struct reactor_conn *c = reactor_ready_list;
+                reactor_ready_list = c->next_ready;
+                c->ready_queued = false;
+                if (!c->closed) {
+                    reactor_advance(c);
+                }
+            }
+        }
+
+        //free connections closed during this batch, now that no event can refer to them
+        while (reactor_closed_list) {
+            struct reactor_conn *c = reactor_closed_list;
+            reactor_closed_list = c->next_closed;
+            free(c->out.data);
+            free(c->backend_out.data);
+            free(c->backend_request.data);
+            for (int i = 0; i < 3; i++) {
+                free(c->parts[i].names);
+            }
+            free(c);
+        }
+    }
+}
+
+//function_to_write_metrics: Writes the relay and cache counters into a scrape. the storage server connections and
+//compression are counted per process, so they are only added in epoll mode, where one process serves every client.
+void function_to_write_metrics(FILE* out) {
+    struct dfs_relay_stats relay;
+    dfs_xfer_get_stats(&relay);
+    dfs_metrics_describe(out, "dfs_relay_spliced_bytes_total", "counter", "Payload bytes relayed to and from Spdf/Stext with splice().");
+    dfs_metrics_print(out, "dfs_relay_spliced_bytes_total", "", relay.spliced_bytes);
+    dfs_metrics_describe(out, "dfs_relay_copied_bytes_total", "counter", "Payload bytes relayed to and from Spdf/Stext through a buffer.");
+    dfs_metrics_print(out, "dfs_relay_copied_bytes_total", "", relay.copied_bytes);
+    dfs_metrics_describe(out, "dfs_relay_splice_fallbacks_total", "counter", "Relays that fell back from splice() to copying.");
+    dfs_metrics_print(out, "dfs_relay_splice_fallbacks_total", "", relay.splice_fallbacks);
+
+    struct dfs_cache_stats cache;
+    dfs_cache_get_stats(&cache);
+    dfs_metrics_describe(out, "dfs_cache_hits_total", "counter", "Downloads served from the cache, by tier.");
+    dfs_metrics_print(out, "dfs_cache_hits_total", "tier=\"memory\"", cache.memory_hits);
+    dfs_metrics_print(out, "dfs_cache_hits_total", "tier=\"disk\"", cache.disk_hits);
+    dfs_metrics_describe(out, "dfs_cache_misses_total", "counter", "Downloads fetched from Spdf/Stext.");
+    dfs_metrics_print(out, "dfs_cache_misses_total", "", cache.misses);
+    dfs_metrics_describe(out, "dfs_cache_evictions_total", "counter", "Cached files dropped to make room.");
+    dfs_metrics_print(out, "dfs_cache_evictions_total", "", cache.evictions);
+    dfs_metrics_describe(out, "dfs_cache_invalidations_total", "counter", "Cached files dropped by an upload or removal.");
+    dfs_metrics_print(out, "dfs_cache_invalidations_total", "", cache.invalidations);
+    dfs_metrics_describe(out, "dfs_cache_bytes", "gauge", "Bytes held by the cache, by tier.");
+    dfs_metrics_print(out, "dfs_cache_bytes", "tier=\"memory\"", cache.memory_bytes);
+    dfs_metrics_print(out, "dfs_cache_bytes", "tier=\"disk\"", cache.disk_bytes);
+    if (!SMAIN_EPOLL) {
+        return;
+    }
+
+    struct dfs_backend_stats backends[2];
+    dfs_backend_get_stats(SPDF_PORT, &backends[0]);
+    dfs_backend_get_stats(STEXT_PORT, &backends[1]);
+    const char *labels[2][2] = {
+        {"backend=\"Spdf\",state=\"in_use\"", "backend=\"Spdf\",state=\"idle\""},
+        {"backend=\"Stext\",state=\"in_use\"", "backend=\"Stext\",state=\"idle\""}
+    };
+    dfs_metrics_describe(out, "dfs_backend_connections", "gauge", "Connections to a storage server, by state.");
+    for (int i = 0; i < 2; i++) {
+        dfs_metrics_print(out, "dfs_backend_connections", labels[i][0], backends[i].in_use);
+        dfs_metrics_print(out, "dfs_backend_connections", labels[i][1], backends[i].idle);
+    }
+    dfs_metrics_describe(out, "dfs_backend_reused_total", "counter", "Requests sent on a parked connection to a storage server.");
+    dfs_metrics_print(out, "dfs_backend_reused_total", "backend=\"Spdf\"", backends[0].reused);
+    dfs_metrics_print(out, "dfs_backend_reused_total", "backend=\"Stext\"", backends[1].reused);
+
+    struct dfs_compress_stats compress;
+    dfs_compress_get_stats(&compress);
+    dfs_metrics_describe(out, "dfs_compress_in_bytes_total", "counter", "Bytes given to the compressor.");
+    dfs_metrics_print(out, "dfs_compress_in_bytes_total", "", compress.compress_in);
+    dfs_metrics_describe(out, "dfs_compress_out_bytes_total", "counter", "Bytes the compressor produced.");
+    dfs_metrics_print(out, "dfs_compress_out_bytes_total", "", compress.compress_out);
+}
@@ -1,423 +1,794 @@
-//stext.c
-//this program implements a server for storing, retrieving, and managing text files.
-//it uses socket programming to handle client requests and performs various file operations.
-#define _XOPEN_SOURCE 500
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <limits.h>
-#include <fcntl.h>
-#include <dirent.h>
-#include <pwd.h>
-#include <ftw.h>
-#include <stdbool.h>
-#include <errno.h>
-
-//define constants for server configuration
-#define PORT 3003
-#define BUFFER_SIZE 1024
-#define SO_REUSEPORT 15
-
-//global variable to store the path of the stext directory
-char STEXT_DIR[256];
-
-//function prototypes
-void handle_client_request(int client_socket);
-void function_for_ufile_dfile_rmfile(int client_socket, char* filename, char* destination_path, int operation);
-void function_to_create_tar(int client_socket);
-void function_to_display_all_files(int client_socket, char* pathname);
-char* get_home_directory();
-void expand_path_for_home(char* expanded_path, const char* path);
-void replace_smain_with_stext(char* path);
-void create_path_directories(const char* path);
-void send_response_to_client(int client_socket, const char* message);
-int open_file_with_flag(const char* filepath, int flags);
-void send_file_content(int client_socket, int fd);
-void receive_and_write_file(int client_socket, int fd);
-
-//enum to represent different file operations
-enum FileOperation {
-    STORE_TEXT,
-    RETRIEVE_TEXT,
-    REMOVE_TEXT
-};
-
-//main function: Sets up the server and handles incoming connections
-int main() {
-    int server_fd, client_socket;
-    struct sockaddr_in address;
-    int opt = 1;
-    int addrlen = sizeof(address);
-
-    //set up the stext directory in the user's home directory
-    snprintf(STEXT_DIR, sizeof(STEXT_DIR), "%s/stext", get_home_directory());
-    mkdir(STEXT_DIR, 0755);
-
-    //create a socket for the server
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        perror("socket failed");
-        exit(EXIT_FAILURE);
-    }
-
-    //set socket options to reuse address and port
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
-        perror("setsockopt");
-        exit(EXIT_FAILURE);
-    }
-
-    //configure server address
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
-
-    //bind the socket to the specified address and port
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        perror("bind failed");
-        exit(EXIT_FAILURE);
-    }
-
-    //listen for incoming connections
-    if (listen(server_fd, 3) < 0) {
-        perror("listen");
-        exit(EXIT_FAILURE);
-    }
-
-    printf("Stext server is running on port %d\n", PORT);
-
-    //main server loop to accept and handle client connections
-    while(1) {
-        if ((client_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
-            perror("accept");
-            continue;
-        }
-
-        //handle the client request
-        handle_client_request(client_socket);
-        close(client_socket);
-    }
-
-    return 0;
-}
-
-//function to handle client requests
-//it reads the client's command and calls the appropriate function
-void handle_client_request(int client_socket) {
-    char buffer[BUFFER_SIZE] = {0};
-    int valread = read(client_socket, buffer, BUFFER_SIZE);
-    if (valread < 0) {
-        perror("read failed");
-        return;
-    }
-
-    printf("Received request: %s\n", buffer);
-
-    //parse the command and arguments from the client's request
-    char command[10] = {0};
-    char arg1[256] = {0};
-    char arg2[256] = {0};
-    sscanf(buffer, "%s %s %s", command, arg1, arg2);
-
-    //determine which operation to perform based on the command
-    switch(command[0]) {
-        case 'u':
-            if (strcmp(command, "ufile") == 0) {
-                //upload a file
-                function_for_ufile_dfile_rmfile(client_socket, arg1, arg2, STORE_TEXT);
-            }
-            break;
-        case 'd':
-            switch(command[1]) {
-                case 'f':
-                    if (strcmp(command, "dfile") == 0) {
-                        //download a file
-                        function_for_ufile_dfile_rmfile(client_socket, arg1, NULL, RETRIEVE_TEXT);
-                    }
-                    break;
-                case 't':
-                    if (strcmp(command, "dtar") == 0) {
-                        //create and send a tar file
-                        function_to_create_tar(client_socket);
-                    }
-                    break;
-                case 'i':
-                    if (strcmp(command, "display") == 0) {
-                        //display all files in a directory
-                        function_to_display_all_files(client_socket, arg1);
-                    }
-                    break;
-            }
-            break;
-        case 'r':
-            if (strcmp(command, "rmfile") == 0) {
-                //remove a file
-                function_for_ufile_dfile_rmfile(client_socket, arg1, NULL, REMOVE_TEXT);
-            }
-            break;
-        default:
-            send_response_to_client(client_socket, "Invalid command");
-    }
-}
-
-//function to handle file operations: store, retrieve, and remove
-//it expands the file path, replaces 'smain' with 'stext', and performs the requested operation
-void function_for_ufile_dfile_rmfile(int client_socket, char* filename, char* destination_path, int operation) {
-    char expanded_path[PATH_MAX];
-    expand_path_for_home(expanded_path, destination_path ? destination_path : filename);
-    replace_smain_with_stext(expanded_path);
-
-    switch(operation) {
-        case STORE_TEXT: {
-            //create necessary directories and open the file for writing
-            create_path_directories(expanded_path);
-            char filepath[PATH_MAX];
-            snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
-            
-            int fd = open_file_with_flag(filepath, O_WRONLY | O_CREAT | O_TRUNC);
-            if (fd < 0) {
-                send_response_to_client(client_socket, "Failed to store text file");
-                return;
-            }
-            
-            //receive file content from client and write to file
-            receive_and_write_file(client_socket, fd);
-            close(fd);
-            break;
-        }
-        case RETRIEVE_TEXT: {
-            //open the file for reading
-            int fd = open_file_with_flag(expanded_path, O_RDONLY);
-            if (fd < 0) {
-                char error_msg[BUFFER_SIZE];
-                snprintf(error_msg, BUFFER_SIZE, "Failed to open file: %s", strerror(errno));
-                send_response_to_client(client_socket, error_msg);
-                return;
-            }
-
-            //get file size
-            struct stat file_stat;
-            if (fstat(fd, &file_stat) < 0) {
-                perror("Failed to get file size");
-                close(fd);
-                send(client_socket, "Failed to get file size", 23, 0);
-                return;
-            }
-            printf("File size: %ld bytes\n", file_stat.st_size);
-
-            //send file content to client
-            send_file_content(client_socket, fd);
-            close(fd);
-            break;
-        }
-        case REMOVE_TEXT: {
-            //remove the specified file
-            if (remove(expanded_path) == 0) {
-                char response[BUFFER_SIZE];
-                snprintf(response, BUFFER_SIZE, "Text file %s removed successfully", expanded_path);
-                send_response_to_client(client_socket, response);
-            } else {
-                char error_msg[BUFFER_SIZE];
-                snprintf(error_msg, BUFFER_SIZE, "Failed to remove text file: %s", strerror(errno));
-                send_response_to_client(client_socket, error_msg);
-            }
-            break;
-        }
-    }
-}
-
-//function to create a tar file of the stext directory and send it to the client
-void function_to_create_tar(int client_socket) {
-    char tar_file_path[PATH_MAX];
-    snprintf(tar_file_path, sizeof(tar_file_path), "%s/txtfiles.tar", STEXT_DIR);
-
-    //remove existing tar file if it exists
-    remove(tar_file_path);
-
-    //prepare tar command
-    char tar_command[BUFFER_SIZE];
-    snprintf(tar_command, sizeof(tar_command), "tar -cf %s -C %s .", tar_file_path, STEXT_DIR);
-    
-    //execute the tar command
-    int result = system(tar_command);
-    if (result != 0) {
-        perror("Failed to create tar file");
-        send(client_socket, "Failed to create tar file", 25, 0);
-        return;
-    }
-
-    //open the created tar file
-    int fd = open(tar_file_path, O_RDONLY);
-    if (fd < 0) {
-        perror("Failed to open tar file");
-        send(client_socket, "Failed to open tar file", 23, 0);
-        return;
-    }
-
-    //get file size
-    struct stat file_stat;
-    if (fstat(fd, &file_stat) < 0) {
-        perror("Failed to get file size");
-        close(fd);
-        send(client_socket, "Failed to get file size", 23, 0);
-        return;
-    }
-
-    //send the tar file content to the client
-    char buffer[BUFFER_SIZE];
-    int bytes_read;
-    int total_bytes_sent = 0;
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-        int bytes_sent = send(client_socket, buffer, bytes_read, 0);
-        if (bytes_sent < 0) {
-            perror("Failed to send tar data");
-            break;
-        }
-        total_bytes_sent += bytes_sent;
-    }
-
-    printf("Total bytes sent: %zu\n", total_bytes_sent);
-
-    //send end-of-file marker
-    char eof_marker[8] = "EOF\n";
-    send(client_socket, eof_marker, strlen(eof_marker), 0);
-
-    close(fd);
-    //clean up the tar file after sending
-    remove(tar_file_path);
-}
-
-//function to display all text files in a specified directory
-void function_to_display_all_files(int client_socket, char* pathname) {
-    char dirpath[512];
-    
-    //check if the pathname starts with "~/smain"
-    if (strncmp(pathname, "~/smain", 7) == 0) {
-        //replace "~/smain" with STEXT_DIR
-        snprintf(dirpath, sizeof(dirpath), "%s%s", STEXT_DIR, pathname + 7);
-    } else {
-        //if it doesn't start with "~/smain", just append it to STEXT_DIR
-        snprintf(dirpath, sizeof(dirpath), "%s/%s", STEXT_DIR, pathname);
-    }
-
-    DIR *dir;
-    struct dirent *ent;
-    struct stat st;
-    char response[BUFFER_SIZE] = "";
-    char fullpath[PATH_MAX];
-
-    //open the directory and read its contents
-    if ((dir = opendir(dirpath)) != NULL) {
-        while ((ent = readdir(dir)) != NULL) {
-            snprintf(fullpath, sizeof(fullpath), "%s/%s", dirpath, ent->d_name);
-            if (stat(fullpath, &st) == 0) {
-                //check if it's a regular file and has a .txt extension
-                if (S_ISREG(st.st_mode) && strstr(ent->d_name, ".txt") != NULL) {
-                    strcat(response, ent->d_name);
-                    strcat(response, "\n");
-                }
-            }
-        }
-        closedir(dir);
-    }
-
-    //send the list of files to the client
-    send(client_socket, response, strlen(response), 0);
-}
-
-//function to get the user's home directory
-char* get_home_directory() {
-    const char *homedir = getenv("HOME");
-    return (char*)homedir;
-}
-
-//function to expand the path if it starts with '~'
-void expand_path_for_home(char* expanded_path, const char* path) {
-    if (path[0] == '~') {
-        snprintf(expanded_path, PATH_MAX, "%s%s", get_home_directory(), path + 1);
-    } else {
-        strncpy(expanded_path, path, PATH_MAX);
-    }
-}
-
-//function to replace 'smain' with 'stext' in the path
-void replace_smain_with_stext(char* path) {
-    char *smain_pos = strstr(path, "/smain");
-    if (smain_pos != NULL) {
-        memcpy(smain_pos, "/stext", 6);
-    }
-}
-
-//function to create all necessary directories in the given path
-void create_path_directories(const char* path) {
-    char temp[PATH_MAX];
-    char *p = NULL;
-    int len;
-
-    snprintf(temp, sizeof(temp), "%s", path);
-    len = strlen(temp);
-    if (temp[len - 1] == '/')
-        temp[len - 1] = 0;
-    for (p = temp + 1; *p; p++)
-        if (*p == '/') {
-            *p = 0;
-            mkdir(temp, 0755);
-            *p = '/';
-        }
-    mkdir(temp, 0755);
-}
-
-//function to send a response message to the client
-void send_response_to_client(int client_socket, const char* message) {
-    send(client_socket, message, strlen(message), 0);
-}
-
-//function to open a file with the specified flags
-int open_file_with_flag(const char* filepath, int flags) {
-    int fd = open(filepath, flags, 0644);
-    if (fd < 0) {
-        perror("Failed to open file");
-    }
-    return fd;
-}
-
-//function to send file content to the client
-void send_file_content(int client_socket, int fd) {
-    char buffer[BUFFER_SIZE];
-    int bytes_read;
-    int total_bytes_sent = 0;
-    while ((bytes_read = read(fd, buffer, BUFFER_SIZE)) > 0) {
-        int sent = send(client_socket, buffer, bytes_read, 0);
-        if (sent < 0) {
-            perror("Failed to send data");
-            break;
-        }
-        total_bytes_sent += sent;
-    }
-    printf("Total file bytes sent: %zu\n", total_bytes_sent);
-}
-
-//function to receive file content from the client and write it to a file
-void receive_and_write_file(int client_socket, int fd) {
-    char buffer[BUFFER_SIZE];
-    int bytes_received;
-    int total_bytes_received = 0;
-
-    //receive data from client in chunks and write to file
-    while ((bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0)) > 0) {
-        //write received data to file
-        if (write(fd, buffer, bytes_received) != bytes_received) {
-            perror("Failed to write file");
-            return;
-        }
-        total_bytes_received += bytes_received;
-    }
-
-    //print total bytes received and written
-    printf("Total bytes received and written: %d\n", total_bytes_received);
-}
\ No newline at end of file
+//stext.c
+//this program implements a server for storing, retrieving, and managing text files.
+//it uses socket programming to handle client requests and performs various file operations.
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+
+#include "dfs_frame.h"
+#include "dfs_xfer.h"
+#include "dfs_pool.h"
+#include "dfs_tar.h"
+#include "dfs_list.h"
+#include "dfs_index.h"
+#include "dfs_stage.h"
+#include "dfs_delta.h"
+#include "dfs_chunk.h"
+#include "dfs_compress.h"
+#include "dfs_uring.h"
+#include "dfs_config.h"
+#include "dfs_metrics.h"
+
+//define constants for server configuration; the port is set by DFS_STEXT_PORT
+#define PORT (dfs_config_net()->stext_port)
+#define BUFFER_SIZE 1024
+#define SO_REUSEPORT 15
+
+//global variable to store the path of the stext directory
+char STEXT_DIR[256];
+//codec stored files are compressed with, DFS_CODEC_NONE to keep them plain
+int STEXT_CODEC = DFS_CODEC_NONE;
+//running totals of the files compressed since the server started
+unsigned long long compressed_raw_bytes = 0;
+unsigned long long compressed_stored_bytes = 0;
+//worker pool, whose counters are added to the metrics
+struct dfs_pool *worker_pool = NULL;
+
+//function prototypes
+int handle_client_request(int client_socket);
+void function_to_dispatch_request(int client_socket, struct dfs_frame request, char* payload);
+void function_to_write_metrics(FILE* out);
+void function_for_ufile_dfile_rmfile(int client_socket, uint32_t request_id, char* filename, char* destination_path, char** range, int range_count, int operation, uint16_t flags);
+void function_to_resume_upload(int client_socket, uint32_t request_id, char* filename, char* destination_path, const char* offset_text);
+void function_to_store_part(int client_socket, uint32_t request_id, uint8_t opcode, char* filename, char* destination_path, char* token, const char* number_text);
+void function_to_store_delta(int client_socket, uint32_t request_id, uint8_t opcode, char* filename, char* destination_path, const char* size_text, const char* sha256_text);
+void function_to_create_tar(int client_socket, uint32_t request_id, const char* options_text);
+void function_to_display_all_files(int client_socket, uint32_t request_id, char* pathname, const char* options_text);
+char* get_home_directory();
+void expand_path_for_home(char* expanded_path, const char* path);
+void replace_smain_with_stext(char* path);
+void create_path_directories(const char* path);
+void send_response_to_client(int client_socket, uint32_t request_id, int ok, const char* message);
+int function_to_open_upload_file(const char* filepath, char* temp_path, size_t capacity);
+int function_to_install_upload(const char* temp_path, const char* filepath);
+long long send_file_content(int client_socket, uint32_t request_id, struct dfs_chunk_file* file, off_t offset, long long length, int codec);
+long long receive_and_write_file(int client_socket, int fd, char* error_message, size_t error_capacity);
+void function_to_compress(const char* source, const char* filepath);
+double function_to_get_seconds(void);
+
+//enum to represent different file operations
+enum FileOperation {
+    STORE_TEXT,
+    RETRIEVE_TEXT,
+    REMOVE_TEXT
+};
+
+//main function: Sets up the server and handles incoming connections
+int main() {
+    int server_fd;
+    struct sockaddr_in address;
+    int opt = 1;
+
+    //settings from the configuration file join the environment before anything reads it
+    if (dfs_config_load("Stext") < 0) {
+        fprintf(stderr, "Ignoring the configuration file\n");
+    }
+
+    //set up the stext directory in the user's home directory
+    snprintf(STEXT_DIR, sizeof(STEXT_DIR), "%s/stext", get_home_directory());
+    mkdir(STEXT_DIR, 0755);
+
+    //packs written before packs were marked are marked once
+    char pack_marker[PATH_MAX + 16];
+    snprintf(pack_marker, sizeof(pack_marker), "%s.packs-marked", STEXT_DIR);
+    long marked_packs = dfs_pack_mark_tree(STEXT_DIR, pack_marker);
+    if (marked_packs < 0) {
+        fprintf(stderr, "Failed to mark the compressed files in %s: %s\n", STEXT_DIR, strerror(errno));
+    } else if (marked_packs > 0) {
+        printf("Marked %ld compressed files in %s\n", marked_packs, STEXT_DIR);
+    }
+
+    //index the stored files so listings and lookups are answered from memory
+    long indexed_files = dfs_index_build(STEXT_DIR);
+    if (indexed_files < 0) {
+        fprintf(stderr, "Failed to index %s, serving it from disk\n", STEXT_DIR);
+    } else {
+        printf("Indexed %ld files in %s\n", indexed_files, STEXT_DIR);
+    }
+
+    //with DFS_STEXT_STORE=compress stored files are kept as compressed packs
+    const char *store_mode = getenv("DFS_STEXT_STORE");
+    if (store_mode && strcmp(store_mode, "compress") == 0) {
+        STEXT_CODEC = DFS_CODEC_LZ;
+    }
+    printf("Storing %s\n", STEXT_CODEC != DFS_CODEC_NONE ? "compressed files" : "plain files");
+
+    //create a socket for the server
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+        perror("socket failed");
+        exit(EXIT_FAILURE);
+    }
+
+    //set socket options to reuse address and port
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
+        perror("setsockopt");
+        exit(EXIT_FAILURE);
+    }
+
+    //connections inherit the socket buffer sizes of the listening socket
+    dfs_config_tune_socket(server_fd);
+
+    //configure server address
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(PORT);
+
+    //bind the socket to the specified address and port
+    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        perror("bind failed");
+        exit(EXIT_FAILURE);
+    }
+
+    //listen for incoming connections
+    if (listen(server_fd, dfs_config_net()->listen_backlog) < 0) {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+
+    //a peer that disconnects mid-transfer must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    //reader threads, compression threads and gzip level for dtar archives
+    dfs_tar_config_from_env();
+
+    //DFS_IO_ENGINE=uring moves plain uploads and downloads to io_uring
+    dfs_uring_config_from_env();
+
+    //start the worker threads that serve requests from Smain
+    int workers, queue_capacity;
+    dfs_pool_config_from_env(&workers, &queue_capacity);
+    struct dfs_pool *pool = dfs_pool_create(workers, queue_capacity, handle_client_request);
+    if (!pool) {
+        perror("Failed to start worker pool");
+        exit(EXIT_FAILURE);
+    }
+
+    //request metrics, served at DFS_METRICS_PORT together with the pool, I/O, compression and store counters
+    worker_pool = pool;
+    dfs_metrics_add_source(function_to_write_metrics);
+    if (dfs_metrics_start_server("Stext") < 0) {
+        fprintf(stderr, "Metrics endpoint disabled\n");
+    }
+
+    printf("Stext server is running on port %d (%d workers, queue of %d, %s I/O)\n", PORT, workers, queue_capacity,
+           dfs_uring_engine_name(dfs_uring_engine()));
+
+    //accept connections and serve their requests; connections stay open between requests
+    dfs_pool_serve(pool, server_fd);
+
+    close(server_fd);
+    return EXIT_FAILURE;
+}
+
+//function to handle client requests
+//it reads the client's request frame and dispatches it, measuring the request for the metrics
+//it returns -1 if no request could be read, so the worker pool closes the connection
+int handle_client_request(int client_socket) {
+    char payload[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame request;
+    struct dfs_metrics_request metrics;
+    dfs_metrics_begin(&metrics, client_socket);
+    errno = 0;
+    if (dfs_recv_control(client_socket, &request, payload, sizeof(payload)) < 0) {
+        //Smain closing a kept-alive connection is not an error
+        if (errno != 0) {
+            perror("read failed");
+        }
+        return -1;
+    }
+
+    dfs_metrics_start(&metrics, request.opcode);
+    function_to_dispatch_request(client_socket, request, payload);
+    dfs_metrics_end(&metrics, client_socket);
+    return 0;
+}
+
+//function to dispatch a request: Parses the arguments of a request frame and calls the function for its opcode.
+void function_to_dispatch_request(int client_socket, struct dfs_frame request, char* payload) {
+    //parse the arguments from the client's request
+    char *args[DFS_MAX_ARGS];
+    int argc = dfs_parse_args(payload, request.length, args, DFS_MAX_ARGS);
+    printf("Received request: %s %s %s\n", dfs_opcode_name(request.opcode), argc > 0 ? args[0] : "", argc > 1 ? args[1] : "");
+
+    //determine which operation to perform based on the opcode
+    switch(request.opcode) {
+        case DFS_OP_UFILE:
+            if (argc == 2) {
+                //upload a file
+                function_for_ufile_dfile_rmfile(client_socket, request.request_id, args[0], args[1], NULL, 0, STORE_TEXT, request.flags);
+                return;
+            }
+            break;
+        case DFS_OP_DFILE:
+            //a ranged download adds the offset and optionally the length of the slice;
+            //DFS_FLAG_COMPRESSED on the request asks for compressed data frames
+            if (argc >= 1 && argc <= 3) {
+                //download a file
+                function_for_ufile_dfile_rmfile(client_socket, request.request_id, args[0], NULL, args + 1, argc - 1, RETRIEVE_TEXT, request.flags);
+                return;
+            }
+            break;
+        case DFS_OP_UFILE_QUERY:
+        case DFS_OP_UFILE_RESUME:
+            //a resumable upload names the offset it continues at
+            if (argc == (request.opcode == DFS_OP_UFILE_RESUME ? 3 : 2)) {
+                function_to_resume_upload(client_socket, request.request_id, args[0], args[1], request.opcode == DFS_OP_UFILE_RESUME ? args[2] : NULL);
+                return;
+            }
+            break;
+        case DFS_OP_UFILE_PART:
+        case DFS_OP_UFILE_COMMIT:
+            //a parallel upload names its token and the part's offset, or the file size to commit
+            if (argc == 4) {
+                function_to_store_part(client_socket, request.request_id, request.opcode, args[0], args[1], args[2], args[3]);
+                return;
+            }
+            break;
+        case DFS_OP_UFILE_CHUNKS:
+        case DFS_OP_UFILE_DELTA:
+            //a delta upload names the file size and its SHA-256
+            if (argc == 4) {
+                function_to_store_delta(client_socket, request.request_id, request.opcode, args[0], args[1], args[2], args[3]);
+                return;
+            }
+            break;
+        case DFS_OP_DTAR:
+            //create and send a tar file
+            function_to_create_tar(client_socket, request.request_id, argc == 2 ? args[1] : NULL);
+            return;
+        case DFS_OP_DISPLAY:
+            if (argc == 1 || argc == 2) {
+                //display all files in a directory
+                function_to_display_all_files(client_socket, request.request_id, args[0], argc == 2 ? args[1] : NULL);
+                return;
+            }
+            break;
+        case DFS_OP_RMFILE:
+            if (argc == 1) {
+                //remove a file
+                function_for_ufile_dfile_rmfile(client_socket, request.request_id, args[0], NULL, NULL, 0, REMOVE_TEXT, request.flags);
+                return;
+            }
+            break;
+    }
+    send_response_to_client(client_socket, request.request_id, 0, "Invalid command");
+}
+
+//function to handle file operations: store, retrieve, and remove
+//it expands the file path, replaces 'smain' with 'stext', and performs the requested operation
+void function_for_ufile_dfile_rmfile(int client_socket, uint32_t request_id, char* filename, char* destination_path, char** range, int range_count, int operation, uint16_t flags) {
+    char expanded_path[PATH_MAX];
+    expand_path_for_home(expanded_path, destination_path ? destination_path : filename);
+    replace_smain_with_stext(expanded_path);
+
+    switch(operation) {
+        case STORE_TEXT: {
+            //create necessary directories and open the file for writing
+            create_path_directories(expanded_path);
+            char filepath[PATH_MAX];
+            snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+            
+            //the upload is received into a file of its own and renamed over the old one once complete
+            char temp_path[PATH_MAX];
+            int fd = function_to_open_upload_file(filepath, temp_path, sizeof(temp_path));
+            if (fd < 0) {
+                send_response_to_client(client_socket, request_id, 0, "Failed to store text file");
+                return;
+            }
+            send_response_to_client(client_socket, request_id, 1, "Ready to receive text file");
+            
+            //receive file content from client and write to file
+            char error_msg[BUFFER_SIZE] = "Failed to store text file";
+            long long bytes_received = receive_and_write_file(client_socket, fd, error_msg, sizeof(error_msg));
+            if (close(fd) < 0 && bytes_received >= 0) {
+                bytes_received = -1;
+            }
+            if (bytes_received >= 0) {
+                //packed while it is still private, so nothing else can change it underneath
+                function_to_compress(temp_path, filepath);
+            }
+            if (bytes_received >= 0 && function_to_install_upload(temp_path, filepath) < 0) {
+                snprintf(error_msg, sizeof(error_msg), "Failed to store text file: %s", strerror(errno));
+                bytes_received = -1;
+            }
+            if (bytes_received < 0) {
+                //discard the partial file; the old version stays in place
+                unlink(temp_path);
+                send_response_to_client(client_socket, request_id, 0, error_msg);
+            } else {
+                dfs_index_update(filepath);
+                char response[BUFFER_SIZE];
+                snprintf(response, BUFFER_SIZE, "Text file %s stored successfully", filename);
+                send_response_to_client(client_socket, request_id, 1, response);
+            }
+            break;
+        }
+        case RETRIEVE_TEXT: {
+            //a file the index does not know is refused without touching the disk
+            struct dfs_index_info info;
+            int indexed = dfs_index_lookup(expanded_path, &info);
+            if (indexed == 0) {
+                char error_msg[BUFFER_SIZE];
+                snprintf(error_msg, BUFFER_SIZE, "Failed to open file: %s", strerror(ENOENT));
+                send_response_to_client(client_socket, request_id, 0, error_msg);
+                return;
+            }
+
+            //open the file for reading; a compressed file is decoded while it is sent
+            struct dfs_chunk_file file;
+            if (dfs_chunk_open(&file, expanded_path) < 0) {
+                perror("Failed to open file");
+                char error_msg[BUFFER_SIZE];
+                snprintf(error_msg, BUFFER_SIZE, "Failed to open file: %s", strerror(errno));
+                send_response_to_client(client_socket, request_id, 0, error_msg);
+                return;
+            }
+
+            //get the file size for logging; the index holds the size on disk, which for a pack is not the file's
+            struct stat file_stat;
+            file_stat.st_size = file.size;
+            printf("File size: %ld bytes%s\n", file_stat.st_size, file.pack ? " (compressed)" : "");
+
+            //a ranged request is answered with the slice it names, clipped to the end of the file
+            uint64_t offset = 0;
+            uint64_t length = file_stat.st_size;
+            char response[BUFFER_SIZE] = "File type accepted";
+            if (range_count > 0) {
+                if (dfs_parse_range(range, range_count, file_stat.st_size, &offset, &length) < 0) {
+                    dfs_chunk_close(&file);
+                    send_response_to_client(client_socket, request_id, 0, "Requested range not satisfiable");
+                    return;
+                }
+                snprintf(response, BUFFER_SIZE, DFS_RANGE_STATUS_FORMAT, (unsigned long long)length, (unsigned long long)offset, (unsigned long long)file_stat.st_size);
+            }
+
+            //send file content to client, compressed if Smain asked for it
+            send_response_to_client(client_socket, request_id, 1, response);
+            int codec = (flags & DFS_FLAG_COMPRESSED) ? DFS_CODEC_LZ : DFS_CODEC_NONE;
+            send_file_content(client_socket, request_id, &file, offset, range_count > 0 ? (long long)length : -1, codec);
+            dfs_chunk_close(&file);
+            break;
+        }
+        case REMOVE_TEXT: {
+            //remove the specified file
+            if (dfs_index_lookup(expanded_path, NULL) == 0) {
+                char error_msg[BUFFER_SIZE];
+                snprintf(error_msg, BUFFER_SIZE, "Failed to remove text file: %s", strerror(ENOENT));
+                send_response_to_client(client_socket, request_id, 0, error_msg);
+            } else if (remove(expanded_path) == 0) {
+                dfs_index_remove(expanded_path);
+                char response[BUFFER_SIZE];
+                snprintf(response, BUFFER_SIZE, "Text file %s removed successfully", expanded_path);
+                send_response_to_client(client_socket, request_id, 1, response);
+            } else {
+                char error_msg[BUFFER_SIZE];
+                snprintf(error_msg, BUFFER_SIZE, "Failed to remove text file: %s", strerror(errno));
+                send_response_to_client(client_socket, request_id, 0, error_msg);
+            }
+            break;
+        }
+    }
+}
+
+//function to answer an upload query or continue a resumable upload.
+//a query (no offset) reports how many bytes of the file are staged; a resumable upload writes the stream
+//into the staging file from `offset_text` on and moves the file into place once the stream is complete.
+void function_to_resume_upload(int client_socket, uint32_t request_id, char* filename, char* destination_path, const char* offset_text) {
+    char expanded_path[PATH_MAX];
+    char filepath[PATH_MAX];
+    expand_path_for_home(expanded_path, destination_path);
+    replace_smain_with_stext(expanded_path);
+    snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+
+    struct dfs_stage stage;
+    if (dfs_stage_init(&stage, STEXT_DIR, filepath) < 0) {
+        send_response_to_client(client_socket, request_id, 0, "Invalid destination path");
+        return;
+    }
+    char response[BUFFER_SIZE];
+    if (!offset_text) {
+        snprintf(response, BUFFER_SIZE, "%llu", (unsigned long long)dfs_stage_query(&stage));
+        send_response_to_client(client_socket, request_id, 1, response);
+        return;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long offset = strtoull(offset_text, &end, 10);
+    if (errno != 0 || end == offset_text || *end != '\0') {
+        send_response_to_client(client_socket, request_id, 0, "Invalid upload offset");
+        return;
+    }
+    create_path_directories(expanded_path);
+    if (dfs_stage_open(&stage, offset, DFS_STAGE_LOCK_WAIT_MS) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to resume text file: %s", errno == ERANGE ? "offset is past the staged data" : errno == EBUSY ? "upload already in progress" : strerror(errno));
+        send_response_to_client(client_socket, request_id, 0, response);
+        return;
+    }
+    send_response_to_client(client_socket, request_id, 1, "Ready to receive text file");
+
+    //receive the rest of the file; what arrived before a failure stays staged for the next attempt
+    char error_msg[BUFFER_SIZE] = "Failed to store text file";
+    long long bytes_received = dfs_stage_receive(client_socket, &stage, error_msg, sizeof(error_msg));
+    printf("Total bytes received and staged: %lld (resumed at %llu)\n", bytes_received, offset);
+    if (bytes_received < 0) {
+        dfs_stage_close(&stage);
+        send_response_to_client(client_socket, request_id, 0, error_msg);
+    } else if (dfs_stage_commit(&stage) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to store text file: %s", strerror(errno));
+        send_response_to_client(client_socket, request_id, 0, response);
+    } else {
+        function_to_compress(filepath, filepath);
+        dfs_index_update(filepath);
+        snprintf(response, BUFFER_SIZE, "Text file %s stored successfully", filename);
+        send_response_to_client(client_socket, request_id, 1, response);
+    }
+}
+
+//function to store one part of a parallel upload or to commit the upload.
+//a part (`number_text` is its offset) is written into the upload's assembly file and logged once flushed;
+//the commit (`number_text` is the file size) moves the assembly file into place if all parts arrived.
+void function_to_store_part(int client_socket, uint32_t request_id, uint8_t opcode, char* filename, char* destination_path, char* token, const char* number_text) {
+    char expanded_path[PATH_MAX];
+    char filepath[PATH_MAX];
+    expand_path_for_home(expanded_path, destination_path);
+    replace_smain_with_stext(expanded_path);
+    snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+
+    struct dfs_stage stage;
+    char *end;
+    errno = 0;
+    unsigned long long number = strtoull(number_text, &end, 10);
+    if (dfs_stage_init(&stage, STEXT_DIR, filepath) < 0 || errno != 0 || end == number_text || *end != '\0') {
+        send_response_to_client(client_socket, request_id, 0, "Invalid upload part");
+        return;
+    }
+    char response[BUFFER_SIZE];
+    create_path_directories(expanded_path);
+    if (opcode == DFS_OP_UFILE_COMMIT) {
+        if (dfs_stage_commit_parts(&stage, token, number) < 0) {
+            snprintf(response, BUFFER_SIZE, "Failed to store text file: %s", errno == EAGAIN ? "parts are missing" : strerror(errno));
+            send_response_to_client(client_socket, request_id, 0, response);
+            return;
+        }
+        function_to_compress(filepath, filepath);
+        dfs_index_update(filepath);
+        snprintf(response, BUFFER_SIZE, "Text file %s stored successfully", filename);
+        send_response_to_client(client_socket, request_id, 1, response);
+        return;
+    }
+
+    if (dfs_stage_open_part(&stage, token, number) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to store text file: %s", strerror(errno));
+        send_response_to_client(client_socket, request_id, 0, response);
+        return;
+    }
+    send_response_to_client(client_socket, request_id, 1, "Ready to receive text file");
+
+    //a part that fails is not logged and is sent again by the client
+    char error_msg[BUFFER_SIZE] = "Failed to store text file";
+    long long bytes_received = dfs_stage_receive_part(client_socket, &stage, error_msg, sizeof(error_msg));
+    printf("Total bytes received for part at %llu: %lld\n", number, bytes_received);
+    if (bytes_received < 0) {
+        dfs_stage_close(&stage);
+        send_response_to_client(client_socket, request_id, 0, error_msg);
+    } else if (dfs_stage_finish_part(&stage) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to store text file: %s", strerror(errno));
+        send_response_to_client(client_socket, request_id, 0, response);
+    } else {
+        snprintf(response, BUFFER_SIZE, "Part of %s stored", filename);
+        send_response_to_client(client_socket, request_id, 1, response);
+    }
+}
+
+//function to answer which chunks of an upload are missing, or to receive an upload of just those chunks.
+//the stext server keeps plain files, so the missing chunks are those not found in the current version of the file.
+void function_to_store_delta(int client_socket, uint32_t request_id, uint8_t opcode, char* filename, char* destination_path, const char* size_text, const char* sha256_text) {
+    char expanded_path[PATH_MAX];
+    char filepath[PATH_MAX];
+    expand_path_for_home(expanded_path, destination_path);
+    replace_smain_with_stext(expanded_path);
+    snprintf(filepath, sizeof(filepath), "%s/%s", expanded_path, filename);
+
+    struct dfs_stage stage;
+    if (dfs_stage_init(&stage, STEXT_DIR, filepath) < 0) {
+        send_response_to_client(client_socket, request_id, 0, "Invalid destination path");
+        return;
+    }
+    char response[BUFFER_SIZE];
+    if (opcode == DFS_OP_UFILE_CHUNKS) {
+        send_response_to_client(client_socket, request_id, 1, "Ready to receive chunk list");
+        int ok = dfs_delta_query(client_socket, 1, filepath, size_text, sha256_text, response, sizeof(response)) == 0;
+        printf("Answered chunk list of %s: %s\n", filepath, response);
+        send_response_to_client(client_socket, request_id, ok, response);
+        return;
+    }
+
+    create_path_directories(expanded_path);
+    send_response_to_client(client_socket, request_id, 1, "Ready to receive text file");
+    struct dfs_delta_stats stats;
+    char error_msg[BUFFER_SIZE];
+    if (dfs_delta_apply(client_socket, 1, &stage, size_text, sha256_text, DFS_STAGE_LOCK_WAIT_MS, &stats, error_msg, sizeof(error_msg)) < 0) {
+        snprintf(response, BUFFER_SIZE, "Failed to store text file: %s", error_msg);
+        send_response_to_client(client_socket, request_id, 0, response);
+        return;
+    }
+    printf("Stored %s from %llu of %llu chunks sent (%llu of %llu bytes)\n", filepath, stats.sent_chunks, stats.chunks, stats.sent_bytes, stats.bytes);
+    function_to_compress(filepath, filepath);
+    dfs_index_update(filepath);
+    snprintf(response, BUFFER_SIZE, "Text file %s stored successfully", filename);
+    send_response_to_client(client_socket, request_id, 1, response);
+}
+
+//function to create a tar file of the stext directory and send it to the client
+//the archive is generated while it is sent, so nothing is written to disk
+void function_to_create_tar(int client_socket, uint32_t request_id, const char* options_text) {
+    //options after the file type ask for a compressed or incremental archive, e.g. "gz,since=1700000000"
+    struct dfs_tar_options options;
+    if (dfs_tar_parse_options(options_text, &options) < 0) {
+        send_response_to_client(client_socket, request_id, 0, "Invalid archive options");
+        return;
+    }
+
+    //make sure the stext directory exists
+    struct stat dir_stat;
+    if (stat(STEXT_DIR, &dir_stat) < 0 || !S_ISDIR(dir_stat.st_mode)) {
+        perror("Failed to create tar file");
+        send_response_to_client(client_socket, request_id, 0, "Failed to create tar file");
+        return;
+    }
+
+    //stream the archive; the stream's END frame marks the end of the archive
+    send_response_to_client(client_socket, request_id, 1, "File type accepted");
+
+    //an archive against a manifest is built once the client has sent its manifest
+    char error_msg[DFS_MAX_CONTROL_PAYLOAD];
+    if (options.send_manifest && dfs_tar_recv_manifest(client_socket, &options, error_msg, sizeof(error_msg)) < 0) {
+        printf("Failed to receive manifest: %s\n", error_msg);
+        send_response_to_client(client_socket, request_id, 0, error_msg);
+        return;
+    }
+    struct dfs_tar_summary summary;
+    long long total_bytes_sent = dfs_tar_stream_options(client_socket, request_id, STEXT_DIR, &options, &summary);
+    printf("Total bytes sent: %lld (archive of %lld bytes%s, %ld files, %ld unchanged, %ld deleted)\n", total_bytes_sent,
+           summary.archive_bytes, options.format == DFS_TAR_GZIP ? ", gzip" : "", summary.files, summary.unchanged, summary.deleted);
+    dfs_tar_free_manifest(options.manifest);
+}
+
+//function to display all text files in a specified directory
+void function_to_display_all_files(int client_socket, uint32_t request_id, char* pathname, const char* options_text) {
+    char dirpath[512];
+    
+    //check if the pathname starts with "~/smain"
+    if (strncmp(pathname, "~/smain", 7) == 0) {
+        //replace "~/smain" with STEXT_DIR
+        snprintf(dirpath, sizeof(dirpath), "%s%s", STEXT_DIR, pathname + 7);
+    } else {
+        //if it doesn't start with "~/smain", just append it to STEXT_DIR
+        snprintf(dirpath, sizeof(dirpath), "%s/%s", STEXT_DIR, pathname);
+    }
+
+    //parse the page size, sort order and cursor
+    struct dfs_list_options options;
+    if (dfs_list_parse_options(options_text, &options) < 0) {
+        send_response_to_client(client_socket, request_id, 0, "Invalid display options");
+        return;
+    }
+
+    //stream the names in bounded frames; a page that leaves files out ends with the cursor of the next page
+    send_response_to_client(client_socket, request_id, 1, "Listing text files");
+    long long listed = dfs_list_stream(client_socket, request_id, dirpath, ".txt", &options);
+    printf("Listed %lld files\n", listed);
+}
+
+//function to get the user's home directory
+char* get_home_directory() {
+    const char *homedir = getenv("HOME");
+    return (char*)homedir;
+}
+
+//function to expand the path if it starts with '~'
+void expand_path_for_home(char* expanded_path, const char* path) {
+    if (path[0] == '~') {
+        snprintf(expanded_path, PATH_MAX, "%s%s", get_home_directory(), path + 1);
+    } else {
+        strncpy(expanded_path, path, PATH_MAX);
+    }
+}
+
+//function to replace 'smain' with 'stext' in the path
+void replace_smain_with_stext(char* path) {
+    char *smain_pos = strstr(path, "/smain");
+    if (smain_pos != NULL) {
+        memcpy(smain_pos, "/stext", 6);
+    }
+}
+
+//function to create all necessary directories in the given path
+void create_path_directories(const char* path) {
+    char temp[PATH_MAX];
+    char *p = NULL;
+    int len;
+
+    snprintf(temp, sizeof(temp), "%s", path);
+    len = strlen(temp);
+    if (temp[len - 1] == '/')
+        temp[len - 1] = 0;
+    for (p = temp + 1; *p; p++)
+        if (*p == '/') {
+            *p = 0;
+            mkdir(temp, 0755);
+            *p = '/';
+        }
+    mkdir(temp, 0755);
+}
+
+//function to send a response message to the client as a status frame
+void send_response_to_client(int client_socket, uint32_t request_id, int ok, const char* message) {
+    dfs_send_status(client_socket, request_id, ok, message);
+}
+
+//function to create the file an upload is received into: a hidden file with a unique name next to `filepath`,
+//so concurrent uploads of one path never write into the same inode and readers never see a partial file.
+//it returns the file descriptor, with the name in `temp_path`, or -1 if the operation fails.
+int function_to_open_upload_file(const char* filepath, char* temp_path, size_t capacity) {
+    const char *slash = strrchr(filepath, '/');
+    int dir_length = slash != NULL ? (int)(slash - filepath + 1) : 0;
+    snprintf(temp_path, capacity, "%.*s.%s.XXXXXX", dir_length, filepath, filepath + dir_length);
+    int fd = mkstemp(temp_path);
+    if (fd < 0 || fchmod(fd, 0644) < 0) {
+        perror("Failed to open file");
+        if (fd >= 0) {
+            close(fd);
+            unlink(temp_path);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+//function to rename a received upload over the file it replaces
+int function_to_install_upload(const char* temp_path, const char* filepath) {
+    return rename(temp_path, filepath);
+}
+
+//function to send file content to the client, from `offset` on and `length` bytes long (-1 for the rest of the file).
+//a plain file goes out in zero-copy data frames; a compressed one, or one sent with a codec, in blocks.
+long long send_file_content(int client_socket, uint32_t request_id, struct dfs_chunk_file* file, off_t offset, long long length, int codec) {
+    //a plain file sent uncompressed goes through the thread's ring when the io_uring engine is configured
+    struct dfs_uring *ring = codec == DFS_CODEC_NONE && file->fd >= 0 ? dfs_uring_thread() : NULL;
+    double start = function_to_get_seconds();
+    long long total_bytes_sent = codec != DFS_CODEC_NONE ? dfs_chunk_send_compressed(client_socket, file, offset, length, request_id, codec)
+                                 : ring ? dfs_uring_send_stream(ring, client_socket, file->fd, offset, length, request_id)
+                                        : dfs_chunk_send_stream(client_socket, file, offset, length, request_id);
+    double seconds = function_to_get_seconds() - start;
+
+    printf("Total file bytes sent: %lld (%s, %.1f MB/s)\n", total_bytes_sent, codec != DFS_CODEC_NONE ? "compressed" : ring ? "plain, io_uring" : "plain",
+           seconds > 0 && total_bytes_sent > 0 ? total_bytes_sent / seconds / 1e6 : 0.0);
+    return total_bytes_sent;
+}
+
+//function to turn a stored file, or the private file `source` of an upload to it, into a compressed pack when
+//the server compresses stored files. a file that does not get smaller, or cannot be packed, stays a plain file,
+//so the upload still succeeds.
+void function_to_compress(const char* source, const char* filepath) {
+    if (STEXT_CODEC == DFS_CODEC_NONE) {
+        return;
+    }
+    int packed;
+    unsigned long long raw_size, pack_size;
+    double start = function_to_get_seconds();
+    if (dfs_pack_file(source, STEXT_CODEC, &packed, &raw_size, &pack_size) < 0) {
+        fprintf(stderr, "Failed to compress %s: %s\n", filepath, strerror(errno));
+        return;
+    }
+    double seconds = function_to_get_seconds() - start;
+    if (!packed) {
+        printf("Kept %s uncompressed (%llu bytes)\n", filepath, raw_size);
+        return;
+    }
+    unsigned long long raw_total = __atomic_add_fetch(&compressed_raw_bytes, raw_size, __ATOMIC_RELAXED);
+    unsigned long long stored_total = __atomic_add_fetch(&compressed_stored_bytes, pack_size, __ATOMIC_RELAXED);
+    printf("Compressed %s: %llu to %llu bytes (ratio %.2f, %.1f MB/s); %llu bytes stored for %llu bytes compressed so far\n",
+           filepath, raw_size, pack_size, (double)raw_size / pack_size, seconds > 0 ? raw_size / seconds / 1e6 : 0.0, stored_total, raw_total);
+}
+
+//function to read a monotonic clock in seconds, for throughput reports
+double function_to_get_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//function to receive file content from the client and write it to a file
+long long receive_and_write_file(int client_socket, int fd, char* error_message, size_t error_capacity) {
+    //receive data frames from client and write to file, through the thread's ring with the io_uring engine
+    struct dfs_uring *ring = dfs_uring_thread();
+    long long total_bytes_received = ring ? dfs_uring_recv_stream(ring, client_socket, fd, error_message, error_capacity)
+                                          : dfs_recv_stream_to_fd(client_socket, fd, error_message, error_capacity);
+
+    //print total bytes received and written
+    printf("Total bytes received and written: %lld%s\n", total_bytes_received, ring ? " (io_uring)" : "");
+    return total_bytes_received;
+}
+
+//function to write the metrics of the worker pool, the I/O engine, compression and the stores into a scrape
+void function_to_write_metrics(FILE* out) {
+    struct dfs_pool_stats pool;
+    dfs_pool_get_stats(worker_pool, &pool);
+    dfs_metrics_describe(out, "dfs_pool_workers", "gauge", "Worker threads.");
+    dfs_metrics_print(out, "dfs_pool_workers", "", pool.workers);
+    dfs_metrics_describe(out, "dfs_pool_busy_workers", "gauge", "Worker threads serving a request.");
+    dfs_metrics_print(out, "dfs_pool_busy_workers", "", pool.busy_workers);
+    dfs_metrics_describe(out, "dfs_pool_queue_depth", "gauge", "Connections with a request waiting for a worker.");
+    dfs_metrics_print(out, "dfs_pool_queue_depth", "", pool.queue_depth);
+    dfs_metrics_describe(out, "dfs_pool_queue_depth_max", "gauge", "Most connections that waited for a worker at once.");
+    dfs_metrics_print(out, "dfs_pool_queue_depth_max", "", pool.max_queue_depth);
+    dfs_metrics_describe(out, "dfs_pool_wait_seconds_total", "counter", "Time requests spent waiting for a worker.");
+    dfs_metrics_print(out, "dfs_pool_wait_seconds_total", "", pool.total_wait_us / 1e6);
+
+    struct dfs_uring_stats uring;
+    dfs_uring_get_stats(&uring);
+    dfs_metrics_describe(out, "dfs_uring_submissions_total", "counter", "Operations queued on io_uring rings.");
+    dfs_metrics_print(out, "dfs_uring_submissions_total", "", uring.submissions);
+    dfs_metrics_describe(out, "dfs_uring_enters_total", "counter", "io_uring_enter() calls.");
+    dfs_metrics_print(out, "dfs_uring_enters_total", "", uring.enters);
+
+    struct dfs_compress_stats compress;
+    dfs_compress_get_stats(&compress);
+    dfs_metrics_describe(out, "dfs_compress_in_bytes_total", "counter", "Bytes given to the compressor.");
+    dfs_metrics_print(out, "dfs_compress_in_bytes_total", "", compress.compress_in);
+    dfs_metrics_describe(out, "dfs_compress_out_bytes_total", "counter", "Bytes the compressor produced.");
+    dfs_metrics_print(out, "dfs_compress_out_bytes_total", "", compress.compress_out);
+    dfs_metrics_describe(out, "dfs_decompress_out_bytes_total", "counter", "Bytes the decompressor produced.");
+    dfs_metrics_print(out, "dfs_decompress_out_bytes_total", "", compress.decompress_out);
+
+    dfs_metrics_describe(out, "dfs_stext_stored_raw_bytes_total", "counter", "Bytes of the files stored compressed, before compression.");
+    dfs_metrics_print(out, "dfs_stext_stored_raw_bytes_total", "", __atomic_load_n(&compressed_raw_bytes, __ATOMIC_RELAXED));
+    dfs_metrics_describe(out, "dfs_stext_stored_compressed_bytes_total", "counter", "Bytes of the files stored compressed, after compression.");
+    dfs_metrics_print(out, "dfs_stext_stored_compressed_bytes_total", "", __atomic_load_n(&compressed_stored_bytes, __ATOMIC_RELAXED));
+
+    struct dfs_chunk_store_stats store;
+    dfs_chunk_get_stats(&store);
+    dfs_metrics_describe(out, "dfs_chunk_store_chunks", "gauge", "Chunks in the deduplicating store.");
+    dfs_metrics_print(out, "dfs_chunk_store_chunks", "", store.chunks);
+    dfs_metrics_describe(out, "dfs_chunk_store_bytes", "gauge", "Bytes of the chunks in the store.");
+    dfs_metrics_print(out, "dfs_chunk_store_bytes", "", store.stored_bytes);
+    dfs_metrics_describe(out, "dfs_chunk_store_referenced_bytes", "gauge", "Bytes of the files built from the chunks.");
+    dfs_metrics_print(out, "dfs_chunk_store_referenced_bytes", "", store.referenced_bytes);
+
+    struct dfs_index_stats index;
+    dfs_index_get_stats(&index);
+    dfs_metrics_describe(out, "dfs_index_files", "gauge", "Files in the metadata index.");
+    dfs_metrics_print(out, "dfs_index_files", "", index.files);
+    dfs_metrics_describe(out, "dfs_index_bytes", "gauge", "Bytes of the files in the metadata index.");
+    dfs_metrics_print(out, "dfs_index_bytes", "", index.bytes);
+}
@@ -0,0 +1,692 @@
+//bench24s.c
+//this program is a load generator for the file system. it runs many simulated clients at once, each on its
+//own connection to Smain, and drives them through a weighted mix of ufile, dfile, display, dtar and rmfile
+//requests on files of the chosen types and sizes. it speaks the same protocol as client24s, but keeps file
+//data in memory and throws downloads away, so the client side costs as little as possible.
+//at the end it prints, per command and in total, the operations and errors, ops/s, MB/s and the mean, p50,
+//p99, p999 and maximum latency as JSON (or CSV) on stdout; progress goes to stderr.
+//usage: bench24s [clients=N] [duration=S | requests=N] [mix=ufile:1,dfile:4,display:1] [types=.txt,.pdf,.c]
+//                [sizes=4K,64K,1M] [files=N] [dir=~/smain/bench] [output=json|csv] [cleanup=0|1]
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dfs_frame.h"
+#include "dfs_config.h"
+
+#define BUFFER_SIZE 1024
+//most clients, file types and sizes a run takes
+#define MAX_CLIENTS 1024
+#define MAX_TYPES 3
+#define MAX_SIZES 16
+
+//commands the mix is made of
+enum bench_command {
+    BENCH_UFILE,
+    BENCH_DFILE,
+    BENCH_DISPLAY,
+    BENCH_DTAR,
+    BENCH_RMFILE,
+    BENCH_COMMANDS
+};
+static const char *command_names[BENCH_COMMANDS] = {"ufile", "dfile", "display", "dtar", "rmfile"};
+
+//results of one command on one client; the latencies are kept to compute percentiles
+struct bench_result {
+    unsigned long long ops;
+    unsigned long long errors;
+    unsigned long long bytes;
+    unsigned int *latencies_us;
+    size_t count;
+    size_t capacity;
+};
+
+//settings of a run
+struct bench_settings {
+    int clients;
+    double duration;
+    long requests;             //per client; 0 runs for `duration` seconds
+    int weights[BENCH_COMMANDS];
+    char types[MAX_TYPES][8];
+    int type_count;
+    unsigned long long sizes[MAX_SIZES];
+    int size_count;
+    int files;                 //files of every type and size uploaded before the run for dfile to fetch
+    char dir[256];
+    int csv;
+    int cleanup;
+};
+
+//one simulated client
+struct bench_client {
+    int id;
+    int sockfd;
+    unsigned int seed;
+    struct bench_result results[BENCH_COMMANDS];
+    pthread_barrier_t *barrier;
+};
+
+static struct bench_settings settings;
+static const unsigned char *file_data;   //contents of every uploaded file, as long as the largest size
+static volatile int stop_clients;
+
+//function prototypes
+int function_to_parse_settings(int argc, char* argv[]);
+int function_to_parse_sizes(const char* text, unsigned long long* values, int capacity);
+int function_to_parse_mix(const char* text);
+int function_for_server_connection(void);
+unsigned long long function_to_get_time_us(void);
+int function_to_request(int sockfd, uint8_t opcode, const char* arg1, const char* arg2, char* response, size_t capacity);
+int function_to_upload(int sockfd, const char* name, const char* destination, unsigned long long size);
+long long function_to_download(int sockfd, const char* path);
+long long function_to_display(int sockfd, const char* path);
+long long function_to_dtar(int sockfd, const char* type);
+int function_to_remove(int sockfd, const char* path);
+int function_to_setup(int sockfd);
+void function_to_cleanup(int sockfd);
+void* function_to_run_client(void* arg);
+long long function_to_run_command(struct bench_client* client, enum bench_command command);
+void function_to_record(struct bench_result* result, unsigned long long latency_us, long long bytes);
+void function_to_merge(struct bench_result* total, const struct bench_result* part);
+void function_to_report(struct bench_client* clients, double seconds);
+void function_to_print_result(const char* name, struct bench_result* result, double seconds, int first);
+int function_to_compare_latency(const void* a, const void* b);
+
+//main function: Uploads the files dfile fetches, runs the clients and prints the report.
+int main(int argc, char* argv[]) {
+    if (dfs_config_load("bench24s") < 0) {
+        fprintf(stderr, "Ignoring the configuration file\n");
+    }
+    if (function_to_parse_settings(argc, argv) < 0) {
+        fprintf(stderr, "usage: %s [clients=N] [duration=S | requests=N] [mix=ufile:1,dfile:4,display:1] [types=.txt,.pdf,.c] "
+                        "[sizes=4K,64K,1M] [files=N] [dir=~/smain/bench] [output=json|csv] [cleanup=0|1]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    //every upload sends a prefix of one buffer of varying bytes
+    unsigned long long largest = 0;
+    for (int i = 0; i < settings.size_count; i++) {
+        largest = settings.sizes[i] > largest ? settings.sizes[i] : largest;
+    }
+    unsigned char *data = malloc(largest > 0 ? largest : 1);
+    if (!data) {
+        perror("Failed to allocate file data");
+        return EXIT_FAILURE;
+    }
+    unsigned int seed = 12345;
+    for (unsigned long long i = 0; i < largest; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+    file_data = data;
+
+    int setup_socket = function_for_server_connection();
+    if (setup_socket < 0) {
+        return EXIT_FAILURE;
+    }
+    if (function_to_setup(setup_socket) < 0) {
+        close(setup_socket);
+        return EXIT_FAILURE;
+    }
+
+    static struct bench_client clients[MAX_CLIENTS];
+    pthread_t threads[MAX_CLIENTS];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, settings.clients + 1);
+    int started = 0;
+    for (; started < settings.clients; started++) {
+        struct bench_client *client = &clients[started];
+        client->id = started;
+        client->seed = 1 + started * 7919;
+        client->barrier = &barrier;
+        client->sockfd = function_for_server_connection();
+        if (client->sockfd < 0) {
+            break;
+        }
+    }
+    if (started < settings.clients) {
+        fprintf(stderr, "Connected %d of %d clients\n", started, settings.clients);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < settings.clients; i++) {
+        pthread_create(&threads[i], NULL, function_to_run_client, &clients[i]);
+    }
+
+    fprintf(stderr, "Running %d clients %s\n", settings.clients, settings.requests > 0 ? "for a fixed number of requests" : "for a fixed time");
+    pthread_barrier_wait(&barrier);
+    unsigned long long started_us = function_to_get_time_us();
+    if (settings.requests == 0) {
+        struct timespec duration;
+        duration.tv_sec = (time_t)settings.duration;
+        duration.tv_nsec = (long)((settings.duration - duration.tv_sec) * 1e9);
+        while (nanosleep(&duration, &duration) < 0 && errno == EINTR) {
+        }
+        stop_clients = 1;
+    }
+    for (int i = 0; i < settings.clients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = (function_to_get_time_us() - started_us) / 1e6;
+    pthread_barrier_destroy(&barrier);
+
+    function_to_report(clients, seconds);
+    for (int i = 0; i < settings.clients; i++) {
+        close(clients[i].sockfd);
+    }
+    if (settings.cleanup) {
+        function_to_cleanup(setup_socket);
+    }
+    close(setup_socket);
+    free(data);
+    return EXIT_SUCCESS;
+}
+
+//function to read the key=value arguments into the settings. returns 0, or -1 if an argument is invalid.
+int function_to_parse_settings(int argc, char* argv[]) {
+    settings.clients = 8;
+    settings.duration = 10;
+    settings.weights[BENCH_UFILE] = 1;
+    settings.weights[BENCH_DFILE] = 4;
+    settings.weights[BENCH_DISPLAY] = 1;
+    snprintf(settings.types[0], sizeof(settings.types[0]), ".txt");
+    snprintf(settings.types[1], sizeof(settings.types[1]), ".pdf");
+    snprintf(settings.types[2], sizeof(settings.types[2]), ".c");
+    settings.type_count = 3;
+    settings.sizes[0] = 4096;
+    settings.sizes[1] = 65536;
+    settings.sizes[2] = 1048576;
+    settings.size_count = 3;
+    settings.files = 4;
+    snprintf(settings.dir, sizeof(settings.dir), "~/smain/bench");
+    settings.cleanup = 1;
+
+    for (int i = 1; i < argc; i++) {
+        char *value = strchr(argv[i], '=');
+        if (!value) {
+            return -1;
+        }
+        size_t key_length = value - argv[i];
+        value++;
+        if (strncmp(argv[i], "clients", key_length) == 0 && key_length == 7) {
+            settings.clients = atoi(value);
+            if (settings.clients < 1 || settings.clients > MAX_CLIENTS) {
+                return -1;
+            }
+        } else if (strncmp(argv[i], "duration", key_length) == 0 && key_length == 8) {
+            settings.duration = atof(value);
+            if (settings.duration <= 0) {
+                return -1;
+            }
+        } else if (strncmp(argv[i], "requests", key_length) == 0 && key_length == 8) {
+            settings.requests = atol(value);
+            if (settings.requests < 1) {
+                return -1;
+            }
+        } else if (strncmp(argv[i], "mix", key_length) == 0 && key_length == 3) {
+            if (function_to_parse_mix(value) < 0) {
+                return -1;
+            }
+        } else if (strncmp(argv[i], "types", key_length) == 0 && key_length == 5) {
+            settings.type_count = 0;
+            char list[BUFFER_SIZE];
+            snprintf(list, sizeof(list), "%s", value);
+            for (char *save, *type = strtok_r(list, ",", &save); type; type = strtok_r(NULL, ",", &save)) {
+                if (settings.type_count == MAX_TYPES || (strcmp(type, ".txt") != 0 && strcmp(type, ".pdf") != 0 && strcmp(type, ".c") != 0)) {
+                    return -1;
+                }
+                snprintf(settings.types[settings.type_count++], sizeof(settings.types[0]), "%s", type);
+            }
+            if (settings.type_count == 0) {
+                return -1;
+            }
+        } else if (strncmp(argv[i], "sizes", key_length) == 0 && key_length == 5) {
+            settings.size_count = function_to_parse_sizes(value, settings.sizes, MAX_SIZES);
+            if (settings.size_count <= 0) {
+                return -1;
+            }
+        } else if (strncmp(argv[i], "files", key_length) == 0 && key_length == 5) {
+            settings.files = atoi(value);
+            if (settings.files < 1) {
+                return -1;
+            }
+        } else if (strncmp(argv[i], "dir", key_length) == 0 && key_length == 3) {
+            if (strncmp(value, "~/smain", 7) != 0) {
+                return -1;
+            }
+            snprintf(settings.dir, sizeof(settings.dir), "%s", value);
+        } else if (strncmp(argv[i], "output", key_length) == 0 && key_length == 6) {
+            if (strcmp(value, "csv") != 0 && strcmp(value, "json") != 0) {
+                return -1;
+            }
+            settings.csv = strcmp(value, "csv") == 0;
+        } else if (strncmp(argv[i], "cleanup", key_length) == 0 && key_length == 7) {
+            settings.cleanup = atoi(value) != 0;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//function to parse a comma-separated list of sizes, which may end in K, M or G.
+//returns the number of sizes, or -1 if the list is invalid.
+int function_to_parse_sizes(const char* text, unsigned long long* values, int capacity) {
+    int count = 0;
+    const char *p = text;
+    while (*p) {
+        char *end;
+        errno = 0;
+        unsigned long long value = strtoull(p, &end, 10);
+        if (errno != 0 || end == p || count == capacity) {
+            return -1;
+        }
+        if (*end == 'K' || *end == 'k') {
+            value <<= 10;
+            end++;
+        } else if (*end == 'M' || *end == 'm') {
+            value <<= 20;
+            end++;
+        } else if (*end == 'G' || *end == 'g') {
+            value <<= 30;
+            end++;
+        }
+        if (*end != ',' && *end != '\0') {
+            return -1;
+        }
+        values[count++] = value;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+//function to parse the command mix, e.g. "ufile:1,dfile:4,dtar:0"; commands left out get no requests.
+//returns 0, or -1 if the mix is invalid or has no requests at all.
+int function_to_parse_mix(const char* text) {
+    char list[BUFFER_SIZE];
+    snprintf(list, sizeof(list), "%s", text);
+    memset(settings.weights, 0, sizeof(settings.weights));
+    int sum = 0;
+    for (char *save, *item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char *colon = strchr(item, ':');
+        int weight = colon ? atoi(colon + 1) : 1;
+        if (colon) {
+            *colon = '\0';
+        }
+        int found = -1;
+        for (int c = 0; c < BENCH_COMMANDS; c++) {
+            if (strcmp(item, command_names[c]) == 0) {
+                found = c;
+            }
+        }
+        if (found < 0 || weight < 0) {
+            return -1;
+        }
+        settings.weights[found] = weight;
+        sum += weight;
+    }
+    return sum > 0 ? 0 : -1;
+}
+
+//function to establish a connection with Smain
+int function_for_server_connection(void) {
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        perror("socket creation failed");
+        return -1;
+    }
+    dfs_config_tune_socket(sockfd);
+    struct sockaddr_in servaddr;
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_port = htons(dfs_config_net()->smain_port);
+    inet_pton(AF_INET, "127.0.0.1", &servaddr.sin_addr);
+    if (connect(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        perror("Connection Failed");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+//function to read a monotonic clock in microseconds
+unsigned long long function_to_get_time_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+//function to send a request and read its status. returns 1 if it was accepted, 0 if it was rejected (the reason
+//is in `response`) and -1 if the connection failed.
+int function_to_request(int sockfd, uint8_t opcode, const char* arg1, const char* arg2, char* response, size_t capacity) {
+    struct dfs_frame reply;
+    uint32_t request_id = dfs_next_request_id();
+    if (dfs_send_request(sockfd, opcode, request_id, arg1, arg2) < 0 ||
+        dfs_recv_control(sockfd, &reply, response, capacity) < 0 || reply.opcode != DFS_OP_STATUS) {
+        return -1;
+    }
+    return (reply.flags & DFS_FLAG_ERROR) ? 0 : 1;
+}
+
+//function to upload `size` bytes of the file data as `name` into `destination`.
+//returns 1 once the server stored the file, 0 if it refused it and -1 if the connection failed.
+int function_to_upload(int sockfd, const char* name, const char* destination, unsigned long long size) {
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    uint32_t request_id = dfs_next_request_id();
+    if (dfs_send_request(sockfd, DFS_OP_UFILE, request_id, name, destination) < 0 ||
+        dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+        return -1;
+    }
+    if (reply.flags & DFS_FLAG_ERROR) {
+        return 0;
+    }
+    unsigned long long sent = 0;
+    size_t chunk_size = dfs_data_chunk_size();
+    while (sent < size) {
+        uint32_t chunk = size - sent < chunk_size ? size - sent : chunk_size;
+        if (dfs_send_frame(sockfd, DFS_OP_DATA, 0, request_id, file_data + sent, chunk) < 0) {
+            return -1;
+        }
+        sent += chunk;
+    }
+    if (dfs_send_frame(sockfd, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0 ||
+        dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+        return -1;
+    }
+    return (reply.flags & DFS_FLAG_ERROR) ? 0 : 1;
+}
+
+//function to download a file and discard it. returns the bytes received, or -1 (rejected) or -2 (connection).
+long long function_to_download(int sockfd, const char* path) {
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    int accepted = function_to_request(sockfd, DFS_OP_DFILE, path, NULL, response, sizeof(response));
+    if (accepted <= 0) {
+        return accepted < 0 ? -2 : -1;
+    }
+    long long bytes = dfs_recv_stream_to_fd(sockfd, -1, response, sizeof(response));
+    return bytes < 0 ? -2 : bytes;
+}
+
+//function to list a directory, following the pages until the listing is complete.
+//returns the bytes of names received, or -1 (rejected) or -2 (connection).
+long long function_to_display(int sockfd, const char* path) {
+    char payload[DFS_MAX_CONTROL_PAYLOAD];
+    char options[DFS_MAX_CONTROL_PAYLOAD];
+    char cursor[DFS_MAX_CONTROL_PAYLOAD] = "";
+    long long bytes = 0;
+    while (1) {
+        if (cursor[0]) {
+            snprintf(options, sizeof(options), "after=%s", cursor);
+        }
+        int accepted = function_to_request(sockfd, DFS_OP_DISPLAY, path, cursor[0] ? options : NULL, payload, sizeof(payload));
+        if (accepted <= 0) {
+            return accepted < 0 ? -2 : -1;
+        }
+        cursor[0] = '\0';
+        struct dfs_frame frame;
+        while (1) {
+            if (dfs_recv_control(sockfd, &frame, payload, sizeof(payload)) < 0) {
+                return -2;
+            }
+            if (frame.opcode == DFS_OP_STATUS) {
+                //the server aborted the listing
+                return -1;
+            }
+            if (frame.flags & DFS_FLAG_CURSOR) {
+                snprintf(cursor, sizeof(cursor), "%s", payload);
+            } else {
+                bytes += frame.length;
+            }
+            if (frame.flags & DFS_FLAG_END) {
+                break;
+            }
+        }
+        if (cursor[0] == '\0') {
+            return bytes;
+        }
+    }
+}
+
+//function to fetch the archive of a file type and discard it. returns its bytes, or -1 (rejected) or -2.
+long long function_to_dtar(int sockfd, const char* type) {
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    int accepted = function_to_request(sockfd, DFS_OP_DTAR, type, NULL, response, sizeof(response));
+    if (accepted <= 0) {
+        return accepted < 0 ? -2 : -1;
+    }
+    long long bytes = dfs_recv_stream_to_fd(sockfd, -1, response, sizeof(response));
+    return bytes < 0 ? -2 : bytes;
+}
+
+//function to remove a file. returns 1, 0 if the server refused and -1 if the connection failed.
+int function_to_remove(int sockfd, const char* path) {
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    return function_to_request(sockfd, DFS_OP_RMFILE, path, NULL, response, sizeof(response));
+}
+
+//function to upload the files dfile fetches: `files` copies of every type and size
+int function_to_setup(int sockfd) {
+    if (settings.weights[BENCH_DFILE] == 0) {
+        return 0;
+    }
+    fprintf(stderr, "Uploading %d files\n", settings.files * settings.type_count * settings.size_count);
+    for (int t = 0; t < settings.type_count; t++) {
+        for (int s = 0; s < settings.size_count; s++) {
+            for (int f = 0; f < settings.files; f++) {
+                char name[BUFFER_SIZE];
+                snprintf(name, sizeof(name), "f%llu-%d%s", settings.sizes[s], f, settings.types[t]);
+                if (function_to_upload(sockfd, name, settings.dir, settings.sizes[s]) != 1) {
+                    fprintf(stderr, "Failed to upload %s to %s\n", name, settings.dir);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+//function to remove the files of the run: the setup files and every file a client may have uploaded
+void function_to_cleanup(int sockfd) {
+    char path[BUFFER_SIZE];
+    for (int t = 0; t < settings.type_count; t++) {
+        for (int s = 0; s < settings.size_count; s++) {
+            for (int f = 0; f < settings.files && settings.weights[BENCH_DFILE] > 0; f++) {
+                snprintf(path, sizeof(path), "%s/f%llu-%d%s", settings.dir, settings.sizes[s], f, settings.types[t]);
+                function_to_remove(sockfd, path);
+            }
+            for (int c = 0; c < settings.clients && settings.weights[BENCH_UFILE] > 0; c++) {
+                snprintf(path, sizeof(path), "%s/u%d-%llu%s", settings.dir, c, settings.sizes[s], settings.types[t]);
+                function_to_remove(sockfd, path);
+            }
+        }
+    }
+}
+
+//function run by every client thread: picks commands by weight until the run ends
+void* function_to_run_client(void* arg) {
+    struct bench_client *client = arg;
+    int total_weight = 0;
+    for (int c = 0; c < BENCH_COMMANDS; c++) {
+        total_weight += settings.weights[c];
+    }
+    pthread_barrier_wait(client->barrier);
+    for (long done = 0; settings.requests > 0 ? done < settings.requests : !stop_clients; done++) {
+        int pick = rand_r(&client->seed) % total_weight;
+        enum bench_command command = BENCH_UFILE;
+        while (pick >= settings.weights[command]) {
+            pick -= settings.weights[command];
+            command++;
+        }
+        unsigned long long started_us = function_to_get_time_us();
+        long long bytes = function_to_run_command(client, command);
+        function_to_record(&client->results[command], function_to_get_time_us() - started_us, bytes);
+
+        //a broken connection is replaced, as client24s does
+        if (bytes == -2) {
+            close(client->sockfd);
+            client->sockfd = function_for_server_connection();
+            if (client->sockfd < 0) {
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+//function to run one command on a random file. returns the bytes it moved, -1 if the server refused it and
+//-2 if the connection failed.
+long long function_to_run_command(struct bench_client* client, enum bench_command command) {
+    const char *type = settings.types[rand_r(&client->seed) % settings.type_count];
+    int size_index = rand_r(&client->seed) % settings.size_count;
+    unsigned long long size = settings.sizes[size_index];
+    char path[BUFFER_SIZE];
+    switch (command) {
+        case BENCH_UFILE: {
+            //every client overwrites its own file of each type and size
+            char name[BUFFER_SIZE];
+            snprintf(name, sizeof(name), "u%d-%llu%s", client->id, size, type);
+            int stored = function_to_upload(client->sockfd, name, settings.dir, size);
+            return stored == 1 ? (long long)size : stored == 0 ? -1 : -2;
+        }
+        case BENCH_DFILE:
+            snprintf(path, sizeof(path), "%s/f%llu-%d%s", settings.dir, size, rand_r(&client->seed) % settings.files, type);
+            return function_to_download(client->sockfd, path);
+        case BENCH_DISPLAY:
+            return function_to_display(client->sockfd, settings.dir);
+        case BENCH_DTAR:
+            return function_to_dtar(client->sockfd, type);
+        case BENCH_RMFILE: {
+            //removes the client's own upload, which a later ufile puts back; a missing file counts as an error
+            snprintf(path, sizeof(path), "%s/u%d-%llu%s", settings.dir, client->id, size, type);
+            int removed = function_to_remove(client->sockfd, path);
+            return removed == 1 ? 0 : removed == 0 ? -1 : -2;
+        }
+        default:
+            return -1;
+    }
+}
+
+//function to add one operation to a result
+void function_to_record(struct bench_result* result, unsigned long long latency_us, long long bytes) {
+    result->ops++;
+    if (bytes < 0) {
+        result->errors++;
+        return;
+    }
+    result->bytes += bytes;
+    if (result->count == result->capacity) {
+        size_t capacity = result->capacity ? result->capacity * 2 : 1024;
+        unsigned int *latencies = realloc(result->latencies_us, capacity * sizeof(*latencies));
+        if (!latencies) {
+            return;
+        }
+        result->latencies_us = latencies;
+        result->capacity = capacity;
+    }
+    result->latencies_us[result->count++] = latency_us > 0xFFFFFFFFu ? 0xFFFFFFFFu : (unsigned int)latency_us;
+}
+
+//function to add the operations of one client to a total
+void function_to_merge(struct bench_result* total, const struct bench_result* part) {
+    total->ops += part->ops;
+    total->errors += part->errors;
+    total->bytes += part->bytes;
+    if (part->count == 0) {
+        return;
+    }
+    unsigned int *latencies = realloc(total->latencies_us, (total->count + part->count) * sizeof(*latencies));
+    if (!latencies) {
+        return;
+    }
+    memcpy(latencies + total->count, part->latencies_us, part->count * sizeof(*latencies));
+    total->latencies_us = latencies;
+    total->count += part->count;
+    total->capacity = total->count;
+}
+
+int function_to_compare_latency(const void* a, const void* b) {
+    unsigned int x = *(const unsigned int*)a;
+    unsigned int y = *(const unsigned int*)b;
+    return x < y ? -1 : x > y;
+}
+
+//function to print the results of all clients, per command and in total
+void function_to_report(struct bench_client* clients, double seconds) {
+    struct bench_result totals[BENCH_COMMANDS + 1];
+    memset(totals, 0, sizeof(totals));
+    for (int i = 0; i < settings.clients; i++) {
+        for (int c = 0; c < BENCH_COMMANDS; c++) {
+            function_to_merge(&totals[c], &clients[i].results[c]);
+            function_to_merge(&totals[BENCH_COMMANDS], &clients[i].results[c]);
+            free(clients[i].results[c].latencies_us);
+        }
+    }
+
+    if (settings.csv) {
+        printf("command,ops,errors,ops_per_s,mb_per_s,bytes,mean_us,p50_us,p99_us,p999_us,max_us\n");
+    } else {
+        printf("{\"clients\": %d, \"seconds\": %.3f, \"mix\": {", settings.clients, seconds);
+        for (int c = 0, first = 1; c < BENCH_COMMANDS; c++) {
+            if (settings.weights[c] > 0) {
+                printf("%s\"%s\": %d", first ? "" : ", ", command_names[c], settings.weights[c]);
+                first = 0;
+            }
+        }
+        printf("}, \"commands\": [");
+    }
+    for (int c = 0, first = 1; c < BENCH_COMMANDS; c++) {
+        if (totals[c].ops > 0) {
+            function_to_print_result(command_names[c], &totals[c], seconds, first);
+            first = 0;
+        }
+        free(totals[c].latencies_us);
+    }
+    if (!settings.csv) {
+        printf("], \"total\": ");
+    }
+    function_to_print_result("total", &totals[BENCH_COMMANDS], seconds, 1);
+    free(totals[BENCH_COMMANDS].latencies_us);
+    if (!settings.csv) {
+        printf("}\n");
+    }
+}
+
+//function to print one result as a CSV row or a JSON object; percentiles count successful operations only
+void function_to_print_result(const char* name, struct bench_result* result, double seconds, int first) {
+    unsigned long long sum = 0;
+    unsigned int p50 = 0, p99 = 0, p999 = 0, max = 0;
+    if (result->count > 0) {
+        qsort(result->latencies_us, result->count, sizeof(unsigned int), function_to_compare_latency);
+        for (size_t i = 0; i < result->count; i++) {
+            sum += result->latencies_us[i];
+        }
+        //nearest rank: the smallest latency at least the given share of operations did not exceed
+        size_t n = result->count;
+        p50 = result->latencies_us[(n * 500 + 999) / 1000 - 1];
+        p99 = result->latencies_us[(n * 990 + 999) / 1000 - 1];
+        p999 = result->latencies_us[(n * 999 + 999) / 1000 - 1];
+        max = result->latencies_us[n - 1];
+    }
+    double mean = result->count > 0 ? (double)sum / result->count : 0.0;
+    double ops_per_s = seconds > 0 ? result->ops / seconds : 0.0;
+    double mb_per_s = seconds > 0 ? result->bytes / seconds / 1e6 : 0.0;
+    if (settings.csv) {
+        printf("%s,%llu,%llu,%.1f,%.2f,%llu,%.0f,%u,%u,%u,%u\n", name, result->ops, result->errors, ops_per_s, mb_per_s,
+               result->bytes, mean, p50, p99, p999, max);
+    } else {
+        printf("%s{\"command\": \"%s\", \"ops\": %llu, \"errors\": %llu, \"ops_per_s\": %.1f, \"mb_per_s\": %.2f, \"bytes\": %llu, "
+               "\"latency_us\": {\"mean\": %.0f, \"p50\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u}}",
+               first ? "" : ", ", name, result->ops, result->errors, ops_per_s, mb_per_s, result->bytes, mean, p50, p99, p999, max);
+    }
+}
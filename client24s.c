@@ -1,351 +1,1261 @@
-//client24s.c
-//this program implements a client for interacting with the Smain server.
-//it allows users to send various file-related commands and handle the responses.
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#include <dirent.h>
-#include <errno.h>
-
-#define PORT 3001
-#define BUFFER_SIZE 1024
-
-//function prototypes
-int function_for_server_connection();
-int function_to_send_socket_command(int sockfd, const char* command);
-int function_to_validate_command(const char* command);
-void function_to_handle_ufile(int sockfd, const char* filename);
-void function_to_handle_dfile(int sockfd, const char* filename);
-void function_to_handle_remove(int sockfd);
-void function_to_handle_dtar(int sockfd, const char* filetype);
-void function_to_handle_display(int sockfd);
-
-//main function: Handles user input and directs program flow
-int main() {
-    //establish connection to the server
-    int sockfd = function_for_server_connection();
-    if (sockfd < 0) {
-        fprintf(stderr, "Failed to connect to server\n");
-        return 1;
-    }
-
-    printf("Connected to Smain server. Enter commands:\n");
-
-    //main loop for handling user commands
-    char command[BUFFER_SIZE];
-    while (1) {
-        printf("> ");
-        if (fgets(command, BUFFER_SIZE, stdin) == NULL) {
-            break;
-        }
-        //remove newline
-        command[strcspn(command, "\n")] = 0;
-
-        //check for exit command
-        if (strcmp(command, "exit") == 0) {
-            break;
-        }
-
-        //validate and process the command
-        if (function_to_validate_command(command)) {
-            char cmd[10], arg1[256], arg2[256];
-            sscanf(command, "%s %s %s", cmd, arg1, arg2);
-
-            //send command to server
-            if (function_to_send_socket_command(sockfd, command) < 0) {
-                fprintf(stderr, "Failed to send command\n");
-                close(sockfd);
-                sockfd = function_for_server_connection();
-                if (sockfd < 0) {
-                    fprintf(stderr, "Failed to reconnect to server\n");
-                    exit(1);
-                }
-                continue;
-            }
-
-            //wait for server response
-            char response[BUFFER_SIZE];
-            int bytes_received = recv(sockfd, response, BUFFER_SIZE - 1, 0);
-            if (bytes_received <= 0) {
-                fprintf(stderr, "Failed to receive server response\n");
-                continue;
-            }
-            response[bytes_received] = '\0';
-
-            //check if server accepted the file
-            if (strstr(response, "Invalid file type") != NULL) {
-                printf("Server rejected file: %s\n", response);
-                continue;
-            }
-            
-            //handle different types of commands
-            if (strcmp(cmd, "ufile") == 0) {
-                function_to_handle_ufile(sockfd, arg1);
-            } else if (strcmp(cmd, "dfile") == 0) {
-                function_to_handle_dfile(sockfd, arg1);
-            } else if (strcmp(cmd, "dtar") == 0) {
-                function_to_handle_dtar(sockfd, arg1);
-            } else if (strcmp(cmd, "rmfile") == 0) {
-                function_to_handle_remove(sockfd);
-            } else {
-                function_to_handle_display(sockfd);
-            }
-        } else {
-            printf("Invalid command. Please try again.\n");
-        }
-    }
-
-    close(sockfd);
-    return 0;
-}
-
-//function to establish a connection with the server
-int function_for_server_connection() {
-    int sockfd;
-    struct sockaddr_in servaddr;
-
-    //create socket
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket creation failed");
-        return -1;
-    }
-
-    //clear buffer
-    memset(&servaddr, 0, sizeof(servaddr));
-
-    //assign IP and PORT
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_port = htons(PORT);
-
-    //convert IPv4 and IPv6 addresses from text to binary form
-    if (inet_pton(AF_INET, "127.0.0.1", &servaddr.sin_addr) <= 0) {
-        perror("Invalid address/ Address not supported");
-        return -1;
-    }
-
-    //connect to the server
-    if (connect(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-        perror("Connection Failed");
-        return -1;
-    }
-
-    return sockfd;
-}
-
-//function to send a command to the server
-int function_to_send_socket_command(int sockfd, const char* command) {
-    if (send(sockfd, command, strlen(command), 0) < 0) {
-        perror("Send failed");
-        return -1;
-    }
-    return 0;
-}
-
-//function to validate user input commands
-int function_to_validate_command(const char* command) {
-    char cmd[10];
-    char arg1[256];
-    char arg2[256];
-
-    int parsed = sscanf(command, "%s %s %s", cmd, arg1, arg2);
-
-    if (parsed < 1) {
-        return 0;
-    }
-
-    //check for valid commands and their required number of arguments
-    if (strcmp(cmd, "ufile") == 0) {
-        return (parsed == 3 && (strncmp(arg2, "~/smain", 7) == 0));
-    } else if (strcmp(cmd, "dfile") == 0 || strcmp(cmd, "rmfile") == 0 || strcmp(cmd, "display") == 0) {
-        return (parsed == 2 && (strncmp(arg1, "~/smain", 7) == 0));
-    } else if (strcmp(cmd, "dtar") == 0) {
-        return (parsed == 2);
-    }
-
-    return 0;
-}
-
-//function to handle uploading a file to the server
-void function_to_handle_ufile(int sockfd, const char* filename) {
-    //open and send the file
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Failed to open file");
-        return;
-    }
-
-    char buffer[BUFFER_SIZE];
-    size_t bytes_read;
-    size_t total_bytes_sent = 0;
-    do {
-        //read from file and send to server
-        bytes_read = fread(buffer, 1, BUFFER_SIZE, file);
-        if (bytes_read > 0) {
-            if (send(sockfd, buffer, bytes_read, 0) < 0) {
-                perror("Failed to send file data");
-                fclose(file);
-                return;
-            }
-            total_bytes_sent += bytes_read;
-        }
-    } while (bytes_read > 0);
-
-    fclose(file);
-    printf("File sent successfully. Total bytes sent: %zu\n", total_bytes_sent);
-
-    //send an empty packet to signal end of file
-    send(sockfd, "", 0, 0);
-}
-
-//function to handle downloading a file from the server
-void function_to_handle_dfile(int sockfd, const char* filename) {
-    char buffer[BUFFER_SIZE];
-    int bytes_received;
-
-    //extract the base filename
-    const char *basename = strrchr(filename, '/');
-    basename = basename ? basename + 1 : filename;
-
-    //open file for writing
-    FILE *file = fopen(basename, "wb");
-    if (!file) {
-        perror("Failed to create file");
-        return;
-    }
-
-    int total_bytes = 0;
-    while ((bytes_received = recv(sockfd, buffer, BUFFER_SIZE, 0)) > 0) {
-        //write received data to file
-        size_t bytes_written = fwrite(buffer, 1, bytes_received, file);
-        if (bytes_written < bytes_received) {
-            perror("Failed to write to file");
-            fclose(file);
-            return;
-        }
-        total_bytes += bytes_written;
-        
-        //check if this is the end of the file
-        if (bytes_received < BUFFER_SIZE) {
-            break;
-        }
-    }
-
-    fclose(file);
-
-    //print appropriate message based on the response
-    if (bytes_received < 0) {
-        perror("Error receiving file data");
-    } else if (total_bytes > 0) {
-        printf("File received and saved as: %s\n", basename);
-    } else {
-        printf("No data received.\n");
-    }
-}
-
-//function to handle removing a file from the server
-void function_to_handle_remove(int sockfd) {
-    char buffer[BUFFER_SIZE];
-    //get response from server regarding the working of command
-    int bytes_received = recv(sockfd, buffer, BUFFER_SIZE - 1, 0);
-    
-    //print appropriate message based on the server response
-    if (bytes_received > 0) {
-        buffer[bytes_received] = '\0';
-        printf("Server response: %s\n", buffer);
-    } else if (bytes_received == 0) {
-        printf("Server closed the connection\n");
-    } else {
-        perror("Error receiving response from server");
-    }
-}
-
-//function to handle downloading a tar file from the server
-void function_to_handle_dtar(int sockfd, const char* filetype) {
-    printf("Receiving tar file...\n");
-    char buffer[BUFFER_SIZE];
-    int bytes_received;
-    
-    //create filename for the tar file
-    char full_filename[256];
-    snprintf(full_filename, sizeof(full_filename), "%sfiles.tar", filetype + 1);
-    
-    //open file for writing
-    FILE* file = fopen(full_filename, "wb");
-    if (file == NULL) {
-        perror("Failed to create tar file");
-        return;
-    }
-    
-    size_t total_bytes = 0;
-    while (1) {
-        bytes_received = recv(sockfd, buffer, BUFFER_SIZE, 0);
-        //error or connection closed
-        if (bytes_received <= 0) {
-            break;
-        }
-        
-        //check for EOF marker
-        if (bytes_received >= 4 && memcmp(buffer + bytes_received - 4, "EOF\n", 4) == 0) {
-            //dont write the EOF marker to the file
-            bytes_received -= 4;
-            fwrite(buffer, 1, bytes_received, file);
-            total_bytes += bytes_received;
-            //end of file reached
-            break;
-        }
-        
-        //write received data to file
-        size_t bytes_written = fwrite(buffer, 1, bytes_received, file);
-        if (bytes_written < bytes_received) {
-            perror("Failed to write to tar file");
-            fclose(file);
-            return;
-        }
-        total_bytes += bytes_written;
-        printf("Received %d bytes, total: %zu bytes\n", bytes_received, total_bytes);
-    }
-    
-    fclose(file);
-    
-    if (bytes_received < 0) {
-        perror("Error receiving data");
-    }
-    
-    //print appropriate message
-    if (total_bytes > 0) {
-        printf("Tar file received and saved as: %s (Total bytes: %zu)\n", full_filename, total_bytes);
-    } else {
-        printf("No data received or error occurred.\n");
-        //remove empty file
-        remove(full_filename);
-    }
-}
-
-//function to handle displaying files from the server
-void function_to_handle_display(int sockfd) {
-    char buffer[BUFFER_SIZE];
-    int bytes_received;
-
-    //list the file names from the directories that match
-    printf("Files in the directory:\n");
-    while ((bytes_received = recv(sockfd, buffer, BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[bytes_received] = '\0';
-        printf("%s", buffer);
-        if (bytes_received < BUFFER_SIZE - 1) {
-            break;
-        }
-    }
-
-    //if there was any error
-    if (bytes_received < 0) {
-        perror("Error receiving response from server");
-    }
-    printf("\n"); 
-}
\ No newline at end of file
+//client24s.c
+//this program implements a client for interacting with the Smain server.
+//it allows users to send various file-related commands and handle the responses.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dfs_frame.h"
+#include "dfs_xfer.h"
+#include "dfs_delta.h"
+#include "dfs_compress.h"
+#include "dfs_config.h"
+
+//port of Smain, set by DFS_SMAIN_PORT
+#define PORT (dfs_config_net()->smain_port)
+#define BUFFER_SIZE 1024
+//times a resumable upload or ranged download reconnects after losing the connection
+#define TRANSFER_RETRIES 5
+//most connections a parallel transfer opens, and the smallest range worth a connection of its own
+#define MAX_TRANSFER_STREAMS 16
+#define MIN_STREAM_RANGE (1024 * 1024)
+//size of the parts a parallel upload hands out to its connections
+#define UPLOAD_PART_SIZE (32 * 1024 * 1024)
+
+//codec agreed with Smain for plain uploads and downloads, DFS_CODEC_NONE when transfers are not compressed
+int transfer_codec = DFS_CODEC_NONE;
+
+//one range of a parallel download, fetched by its own thread over its own connection
+struct download_range {
+    const char *filename;
+    int fd;                            //shared local file, written with pwrite()
+    off_t offset;                      //next byte to fetch
+    off_t end;                         //end of the range
+    unsigned long long *progress;      //bytes written by all threads
+    int *finished;                     //threads done with their range
+    int ok;
+    char error[DFS_MAX_CONTROL_PAYLOAD];
+};
+
+//a parallel upload: its threads take parts in turn and send each over their own connection
+struct parallel_upload {
+    const char *filename;
+    const char *destination;
+    char token[33];                    //names the upload on the server
+    int fd;                            //local file, read with sendfile() at each part's offset
+    unsigned long long size;
+    unsigned long long parts;
+    unsigned long long next_part;      //next part to send, taken atomically
+    unsigned long long progress;       //bytes of the parts stored so far
+    int finished;                      //threads done
+    int failed;                        //set by the first thread that gives up
+    char error[DFS_MAX_CONTROL_PAYLOAD];
+};
+
+//function prototypes
+int function_for_server_connection();
+unsigned long long function_to_get_time_us(void);
+void function_to_negotiate_compression(int sockfd);
+void function_to_report_compression(const struct dfs_compress_stats* before, int sending, long long total_bytes, unsigned long long started_us);
+int function_to_send_socket_command(int sockfd, uint32_t request_id, const char* command);
+int function_to_validate_command(const char* command);
+void function_to_handle_ufile(int sockfd, uint32_t request_id, const char* filename);
+void function_to_handle_resumable_ufile(int* sockfd, const char* filename, const char* destination);
+void function_to_handle_dedup_ufile(int sockfd, const char* filename, const char* destination);
+void function_to_send_missing_chunks(int sockfd, int fd, const struct dfs_chunk_recipe* recipe, const char* const* args, unsigned char* sent, unsigned long long started_us);
+void function_to_handle_dfile(int sockfd, const char* filename);
+void function_to_handle_ranged_dfile(int* sockfd, const char* filename, const char* options);
+void function_to_handle_parallel_dfile(int sockfd, const char* filename, int streams);
+void* function_to_download_range(void* arg);
+void function_to_handle_parallel_ufile(int sockfd, const char* filename, const char* destination, int streams);
+void* function_to_upload_parts(void* arg);
+void function_to_show_progress(unsigned long long* progress, int* finished, int threads, unsigned long long total, unsigned long long started_us);
+void function_to_handle_remove(const char* response);
+void function_to_handle_dtar(int sockfd, uint32_t request_id, const char* filetype, const char* options);
+int function_to_get_dtar_options(const char* options, char* request_options, size_t capacity, char* manifest_path, size_t path_capacity, int* send_manifest);
+void function_to_handle_display(int sockfd, const char* pathname, const char* options);
+int function_to_receive_listing(int sockfd, char* cursor, size_t cursor_size, char* error_msg, size_t error_size);
+
+//main function: Handles user input and directs program flow
+int main() {
+    //settings from the configuration file join the environment before anything reads it
+    if (dfs_config_load("client24s") < 0) {
+        fprintf(stderr, "Ignoring the configuration file\n");
+    }
+
+    //establish connection to the server
+    int sockfd = function_for_server_connection();
+    if (sockfd < 0) {
+        fprintf(stderr, "Failed to connect to server\n");
+        return 1;
+    }
+
+    printf("Connected to Smain server. Enter commands:\n");
+    function_to_negotiate_compression(sockfd);
+
+    //main loop for handling user commands
+    char command[BUFFER_SIZE];
+    while (1) {
+        printf("> ");
+        if (fgets(command, BUFFER_SIZE, stdin) == NULL) {
+            break;
+        }
+        //remove newline
+        command[strcspn(command, "\n")] = 0;
+
+        //check for exit command
+        if (strcmp(command, "exit") == 0) {
+            break;
+        }
+
+        //validate and process the command
+        if (function_to_validate_command(command)) {
+            char cmd[10], arg1[256], arg2[256], arg3[256];
+            int parsed = sscanf(command, "%9s %255s %255s %255s", cmd, arg1, arg2, arg3);
+
+            //resumable and parallel uploads and ranged downloads run their own exchanges
+            if (parsed == 4 || (parsed == 3 && strcmp(cmd, "dfile") == 0)) {
+                if (parsed == 4 && strcmp(arg3, "resume") == 0) {
+                    function_to_handle_resumable_ufile(&sockfd, arg1, arg2);
+                } else if (parsed == 4 && strcmp(arg3, "dedup") == 0) {
+                    function_to_handle_dedup_ufile(sockfd, arg1, arg2);
+                } else if (parsed == 4) {
+                    int streams = atoi(arg3 + 8);
+                    if (streams < 1 || streams > MAX_TRANSFER_STREAMS) {
+                        printf("streams takes 1 to %d connections\n", MAX_TRANSFER_STREAMS);
+                    } else {
+                        function_to_handle_parallel_ufile(sockfd, arg1, arg2, streams);
+                    }
+                } else {
+                    function_to_handle_ranged_dfile(&sockfd, arg1, arg2);
+                }
+                if (sockfd < 0) {
+                    fprintf(stderr, "Failed to reconnect to server\n");
+                    exit(1);
+                }
+                continue;
+            }
+
+            //send command to server
+            uint32_t request_id = dfs_next_request_id();
+            if (function_to_send_socket_command(sockfd, request_id, command) < 0) {
+                fprintf(stderr, "Failed to send command\n");
+                close(sockfd);
+                sockfd = function_for_server_connection();
+                if (sockfd < 0) {
+                    fprintf(stderr, "Failed to reconnect to server\n");
+                    exit(1);
+                }
+                continue;
+            }
+
+            //wait for server response
+            char response[DFS_MAX_CONTROL_PAYLOAD];
+            struct dfs_frame reply;
+            if (dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+                fprintf(stderr, "Failed to receive server response\n");
+                close(sockfd);
+                sockfd = function_for_server_connection();
+                if (sockfd < 0) {
+                    fprintf(stderr, "Failed to reconnect to server\n");
+                    exit(1);
+                }
+                continue;
+            }
+
+            //check if server accepted the request
+            if (reply.flags & DFS_FLAG_ERROR) {
+                printf("Server rejected request: %s\n", response);
+                continue;
+            }
+            
+            //handle different types of commands
+            if (strcmp(cmd, "ufile") == 0) {
+                function_to_handle_ufile(sockfd, request_id, arg1);
+            } else if (strcmp(cmd, "dfile") == 0) {
+                function_to_handle_dfile(sockfd, arg1);
+            } else if (strcmp(cmd, "dtar") == 0) {
+                function_to_handle_dtar(sockfd, request_id, arg1, parsed == 3 ? arg2 : NULL);
+            } else if (strcmp(cmd, "rmfile") == 0) {
+                function_to_handle_remove(response);
+            } else {
+                function_to_handle_display(sockfd, arg1, parsed == 3 ? arg2 : NULL);
+            }
+        } else {
+            printf("Invalid command. Please try again.\n");
+        }
+    }
+
+    close(sockfd);
+    return 0;
+}
+
+//function to establish a connection with the server
+int function_for_server_connection() {
+    int sockfd;
+    struct sockaddr_in servaddr;
+
+    //create socket
+    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket creation failed");
+        return -1;
+    }
+
+    //socket buffers must be sized before connecting so the window scale covers them
+    dfs_config_tune_socket(sockfd);
+
+    //clear buffer
+    memset(&servaddr, 0, sizeof(servaddr));
+
+    //assign IP and PORT
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_port = htons(PORT);
+
+    //convert IPv4 and IPv6 addresses from text to binary form
+    if (inet_pton(AF_INET, "127.0.0.1", &servaddr.sin_addr) <= 0) {
+        perror("Invalid address/ Address not supported");
+        return -1;
+    }
+
+    //connect to the server
+    if (connect(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        perror("Connection Failed");
+        return -1;
+    }
+
+    return sockfd;
+}
+
+//function to read a monotonic clock in microseconds, for throughput readouts
+unsigned long long function_to_get_time_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+//function to agree on a codec with Smain when DFS_COMPRESS names the codecs this client may use, e.g. "lz".
+//a server without compression rejects the request and transfers stay uncompressed.
+void function_to_negotiate_compression(int sockfd) {
+    const char *offered = getenv("DFS_COMPRESS");
+    if (!offered || offered[0] == '\0' || strcmp(offered, "none") == 0) {
+        return;
+    }
+    uint32_t request_id = dfs_next_request_id();
+    const char *args[1] = {offered};
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    if (dfs_send_request_args(sockfd, DFS_OP_COMPRESS, request_id, args, 1) < 0 ||
+        dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+        fprintf(stderr, "Failed to negotiate compression\n");
+        return;
+    }
+    if (reply.flags & DFS_FLAG_ERROR) {
+        printf("Server does not compress transfers: %s\n", response);
+        return;
+    }
+    int codec = dfs_codec_parse(response);
+    transfer_codec = codec > DFS_CODEC_NONE ? codec : DFS_CODEC_NONE;
+    printf("Compressed transfers: %s\n", dfs_codec_name(transfer_codec));
+}
+
+//function to print how well a transfer compressed and how fast it ran, from the codec totals before it.
+//blocks sent as they were count on both sides, so the ratio is that of the whole stream.
+void function_to_report_compression(const struct dfs_compress_stats* before, int sending, long long total_bytes, unsigned long long started_us) {
+    struct dfs_compress_stats after;
+    dfs_compress_get_stats(&after);
+    unsigned long long wire_bytes;
+    if (sending) {
+        wire_bytes = total_bytes - (after.compress_in - before->compress_in) + (after.compress_out - before->compress_out);
+    } else {
+        wire_bytes = total_bytes - (after.decompress_out - before->decompress_out) + (after.decompress_in - before->decompress_in);
+    }
+    double seconds = (function_to_get_time_us() - started_us) / 1e6;
+    printf("Compression: %lld bytes as %llu on the wire (ratio %.2f), %.1f MB/s\n", total_bytes, wire_bytes,
+           wire_bytes > 0 ? (double)total_bytes / wire_bytes : 1.0, seconds > 0 ? total_bytes / seconds / 1e6 : 0.0);
+}
+
+//function to send a command to the server as a request frame.
+//with a codec agreed, a download asks for compressed data frames.
+int function_to_send_socket_command(int sockfd, uint32_t request_id, const char* command) {
+    char cmd[10], arg1[256], arg2[256];
+    int parsed = sscanf(command, "%9s %255s %255s", cmd, arg1, arg2);
+
+    //map the command name to its opcode
+    uint8_t opcode;
+    if (strcmp(cmd, "ufile") == 0) {
+        opcode = DFS_OP_UFILE;
+    } else if (strcmp(cmd, "dfile") == 0) {
+        opcode = DFS_OP_DFILE;
+    } else if (strcmp(cmd, "rmfile") == 0) {
+        opcode = DFS_OP_RMFILE;
+    } else if (strcmp(cmd, "dtar") == 0) {
+        opcode = DFS_OP_DTAR;
+    } else {
+        opcode = DFS_OP_DISPLAY;
+    }
+
+    //the path of a dtar's manifest stays on this side; the server is only told that one follows
+    if (opcode == DFS_OP_DTAR && parsed == 3) {
+        char manifest_path[256];
+        int send_manifest;
+        char request_options[256];
+        function_to_get_dtar_options(arg2, request_options, sizeof(request_options), manifest_path, sizeof(manifest_path), &send_manifest);
+        snprintf(arg2, sizeof(arg2), "%s", request_options);
+    }
+
+    const char *args[2] = {arg1, parsed == 3 ? arg2 : NULL};
+    uint16_t flags = opcode == DFS_OP_DFILE && transfer_codec != DFS_CODEC_NONE ? DFS_FLAG_COMPRESSED : 0;
+    if (dfs_send_request_flags(sockfd, opcode, flags, request_id, args, parsed == 3 ? 2 : 1) < 0) {
+        perror("Send failed");
+        return -1;
+    }
+    return 0;
+}
+
+//function to validate user input commands
+int function_to_validate_command(const char* command) {
+    char cmd[10];
+    char arg1[256];
+    char arg2[256];
+    char arg3[256];
+
+    int parsed = sscanf(command, "%9s %255s %255s %255s", cmd, arg1, arg2, arg3);
+
+    if (parsed < 1) {
+        return 0;
+    }
+
+    //check for valid commands and their required number of arguments
+    if (strcmp(cmd, "ufile") == 0) {
+        //a trailing "resume" makes the upload resumable, "streams=N" sends it over N connections
+        //and "dedup" sends only the parts of the file the server does not already have
+        return ((parsed == 3 || (parsed == 4 && (strcmp(arg3, "resume") == 0 || strcmp(arg3, "dedup") == 0 || strncmp(arg3, "streams=", 8) == 0))) && (strncmp(arg2, "~/smain", 7) == 0));
+    } else if (strcmp(cmd, "dfile") == 0) {
+        //an optional third argument resumes the download or picks a byte range, e.g. offset=4096,length=1024
+        return ((parsed == 2 || parsed == 3) && (strncmp(arg1, "~/smain", 7) == 0));
+    } else if (strcmp(cmd, "rmfile") == 0) {
+        return (parsed == 2 && (strncmp(arg1, "~/smain", 7) == 0));
+    } else if (strcmp(cmd, "display") == 0) {
+        //an optional third argument sets the page size, sort order and cursor, e.g. page=100,sort=asc
+        return ((parsed == 2 || parsed == 3) && (strncmp(arg1, "~/smain", 7) == 0));
+    } else if (strcmp(cmd, "dtar") == 0) {
+        //optional archive options: "gz" for a .tar.gz, "since=<time>" for the files changed since then,
+        //"manifest=<file>" for the changes against an earlier archive's manifest; the server checks them
+        return (parsed == 2 || parsed == 3);
+    }
+
+    return 0;
+}
+
+//function to handle uploading a file to the server
+void function_to_handle_ufile(int sockfd, uint32_t request_id, const char* filename) {
+    //open and send the file
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+        //abort the upload so the server does not wait for data
+        dfs_send_status(sockfd, request_id, 0, "Client failed to open file");
+    } else {
+        //Smain writes .c uploads straight into its files, so only those relayed to Spdf/Stext are compressed
+        const char *extension = strrchr(filename, '.');
+        int codec = extension && strcmp(extension, ".c") != 0 ? transfer_codec : DFS_CODEC_NONE;
+        struct dfs_compress_stats before;
+        dfs_compress_get_stats(&before);
+        unsigned long long started_us = function_to_get_time_us();
+        long long total_bytes_sent = codec != DFS_CODEC_NONE ? dfs_send_compressed_stream(sockfd, fd, request_id, codec)
+                                                             : dfs_send_stream_from_fd(sockfd, fd, request_id);
+        close(fd);
+        if (total_bytes_sent < 0) {
+            perror("Failed to send file data");
+        } else {
+            printf("File sent successfully. Total bytes sent: %lld\n", total_bytes_sent);
+            if (codec != DFS_CODEC_NONE) {
+                function_to_report_compression(&before, 1, total_bytes_sent, started_us);
+            }
+        }
+    }
+
+    //get the final response from the server
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    if (dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0) {
+        perror("Error receiving response from server");
+        return;
+    }
+    printf("Server response: %s\n", response);
+}
+
+//function to upload a file in resumable mode.
+//the server stages what it receives, so after a dropped connection the client reconnects, asks how much of
+//the file the server already has and sends only the rest.
+void function_to_handle_resumable_ufile(int* sockfd, const char* filename, const char* destination) {
+    int fd = open(filename, O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) < 0) {
+        perror("Failed to open file");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    int attempt;
+    for (attempt = 0; attempt <= TRANSFER_RETRIES; attempt++) {
+        if (attempt > 0) {
+            printf("Upload interrupted, reconnecting to resume (attempt %d of %d)\n", attempt, TRANSFER_RETRIES);
+            if (*sockfd >= 0) {
+                close(*sockfd);
+            }
+            sleep(1);
+            if ((*sockfd = function_for_server_connection()) < 0) {
+                continue;
+            }
+        }
+
+        //ask how much of the file the server already has
+        uint32_t request_id = dfs_next_request_id();
+        if (dfs_send_request(*sockfd, DFS_OP_UFILE_QUERY, request_id, filename, destination) < 0 ||
+            dfs_recv_control(*sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+            continue;
+        }
+        if (reply.flags & DFS_FLAG_ERROR) {
+            printf("Server rejected request: %s\n", response);
+            break;
+        }
+        unsigned long long offset = strtoull(response, NULL, 10);
+        if (offset > (unsigned long long)file_stat.st_size) {
+            //what the server has belongs to a larger version of the file
+            offset = 0;
+        }
+
+        //continue the upload at that offset
+        char offset_text[32];
+        snprintf(offset_text, sizeof(offset_text), "%llu", offset);
+        const char *args[3] = {filename, destination, offset_text};
+        request_id = dfs_next_request_id();
+        if (dfs_send_request_args(*sockfd, DFS_OP_UFILE_RESUME, request_id, args, 3) < 0 ||
+            dfs_recv_control(*sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+            continue;
+        }
+        if ((reply.flags & DFS_FLAG_ERROR) && strstr(response, "already in progress")) {
+            //the server has not yet noticed that the interrupted upload is gone
+            continue;
+        }
+        if (reply.flags & DFS_FLAG_ERROR) {
+            printf("Server rejected request: %s\n", response);
+            break;
+        }
+        if (offset > 0) {
+            printf("Resuming upload at byte %llu of %lld\n", offset, (long long)file_stat.st_size);
+        }
+        long long total_bytes_sent = dfs_sendfile_stream(*sockfd, fd, offset, file_stat.st_size - offset, request_id);
+        if (total_bytes_sent < 0 || dfs_recv_control(*sockfd, &reply, response, sizeof(response)) < 0) {
+            continue;
+        }
+        printf("File sent successfully. Total bytes sent: %lld\n", total_bytes_sent);
+        printf("Server response: %s\n", response);
+        break;
+    }
+    if (attempt > TRANSFER_RETRIES) {
+        printf("Upload failed; run the same command again to continue where it stopped\n");
+    }
+    close(fd);
+}
+
+//function to upload a file sending only the data the server does not already have.
+//the file is cut into content-defined chunks and their list sent first; the server answers which chunks it lacks,
+//either because it has the file already or because they are found in its copy or its chunk store.
+//a server that does not know the exchange gets a plain upload instead.
+void function_to_handle_dedup_ufile(int sockfd, const char* filename, const char* destination) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return;
+    }
+    unsigned long long started_us = function_to_get_time_us();
+    struct dfs_chunk_recipe *recipe = dfs_chunk_scan(fd);
+    unsigned char *sent = recipe ? malloc(recipe->count > 0 ? recipe->count : 1) : NULL;
+    if (!sent) {
+        perror("Failed to read file");
+        dfs_chunk_release(recipe, 0);
+        close(fd);
+        return;
+    }
+    char size_text[32];
+    char sha256_text[DFS_SHA256_HEX_SIZE + 1];
+    snprintf(size_text, sizeof(size_text), "%llu", (unsigned long long)recipe->size);
+    dfs_sha256_hex(recipe->sha256, sha256_text);
+    const char *args[4] = {filename, destination, size_text, sha256_text};
+
+    //send the chunk list and read which chunks are missing
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    uint32_t request_id = dfs_next_request_id();
+    if (dfs_send_request_args(sockfd, DFS_OP_UFILE_CHUNKS, request_id, args, 4) < 0 ||
+        dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+        fprintf(stderr, "Failed to receive server response\n");
+    } else if ((reply.flags & DFS_FLAG_ERROR) && strcmp(response, "Invalid command") == 0) {
+        //the server predates the exchange
+        close(fd);
+        request_id = dfs_next_request_id();
+        if (dfs_send_request(sockfd, DFS_OP_UFILE, request_id, filename, destination) < 0 ||
+            dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+            fprintf(stderr, "Failed to receive server response\n");
+        } else if (reply.flags & DFS_FLAG_ERROR) {
+            printf("Server rejected request: %s\n", response);
+        } else {
+            function_to_handle_ufile(sockfd, request_id, filename);
+        }
+        fd = -1;
+    } else if (reply.flags & DFS_FLAG_ERROR) {
+        printf("Server rejected request: %s\n", response);
+    } else if (dfs_delta_send_list(sockfd, request_id, recipe, NULL) < 0 || dfs_send_frame(sockfd, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0 ||
+               dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+        fprintf(stderr, "Failed to receive server response\n");
+    } else if (reply.flags & DFS_FLAG_ERROR) {
+        printf("Server rejected request: %s\n", response);
+    } else {
+        int answer = dfs_delta_parse_answer(response, sent, recipe->count);
+        if (answer < 0) {
+            printf("Invalid server response: %s\n", response);
+        } else if (answer == 1) {
+            printf("Server response: %s\n", response);
+        } else {
+            function_to_send_missing_chunks(sockfd, fd, recipe, args, sent, started_us);
+        }
+    }
+    free(sent);
+    dfs_chunk_release(recipe, 0);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+//function to send the chunks a server found missing, with the chunk list marking them.
+//if a chunk the server offered was dropped before the upload reached it, the whole file is sent once more.
+void function_to_send_missing_chunks(int sockfd, int fd, const struct dfs_chunk_recipe* recipe, const char* const* args, unsigned char* sent, unsigned long long started_us) {
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        unsigned long long bytes = 0;
+        size_t chunks = 0;
+        for (size_t i = 0; i < recipe->count; i++) {
+            if (sent[i]) {
+                bytes += recipe->chunks[i].length;
+                chunks++;
+            }
+        }
+        printf("Sending %llu of %llu bytes (%zu of %zu chunks)\n", bytes, (unsigned long long)recipe->size, chunks, recipe->count);
+
+        uint32_t request_id = dfs_next_request_id();
+        if (dfs_send_request_args(sockfd, DFS_OP_UFILE_DELTA, request_id, args, 4) < 0 ||
+            dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+            fprintf(stderr, "Failed to receive server response\n");
+            return;
+        }
+        if (reply.flags & DFS_FLAG_ERROR) {
+            printf("Server rejected request: %s\n", response);
+            return;
+        }
+        long long total_bytes_sent = 0;
+        if (dfs_delta_send_list(sockfd, request_id, recipe, sent) < 0 || (total_bytes_sent = dfs_delta_send_chunks(sockfd, request_id, fd, recipe, sent)) < 0 ||
+            dfs_send_frame(sockfd, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0 ||
+            dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+            perror("Failed to send file data");
+            return;
+        }
+        if ((reply.flags & DFS_FLAG_ERROR) && strstr(response, "no longer stored") && attempt == 0) {
+            memset(sent, 1, recipe->count);
+            continue;
+        }
+        double elapsed = (function_to_get_time_us() - started_us) / 1e6;
+        printf("File sent successfully. Total bytes sent: %lld (%.2f s)\n", total_bytes_sent, elapsed);
+        printf("Server response: %s\n", response);
+        return;
+    }
+}
+
+//function to upload a file over several connections at once.
+//the file is cut into parts that the threads send in turn, each part written at its offset by the server;
+//the commit sent once every part is stored makes the server move the assembled file into place.
+void function_to_handle_parallel_ufile(int sockfd, const char* filename, const char* destination, int streams) {
+    struct parallel_upload upload = {0};
+    struct stat file_stat;
+    upload.fd = open(filename, O_RDONLY);
+    if (upload.fd < 0 || fstat(upload.fd, &file_stat) < 0) {
+        perror("Failed to open file");
+        if (upload.fd >= 0) {
+            close(upload.fd);
+        }
+        return;
+    }
+    upload.filename = filename;
+    upload.destination = destination;
+    upload.size = file_stat.st_size;
+    upload.parts = (upload.size + UPLOAD_PART_SIZE - 1) / UPLOAD_PART_SIZE;
+    snprintf(upload.token, sizeof(upload.token), "%x%llx", (unsigned)getpid(), function_to_get_time_us());
+
+    //every thread needs at least one part
+    if (upload.parts < (unsigned long long)streams) {
+        streams = upload.parts;
+    }
+    pthread_t threads[MAX_TRANSFER_STREAMS];
+    unsigned long long started_us = function_to_get_time_us();
+    int started_threads = 0;
+    for (int i = 0; i < streams; i++) {
+        if (pthread_create(&threads[i], NULL, function_to_upload_parts, &upload) != 0) {
+            break;
+        }
+        started_threads++;
+    }
+    if (streams > 0 && started_threads == 0) {
+        printf("Failed to start upload threads\n");
+        close(upload.fd);
+        return;
+    }
+    printf("Uploading %s (%llu bytes) in %llu parts over %d connections\n", filename, upload.size, upload.parts, started_threads);
+    function_to_show_progress(&upload.progress, &upload.finished, started_threads, upload.size, started_us);
+    for (int i = 0; i < started_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    close(upload.fd);
+    if (upload.failed) {
+        printf("Upload failed: %s\n", upload.error);
+        return;
+    }
+
+    //all parts are stored; move the file into place
+    char size_text[32];
+    snprintf(size_text, sizeof(size_text), "%llu", upload.size);
+    const char *args[4] = {filename, destination, upload.token, size_text};
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    if (dfs_send_request_args(sockfd, DFS_OP_UFILE_COMMIT, dfs_next_request_id(), args, 4) < 0 ||
+        dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+        fprintf(stderr, "Failed to receive server response\n");
+        return;
+    }
+    double elapsed = (function_to_get_time_us() - started_us) / 1e6;
+    printf("File sent successfully. Total bytes sent: %llu (%.2f s, %.1f MB/s)\n", upload.size, elapsed, elapsed > 0 ? upload.size / elapsed / (1024 * 1024) : 0.0);
+    printf("Server response: %s\n", response);
+}
+
+//function run by each thread of a parallel upload.
+//it takes the next part until none are left and sends it over its own connection, sending a part again
+//over a new connection if the connection drops.
+void* function_to_upload_parts(void* arg) {
+    struct parallel_upload *upload = arg;
+    int sock = -1;
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    unsigned long long part;
+    while (!__atomic_load_n(&upload->failed, __ATOMIC_RELAXED) && (part = __atomic_fetch_add(&upload->next_part, 1, __ATOMIC_RELAXED)) < upload->parts) {
+        unsigned long long offset = part * UPLOAD_PART_SIZE;
+        unsigned long long length = upload->size - offset < UPLOAD_PART_SIZE ? upload->size - offset : UPLOAD_PART_SIZE;
+        char offset_text[32];
+        snprintf(offset_text, sizeof(offset_text), "%llu", offset);
+        const char *args[4] = {upload->filename, upload->destination, upload->token, offset_text};
+        int stored = 0;
+        snprintf(response, sizeof(response), "Failed to connect to server");
+        for (int attempt = 0; attempt <= TRANSFER_RETRIES && !stored; attempt++) {
+            if (attempt > 0) {
+                sleep(1);
+            }
+            if (sock < 0 && (sock = function_for_server_connection()) < 0) {
+                continue;
+            }
+            uint32_t request_id = dfs_next_request_id();
+            if (dfs_send_request_args(sock, DFS_OP_UFILE_PART, request_id, args, 4) < 0 ||
+                dfs_recv_control(sock, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+                snprintf(response, sizeof(response), "Connection lost during transfer");
+                close(sock);
+                sock = -1;
+                continue;
+            }
+            if (reply.flags & DFS_FLAG_ERROR) {
+                break;
+            }
+            if (dfs_sendfile_stream(sock, upload->fd, offset, length, request_id) < 0 ||
+                dfs_recv_control(sock, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+                snprintf(response, sizeof(response), "Connection lost during transfer");
+                close(sock);
+                sock = -1;
+                continue;
+            }
+            stored = !(reply.flags & DFS_FLAG_ERROR);
+        }
+        if (!stored) {
+            if (__atomic_exchange_n(&upload->failed, 1, __ATOMIC_RELAXED) == 0) {
+                snprintf(upload->error, sizeof(upload->error), "part at %llu: %s", offset, response);
+            }
+            break;
+        }
+        __atomic_add_fetch(&upload->progress, length, __ATOMIC_RELAXED);
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+    __atomic_add_fetch(&upload->finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+//function to handle downloading a file from the server
+void function_to_handle_dfile(int sockfd, const char* filename) {
+    //extract the base filename
+    const char *basename = strrchr(filename, '/');
+    basename = basename ? basename + 1 : filename;
+
+    //open file for writing
+    int fd = open(basename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create file");
+    }
+
+    //receive the data stream; it is drained even if the local file could not be created
+    char error_msg[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_compress_stats before;
+    dfs_compress_get_stats(&before);
+    unsigned long long started_us = function_to_get_time_us();
+    long long total_bytes = dfs_recv_stream_to_fd(sockfd, fd, error_msg, sizeof(error_msg));
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+    if (total_bytes > 0 && transfer_codec != DFS_CODEC_NONE) {
+        function_to_report_compression(&before, 0, total_bytes, started_us);
+    }
+
+    //print appropriate message based on the response
+    if (total_bytes < 0) {
+        printf("Error receiving file data: %s\n", error_msg);
+        //what arrived is kept so the download can be resumed
+        struct stat file_stat;
+        if (stat(basename, &file_stat) == 0 && file_stat.st_size > 0) {
+            printf("Partial file kept; run 'dfile %s resume' to continue\n", filename);
+        } else {
+            remove(basename);
+        }
+    } else if (total_bytes > 0) {
+        printf("File received and saved as: %s (Total bytes: %lld)\n", basename, total_bytes);
+    } else {
+        printf("No data received.\n");
+    }
+}
+
+//function to download a byte range of a file.
+//"resume" continues after the bytes already in the local file, and offset=N,length=M fetches a slice and writes it
+//at the same position of the local file. after a dropped connection the client reconnects and asks for the rest.
+void function_to_handle_ranged_dfile(int* sockfd, const char* filename, const char* options) {
+    const char *basename = strrchr(filename, '/');
+    basename = basename ? basename + 1 : filename;
+
+    //parse the comma separated options
+    unsigned long long offset = 0;
+    unsigned long long length = 0;
+    unsigned long long streams = 0;
+    int has_offset = 0;
+    int has_length = 0;
+    int resume = 0;
+    char text[256];
+    snprintf(text, sizeof(text), "%s", options);
+    char *save = NULL;
+    for (char *option = strtok_r(text, ",", &save); option; option = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(option, '=');
+        char *end = NULL;
+        if (strcmp(option, "resume") == 0) {
+            resume = 1;
+            continue;
+        }
+        if (value && value[1] != '-') {
+            if (strncmp(option, "offset=", 7) == 0) {
+                offset = strtoull(value + 1, &end, 10);
+                has_offset = 1;
+            } else if (strncmp(option, "length=", 7) == 0) {
+                length = strtoull(value + 1, &end, 10);
+                has_length = 1;
+            } else if (strncmp(option, "streams=", 8) == 0) {
+                streams = strtoull(value + 1, &end, 10);
+            }
+        }
+        if (!end || end == value + 1 || *end != '\0') {
+            printf("Invalid dfile option: %s\n", option);
+            return;
+        }
+    }
+    if (resume && (has_offset || has_length)) {
+        printf("resume cannot be combined with offset or length\n");
+        return;
+    }
+    if (streams > 0) {
+        if (resume || has_offset || has_length || streams > MAX_TRANSFER_STREAMS) {
+            printf("streams takes 1 to %d connections and cannot be combined with other options\n", MAX_TRANSFER_STREAMS);
+            return;
+        }
+        function_to_handle_parallel_dfile(*sockfd, filename, streams);
+        return;
+    }
+
+    //the local file is never truncated: a slice lands at its own offset
+    int fd = open(basename, O_WRONLY | O_CREAT, 0644);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) < 0) {
+        perror("Failed to open file");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    if (resume) {
+        offset = file_stat.st_size;
+    }
+
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    char error_msg[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    unsigned long long received = 0;
+    int attempt;
+    for (attempt = 0; attempt <= TRANSFER_RETRIES; attempt++) {
+        if (attempt > 0) {
+            printf("Download interrupted, reconnecting to resume (attempt %d of %d)\n", attempt, TRANSFER_RETRIES);
+            if (*sockfd >= 0) {
+                close(*sockfd);
+            }
+            sleep(1);
+            if ((*sockfd = function_for_server_connection()) < 0) {
+                continue;
+            }
+        }
+
+        //ask for the part still missing
+        char offset_text[32];
+        char length_text[32];
+        snprintf(offset_text, sizeof(offset_text), "%llu", offset);
+        snprintf(length_text, sizeof(length_text), "%llu", length);
+        const char *args[3] = {filename, offset_text, length_text};
+        uint32_t request_id = dfs_next_request_id();
+        if (dfs_send_request_args(*sockfd, DFS_OP_DFILE, request_id, args, has_length ? 3 : 2) < 0 ||
+            dfs_recv_control(*sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+            continue;
+        }
+        if (reply.flags & DFS_FLAG_ERROR) {
+            printf("Server rejected request: %s\n", response);
+            break;
+        }
+        unsigned long long range_length = 0, range_offset = 0, file_size = 0;
+        if (sscanf(response, DFS_RANGE_STATUS_FORMAT, &range_length, &range_offset, &file_size) == 3 && attempt == 0 && resume) {
+            if (range_length == 0) {
+                printf("%s is already complete (%llu bytes)\n", basename, file_size);
+            } else if (range_offset > 0) {
+                printf("Resuming download at byte %llu of %llu\n", range_offset, file_size);
+            }
+        }
+
+        //write the stream at the requested offset
+        if (lseek(fd, offset, SEEK_SET) < 0) {
+            perror("Failed to seek in file");
+            dfs_recv_stream_to_fd(*sockfd, -1, NULL, 0);
+            break;
+        }
+        snprintf(error_msg, sizeof(error_msg), "Connection lost during transfer");
+        long long total_bytes = dfs_recv_stream_to_fd(*sockfd, fd, error_msg, sizeof(error_msg));
+        if (total_bytes >= 0) {
+            received += total_bytes;
+            if (received == 0 && resume) {
+                break;
+            }
+            printf("File received and saved as: %s (Total bytes: %llu)\n", basename, received);
+            break;
+        }
+
+        //keep what arrived and continue after it
+        off_t position = lseek(fd, 0, SEEK_CUR);
+        if (position > (off_t)offset) {
+            received += position - offset;
+            if (has_length) {
+                length -= position - offset;
+            }
+            offset = position;
+        }
+        printf("Error receiving file data: %s\n", error_msg);
+    }
+    if (attempt > TRANSFER_RETRIES) {
+        printf("Download failed; run 'dfile %s resume' to continue where it stopped\n", filename);
+    }
+    close(fd);
+}
+
+//function to download a file over several connections at once.
+//the size is probed with an empty range, the local file is preallocated, and each thread fetches one slice of it
+//and writes it in place with pwrite(). meanwhile the progress and throughput are printed.
+void function_to_handle_parallel_dfile(int sockfd, const char* filename, int streams) {
+    const char *basename = strrchr(filename, '/');
+    basename = basename ? basename + 1 : filename;
+
+    //an empty range tells the size of the file
+    char response[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame reply;
+    const char *args[3] = {filename, "0", "0"};
+    if (dfs_send_request_args(sockfd, DFS_OP_DFILE, dfs_next_request_id(), args, 3) < 0 ||
+        dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+        fprintf(stderr, "Failed to receive server response\n");
+        return;
+    }
+    if (reply.flags & DFS_FLAG_ERROR) {
+        printf("Server rejected request: %s\n", response);
+        return;
+    }
+    unsigned long long range_length = 0, range_offset = 0, file_size = 0;
+    if (sscanf(response, DFS_RANGE_STATUS_FORMAT, &range_length, &range_offset, &file_size) != 3 ||
+        dfs_recv_stream_to_fd(sockfd, -1, NULL, 0) < 0) {
+        fprintf(stderr, "Unexpected server response: %s\n", response);
+        return;
+    }
+
+    //reserve the whole file up front so the ranges land in allocated blocks
+    int fd = open(basename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create file");
+        return;
+    }
+    int error = file_size > 0 ? posix_fallocate(fd, 0, file_size) : 0;
+    if (error != 0 && ftruncate(fd, file_size) < 0) {
+        perror("Failed to allocate file");
+        close(fd);
+        return;
+    }
+
+    //small files get fewer connections
+    if (file_size / MIN_STREAM_RANGE + 1 < (unsigned long long)streams) {
+        streams = file_size / MIN_STREAM_RANGE + 1;
+    }
+    struct download_range ranges[MAX_TRANSFER_STREAMS];
+    pthread_t threads[MAX_TRANSFER_STREAMS];
+    unsigned long long progress = 0;
+    int finished = 0;
+    unsigned long long range_size = file_size / streams;
+    unsigned long long started_us = function_to_get_time_us();
+    int started_threads = 0;
+    for (int i = 0; i < streams; i++) {
+        ranges[i].filename = filename;
+        ranges[i].fd = fd;
+        ranges[i].offset = i * range_size;
+        ranges[i].end = i == streams - 1 ? (off_t)file_size : (off_t)((i + 1) * range_size);
+        ranges[i].progress = &progress;
+        ranges[i].finished = &finished;
+        ranges[i].ok = 0;
+        snprintf(ranges[i].error, sizeof(ranges[i].error), "Failed to start download thread");
+        if (pthread_create(&threads[i], NULL, function_to_download_range, &ranges[i]) != 0) {
+            break;
+        }
+        started_threads++;
+    }
+    printf("Downloading %s (%llu bytes) over %d connections\n", basename, file_size, started_threads);
+
+    function_to_show_progress(&progress, &finished, started_threads, file_size, started_us);
+    for (int i = 0; i < started_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    //ranges after the one that failed to start were never set up
+    int failed = 0;
+    for (int i = 0; i < streams && i <= started_threads; i++) {
+        if (i == started_threads || !ranges[i].ok) {
+            printf("Range %d failed: %s\n", i, ranges[i].error);
+            failed = 1;
+        }
+    }
+
+    //the file is cut back to the bytes received in one piece from its start, so that resume, which continues
+    //after the end of the local file, does not skip the holes of the ranges that failed
+    if (failed) {
+        off_t complete = 0;
+        for (int i = 0; i < streams && i <= started_threads; i++) {
+            complete = ranges[i].offset;
+            if (i == started_threads || !ranges[i].ok) {
+                break;
+            }
+        }
+        if (ftruncate(fd, complete) < 0) {
+            perror("Failed to truncate partial file");
+        }
+        close(fd);
+        if (complete > 0) {
+            printf("Download of %s incomplete; %lld bytes kept, run 'dfile %s resume' to continue\n", basename, (long long)complete, filename);
+        } else {
+            printf("Download of %s incomplete\n", basename);
+            remove(basename);
+        }
+        return;
+    }
+    close(fd);
+    double elapsed = (function_to_get_time_us() - started_us) / 1e6;
+    printf("File received and saved as: %s (Total bytes: %llu, %.2f s, %.1f MB/s)\n", basename, file_size, elapsed, elapsed > 0 ? file_size / elapsed / (1024 * 1024) : 0.0);
+}
+
+//function to print the progress and throughput of a parallel transfer twice a second until all threads are done
+void function_to_show_progress(unsigned long long* progress, int* finished, int threads, unsigned long long total, unsigned long long started_us) {
+    unsigned long long reported_us = 0;
+    while (1) {
+        int running = threads - __atomic_load_n(finished, __ATOMIC_ACQUIRE);
+        unsigned long long now_us = function_to_get_time_us();
+        if (running == 0 || now_us - reported_us >= 500000) {
+            unsigned long long done = __atomic_load_n(progress, __ATOMIC_RELAXED);
+            double elapsed = (now_us - started_us) / 1e6;
+            printf("\r%llu of %llu MB (%.0f%%), %.1f MB/s   ", done >> 20, total >> 20, total ? 100.0 * done / total : 100.0, elapsed > 0 ? done / elapsed / (1024 * 1024) : 0.0);
+            fflush(stdout);
+            reported_us = now_us;
+        }
+        if (running == 0) {
+            break;
+        }
+        usleep(10000);
+    }
+    printf("\n");
+}
+
+//function run by each thread of a parallel download.
+//it fetches its range over its own connection, reconnecting and asking for the rest if the stream breaks.
+void* function_to_download_range(void* arg) {
+    struct download_range *range = arg;
+    for (int attempt = 0; attempt <= TRANSFER_RETRIES && range->offset < range->end; attempt++) {
+        if (attempt > 0) {
+            sleep(1);
+        }
+        int sock = function_for_server_connection();
+        if (sock < 0) {
+            snprintf(range->error, sizeof(range->error), "Failed to connect to server");
+            continue;
+        }
+        char offset_text[32];
+        char length_text[32];
+        snprintf(offset_text, sizeof(offset_text), "%lld", (long long)range->offset);
+        snprintf(length_text, sizeof(length_text), "%lld", (long long)(range->end - range->offset));
+        const char *args[3] = {range->filename, offset_text, length_text};
+        char response[DFS_MAX_CONTROL_PAYLOAD];
+        struct dfs_frame reply;
+        if (dfs_send_request_args(sock, DFS_OP_DFILE, dfs_next_request_id(), args, 3) < 0 ||
+            dfs_recv_control(sock, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+            snprintf(range->error, sizeof(range->error), "Failed to receive server response");
+            close(sock);
+            continue;
+        }
+        if (reply.flags & DFS_FLAG_ERROR) {
+            snprintf(range->error, sizeof(range->error), "%s", response);
+            close(sock);
+            break;
+        }
+        snprintf(range->error, sizeof(range->error), "Connection lost during transfer");
+        long long received = dfs_recv_stream_at(sock, range->fd, &range->offset, range->progress, range->error, sizeof(range->error));
+        close(sock);
+        if (received >= 0 && range->offset < range->end) {
+            snprintf(range->error, sizeof(range->error), "File changed while being downloaded");
+            break;
+        }
+    }
+    range->ok = range->offset >= range->end;
+    __atomic_add_fetch(range->finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+//function to handle removing a file from the server
+void function_to_handle_remove(const char* response) {
+    //the status frame already carries the result of the command
+    printf("Server response: %s\n", response);
+}
+
+//function to split the options of a dtar into those sent to the server and the manifest sent after them.
+//"manifest=<file>" is requested as "manifest" and the file follows the acceptance; a bare "manifest" sends an
+//empty one, which asks for a full archive that carries a manifest for the next incremental one.
+//returns 1 if the options ask for a gzip compressed archive.
+int function_to_get_dtar_options(const char* options, char* request_options, size_t capacity, char* manifest_path, size_t path_capacity, int* send_manifest) {
+    char copy[256];
+    int gzip = 0;
+    size_t used = 0;
+    *send_manifest = 0;
+    manifest_path[0] = '\0';
+    request_options[0] = '\0';
+    snprintf(copy, sizeof(copy), "%s", options ? options : "");
+    char *saved;
+    for (char *option = strtok_r(copy, ",", &saved); option; option = strtok_r(NULL, ",", &saved)) {
+        if (strncmp(option, "manifest=", 9) == 0) {
+            snprintf(manifest_path, path_capacity, "%s", option + 9);
+            option[8] = '\0';
+        }
+        if (strcmp(option, "manifest") == 0) {
+            *send_manifest = 1;
+        } else if (strcmp(option, "gz") == 0 || strcmp(option, "gzip") == 0) {
+            gzip = 1;
+        } else if (strcmp(option, "none") == 0) {
+            gzip = 0;
+        }
+        int n = snprintf(request_options + used, capacity - used, "%s%s", used > 0 ? "," : "", option);
+        if (n > 0 && (size_t)n < capacity - used) {
+            used += n;
+        }
+    }
+    return gzip;
+}
+
+//function to handle downloading a tar file from the server.
+//with "gz" the server sends the archive compressed, and it is saved as it arrives, e.g. as txtfiles.tar.gz.
+//an incremental archive against a manifest needs that manifest sent first; its ./.dfs-manifest member is
+//the manifest for the next one.
+void function_to_handle_dtar(int sockfd, uint32_t request_id, const char* filetype, const char* options) {
+    char request_options[256];
+    char manifest_path[256];
+    int send_manifest;
+    int gzip = function_to_get_dtar_options(options, request_options, sizeof(request_options), manifest_path, sizeof(manifest_path), &send_manifest);
+
+    //send the manifest of the last archive, or an empty stream for a first one
+    if (send_manifest) {
+        int manifest_fd = manifest_path[0] ? open(manifest_path, O_RDONLY) : -1;
+        long long manifest_bytes = 0;
+        if (manifest_path[0] && manifest_fd < 0) {
+            perror("Failed to open manifest");
+            //the server answers the aborted manifest with an error instead of an archive
+            dfs_send_status(sockfd, request_id, 0, "Client failed to open manifest");
+        } else if (manifest_fd >= 0) {
+            manifest_bytes = dfs_send_stream_from_fd(sockfd, manifest_fd, request_id);
+            close(manifest_fd);
+        } else if (dfs_send_frame(sockfd, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0) {
+            manifest_bytes = -1;
+        }
+        if (manifest_bytes < 0) {
+            perror("Failed to send manifest");
+            return;
+        }
+    }
+
+    printf("Receiving tar file...\n");
+    
+    //create filename for the tar file
+    char full_filename[256];
+    snprintf(full_filename, sizeof(full_filename), "%sfiles.tar%s", filetype + 1, gzip ? ".gz" : "");
+    
+    //open file for writing
+    int fd = open(full_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create tar file");
+    }
+    
+    //the archive ends at the stream's END frame, so no in-band marker is needed
+    char error_msg[DFS_MAX_CONTROL_PAYLOAD];
+    long long total_bytes = dfs_recv_stream_to_fd(sockfd, fd, error_msg, sizeof(error_msg));
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+    
+    if (total_bytes < 0) {
+        printf("Error receiving data: %s\n", error_msg);
+    }
+    
+    //print appropriate message
+    if (total_bytes > 0) {
+        printf("Tar file received and saved as: %s (Total bytes: %lld)\n", full_filename, total_bytes);
+    } else {
+        printf("No data received or error occurred.\n");
+        //remove empty file
+        remove(full_filename);
+    }
+}
+
+//function to handle displaying files from the server.
+//a listing may come in pages; without a page size the next pages are requested until the listing is complete,
+//with one only the requested page is shown, followed by the command that shows the next one.
+void function_to_handle_display(int sockfd, const char* pathname, const char* options) {
+    char error_msg[DFS_MAX_CONTROL_PAYLOAD];
+    char cursor[DFS_MAX_CONTROL_PAYLOAD];
+    char next_options[DFS_MAX_CONTROL_PAYLOAD];
+
+    //options without their cursor, to which the cursor of each following page is added
+    char base_options[DFS_MAX_CONTROL_PAYLOAD] = "";
+    if (options) {
+        snprintf(base_options, sizeof(base_options), "%s", options);
+        char *after = strstr(base_options, "after=");
+        if (after) {
+            *after = '\0';
+        }
+    }
+    size_t base_length = strlen(base_options);
+    if (base_length > 0 && base_options[base_length - 1] != ',') {
+        snprintf(base_options + base_length, sizeof(base_options) - base_length, ",");
+    }
+
+    //list the file names from the directories that match
+    printf("Files in the directory:\n");
+    fflush(stdout);
+    while (1) {
+        if (function_to_receive_listing(sockfd, cursor, sizeof(cursor), error_msg, sizeof(error_msg)) < 0) {
+            //if there was any error
+            printf("Error receiving response from server: %s\n", error_msg);
+            break;
+        }
+        if (cursor[0] == '\0') {
+            break;
+        }
+        snprintf(next_options, sizeof(next_options), "%safter=%s", base_options, cursor);
+        if (options && strstr(options, "page=")) {
+            printf("More files available. Next page: display %s %s\n", pathname, next_options);
+            break;
+        }
+
+        //request the next page
+        uint32_t request_id = dfs_next_request_id();
+        char response[DFS_MAX_CONTROL_PAYLOAD];
+        struct dfs_frame reply;
+        if (dfs_send_request(sockfd, DFS_OP_DISPLAY, request_id, pathname, next_options) < 0 ||
+            dfs_recv_control(sockfd, &reply, response, sizeof(response)) < 0 || reply.opcode != DFS_OP_STATUS) {
+            printf("Error receiving response from server: Connection lost\n");
+            break;
+        }
+        if (reply.flags & DFS_FLAG_ERROR) {
+            printf("Server rejected request: %s\n", response);
+            break;
+        }
+    }
+    printf("\n");
+}
+
+//function to receive one page of a listing, printing the names as they arrive.
+//`cursor` receives the cursor of the next page, or an empty string when the listing is complete.
+int function_to_receive_listing(int sockfd, char* cursor, size_t cursor_size, char* error_msg, size_t error_size) {
+    char payload[DFS_MAX_CONTROL_PAYLOAD];
+    struct dfs_frame frame;
+    cursor[0] = '\0';
+    while (1) {
+        if (dfs_recv_control(sockfd, &frame, payload, sizeof(payload)) < 0) {
+            snprintf(error_msg, error_size, "Connection lost during transfer");
+            return -1;
+        }
+        if (frame.opcode == DFS_OP_STATUS) {
+            //the server aborted the listing
+            snprintf(error_msg, error_size, "%s", payload);
+            return -1;
+        }
+        if (frame.flags & DFS_FLAG_CURSOR) {
+            snprintf(cursor, cursor_size, "%s", payload);
+        } else {
+            fwrite(payload, 1, frame.length, stdout);
+        }
+        if (frame.flags & DFS_FLAG_END) {
+            fflush(stdout);
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,194 @@
+//dfs_backend.c
+//this file implements the keep-alive connection pool declared in dfs_backend.h.
+//Smain handles each client in a single thread (one process per client or one event loop),
+//so the pool is per process and needs no locking. in fork mode that process serves a single client:
+//parked connections are only reused between the requests of one client session, and the limits
+//apply to each client process rather than to the whole server.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "dfs_backend.h"
+#include "dfs_config.h"
+
+//a parked connection and when it was parked
+struct idle_conn {
+    int fd;
+    time_t since;
+};
+
+//pool state of one storage server
+struct backend {
+    int port;
+    struct idle_conn idle[DFS_BACKEND_IDLE_LIMIT];
+    struct dfs_backend_stats stats;
+};
+
+//Smain talks to two storage servers; a few spare slots keep the table generic
+#define MAX_BACKENDS 4
+
+static struct backend backends[MAX_BACKENDS];
+static int backend_count = 0;
+static int max_connections = DFS_BACKEND_DEFAULT_MAX_CONNS;
+static int max_idle = DFS_BACKEND_DEFAULT_MAX_IDLE;
+static int idle_timeout = DFS_BACKEND_DEFAULT_IDLE_TIMEOUT;
+
+//dfs_backend_configure: Sets the per-backend connection limit, the number of parked connections
+//kept per backend and how long a parked connection may stay unused.
+void dfs_backend_configure(int connections, int idle, int timeout_seconds) {
+    max_connections = connections > 0 ? connections : DFS_BACKEND_DEFAULT_MAX_CONNS;
+    max_idle = idle >= 0 ? idle : DFS_BACKEND_DEFAULT_MAX_IDLE;
+    if (max_idle > DFS_BACKEND_IDLE_LIMIT) {
+        max_idle = DFS_BACKEND_IDLE_LIMIT;
+    }
+    idle_timeout = timeout_seconds > 0 ? timeout_seconds : DFS_BACKEND_DEFAULT_IDLE_TIMEOUT;
+}
+
+//env_int: Returns the integer value of an environment variable, or `fallback` if it is not set.
+static int env_int(const char* name, int fallback) {
+    const char *value = getenv(name);
+    return value ? atoi(value) : fallback;
+}
+
+//dfs_backend_config_from_env: Reads DFS_BACKEND_MAX_CONNS, DFS_BACKEND_MAX_IDLE and DFS_BACKEND_IDLE_TIMEOUT.
+void dfs_backend_config_from_env(void) {
+    dfs_backend_configure(env_int("DFS_BACKEND_MAX_CONNS", DFS_BACKEND_DEFAULT_MAX_CONNS),
+                          env_int("DFS_BACKEND_MAX_IDLE", DFS_BACKEND_DEFAULT_MAX_IDLE),
+                          env_int("DFS_BACKEND_IDLE_TIMEOUT", DFS_BACKEND_DEFAULT_IDLE_TIMEOUT));
+}
+
+//find_backend: Returns the pool state for a port, creating it on first use.
+static struct backend* find_backend(int port) {
+    for (int i = 0; i < backend_count; i++) {
+        if (backends[i].port == port) {
+            return &backends[i];
+        }
+    }
+    if (backend_count == MAX_BACKENDS) {
+        return NULL;
+    }
+    struct backend *b = &backends[backend_count++];
+    memset(b, 0, sizeof(*b));
+    b->port = port;
+    return b;
+}
+
+//connection_is_healthy: Checks that a parked connection is still usable.
+//an idle connection must have nothing to read: readability means the server closed it or sent stray data.
+static int connection_is_healthy(int fd) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN | POLLRDHUP;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 0;
+}
+
+//dfs_backend_take_idle: Pops the most recently parked connection that passes the health check.
+int dfs_backend_take_idle(int port) {
+    struct backend *b = find_backend(port);
+    if (!b) {
+        return -1;
+    }
+    time_t now = time(NULL);
+    while (b->stats.idle > 0) {
+        struct idle_conn conn = b->idle[--b->stats.idle];
+        if (now - conn.since <= idle_timeout && connection_is_healthy(conn.fd)) {
+            b->stats.in_use++;
+            b->stats.reused++;
+            return conn.fd;
+        }
+        close(conn.fd);
+        b->stats.discarded++;
+    }
+    return -1;
+}
+
+//dfs_backend_connect: Opens a new connection to a storage server on the loopback interface.
+//a non-blocking connection is returned while still connecting; the caller checks SO_ERROR once it is writable.
+int dfs_backend_connect(int port, int nonblocking) {
+    struct backend *b = find_backend(port);
+    if (!b) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if ((int)b->stats.in_use >= max_connections) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0), 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    //request and status frames are small; send them without waiting for earlier acks (DFS_TCP_NODELAY),
+    //and size the buffers before connecting so the window scale covers them
+    dfs_config_tune_socket(sock);
+
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr);
+    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0 && !(nonblocking && errno == EINPROGRESS)) {
+        int saved_errno = errno;
+        close(sock);
+        errno = saved_errno;
+        return -1;
+    }
+    b->stats.in_use++;
+    b->stats.opened++;
+    return sock;
+}
+
+//dfs_backend_acquire: Returns a blocking connection to a storage server, reusing a parked one when possible.
+//`reused` tells the caller whether the connection may have gone stale since its last use.
+int dfs_backend_acquire(int port, int* reused) {
+    int sock = dfs_backend_take_idle(port);
+    if (reused) {
+        *reused = sock >= 0;
+    }
+    if (sock < 0) {
+        sock = dfs_backend_connect(port, 0);
+    }
+    return sock;
+}
+
+//dfs_backend_release: Parks a connection for reuse, or closes it if it is not reusable or the pool is full.
+void dfs_backend_release(int port, int fd, int reusable) {
+    struct backend *b = find_backend(port);
+    if (!b) {
+        close(fd);
+        return;
+    }
+    if (b->stats.in_use > 0) {
+        b->stats.in_use--;
+    }
+    if (!reusable || (int)b->stats.idle >= max_idle) {
+        close(fd);
+        return;
+    }
+    b->idle[b->stats.idle].fd = fd;
+    b->idle[b->stats.idle].since = time(NULL);
+    b->stats.idle++;
+}
+
+//dfs_backend_get_stats: Copies the pool counters of one backend.
+//it only looks the backend up, so another thread may read the counters, e.g. to serve the metrics.
+void dfs_backend_get_stats(int port, struct dfs_backend_stats* out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < backend_count; i++) {
+        if (backends[i].port == port) {
+            *out = backends[i].stats;
+        }
+    }
+}
@@ -0,0 +1,41 @@
+//dfs_backend.h
+//this header declares the keep-alive connection pool Smain uses to reach Spdf and Stext.
+//finished connections are parked per backend and reused by later requests instead of paying
+//a connect/accept handshake every time; each connection carries one request at a time and
+//replies are matched to requests by their request id. the pool belongs to the process using it,
+//so with one process per client it only spans the requests of that client.
+#ifndef DFS_BACKEND_H
+#define DFS_BACKEND_H
+
+//defaults used when DFS_BACKEND_MAX_CONNS / DFS_BACKEND_MAX_IDLE / DFS_BACKEND_IDLE_TIMEOUT are not set
+#define DFS_BACKEND_DEFAULT_MAX_CONNS 16
+#define DFS_BACKEND_DEFAULT_MAX_IDLE 4
+#define DFS_BACKEND_DEFAULT_IDLE_TIMEOUT 30
+//upper bound for the number of idle connections kept per backend
+#define DFS_BACKEND_IDLE_LIMIT 64
+
+//per-backend pool counters
+struct dfs_backend_stats {
+    unsigned int in_use;               //connections handed out and not yet released
+    unsigned int idle;                 //connections parked for reuse
+    unsigned long long opened;         //new connections made
+    unsigned long long reused;         //requests served on a parked connection
+    unsigned long long discarded;      //parked connections dropped by the health check or the idle timeout
+};
+
+//pool configuration, applied before the first connection
+void dfs_backend_configure(int max_connections, int max_idle, int idle_timeout_seconds);
+void dfs_backend_config_from_env(void);
+
+//dfs_backend_take_idle() returns a healthy parked connection or -1.
+//dfs_backend_connect() opens a new connection (non-blocking ones may still be connecting)
+//and fails with EAGAIN once the backend's connection limit is reached.
+int dfs_backend_take_idle(int port);
+int dfs_backend_connect(int port, int nonblocking);
+int dfs_backend_acquire(int port, int* reused);
+
+//hands a connection back; only connections whose last exchange completed cleanly may be reused
+void dfs_backend_release(int port, int fd, int reusable);
+void dfs_backend_get_stats(int port, struct dfs_backend_stats* out);
+
+#endif
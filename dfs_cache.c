@@ -0,0 +1,545 @@
+//dfs_cache.c
+//this file implements the download cache declared in dfs_cache.h.
+//the index is a fixed table of entries in a shared mapping. it is searched linearly: with a few thousand
+//entries a scan costs microseconds, next to the backend round trip a hit saves.
+//every stored file is named after a serial number that is never reused, so a file being filled, served or
+//unlinked can never be confused with a newer copy of the same path.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "dfs_cache.h"
+#include "dfs_frame.h"
+#include "dfs_sha256.h"
+#include "dfs_xfer.h"
+
+//states of an index entry
+#define ENTRY_FREE 0
+#define ENTRY_FILLING 1     //a download is being copied into the memory tier (or the disk tier without one)
+#define ENTRY_MEMORY 2
+#define ENTRY_DEMOTING 3    //in the memory tier while a copy is written to the disk tier
+#define ENTRY_DISK 4
+
+//one cached file
+struct cache_entry {
+    unsigned char key[DFS_SHA256_SIZE];    //SHA-256 of the normalised path
+    int state;
+    int stale;                             //invalidated while it was filled or demoted
+    pid_t filler;                          //process filling it, to reclaim fills of processes that died
+    uint64_t size;
+    uint64_t last_used;
+    uint64_t serial;
+};
+
+//the shared index
+struct cache_shared {
+    pthread_mutex_t lock;
+    uint64_t clock;
+    uint64_t next_serial;
+    struct dfs_cache_stats stats;
+    struct cache_entry entries[];
+};
+
+static uint64_t memory_limit = (uint64_t)DFS_CACHE_DEFAULT_MEMORY_MB << 20;
+static uint64_t disk_limit = (uint64_t)DFS_CACHE_DEFAULT_DISK_MB << 20;
+static uint64_t max_file = (uint64_t)DFS_CACHE_DEFAULT_MAX_FILE_MB << 20;
+static int entry_count = DFS_CACHE_DEFAULT_ENTRIES;
+static char memory_root[PATH_MAX] = DFS_CACHE_DEFAULT_MEMORY_DIR;
+static char memory_dir[PATH_MAX];
+static char disk_dir[PATH_MAX];
+static struct cache_shared *cache = NULL;
+
+//dfs_cache_configure: Sets the size of both tiers, the largest file stored, the number of files indexed
+//and the tmpfs directory holding the memory tier.
+void dfs_cache_configure(long memory_mb, long disk_mb, long max_file_mb, int entries, const char* memory_directory) {
+    memory_limit = memory_mb > 0 ? (uint64_t)memory_mb << 20 : 0;
+    disk_limit = disk_mb > 0 ? (uint64_t)disk_mb << 20 : 0;
+    max_file = max_file_mb > 0 ? (uint64_t)max_file_mb << 20 : (uint64_t)DFS_CACHE_DEFAULT_MAX_FILE_MB << 20;
+    entry_count = entries > 0 ? entries : DFS_CACHE_DEFAULT_ENTRIES;
+    if (entry_count > DFS_CACHE_ENTRY_LIMIT) {
+        entry_count = DFS_CACHE_ENTRY_LIMIT;
+    }
+    snprintf(memory_root, sizeof(memory_root), "%s", memory_directory && memory_directory[0] ? memory_directory : DFS_CACHE_DEFAULT_MEMORY_DIR);
+}
+
+//env_long: Returns the integer value of an environment variable, or `fallback` if it is not set.
+static long env_long(const char* name, long fallback) {
+    const char *value = getenv(name);
+    return value ? atol(value) : fallback;
+}
+
+//dfs_cache_config_from_env: Reads DFS_CACHE_MEMORY_MB, DFS_CACHE_DISK_MB, DFS_CACHE_MAX_FILE_MB,
+//DFS_CACHE_ENTRIES and DFS_CACHE_MEMORY_DIR.
+void dfs_cache_config_from_env(void) {
+    dfs_cache_configure(env_long("DFS_CACHE_MEMORY_MB", DFS_CACHE_DEFAULT_MEMORY_MB),
+                        env_long("DFS_CACHE_DISK_MB", DFS_CACHE_DEFAULT_DISK_MB),
+                        env_long("DFS_CACHE_MAX_FILE_MB", DFS_CACHE_DEFAULT_MAX_FILE_MB),
+                        (int)env_long("DFS_CACHE_ENTRIES", DFS_CACHE_DEFAULT_ENTRIES),
+                        getenv("DFS_CACHE_MEMORY_DIR"));
+}
+
+//empty_directory: Creates `path` if needed and unlinks the files an earlier run left in it.
+static int empty_directory(const char* path) {
+    if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+//dfs_cache_init: Creates the tier directories and the shared index.
+int dfs_cache_init(const char* root) {
+    if (memory_limit == 0 && disk_limit == 0) {
+        return -1;
+    }
+    if (max_file > (memory_limit ? memory_limit : disk_limit)) {
+        max_file = memory_limit ? memory_limit : disk_limit;
+    }
+
+    //servers with different storage directories get their own memory tier on the shared tmpfs
+    unsigned char digest[DFS_SHA256_SIZE];
+    char hex[DFS_SHA256_HEX_SIZE + 1];
+    struct dfs_sha256 ctx;
+    dfs_sha256_init(&ctx);
+    dfs_sha256_update(&ctx, root, strlen(root));
+    dfs_sha256_final(&ctx, digest);
+    dfs_sha256_hex(digest, hex);
+    snprintf(memory_dir, sizeof(memory_dir), "%s/dfs-cache-%.16s", memory_root, hex);
+    snprintf(disk_dir, sizeof(disk_dir), "%s.cache", root);
+    if ((memory_limit && empty_directory(memory_dir) < 0) || (disk_limit && empty_directory(disk_dir) < 0)) {
+        return -1;
+    }
+
+    size_t size = sizeof(struct cache_shared) + (size_t)entry_count * sizeof(struct cache_entry);
+    struct cache_shared *shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return -1;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    cache = shared;
+    return 0;
+}
+
+//dfs_cache_enabled: Returns 1 if the cache was set up.
+int dfs_cache_enabled(void) {
+    return cache != NULL;
+}
+
+//cache_key: Hashes a path after collapsing repeated slashes, so "a//b.txt" and "a/b.txt" share an entry.
+static void cache_key(const char* path, unsigned char key[DFS_SHA256_SIZE]) {
+    char normal[PATH_MAX];
+    size_t length = 0;
+    for (const char *p = path; *p && length < sizeof(normal) - 1; p++) {
+        if (*p == '/' && length > 0 && normal[length - 1] == '/') {
+            continue;
+        }
+        normal[length++] = *p;
+    }
+    struct dfs_sha256 ctx;
+    dfs_sha256_init(&ctx);
+    dfs_sha256_update(&ctx, normal, length);
+    dfs_sha256_final(&ctx, key);
+}
+
+//entry_path: Names the file of an entry in the tier it is stored in.
+static void entry_path(uint64_t serial, int disk, char* path, size_t capacity) {
+    snprintf(path, capacity, "%s/%llu", disk ? disk_dir : memory_dir, (unsigned long long)serial);
+}
+
+//stored_on_disk: Returns whether an entry's file is in the disk tier; fills go there only without a memory tier.
+static int stored_on_disk(const struct cache_entry* e) {
+    return e->state == ENTRY_DISK || (e->state == ENTRY_FILLING && memory_limit == 0);
+}
+
+//find_entry: Returns the slot holding `key`, or -1. the caller holds the lock.
+static int find_entry(const unsigned char key[DFS_SHA256_SIZE]) {
+    for (int i = 0; i < entry_count; i++) {
+        if (cache->entries[i].state != ENTRY_FREE && memcmp(cache->entries[i].key, key, DFS_SHA256_SIZE) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//drop_entry: Unlinks an entry's file and frees its slot. the caller holds the lock.
+static void drop_entry(struct cache_entry* e) {
+    char path[PATH_MAX];
+    entry_path(e->serial, stored_on_disk(e), path, sizeof(path));
+    unlink(path);
+    if (e->state == ENTRY_MEMORY || e->state == ENTRY_DEMOTING) {
+        cache->stats.memory_bytes -= e->size;
+    } else if (e->state == ENTRY_DISK) {
+        cache->stats.disk_bytes -= e->size;
+    }
+    if (e->state != ENTRY_FILLING) {
+        cache->stats.files--;
+    }
+    e->state = ENTRY_FREE;
+}
+
+//least_recent: Returns the least recently used entry in `state`, or -1. the caller holds the lock.
+static int least_recent(int state) {
+    int oldest = -1;
+    for (int i = 0; i < entry_count; i++) {
+        if (cache->entries[i].state == state && (oldest < 0 || cache->entries[i].last_used < cache->entries[oldest].last_used)) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+//dfs_cache_open: Opens the cached copy of a path.
+int dfs_cache_open(const char* path, uint64_t* size, int* tier) {
+    if (!cache) {
+        return -1;
+    }
+    unsigned char key[DFS_SHA256_SIZE];
+    cache_key(path, key);
+
+    //the file is opened under the lock, so an eviction right after cannot take it away
+    int fd = -1;
+    pthread_mutex_lock(&cache->lock);
+    int slot = find_entry(key);
+    struct cache_entry *e = slot >= 0 ? &cache->entries[slot] : NULL;
+    if (e && e->state != ENTRY_FILLING && !e->stale) {
+        char file[PATH_MAX];
+        entry_path(e->serial, e->state == ENTRY_DISK, file, sizeof(file));
+        fd = open(file, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            e->last_used = ++cache->clock;
+            *size = e->size;
+            *tier = e->state == ENTRY_DISK ? DFS_CACHE_DISK : DFS_CACHE_MEMORY;
+            if (*tier == DFS_CACHE_DISK) {
+                cache->stats.disk_hits++;
+            } else {
+                cache->stats.memory_hits++;
+            }
+        } else {
+            drop_entry(e);
+        }
+    }
+    if (fd < 0) {
+        cache->stats.misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return fd;
+}
+
+//dfs_cache_fill_begin: Reserves an entry for a download and creates its file.
+int dfs_cache_fill_begin(struct dfs_cache_fill* fill, const char* path) {
+    memset(fill, 0, sizeof(*fill));
+    fill->fd = -1;
+    if (!cache) {
+        return -1;
+    }
+    unsigned char key[DFS_SHA256_SIZE];
+    cache_key(path, key);
+
+    pthread_mutex_lock(&cache->lock);
+    int slot = find_entry(key);
+    if (slot >= 0) {
+        //another download stores this path already, unless the process doing it has died
+        struct cache_entry *e = &cache->entries[slot];
+        if (e->state != ENTRY_FILLING || kill(e->filler, 0) == 0 || errno != ESRCH) {
+            pthread_mutex_unlock(&cache->lock);
+            return -1;
+        }
+        drop_entry(e);
+    }
+    slot = least_recent(ENTRY_FREE);
+    if (slot < 0) {
+        //every slot is taken: the least recently used file makes room, preferring the disk tier
+        slot = least_recent(ENTRY_DISK);
+        if (slot < 0) {
+            slot = least_recent(ENTRY_MEMORY);
+        }
+        if (slot < 0) {
+            pthread_mutex_unlock(&cache->lock);
+            return -1;
+        }
+        drop_entry(&cache->entries[slot]);
+        cache->stats.evictions++;
+    }
+    struct cache_entry *e = &cache->entries[slot];
+    memcpy(e->key, key, DFS_SHA256_SIZE);
+    e->state = ENTRY_FILLING;
+    e->stale = 0;
+    e->filler = getpid();
+    e->size = 0;
+    e->serial = ++cache->next_serial;
+    fill->serial = e->serial;
+    pthread_mutex_unlock(&cache->lock);
+
+    char file[PATH_MAX];
+    entry_path(fill->serial, memory_limit == 0, file, sizeof(file));
+    fill->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    fill->slot = slot;
+    fill->active = 1;
+    if (fill->fd < 0) {
+        fill->failed = 1;
+    }
+    return 0;
+}
+
+//dfs_cache_fill_write: Appends relayed data to a fill.
+void dfs_cache_fill_write(struct dfs_cache_fill* fill, const void* data, size_t length) {
+    if (!fill->active || fill->failed) {
+        return;
+    }
+    if (fill->written + length > max_file || dfs_write_full(fill->fd, data, length) < 0) {
+        fill->failed = 1;
+        return;
+    }
+    fill->written += length;
+}
+
+//copy_file: Copies a memory tier file into the disk tier. returns 0 or -1.
+static int copy_file(const char* from, const char* to, uint64_t size) {
+    int in = open(from, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -1;
+    }
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    uint64_t copied = 0;
+    while (copied < size) {
+        ssize_t n = sendfile(out, in, NULL, size - copied);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        copied += n;
+    }
+    close(in);
+    if (close(out) < 0 || copied < size) {
+        unlink(to);
+        return -1;
+    }
+    return 0;
+}
+
+//make_disk_room: Drops the least recently used disk tier files until `size` more bytes fit.
+//returns 0, or -1 if the file can never fit. the caller holds the lock.
+static int make_disk_room(uint64_t size) {
+    if (size > disk_limit) {
+        return -1;
+    }
+    while (cache->stats.disk_bytes + size > disk_limit) {
+        int victim = least_recent(ENTRY_DISK);
+        if (victim < 0) {
+            return -1;
+        }
+        drop_entry(&cache->entries[victim]);
+        cache->stats.evictions++;
+    }
+    return 0;
+}
+
+//make_memory_room: Moves the least recently used memory tier files to the disk tier, or drops them, until the
+//memory tier fits in its limit again. the copy is made without the lock, so other processes keep using the cache.
+static void make_memory_room(void) {
+    while (1) {
+        pthread_mutex_lock(&cache->lock);
+        int victim = cache->stats.memory_bytes > memory_limit ? least_recent(ENTRY_MEMORY) : -1;
+        if (victim < 0) {
+            pthread_mutex_unlock(&cache->lock);
+            return;
+        }
+        struct cache_entry *e = &cache->entries[victim];
+        if (disk_limit == 0) {
+            drop_entry(e);
+            cache->stats.evictions++;
+            pthread_mutex_unlock(&cache->lock);
+            continue;
+        }
+        //the file stays readable in the memory tier while it is copied
+        e->state = ENTRY_DEMOTING;
+        e->stale = 0;
+        uint64_t serial = e->serial;
+        uint64_t size = e->size;
+        pthread_mutex_unlock(&cache->lock);
+
+        char from[PATH_MAX];
+        char to[PATH_MAX];
+        entry_path(serial, 0, from, sizeof(from));
+        entry_path(serial, 1, to, sizeof(to));
+        int copied = copy_file(from, to, size) == 0;
+
+        pthread_mutex_lock(&cache->lock);
+        if (e->state != ENTRY_DEMOTING || e->serial != serial) {
+            //the entry was invalidated and reused during the copy
+            if (copied) {
+                unlink(to);
+            }
+        } else if (!copied || e->stale || make_disk_room(size) < 0) {
+            if (copied) {
+                unlink(to);
+            }
+            drop_entry(e);
+            cache->stats.evictions++;
+        } else {
+            unlink(from);
+            cache->stats.memory_bytes -= size;
+            cache->stats.disk_bytes += size;
+            e->state = ENTRY_DISK;
+            cache->stats.demotions++;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+}
+
+//dfs_cache_fill_end: Publishes or discards a fill.
+void dfs_cache_fill_end(struct dfs_cache_fill* fill, int complete) {
+    if (!fill->active) {
+        return;
+    }
+    fill->active = 0;
+    if (fill->fd >= 0 && close(fill->fd) < 0) {
+        fill->failed = 1;
+    }
+    fill->fd = -1;
+
+    pthread_mutex_lock(&cache->lock);
+    struct cache_entry *e = &cache->entries[fill->slot];
+    if (e->state != ENTRY_FILLING || e->serial != fill->serial) {
+        //the slot was reclaimed meanwhile
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+    if (!complete || fill->failed || e->stale || (memory_limit == 0 && make_disk_room(fill->written) < 0)) {
+        drop_entry(e);
+        cache->stats.abandoned_fills++;
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+    e->size = fill->written;
+    e->last_used = ++cache->clock;
+    e->state = memory_limit ? ENTRY_MEMORY : ENTRY_DISK;
+    if (memory_limit) {
+        cache->stats.memory_bytes += e->size;
+    } else {
+        cache->stats.disk_bytes += e->size;
+    }
+    cache->stats.files++;
+    cache->stats.fills++;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (memory_limit) {
+        make_memory_room();
+    }
+}
+
+//dfs_cache_relay: Forwards a download stream frame by frame, copying DATA payloads into the fill.
+//payloads pass through a buffer instead of a pipe, since they have to be read to be stored.
+long long dfs_cache_relay(int source_sock, int dest_sock, uint32_t request_id, struct dfs_cache_fill* fill) {
+    size_t chunk_size = dfs_data_chunk_size();
+    char *buffer = malloc(chunk_size);
+    if (!buffer) {
+        return -1;
+    }
+    long long total_bytes = 0;
+    struct dfs_frame frame;
+
+    while (1) {
+        if (dfs_recv_header(source_sock, &frame) < 0 || (frame.opcode != DFS_OP_DATA && frame.opcode != DFS_OP_STATUS)) {
+            free(buffer);
+            return -1;
+        }
+        int is_error = frame.opcode == DFS_OP_STATUS;
+        if (frame.flags & DFS_FLAG_COMPRESSED) {
+            //compressed payloads are not the file's bytes
+            fill->failed = 1;
+        }
+        unsigned char header[DFS_FRAME_HEADER_SIZE];
+        dfs_encode_header(header, frame.opcode, frame.flags, request_id, frame.length);
+        if (dfs_write_full(dest_sock, header, sizeof(header)) < 0) {
+            free(buffer);
+            return -1;
+        }
+        for (uint32_t left = frame.length; left > 0;) {
+            size_t piece = left < chunk_size ? left : chunk_size;
+            if (dfs_read_full(source_sock, buffer, piece) < 0 || dfs_write_full(dest_sock, buffer, piece) < 0) {
+                free(buffer);
+                return -1;
+            }
+            if (!is_error) {
+                dfs_cache_fill_write(fill, buffer, piece);
+            }
+            dfs_xfer_count(0, piece);
+            left -= piece;
+        }
+        if (is_error) {
+            free(buffer);
+            return -1;
+        }
+        total_bytes += frame.length;
+        if (frame.flags & DFS_FLAG_END) {
+            free(buffer);
+            return total_bytes;
+        }
+    }
+}
+
+//dfs_cache_invalidate: Drops a path's cached copy, or marks its running fill or demotion stale.
+void dfs_cache_invalidate(const char* path) {
+    if (!cache) {
+        return;
+    }
+    unsigned char key[DFS_SHA256_SIZE];
+    cache_key(path, key);
+    pthread_mutex_lock(&cache->lock);
+    int slot = find_entry(key);
+    if (slot >= 0) {
+        struct cache_entry *e = &cache->entries[slot];
+        if (e->state == ENTRY_FILLING || e->state == ENTRY_DEMOTING) {
+            e->stale = 1;
+        } else {
+            drop_entry(e);
+        }
+        cache->stats.invalidations++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+//dfs_cache_get_stats: Copies the cache counters.
+void dfs_cache_get_stats(struct dfs_cache_stats* out) {
+    memset(out, 0, sizeof(*out));
+    if (!cache) {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    *out = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
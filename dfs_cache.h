@@ -0,0 +1,88 @@
+//dfs_cache.h
+//this header declares the cache through which Smain serves hot .txt and .pdf downloads without asking Spdf or
+//Stext again. a full download relayed from a storage server is copied into a cache file as it passes; later
+//downloads of the same path, ranged or not, are sent from that file with sendfile().
+//the cache has two tiers. the memory tier keeps its files on a tmpfs (/dev/shm); when it is full the least
+//recently used files move to the optional disk tier next to the storage directory (root + ".cache"), and when
+//that is full too they are dropped. uploads and removals that go through Smain invalidate a path, so the cache
+//never serves a file older than the last change Smain relayed.
+//the index of cached files lives in a shared mapping guarded by a process-shared mutex, so every client process
+//of the fork server sees the same cache. an evicted file is only unlinked; a download that already opened it
+//finishes from the open descriptor.
+#ifndef DFS_CACHE_H
+#define DFS_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+//defaults used when DFS_CACHE_MEMORY_MB / DFS_CACHE_DISK_MB / DFS_CACHE_MAX_FILE_MB / DFS_CACHE_ENTRIES /
+//DFS_CACHE_MEMORY_DIR are not set
+#define DFS_CACHE_DEFAULT_MEMORY_MB 64
+#define DFS_CACHE_DEFAULT_DISK_MB 0
+#define DFS_CACHE_DEFAULT_MAX_FILE_MB 8
+#define DFS_CACHE_DEFAULT_ENTRIES 4096
+#define DFS_CACHE_DEFAULT_MEMORY_DIR "/dev/shm"
+//upper bound for the number of cached files
+#define DFS_CACHE_ENTRY_LIMIT 65536
+
+//tiers a file is served from
+#define DFS_CACHE_MISS 0
+#define DFS_CACHE_MEMORY 1
+#define DFS_CACHE_DISK 2
+
+//counters shared by all processes
+struct dfs_cache_stats {
+    unsigned long long memory_hits;
+    unsigned long long disk_hits;
+    unsigned long long misses;
+    unsigned long long fills;              //downloads stored in the cache
+    unsigned long long abandoned_fills;    //downloads that failed, grew too large or were invalidated while stored
+    unsigned long long demotions;          //files moved from the memory tier to the disk tier
+    unsigned long long evictions;          //files dropped to make room
+    unsigned long long invalidations;      //cached files dropped by an upload or removal
+    unsigned long long memory_bytes;       //bytes held by each tier
+    unsigned long long disk_bytes;
+    unsigned long files;
+};
+
+//a download being copied into the cache; `active` is 0 when the download is not stored
+struct dfs_cache_fill {
+    int active;
+    int fd;
+    int slot;
+    uint64_t serial;
+    uint64_t written;
+    int failed;
+};
+
+//cache configuration, applied before dfs_cache_init(); sizes in MiB, a memory and disk size of 0 disable the cache
+void dfs_cache_configure(long memory_mb, long disk_mb, long max_file_mb, int entries, const char* memory_dir);
+void dfs_cache_config_from_env(void);
+
+//dfs_cache_init() creates both tiers for the storage directory `root`, emptying what an earlier run left there,
+//and the shared index. call it before forking. returns 0, or -1 (the cache is then disabled).
+int dfs_cache_init(const char* root);
+int dfs_cache_enabled(void);
+
+//dfs_cache_open() returns a descriptor of the cached copy of `path` and its size, or -1 on a miss.
+//`tier` receives DFS_CACHE_MEMORY or DFS_CACHE_DISK.
+int dfs_cache_open(const char* path, uint64_t* size, int* tier);
+
+//dfs_cache_fill_begin() starts storing a download of `path`; it returns -1 if the cache is disabled or the path
+//is already being stored. dfs_cache_fill_write() copies relayed data into the fill and drops the fill once it
+//exceeds the size limit. dfs_cache_fill_end() publishes a complete fill, or discards it.
+int dfs_cache_fill_begin(struct dfs_cache_fill* fill, const char* path);
+void dfs_cache_fill_write(struct dfs_cache_fill* fill, const void* data, size_t length);
+void dfs_cache_fill_end(struct dfs_cache_fill* fill, int complete);
+
+//dfs_cache_relay() forwards a download stream like dfs_relay_stream() with its END flag and copies it into
+//`fill`. returns the number of payload bytes relayed or -1 on error.
+long long dfs_cache_relay(int source_sock, int dest_sock, uint32_t request_id, struct dfs_cache_fill* fill);
+
+//dfs_cache_invalidate() drops the cached copy of `path` after it was uploaded or removed; a fill of the path
+//that is still running is discarded when it ends.
+void dfs_cache_invalidate(const char* path);
+void dfs_cache_get_stats(struct dfs_cache_stats* out);
+
+#endif
@@ -0,0 +1,1163 @@
+//dfs_chunk.c
+//this file implements the deduplicating chunk store declared in dfs_chunk.h.
+//chunk boundaries come from a gear hash: every byte shifts the hash left and adds a random 64 bit value for
+//that byte, and a boundary is cut where the top bits of the hash are zero. before the average size a
+//stricter mask is used and after it a looser one, which keeps chunk sizes close to the average.
+//chunks live in root + ".chunks"/ab/cdef... (the first two hex digits fan out the directory), and the
+//reference counts are kept in memory: dfs_chunk_init() rebuilds them from the recipes below the root.
+//recipes are marked with DFS_CHUNK_RECIPE_XATTR. stores older than the mark told them by their magic alone, so
+//until the store holds STORE_MARKED, dfs_chunk_init() marks the files that parse as recipes and whose chunks are
+//all in the store, once.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+
+#include "dfs_chunk.h"
+#include "dfs_compress.h"
+#include "dfs_frame.h"
+#include "dfs_xfer.h"
+
+#define CHUNK_MIN_BUCKETS 4096
+//masks for the gear hash: 2 bits stricter than the average before it, 2 bits looser after it
+#define CHUNK_MASK_STRICT 0xffffc00000000000ULL
+#define CHUNK_MASK_LOOSE 0xfffc000000000000ULL
+//longest recipe line: hex digest, space, length, newline
+#define RECIPE_LINE_SIZE (DFS_SHA256_HEX_SIZE + 32)
+//file in the store telling that its recipes are all marked
+#define STORE_MARKED ".marked"
+//locks serializing the changes of stored files, picked by a hash of the path
+#define PATH_LOCKS 64
+
+//one chunk of the store, the number of recipe entries using it and the number of open files reading it.
+//a chunk is deleted once both are zero, so a download keeps the chunks of a file removed under it.
+struct chunk_ref {
+    struct chunk_ref *next;
+    unsigned char digest[DFS_SHA256_SIZE];
+    uint32_t length;
+    unsigned long refs;
+    unsigned long readers;
+};
+
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct chunk_ref **chunk_table = NULL;
+static size_t chunk_buckets = 0;
+static struct dfs_chunk_store_stats chunk_totals;
+static bool chunk_ready = false;
+static bool chunk_dedup = false;
+static bool chunk_adopting = false;      //dfs_chunk_init() is marking the recipes of an older store
+static bool chunk_adopt_failed = false;
+static char chunk_root[PATH_MAX];
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t path_locks[PATH_LOCKS];
+static pthread_once_t path_locks_once = PTHREAD_ONCE_INIT;
+
+//init_gear: Fills the gear table from a fixed seed so every server cuts the same data at the same places.
+static void init_gear(void) {
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < 256; i++) {
+        //splitmix64
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+static void init_path_locks(void) {
+    for (int i = 0; i < PATH_LOCKS; i++) {
+        pthread_mutex_init(&path_locks[i], NULL);
+    }
+}
+
+//path_lock: Returns the lock of `path`. repeated slashes are skipped, so every spelling of a path the servers
+//build gets the same lock.
+static pthread_mutex_t* path_lock(const char* path) {
+    pthread_once(&path_locks_once, init_path_locks);
+    uint32_t hash = 2166136261u;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' && p[1] == '/') {
+            continue;
+        }
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return &path_locks[hash % PATH_LOCKS];
+}
+
+//find_boundary: Returns the length of the chunk starting at `data`.
+static size_t find_boundary(const unsigned char* data, size_t length) {
+    if (length <= DFS_CHUNK_MIN_SIZE) {
+        return length;
+    }
+    size_t limit = length < DFS_CHUNK_MAX_SIZE ? length : DFS_CHUNK_MAX_SIZE;
+    size_t middle = limit < DFS_CHUNK_AVERAGE_SIZE ? limit : DFS_CHUNK_AVERAGE_SIZE;
+    uint64_t hash = 0;
+    size_t i = DFS_CHUNK_MIN_SIZE;
+    for (; i < middle; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CHUNK_MASK_STRICT)) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CHUNK_MASK_LOOSE)) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+//chunk_path: Writes the path of the chunk with `digest`; with `dir_only` set, the path of its fanout directory.
+static void chunk_path(const unsigned char* digest, char* out, size_t capacity, bool dir_only) {
+    char hex[DFS_SHA256_HEX_SIZE + 1];
+    dfs_sha256_hex(digest, hex);
+    if (dir_only) {
+        snprintf(out, capacity, "%s.chunks/%.2s", chunk_root, hex);
+    } else {
+        snprintf(out, capacity, "%s.chunks/%.2s/%s", chunk_root, hex, hex + 2);
+    }
+}
+
+static size_t bucket_of(const unsigned char* digest, size_t buckets) {
+    uint64_t key;
+    memcpy(&key, digest, sizeof(key));
+    return key & (buckets - 1);
+}
+
+//find_ref: Looks a chunk up. the caller holds chunk_lock.
+static struct chunk_ref* find_ref(const unsigned char* digest) {
+    for (struct chunk_ref *ref = chunk_table[bucket_of(digest, chunk_buckets)]; ref != NULL; ref = ref->next) {
+        if (memcmp(ref->digest, digest, DFS_SHA256_SIZE) == 0) {
+            return ref;
+        }
+    }
+    return NULL;
+}
+
+//insert_ref: Adds a chunk with no references, growing the table as needed. the caller holds chunk_lock.
+static struct chunk_ref* insert_ref(const unsigned char* digest, uint32_t length) {
+    if (chunk_totals.chunks + 1 > chunk_buckets) {
+        size_t buckets = chunk_buckets * 2;
+        struct chunk_ref **table = calloc(buckets, sizeof(*table));
+        if (table != NULL) {
+            for (size_t i = 0; i < chunk_buckets; i++) {
+                while (chunk_table[i] != NULL) {
+                    struct chunk_ref *ref = chunk_table[i];
+                    chunk_table[i] = ref->next;
+                    size_t bucket = bucket_of(ref->digest, buckets);
+                    ref->next = table[bucket];
+                    table[bucket] = ref;
+                }
+            }
+            free(chunk_table);
+            chunk_table = table;
+            chunk_buckets = buckets;
+        }
+    }
+    struct chunk_ref *ref = calloc(1, sizeof(*ref));
+    if (ref == NULL) {
+        return NULL;
+    }
+    memcpy(ref->digest, digest, DFS_SHA256_SIZE);
+    ref->length = length;
+    size_t bucket = bucket_of(digest, chunk_buckets);
+    ref->next = chunk_table[bucket];
+    chunk_table[bucket] = ref;
+    chunk_totals.chunks++;
+    chunk_totals.stored_bytes += length;
+    return ref;
+}
+
+//find_link: Returns the link pointing to a chunk, or NULL if the store lacks it. the caller holds chunk_lock.
+static struct chunk_ref** find_link(const unsigned char* digest) {
+    size_t bucket = bucket_of(digest, chunk_buckets);
+    for (struct chunk_ref **link = &chunk_table[bucket]; *link != NULL; link = &(*link)->next) {
+        if (memcmp((*link)->digest, digest, DFS_SHA256_SIZE) == 0) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+//remove_unused: Deletes the chunk `link` points to if no recipe uses it and no open file reads it.
+//the caller holds chunk_lock.
+static void remove_unused(struct chunk_ref** link) {
+    struct chunk_ref *ref = *link;
+    if (ref->refs > 0 || ref->readers > 0) {
+        return;
+    }
+    char path[PATH_MAX];
+    chunk_path(ref->digest, path, sizeof(path), false);
+    unlink(path);
+    chunk_totals.chunks--;
+    chunk_totals.stored_bytes -= ref->length;
+    *link = ref->next;
+    free(ref);
+}
+
+//drop_ref: Removes one reference to a chunk and deletes the chunk with its last one. the caller holds chunk_lock.
+static void drop_ref(const unsigned char* digest) {
+    struct chunk_ref **link = find_link(digest);
+    if (link == NULL) {
+        return;
+    }
+    chunk_totals.referenced_bytes -= (*link)->length;
+    (*link)->refs--;
+    remove_unused(link);
+}
+
+//pin_recipe: Marks the chunks of a recipe as read by one more open file, or one fewer with `pin` false.
+static void pin_recipe(const struct dfs_chunk_recipe* recipe, bool pin) {
+    pthread_mutex_lock(&chunk_lock);
+    for (size_t i = 0; i < recipe->count; i++) {
+        struct chunk_ref **link = find_link(recipe->chunks[i].digest);
+        if (link == NULL) {
+            continue;
+        }
+        if (pin) {
+            (*link)->readers++;
+        } else {
+            (*link)->readers--;
+            remove_unused(link);
+        }
+    }
+    pthread_mutex_unlock(&chunk_lock);
+}
+
+//write_chunk: Saves a chunk the store does not have, through a temporary file so readers never see part of it.
+//chunks are not synced one by one: dfs_chunk_save_recipe() syncs the store once before the recipe replaces the file.
+static int write_chunk(const unsigned char* digest, const unsigned char* data, size_t length) {
+    char path[PATH_MAX];
+    char temp_path[PATH_MAX + 16];
+    chunk_path(digest, path, sizeof(path), true);
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    chunk_path(digest, path, sizeof(path), false);
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (dfs_write_full(fd, data, length) < 0) {
+        close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+    close(fd);
+    if (rename(temp_path, path) < 0) {
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+//parse_recipe: Reads the recipe open on `fd`. returns NULL if it is not a valid recipe.
+static struct dfs_chunk_recipe* parse_recipe(int fd) {
+    int copy = dup(fd);
+    if (copy < 0) {
+        return NULL;
+    }
+    FILE *file = fdopen(copy, "r");
+    if (file == NULL) {
+        close(copy);
+        return NULL;
+    }
+    struct dfs_chunk_recipe *recipe = calloc(1, sizeof(*recipe));
+    size_t capacity = 0;
+    char line[RECIPE_LINE_SIZE];
+    char hex[DFS_SHA256_HEX_SIZE + 1];
+    unsigned long long size;
+    bool valid = recipe != NULL && fseeko(file, 0, SEEK_SET) == 0;
+
+    //header: magic, then "size N sha256 HEX"
+    if (valid) {
+        valid = fgets(line, sizeof(line), file) != NULL && strcmp(line, DFS_CHUNK_RECIPE_MAGIC) == 0 &&
+                fgets(line, sizeof(line), file) != NULL &&
+                sscanf(line, "size %llu sha256 %64s", &size, hex) == 2 && dfs_sha256_parse(hex, recipe->sha256) == 0;
+    }
+    if (valid) {
+        recipe->size = size;
+    }
+
+    //one "HEX LENGTH" line per chunk
+    uint64_t offset = 0;
+    while (valid && fgets(line, sizeof(line), file) != NULL) {
+        unsigned long length;
+        if (sscanf(line, "%64s %lu", hex, &length) != 2 || length == 0 || length > DFS_CHUNK_MAX_SIZE) {
+            valid = false;
+            break;
+        }
+        if (recipe->count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            struct dfs_chunk_entry *grown = realloc(recipe->chunks, capacity * sizeof(*grown));
+            if (grown == NULL) {
+                valid = false;
+                break;
+            }
+            recipe->chunks = grown;
+        }
+        struct dfs_chunk_entry *entry = &recipe->chunks[recipe->count];
+        if (dfs_sha256_parse(hex, entry->digest) < 0) {
+            valid = false;
+            break;
+        }
+        entry->length = length;
+        entry->offset = offset;
+        offset += length;
+        recipe->count++;
+    }
+    fclose(file);
+
+    if (valid && offset != recipe->size) {
+        valid = false;
+    }
+    if (!valid) {
+        if (recipe != NULL) {
+            free(recipe->chunks);
+            free(recipe);
+        }
+        return NULL;
+    }
+    return recipe;
+}
+
+//has_magic: Checks the magic at the start of `fd`.
+static bool has_magic(int fd) {
+    char magic[sizeof(DFS_CHUNK_RECIPE_MAGIC) - 1];
+    return pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+           memcmp(magic, DFS_CHUNK_RECIPE_MAGIC, sizeof(magic)) == 0;
+}
+
+//is_recipe: Tells whether `fd` is a recipe: it must carry the mark, and the magic as a sanity check.
+static bool is_recipe(int fd) {
+    return fgetxattr(fd, DFS_CHUNK_RECIPE_XATTR, NULL, 0) >= 0 && has_magic(fd);
+}
+
+static void free_recipe(struct dfs_chunk_recipe* recipe) {
+    if (recipe != NULL) {
+        free(recipe->chunks);
+        free(recipe);
+    }
+}
+
+//adopt_recipe: Parses an unmarked file of a store older than the mark and marks it if it is a recipe whose chunks
+//are all in the store.
+static struct dfs_chunk_recipe* adopt_recipe(int fd) {
+    struct dfs_chunk_recipe *recipe = has_magic(fd) ? parse_recipe(fd) : NULL;
+    if (recipe == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < recipe->count; i++) {
+        char path[PATH_MAX + 96];
+        chunk_path(recipe->chunks[i].digest, path, sizeof(path), false);
+        if (access(path, F_OK) < 0) {
+            free_recipe(recipe);
+            return NULL;
+        }
+    }
+    if (fsetxattr(fd, DFS_CHUNK_RECIPE_XATTR, "1", 1, 0) < 0) {
+        //its chunks are still counted, and the next start tries again
+        chunk_adopt_failed = true;
+    }
+    return recipe;
+}
+
+//count_recipe: nftw() callback adding the references of every recipe below the root.
+static int count_recipe(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)ftw;
+    if (type != FTW_F || !S_ISREG(st->st_mode)) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    struct dfs_chunk_recipe *recipe = is_recipe(fd) ? parse_recipe(fd) : chunk_adopting ? adopt_recipe(fd) : NULL;
+    close(fd);
+    if (recipe == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < recipe->count; i++) {
+        struct chunk_ref *ref = find_ref(recipe->chunks[i].digest);
+        if (ref == NULL) {
+            ref = insert_ref(recipe->chunks[i].digest, recipe->chunks[i].length);
+        }
+        if (ref != NULL) {
+            ref->refs++;
+            chunk_totals.referenced_bytes += ref->length;
+        }
+    }
+    free_recipe(recipe);
+    return 0;
+}
+
+//is_hex_name: Tells whether the first `length` characters of `name` are hex digits.
+static bool is_hex_name(const char* name, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (!isxdigit((unsigned char)name[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//sweep_chunk: Tells whether the entry `name` of the fanout directory `fanout` is a chunk no recipe references or a
+//temporary left by a crash. anything that is not a regular file named like a chunk is left alone.
+static bool sweep_chunk(int dir_fd, const char* fanout, const char* name) {
+    size_t name_length = strlen(name);
+    bool temporary = name_length == DFS_SHA256_HEX_SIZE - 2 + 4 && strcmp(name + DFS_SHA256_HEX_SIZE - 2, ".tmp") == 0;
+    if ((name_length != DFS_SHA256_HEX_SIZE - 2 && !temporary) || !is_hex_name(name, DFS_SHA256_HEX_SIZE - 2)) {
+        return false;
+    }
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    if (temporary) {
+        return true;
+    }
+    char hex[DFS_SHA256_HEX_SIZE + 1];
+    unsigned char digest[DFS_SHA256_SIZE];
+    memcpy(hex, fanout, 2);
+    memcpy(hex + 2, name, DFS_SHA256_HEX_SIZE - 1);
+    return dfs_sha256_parse(hex, digest) == 0 && find_ref(digest) == NULL;
+}
+
+//sweep_store: Deletes chunk files no recipe references, and temporaries left by a crash. the store and its fanout
+//directories are opened without following links and only two hex digit fanouts are entered, so the sweep never
+//leaves the store.
+static void sweep_store(void) {
+    char store[PATH_MAX + 16];
+    snprintf(store, sizeof(store), "%s.chunks", chunk_root);
+    int store_fd = open(store, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (store_fd < 0) {
+        return;
+    }
+    DIR *top = fdopendir(store_fd);
+    if (top == NULL) {
+        close(store_fd);
+        return;
+    }
+    struct dirent *fanout;
+    while ((fanout = readdir(top)) != NULL) {
+        if (strlen(fanout->d_name) != 2 || !is_hex_name(fanout->d_name, 2)) {
+            continue;
+        }
+        int dir_fd = openat(store_fd, fanout->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dir_fd < 0) {
+            continue;
+        }
+        DIR *dir = fdopendir(dir_fd);
+        if (dir == NULL) {
+            close(dir_fd);
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (sweep_chunk(dir_fd, fanout->d_name, entry->d_name)) {
+                unlinkat(dir_fd, entry->d_name, 0);
+            }
+        }
+        closedir(dir);
+    }
+    closedir(top);
+}
+
+//dfs_chunk_init: Opens the chunk store and rebuilds its reference counts.
+long dfs_chunk_init(const char* root, int dedup) {
+    char store[PATH_MAX + 16];
+    snprintf(chunk_root, sizeof(chunk_root), "%s", root);
+    snprintf(store, sizeof(store), "%s.chunks", root);
+    if (mkdir(store, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    pthread_once(&gear_once, init_gear);
+
+    pthread_mutex_lock(&chunk_lock);
+    chunk_buckets = CHUNK_MIN_BUCKETS;
+    chunk_table = calloc(chunk_buckets, sizeof(*chunk_table));
+    if (chunk_table == NULL) {
+        pthread_mutex_unlock(&chunk_lock);
+        return -1;
+    }
+    memset(&chunk_totals, 0, sizeof(chunk_totals));
+    char marked[PATH_MAX + 32];
+    snprintf(marked, sizeof(marked), "%s/%s", store, STORE_MARKED);
+    chunk_adopting = access(marked, F_OK) < 0;
+    chunk_adopt_failed = false;
+    nftw(root, count_recipe, 32, FTW_PHYS);
+    sweep_store();
+    if (chunk_adopting && !chunk_adopt_failed) {
+        int marked_fd = open(marked, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (marked_fd >= 0) {
+            close(marked_fd);
+        }
+    }
+    chunk_adopting = false;
+    long chunks = chunk_totals.chunks;
+    chunk_dedup = dedup != 0;
+    chunk_ready = true;
+    pthread_mutex_unlock(&chunk_lock);
+    return chunks;
+}
+
+//dfs_chunk_dedup_enabled: Tells whether stored files are turned into recipes.
+int dfs_chunk_dedup_enabled(void) {
+    return chunk_ready && chunk_dedup;
+}
+
+//dfs_chunk_boundary: Returns the length of the chunk starting at `data`, of which `length` bytes remain.
+size_t dfs_chunk_boundary(const unsigned char* data, size_t length) {
+    pthread_once(&gear_once, init_gear);
+    return find_boundary(data, length);
+}
+
+//scan_data: Cuts `size` bytes into chunks and hashes them and the whole data. returns NULL if out of memory.
+static struct dfs_chunk_recipe* scan_data(const unsigned char* data, uint64_t size) {
+    struct dfs_chunk_recipe *recipe = calloc(1, sizeof(*recipe));
+    if (recipe == NULL) {
+        return NULL;
+    }
+    size_t capacity = size / DFS_CHUNK_AVERAGE_SIZE + 16;
+    recipe->chunks = malloc(capacity * sizeof(*recipe->chunks));
+    if (recipe->chunks == NULL) {
+        free(recipe);
+        return NULL;
+    }
+    recipe->size = size;
+    struct dfs_sha256 whole;
+    dfs_sha256_init(&whole);
+    uint64_t offset = 0;
+    while (offset < size) {
+        size_t length = dfs_chunk_boundary(data + offset, size - offset);
+        if (recipe->count == capacity) {
+            capacity *= 2;
+            struct dfs_chunk_entry *grown = realloc(recipe->chunks, capacity * sizeof(*grown));
+            if (grown == NULL) {
+                free_recipe(recipe);
+                return NULL;
+            }
+            recipe->chunks = grown;
+        }
+        struct dfs_chunk_entry *entry = &recipe->chunks[recipe->count++];
+        struct dfs_sha256 ctx;
+        dfs_sha256_init(&ctx);
+        dfs_sha256_update(&ctx, data + offset, length);
+        dfs_sha256_final(&ctx, entry->digest);
+        dfs_sha256_update(&whole, data + offset, length);
+        entry->length = length;
+        entry->offset = offset;
+        offset += length;
+    }
+    dfs_sha256_final(&whole, recipe->sha256);
+    return recipe;
+}
+
+//map_file: Maps the whole of `fd` for reading; an empty file maps to NULL.
+static int map_file(int fd, const unsigned char** data, uint64_t* size) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+    *size = st.st_size;
+    *data = NULL;
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            return -1;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        *data = map;
+    }
+    return 0;
+}
+
+//unpack: Decodes the whole of a pack into memory for scanning; NULL with errno 0 if `fd` is not a pack.
+static unsigned char* unpack(int fd, uint64_t* size) {
+    int pack_fd = dup(fd);
+    if (pack_fd < 0) {
+        return NULL;
+    }
+    struct dfs_pack *pack = dfs_pack_open(pack_fd);
+    if (pack == NULL) {
+        int saved_errno = errno;
+        close(pack_fd);
+        errno = saved_errno;
+        return NULL;
+    }
+    unsigned char *data = malloc(pack->size > 0 ? pack->size : 1);
+    uint64_t done = 0;
+    while (data != NULL && done < pack->size) {
+        ssize_t n = dfs_pack_pread(pack, data + done, pack->size - done, done);
+        if (n <= 0) {
+            free(data);
+            data = NULL;
+            errno = EIO;
+            break;
+        }
+        done += n;
+    }
+    *size = pack->size;
+    dfs_pack_close(pack);
+    if (data == NULL && errno == 0) {
+        errno = ENOMEM;
+    }
+    return data;
+}
+
+//dfs_chunk_scan: Cuts the file open on `fd` into chunks without storing them.
+struct dfs_chunk_recipe* dfs_chunk_scan(int fd) {
+    const unsigned char *data;
+    uint64_t size;
+    unsigned char *unpacked = unpack(fd, &size);
+    if (unpacked == NULL && errno != 0) {
+        return NULL;
+    }
+    if (unpacked != NULL) {
+        data = unpacked;
+    } else if (map_file(fd, &data, &size) < 0) {
+        return NULL;
+    }
+    struct dfs_chunk_recipe *recipe = scan_data(data, size);
+    if (unpacked != NULL) {
+        free(unpacked);
+    } else if (data != NULL) {
+        munmap((void*)data, size);
+    }
+    if (recipe == NULL) {
+        errno = ENOMEM;
+    }
+    return recipe;
+}
+
+//dfs_chunk_ref: Adds a reference to a chunk, saving it first if the store lacks it and `data` holds it.
+//without `data` a missing chunk fails with ENOENT.
+int dfs_chunk_ref(const unsigned char* digest, const void* data, uint32_t length, struct dfs_chunk_stats* stats) {
+    pthread_mutex_lock(&chunk_lock);
+    struct chunk_ref *ref = chunk_ready ? find_ref(digest) : NULL;
+    if (ref == NULL) {
+        if (!chunk_ready || data == NULL) {
+            pthread_mutex_unlock(&chunk_lock);
+            errno = ENOENT;
+            return -1;
+        }
+        if (write_chunk(digest, data, length) < 0 || (ref = insert_ref(digest, length)) == NULL) {
+            pthread_mutex_unlock(&chunk_lock);
+            return -1;
+        }
+        if (stats != NULL) {
+            stats->new_chunks++;
+            stats->new_bytes += length;
+        }
+    }
+    ref->refs++;
+    chunk_totals.referenced_bytes += length;
+    pthread_mutex_unlock(&chunk_lock);
+    return 0;
+}
+
+//dfs_chunk_has: Tells whether the store holds a chunk.
+int dfs_chunk_has(const unsigned char* digest) {
+    pthread_mutex_lock(&chunk_lock);
+    int found = chunk_ready && find_ref(digest) != NULL;
+    pthread_mutex_unlock(&chunk_lock);
+    return found;
+}
+
+//dfs_chunk_read: Reads a stored chunk of `length` bytes.
+int dfs_chunk_read(const unsigned char* digest, void* buffer, uint32_t length) {
+    char path[PATH_MAX];
+    chunk_path(digest, path, sizeof(path), false);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t got = pread(fd, buffer, length, 0);
+    close(fd);
+    if (got != (ssize_t)length) {
+        errno = got < 0 ? errno : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+//dfs_chunk_unref: Drops the references taken for the first `count` chunks of a recipe.
+void dfs_chunk_unref(const struct dfs_chunk_recipe* recipe, size_t count) {
+    pthread_mutex_lock(&chunk_lock);
+    for (size_t i = 0; i < count && i < recipe->count; i++) {
+        drop_ref(recipe->chunks[i].digest);
+    }
+    pthread_mutex_unlock(&chunk_lock);
+}
+
+//save_recipe: Writes a recipe whose chunks are referenced over `path`, releasing the recipe it replaces. with
+//`expected` set, `path` must still be that file when the recipe replaces it, or the save fails with ESTALE.
+//the new chunks are synced once, before the recipe is written. on failure `path` is left as it was.
+static int save_recipe(const char* path, const struct dfs_chunk_recipe* recipe, const struct stat* expected) {
+    //the recipe is written next to the file under a hidden name and renamed over it
+    char temp_path[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    int dir_length = slash != NULL ? (int)(slash - path + 1) : 0;
+    snprintf(temp_path, sizeof(temp_path), "%.*s.%s.recipe", dir_length, path, path + dir_length);
+
+    char store[PATH_MAX + 16];
+    snprintf(store, sizeof(store), "%s.chunks", chunk_root);
+    int store_fd = open(store, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (store_fd < 0 || syncfs(store_fd) < 0) {
+        int saved_errno = errno;
+        if (store_fd >= 0) {
+            close(store_fd);
+        }
+        errno = saved_errno;
+        return -1;
+    }
+    close(store_fd);
+
+    dfs_chunk_lock(path);
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL) {
+        int saved_errno = errno;
+        dfs_chunk_unlock(path);
+        errno = saved_errno;
+        return -1;
+    }
+    char hex[DFS_SHA256_HEX_SIZE + 1];
+    dfs_sha256_hex(recipe->sha256, hex);
+    fprintf(file, "%ssize %llu sha256 %s\n", DFS_CHUNK_RECIPE_MAGIC, (unsigned long long)recipe->size, hex);
+    for (size_t i = 0; i < recipe->count; i++) {
+        dfs_sha256_hex(recipe->chunks[i].digest, hex);
+        fprintf(file, "%s %u\n", hex, recipe->chunks[i].length);
+    }
+    bool ok = fsetxattr(fileno(file), DFS_CHUNK_RECIPE_XATTR, "1", 1, 0) == 0;
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+
+    //a file replaced while it was being chunked keeps its newer version
+    struct stat now;
+    if (ok && expected != NULL && (stat(path, &now) < 0 || now.st_dev != expected->st_dev || now.st_ino != expected->st_ino)) {
+        errno = ESTALE;
+        ok = false;
+    }
+    struct dfs_chunk_recipe *old_recipe = ok ? dfs_chunk_hold(path) : NULL;
+    if (!ok || rename(temp_path, path) < 0) {
+        int saved_errno = errno;
+        unlink(temp_path);
+        dfs_chunk_release(old_recipe, 0);
+        dfs_chunk_unlock(path);
+        errno = saved_errno;
+        return -1;
+    }
+    dfs_chunk_release(old_recipe, 1);
+    dfs_chunk_unlock(path);
+    return 0;
+}
+
+//dfs_chunk_save_recipe: Writes a recipe whose chunks are referenced over `path`, releasing the recipe it replaces.
+int dfs_chunk_save_recipe(const char* path, const struct dfs_chunk_recipe* recipe) {
+    return save_recipe(path, recipe, NULL);
+}
+
+//dfs_chunk_ingest: Replaces the plain file at `path` by a recipe. on failure the plain file is left in place.
+int dfs_chunk_ingest(const char* path, struct dfs_chunk_stats* stats) {
+    struct dfs_chunk_stats local;
+    if (stats == NULL) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (!dfs_chunk_dedup_enabled()) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    const unsigned char *data;
+    uint64_t size;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    if (is_recipe(fd)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    if (map_file(fd, &data, &size) < 0) {
+        close(fd);
+        return -1;
+    }
+    struct dfs_chunk_recipe *recipe = scan_data(data, size);
+    size_t stored = 0;
+    while (recipe != NULL && stored < recipe->count) {
+        const struct dfs_chunk_entry *entry = &recipe->chunks[stored];
+        if (dfs_chunk_ref(entry->digest, data + entry->offset, entry->length, stats) < 0) {
+            break;
+        }
+        stored++;
+    }
+    int result = recipe != NULL && stored == recipe->count ? 0 : -1;
+    if (recipe == NULL) {
+        errno = ENOMEM;
+    }
+    if (data != NULL) {
+        munmap((void*)data, size);
+    }
+    close(fd);
+
+    if (result == 0) {
+        stats->bytes = size;
+        stats->chunks = recipe->count;
+        result = save_recipe(path, recipe, &st);
+    }
+    if (result < 0 && recipe != NULL) {
+        int saved_errno = errno;
+        dfs_chunk_unref(recipe, stored);
+        errno = saved_errno;
+    }
+    free_recipe(recipe);
+    return result;
+}
+
+//dfs_chunk_hold: Loads the recipe at `path`, or returns NULL if the file is missing or plain.
+struct dfs_chunk_recipe* dfs_chunk_hold(const char* path) {
+    if (!chunk_ready) {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct dfs_chunk_recipe *recipe = is_recipe(fd) ? parse_recipe(fd) : NULL;
+    close(fd);
+    return recipe;
+}
+
+//dfs_chunk_release: Frees a held recipe, dropping its references when the file it described is gone.
+void dfs_chunk_release(struct dfs_chunk_recipe* recipe, int gone) {
+    if (recipe == NULL) {
+        return;
+    }
+    if (gone) {
+        pthread_mutex_lock(&chunk_lock);
+        for (size_t i = 0; i < recipe->count; i++) {
+            drop_ref(recipe->chunks[i].digest);
+        }
+        pthread_mutex_unlock(&chunk_lock);
+    }
+    free_recipe(recipe);
+}
+
+//dfs_chunk_lock: Takes the lock serializing the changes of `path`.
+void dfs_chunk_lock(const char* path) {
+    pthread_mutex_lock(path_lock(path));
+}
+
+//dfs_chunk_unlock: Gives back the lock of `path`.
+void dfs_chunk_unlock(const char* path) {
+    pthread_mutex_unlock(path_lock(path));
+}
+
+//open_file: Opens a file for reading, loading its recipe and pinning its chunks if it is one.
+static int open_file(struct dfs_chunk_file* file, const char* path) {
+    file->fd = -1;
+    file->size = 0;
+    file->recipe = NULL;
+    file->pack = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (chunk_ready && S_ISREG(st.st_mode) && is_recipe(fd)) {
+        file->recipe = parse_recipe(fd);
+        close(fd);
+        if (file->recipe == NULL) {
+            errno = EIO;
+            return -1;
+        }
+        pin_recipe(file->recipe, true);
+        file->size = file->recipe->size;
+        return 0;
+    }
+    if (S_ISREG(st.st_mode)) {
+        file->pack = dfs_pack_open(fd);
+        if (file->pack != NULL) {
+            file->size = file->pack->size;
+            return 0;
+        }
+        if (errno != 0) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+    }
+    file->fd = fd;
+    file->size = st.st_size;
+    return 0;
+}
+
+//dfs_chunk_open: Opens a file for reading, loading its recipe if it is one. a recipe is read and its chunks pinned
+//under the path lock, so an overwrite or removal running meanwhile cannot delete them before they are pinned.
+int dfs_chunk_open(struct dfs_chunk_file* file, const char* path) {
+    if (!chunk_ready) {
+        return open_file(file, path);
+    }
+    dfs_chunk_lock(path);
+    int result = open_file(file, path);
+    int saved_errno = errno;
+    dfs_chunk_unlock(path);
+    errno = saved_errno;
+    return result;
+}
+
+//find_chunk: Returns the index of the chunk holding `offset`, which must be below the size.
+static size_t find_chunk(const struct dfs_chunk_recipe* recipe, uint64_t offset) {
+    size_t low = 0;
+    size_t high = recipe->count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (recipe->chunks[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+//open_chunk: Opens the chunk file of recipe entry `index`.
+static int open_chunk(const struct dfs_chunk_recipe* recipe, size_t index) {
+    char path[PATH_MAX];
+    chunk_path(recipe->chunks[index].digest, path, sizeof(path), false);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+//dfs_chunk_pread: Reads up to `length` bytes at `offset`, like pread(). returns 0 at the end of the file.
+ssize_t dfs_chunk_pread(struct dfs_chunk_file* file, void* buffer, size_t length, uint64_t offset) {
+    if (file->pack != NULL) {
+        //like a plain file a pack fills the whole buffer unless it ends first
+        size_t done = 0;
+        while (done < length) {
+            ssize_t n = dfs_pack_pread(file->pack, (char*)buffer + done, length - done, offset + done);
+            if (n < 0) {
+                return done > 0 ? (ssize_t)done : -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            done += n;
+        }
+        return done;
+    }
+    if (file->recipe == NULL) {
+        return pread(file->fd, buffer, length, offset);
+    }
+    if (offset >= file->size || length == 0) {
+        return 0;
+    }
+    size_t index = find_chunk(file->recipe, offset);
+    const struct dfs_chunk_entry *entry = &file->recipe->chunks[index];
+    uint64_t inner = offset - entry->offset;
+    size_t piece = entry->length - inner < length ? entry->length - inner : length;
+    int fd = open_chunk(file->recipe, index);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t got = pread(fd, buffer, piece, inner);
+    close(fd);
+    //a chunk is never shorter than its recipe says unless the store was damaged
+    if (got >= 0 && (size_t)got < piece) {
+        errno = EIO;
+        return -1;
+    }
+    return got;
+}
+
+//dfs_chunk_sendfile: Sends `length` bytes from `offset` to `out_fd` with sendfile() chunk by chunk.
+//returns the number of bytes sent, short only if the file ends first, or -1 on error.
+long long dfs_chunk_sendfile(int out_fd, struct dfs_chunk_file* file, uint64_t offset, uint64_t length) {
+    if (file->pack != NULL) {
+        //a pack has to be decoded, so its content is copied through a buffer
+        char *buffer = malloc(DFS_COMPRESS_BLOCK_SIZE);
+        if (!buffer) {
+            return -1;
+        }
+        long long total = 0;
+        while ((uint64_t)total < length) {
+            uint64_t left = length - total;
+            ssize_t n = dfs_chunk_pread(file, buffer, left < DFS_COMPRESS_BLOCK_SIZE ? left : DFS_COMPRESS_BLOCK_SIZE, offset + total);
+            if (n < 0 || (n > 0 && dfs_write_full(out_fd, buffer, n) < 0)) {
+                free(buffer);
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            total += n;
+        }
+        free(buffer);
+        return total;
+    }
+    if (file->recipe == NULL) {
+        return dfs_sendfile_range(out_fd, file->fd, offset, length);
+    }
+    long long total = 0;
+    uint64_t end = offset + length < file->size ? offset + length : file->size;
+    size_t index = offset < end ? find_chunk(file->recipe, offset) : file->recipe->count;
+    while (offset < end) {
+        const struct dfs_chunk_entry *entry = &file->recipe->chunks[index];
+        uint64_t inner = offset - entry->offset;
+        uint64_t piece = entry->length - inner < end - offset ? entry->length - inner : end - offset;
+        int fd = open_chunk(file->recipe, index);
+        if (fd < 0) {
+            return -1;
+        }
+        long long sent = dfs_sendfile_range(out_fd, fd, inner, piece);
+        close(fd);
+        if (sent < 0 || (uint64_t)sent < piece) {
+            return -1;
+        }
+        offset += piece;
+        total += piece;
+        index++;
+    }
+    return total;
+}
+
+//dfs_chunk_send_stream: Sends a range of a file as a complete stream: DATA frames followed by an END frame.
+//a negative `length` means "to the end of the file".
+long long dfs_chunk_send_stream(int sock, struct dfs_chunk_file* file, uint64_t offset, long long length, uint32_t request_id) {
+    if (file->pack != NULL) {
+        return dfs_chunk_send_compressed(sock, file, offset, length, request_id, DFS_CODEC_NONE);
+    }
+    if (file->recipe == NULL) {
+        return dfs_sendfile_stream(sock, file->fd, offset, length, request_id);
+    }
+    uint64_t end = file->size;
+    if (length >= 0 && offset + length < end) {
+        end = offset + length;
+    }
+    long long total_bytes_sent = 0;
+    dfs_xfer_cork(sock, 1);
+    while (offset < end) {
+        uint32_t frame_length = end - offset < DFS_SENDFILE_FRAME_SIZE ? end - offset : DFS_SENDFILE_FRAME_SIZE;
+        unsigned char header[DFS_FRAME_HEADER_SIZE];
+        dfs_encode_header(header, DFS_OP_DATA, 0, request_id, frame_length);
+        if (send(sock, header, sizeof(header), MSG_MORE | MSG_NOSIGNAL) != sizeof(header)) {
+            dfs_xfer_cork(sock, 0);
+            return -1;
+        }
+        //a missing chunk cannot be sent around, so the connection is given up rather than padded
+        if (dfs_chunk_sendfile(sock, file, offset, frame_length) != frame_length) {
+            dfs_xfer_cork(sock, 0);
+            return -1;
+        }
+        offset += frame_length;
+        total_bytes_sent += frame_length;
+    }
+    if (dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0) {
+        total_bytes_sent = -1;
+    }
+    dfs_xfer_cork(sock, 0);
+    return total_bytes_sent;
+}
+
+//dfs_chunk_send_compressed: Sends a range of a file as a stream of DATA frames of up to a block each,
+//compressed with `codec` where that makes them smaller, followed by an END frame.
+//whole blocks of a pack stored with `codec` go out as they are on disk, without being decoded.
+long long dfs_chunk_send_compressed(int sock, struct dfs_chunk_file* file, uint64_t offset, long long length, uint32_t request_id, int codec) {
+    uint64_t end = file->size;
+    if (length >= 0 && offset + length < end) {
+        end = offset + length;
+    }
+    unsigned char *buffer = malloc(DFS_COMPRESS_BLOCK_SIZE + DFS_COMPRESS_PAYLOAD_MAX);
+    if (!buffer) {
+        return -1;
+    }
+    unsigned char *payload = buffer + DFS_COMPRESS_BLOCK_SIZE;
+    long long total_bytes_sent = 0;
+    while (offset < end) {
+        uint64_t block_end = (offset / DFS_COMPRESS_BLOCK_SIZE + 1) * DFS_COMPRESS_BLOCK_SIZE;
+        if (block_end > end) {
+            block_end = end;
+        }
+        uint32_t frame_length = block_end - offset;
+        long long sent;
+        if (file->pack != NULL && offset % DFS_COMPRESS_BLOCK_SIZE == 0 && (block_end % DFS_COMPRESS_BLOCK_SIZE == 0 || block_end == file->size)) {
+            sent = dfs_pack_send_block(sock, file->pack, offset / DFS_COMPRESS_BLOCK_SIZE, request_id, codec);
+        } else if (dfs_chunk_pread(file, buffer, frame_length, offset) != (ssize_t)frame_length) {
+            //the stream cannot be padded, so the connection is given up
+            sent = -1;
+        } else {
+            uint32_t n = dfs_compress_payload(codec, buffer, frame_length, payload);
+            int r = n != 0 ? dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_COMPRESSED, request_id, payload, n)
+                           : dfs_send_frame(sock, DFS_OP_DATA, 0, request_id, buffer, frame_length);
+            sent = r < 0 ? -1 : (long long)frame_length;
+        }
+        if (sent != frame_length) {
+            free(buffer);
+            return -1;
+        }
+        offset += frame_length;
+        total_bytes_sent += frame_length;
+    }
+    free(buffer);
+    if (dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0) {
+        return -1;
+    }
+    return total_bytes_sent;
+}
+
+//dfs_chunk_close: Closes a file opened with dfs_chunk_open().
+void dfs_chunk_close(struct dfs_chunk_file* file) {
+    if (file->fd >= 0) {
+        close(file->fd);
+    }
+    if (file->recipe != NULL) {
+        pin_recipe(file->recipe, false);
+    }
+    free_recipe(file->recipe);
+    dfs_pack_close(file->pack);
+    file->fd = -1;
+    file->recipe = NULL;
+    file->pack = NULL;
+}
+
+//dfs_chunk_get_stats: Copies the running totals of the store.
+void dfs_chunk_get_stats(struct dfs_chunk_store_stats* out) {
+    pthread_mutex_lock(&chunk_lock);
+    *out = chunk_totals;
+    pthread_mutex_unlock(&chunk_lock);
+}
@@ -0,0 +1,111 @@
+//dfs_chunk.h
+//this header declares the deduplicating chunk store Spdf can keep its files in. a stored file is cut into chunks
+//at content-defined boundaries: a rolling gear hash over the bytes picks them, so inserting or changing a few
+//bytes only changes the chunks around the edit. every chunk is saved once, named by its SHA-256, in
+//root + ".chunks", and the file itself is replaced by a small recipe listing its chunks, so identical and
+//near-identical files cost disk once. a chunk counts the recipes using it and is deleted with the last of them.
+//a recipe is told apart from a stored file by the extended attribute DFS_CHUNK_RECIPE_XATTR, never by its
+//content, so a file that happens to start like a recipe is served as it was stored; the store therefore needs a
+//file system with user extended attributes. readers go through dfs_chunk_open(), which serves plain files and
+//recipes alike.
+#ifndef DFS_CHUNK_H
+#define DFS_CHUNK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dfs_sha256.h"
+
+//chunk size bounds; boundaries are chosen so chunks average DFS_CHUNK_AVERAGE_SIZE bytes
+#define DFS_CHUNK_MIN_SIZE (16 * 1024)
+#define DFS_CHUNK_AVERAGE_SIZE (64 * 1024)
+#define DFS_CHUNK_MAX_SIZE (256 * 1024)
+//first line of every recipe
+#define DFS_CHUNK_RECIPE_MAGIC "DFS-RECIPE 1\n"
+//extended attribute every recipe carries
+#define DFS_CHUNK_RECIPE_XATTR "user.dfs.recipe"
+
+//what storing one file cost
+struct dfs_chunk_stats {
+    unsigned long long bytes;          //size of the file
+    unsigned long long chunks;         //chunks it was cut into
+    unsigned long long new_bytes;      //bytes of the chunks the store did not have yet
+    unsigned long long new_chunks;
+};
+
+//the chunks of one stored file
+struct dfs_chunk_recipe {
+    uint64_t size;
+    unsigned char sha256[DFS_SHA256_SIZE];   //digest of the whole file
+    size_t count;
+    struct dfs_chunk_entry {
+        unsigned char digest[DFS_SHA256_SIZE];
+        uint32_t length;
+        uint64_t offset;                     //position of the chunk in the file
+    } *chunks;
+};
+
+//a file opened for reading: a plain file, a recipe or a compressed pack (see dfs_compress.h)
+struct dfs_chunk_file {
+    int fd;                              //the plain file, -1 for a recipe or a pack
+    uint64_t size;                       //bytes of content
+    struct dfs_chunk_recipe *recipe;     //NULL for a plain file
+    struct dfs_pack *pack;               //NULL unless the file is a pack
+};
+
+//dfs_chunk_init() opens the chunk store of `root`, counts the references held by every recipe below root and
+//deletes chunks left unused, e.g. by a crash. with `dedup` set, dfs_chunk_ingest() turns stored files into
+//recipes; without it the store only serves the recipes already there. returns the number of chunks or -1.
+long dfs_chunk_init(const char* root, int dedup);
+int dfs_chunk_dedup_enabled(void);
+
+//dfs_chunk_ingest() replaces the plain file at `path` by a recipe, storing the chunks the store lacks. the file
+//is mapped while it is cut, so it must not be rewritten in place meanwhile; ingest an upload before it is renamed
+//into place. if `path` is replaced by another file meanwhile, the newer file stays and the ingest fails with ESTALE.
+int dfs_chunk_ingest(const char* path, struct dfs_chunk_stats* stats);
+
+//building recipes chunk by chunk, as an upload that only sends the chunks the server lacks does.
+//dfs_chunk_ref() references a stored chunk, saving it first if `data` holds it; without `data` a chunk the store
+//lacks fails with ENOENT. dfs_chunk_save_recipe() writes a recipe whose chunks are all referenced over `path`,
+//and dfs_chunk_unref() gives back the references of the first `count` chunks when it cannot be saved.
+int dfs_chunk_ref(const unsigned char* digest, const void* data, uint32_t length, struct dfs_chunk_stats* stats);
+int dfs_chunk_has(const unsigned char* digest);
+int dfs_chunk_read(const unsigned char* digest, void* buffer, uint32_t length);
+int dfs_chunk_save_recipe(const char* path, const struct dfs_chunk_recipe* recipe);
+void dfs_chunk_unref(const struct dfs_chunk_recipe* recipe, size_t count);
+
+//cutting data into chunks without storing them, as a client does before asking which chunks a server has.
+//dfs_chunk_scan() returns the recipe of the file open on `fd`, decoding it first if it is a pack;
+//free it with dfs_chunk_release(recipe, 0).
+size_t dfs_chunk_boundary(const unsigned char* data, size_t length);
+struct dfs_chunk_recipe* dfs_chunk_scan(int fd);
+
+//dfs_chunk_hold() loads the recipe at `path` before the file is replaced or removed; NULL if it is not one.
+//dfs_chunk_release() frees it, and with `gone` set drops its references, deleting chunks no longer used.
+//hold, replace or remove and release between dfs_chunk_lock() and dfs_chunk_unlock() of the path: the lock
+//serializes the changes of one path, so two overlapping overwrites cannot both release the same recipe.
+//dfs_chunk_save_recipe() takes it itself.
+struct dfs_chunk_recipe* dfs_chunk_hold(const char* path);
+void dfs_chunk_release(struct dfs_chunk_recipe* recipe, int gone);
+void dfs_chunk_lock(const char* path);
+void dfs_chunk_unlock(const char* path);
+
+//reading plain files, recipes and packs. the chunks of an open recipe stay in the store until it is closed,
+//even if the file is removed or overwritten meanwhile.
+int dfs_chunk_open(struct dfs_chunk_file* file, const char* path);
+ssize_t dfs_chunk_pread(struct dfs_chunk_file* file, void* buffer, size_t length, uint64_t offset);
+long long dfs_chunk_sendfile(int out_fd, struct dfs_chunk_file* file, uint64_t offset, uint64_t length);
+long long dfs_chunk_send_stream(int sock, struct dfs_chunk_file* file, uint64_t offset, long long length, uint32_t request_id);
+//dfs_chunk_send_compressed() is dfs_chunk_send_stream() with every frame compressed with `codec` where that helps
+long long dfs_chunk_send_compressed(int sock, struct dfs_chunk_file* file, uint64_t offset, long long length, uint32_t request_id, int codec);
+void dfs_chunk_close(struct dfs_chunk_file* file);
+
+//running totals of the store
+struct dfs_chunk_store_stats {
+    unsigned long long chunks;
+    unsigned long long stored_bytes;     //bytes of all chunks
+    unsigned long long referenced_bytes; //bytes of all recipes' files, counting shared chunks every time
+};
+void dfs_chunk_get_stats(struct dfs_chunk_store_stats* out);
+
+#endif
@@ -0,0 +1,811 @@
+//dfs_compress.c
+//this file implements the block compression declared in dfs_compress.h: the built-in "lz" codec, compressed
+//frame payloads and packs.
+//an "lz" block is a run of sequences. a sequence starts with a token byte whose high 4 bits hold the number of
+//literals and whose low 4 bits hold the match length minus 4; a field of 15 continues in extra bytes that are
+//added up until one is below 255. the literals follow, then the distance back to the match (16 bit little
+//endian) and the extra match length bytes. the last sequence has literals only.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+
+#include "dfs_compress.h"
+#include "dfs_frame.h"
+
+#define LZ_HASH_LOG 14
+#define LZ_MIN_MATCH 4
+//no match starts in the last LZ_MATCH_LIMIT bytes and the last LZ_LAST_LITERALS bytes are always literals
+#define LZ_MATCH_LIMIT 12
+#define LZ_LAST_LITERALS 5
+//pack header: magic, codec(1), block size(4), content size(8), block count(4); then a 4 byte length per block
+#define PACK_HEADER_SIZE (sizeof(DFS_PACK_MAGIC) - 1 + 1 + 4 + 8 + 4)
+
+static struct dfs_compress_stats totals;
+//state of dfs_pack_mark_tree(), which nftw() gives no way to pass
+static long marked_packs;
+static bool mark_failed;
+
+//helpers to store and load big-endian integers
+static void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_u64(unsigned char* p, uint64_t v) {
+    put_u32(p, v >> 32);
+    put_u32(p + 4, (uint32_t)v);
+}
+
+static uint64_t get_u64(const unsigned char* p) {
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+//now_us: Returns a monotonic timestamp in microseconds for the throughput totals.
+static unsigned long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//dfs_compress_get_stats: Copies the running totals of this process.
+void dfs_compress_get_stats(struct dfs_compress_stats* out) {
+    out->compressed_blocks = __atomic_load_n(&totals.compressed_blocks, __ATOMIC_RELAXED);
+    out->compress_in = __atomic_load_n(&totals.compress_in, __ATOMIC_RELAXED);
+    out->compress_out = __atomic_load_n(&totals.compress_out, __ATOMIC_RELAXED);
+    out->compress_us = __atomic_load_n(&totals.compress_us, __ATOMIC_RELAXED);
+    out->decompressed_blocks = __atomic_load_n(&totals.decompressed_blocks, __ATOMIC_RELAXED);
+    out->decompress_in = __atomic_load_n(&totals.decompress_in, __ATOMIC_RELAXED);
+    out->decompress_out = __atomic_load_n(&totals.decompress_out, __ATOMIC_RELAXED);
+    out->decompress_us = __atomic_load_n(&totals.decompress_us, __ATOMIC_RELAXED);
+}
+
+//dfs_codec_name: Returns the name of a codec.
+const char* dfs_codec_name(int codec) {
+    switch (codec) {
+        case DFS_CODEC_NONE: return "none";
+        case DFS_CODEC_LZ: return "lz";
+        default: return "unknown";
+    }
+}
+
+//dfs_codec_parse: Returns the codec called `name`, or -1.
+int dfs_codec_parse(const char* name) {
+    if (strcmp(name, "none") == 0) {
+        return DFS_CODEC_NONE;
+    }
+    if (strcmp(name, "lz") == 0) {
+        return DFS_CODEC_LZ;
+    }
+    return -1;
+}
+
+//list_has: Checks whether the comma-separated `list` names `codec`.
+static bool list_has(const char* list, int codec) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", list);
+    char *save = NULL;
+    for (char *name = strtok_r(copy, ", ", &save); name != NULL; name = strtok_r(NULL, ", ", &save)) {
+        if (dfs_codec_parse(name) == codec) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//dfs_codec_choose: Picks the first codec of `offered` that `allowed` names too, DFS_CODEC_NONE if there is none.
+int dfs_codec_choose(const char* offered, const char* allowed) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", offered);
+    char *save = NULL;
+    for (char *name = strtok_r(copy, ", ", &save); name != NULL; name = strtok_r(NULL, ", ", &save)) {
+        int codec = dfs_codec_parse(name);
+        if (codec > DFS_CODEC_NONE && list_has(allowed, codec)) {
+            return codec;
+        }
+    }
+    return DFS_CODEC_NONE;
+}
+
+static uint32_t read_u32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+//lz_match_length: Counts the bytes from `ip` on that equal those from `candidate` on, stopping at `limit`.
+//eight bytes are compared at a time and the first differing byte is found from the lowest set bit.
+static size_t lz_match_length(const unsigned char* src, size_t candidate, size_t ip, size_t limit) {
+    size_t start = ip;
+    while (ip + 8 <= limit) {
+        uint64_t a, b;
+        memcpy(&a, src + candidate, sizeof(a));
+        memcpy(&b, src + ip, sizeof(b));
+        uint64_t diff = a ^ b;
+        if (diff != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return ip - start + (__builtin_ctzll(diff) >> 3);
+#else
+            return ip - start + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+        ip += 8;
+        candidate += 8;
+    }
+    while (ip < limit && src[candidate] == src[ip]) {
+        ip++;
+        candidate++;
+    }
+    return ip - start;
+}
+
+//lz_put_length: Writes the part of a length that did not fit its token field. returns NULL if `out` is full.
+static unsigned char* lz_put_length(unsigned char* op, const unsigned char* end, size_t length) {
+    while (length >= 255) {
+        if (op >= end) {
+            return NULL;
+        }
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op >= end) {
+        return NULL;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+//lz_put_sequence: Writes a token, its literals and, if `match` is not 0, the match.
+static unsigned char* lz_put_sequence(unsigned char* op, const unsigned char* end, const unsigned char* literals, size_t literal_count, size_t offset, size_t match) {
+    if (op >= end) {
+        return NULL;
+    }
+    unsigned char *token = op++;
+    *token = (unsigned char)((literal_count >= 15 ? 15 : literal_count) << 4);
+    if (literal_count >= 15 && (op = lz_put_length(op, end, literal_count - 15)) == NULL) {
+        return NULL;
+    }
+    if ((size_t)(end - op) < literal_count + (match ? 2 : 0)) {
+        return NULL;
+    }
+    memcpy(op, literals, literal_count);
+    op += literal_count;
+    if (match == 0) {
+        return op;
+    }
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    size_t extra = match - LZ_MIN_MATCH;
+    *token |= extra >= 15 ? 15 : extra;
+    if (extra >= 15) {
+        op = lz_put_length(op, end, extra - 15);
+    }
+    return op;
+}
+
+//lz_compress: Compresses one block of at most DFS_COMPRESS_BLOCK_SIZE bytes with greedy hash matching.
+//the longer no match is found the further the scan skips ahead, so data that does not compress costs little.
+static size_t lz_compress(const unsigned char* src, size_t length, unsigned char* dst, size_t capacity) {
+    //positions fit 16 bits because a block is at most 64KiB, which also keeps every match in range of its offset
+    uint16_t table[1 << LZ_HASH_LOG];
+    memset(table, 0, sizeof(table));
+    unsigned char *op = dst;
+    const unsigned char *end = dst + capacity;
+    size_t anchor = 0;
+    size_t ip = 1;
+
+    if (length > LZ_MATCH_LIMIT) {
+        size_t limit = length - LZ_MATCH_LIMIT;
+        size_t match_limit = length - LZ_LAST_LITERALS;
+        table[lz_hash(read_u32(src))] = 0;
+        while (ip < limit) {
+            uint32_t sequence = read_u32(src + ip);
+            uint32_t h = lz_hash(sequence);
+            size_t candidate = table[h];
+            table[h] = (uint16_t)ip;
+            if (candidate >= ip || read_u32(src + candidate) != sequence) {
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            //extend the match backwards over literals that also match, then forwards
+            while (ip > anchor && candidate > 0 && src[ip - 1] == src[candidate - 1]) {
+                ip--;
+                candidate--;
+            }
+            size_t match = lz_match_length(src, candidate + LZ_MIN_MATCH, ip + LZ_MIN_MATCH, match_limit) + LZ_MIN_MATCH;
+            op = lz_put_sequence(op, end, src + anchor, ip - anchor, ip - candidate, match);
+            if (op == NULL) {
+                return 0;
+            }
+            ip += match;
+            anchor = ip;
+            if (ip - 2 < limit) {
+                table[lz_hash(read_u32(src + ip - 2))] = (uint16_t)(ip - 2);
+            }
+        }
+    }
+    op = lz_put_sequence(op, end, src + anchor, length - anchor, 0, 0);
+    return op != NULL ? (size_t)(op - dst) : 0;
+}
+
+//lz_decompress: Decodes one block, checking every length and offset against both buffers.
+static long lz_decompress(const unsigned char* src, size_t length, unsigned char* dst, size_t capacity) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < length) {
+        unsigned token = src[ip++];
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            unsigned char b;
+            do {
+                if (ip >= length) {
+                    return -1;
+                }
+                b = src[ip++];
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > length - ip || literals > capacity - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == length) {
+            return (long)op;
+        }
+
+        if (length - ip < 2) {
+            return -1;
+        }
+        size_t offset = src[ip] | (size_t)src[ip + 1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return -1;
+        }
+        size_t match = token & 15;
+        if (match == 15) {
+            unsigned char b;
+            do {
+                if (ip >= length) {
+                    return -1;
+                }
+                b = src[ip++];
+                match += b;
+            } while (b == 255);
+        }
+        match += LZ_MIN_MATCH;
+        if (match > capacity - op) {
+            return -1;
+        }
+        unsigned char *d = dst + op;
+        const unsigned char *s = d - offset;
+        if (offset >= match) {
+            memcpy(d, s, match);
+        } else {
+            //the match overlaps the bytes it produces, which repeats the last `offset` bytes
+            for (size_t i = 0; i < match; i++) {
+                d[i] = s[i];
+            }
+        }
+        op += match;
+    }
+    return -1;
+}
+
+//dfs_compress_block: Compresses one block; returns 0 if it would not get smaller.
+size_t dfs_compress_block(int codec, const void* data, size_t length, void* out, size_t capacity) {
+    if (codec != DFS_CODEC_LZ || length == 0 || length > DFS_COMPRESS_BLOCK_SIZE) {
+        return 0;
+    }
+    unsigned long long start = now_us();
+    size_t n = lz_compress(data, length, out, capacity < length ? capacity : length - 1);
+    __atomic_add_fetch(&totals.compressed_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&totals.compress_in, length, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&totals.compress_out, n != 0 ? n : length, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&totals.compress_us, now_us() - start, __ATOMIC_RELAXED);
+    return n;
+}
+
+//dfs_decompress_block: Decodes one block into `out`; returns the decoded length or -1.
+long dfs_decompress_block(int codec, const void* data, size_t length, void* out, size_t capacity) {
+    unsigned long long start = now_us();
+    long n;
+    if (codec == DFS_CODEC_LZ) {
+        n = lz_decompress(data, length, out, capacity);
+    } else if (codec == DFS_CODEC_NONE && length <= capacity) {
+        memcpy(out, data, length);
+        n = (long)length;
+    } else {
+        n = -1;
+    }
+    if (n >= 0) {
+        __atomic_add_fetch(&totals.decompressed_blocks, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&totals.decompress_in, length, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&totals.decompress_out, n, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&totals.decompress_us, now_us() - start, __ATOMIC_RELAXED);
+    }
+    return n;
+}
+
+//dfs_compress_payload: Builds the payload of a compressed DATA frame, or returns 0 if the block does not shrink.
+uint32_t dfs_compress_payload(int codec, const void* data, uint32_t length, unsigned char* out) {
+    size_t n = dfs_compress_block(codec, data, length, out + DFS_COMPRESS_HEADER_SIZE, DFS_COMPRESS_BOUND(length));
+    if (n == 0) {
+        return 0;
+    }
+    out[0] = (unsigned char)codec;
+    put_u32(out + 1, length);
+    return (uint32_t)(n + DFS_COMPRESS_HEADER_SIZE);
+}
+
+//dfs_decompress_payload: Decodes the payload of a compressed DATA frame.
+long dfs_decompress_payload(const unsigned char* payload, uint32_t length, void* out, size_t capacity) {
+    if (length < DFS_COMPRESS_HEADER_SIZE) {
+        return -1;
+    }
+    uint32_t decoded = get_u32(payload + 1);
+    if (decoded > capacity) {
+        return -1;
+    }
+    long n = dfs_decompress_block(payload[0], payload + DFS_COMPRESS_HEADER_SIZE, length - DFS_COMPRESS_HEADER_SIZE, out, decoded);
+    return n == (long)decoded ? n : -1;
+}
+
+//read_block: Reads up to a whole block, so a pipe or socket that delivers less at a time still fills it.
+static ssize_t read_block(int fd, unsigned char* buffer, size_t capacity) {
+    size_t filled = 0;
+    while (filled < capacity) {
+        ssize_t n = read(fd, buffer + filled, capacity - filled);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        filled += n;
+    }
+    return (ssize_t)filled;
+}
+
+//dfs_send_compressed_stream: Sends everything readable from `fd` as compressed DATA frames and an END frame.
+long long dfs_send_compressed_stream(int sock, int fd, uint32_t request_id, int codec) {
+    unsigned char *buffer = malloc(DFS_COMPRESS_BLOCK_SIZE + DFS_COMPRESS_PAYLOAD_MAX);
+    if (!buffer) {
+        return -1;
+    }
+    unsigned char *payload = buffer + DFS_COMPRESS_BLOCK_SIZE;
+    long long total_bytes_sent = 0;
+    ssize_t bytes_read;
+    while ((bytes_read = read_block(fd, buffer, DFS_COMPRESS_BLOCK_SIZE)) != 0) {
+        if (bytes_read < 0) {
+            perror("Failed to read data");
+            free(buffer);
+            dfs_send_status(sock, request_id, 0, "Failed to read file");
+            return -1;
+        }
+        uint32_t n = dfs_compress_payload(codec, buffer, bytes_read, payload);
+        int sent = n != 0 ? dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_COMPRESSED, request_id, payload, n)
+                          : dfs_send_frame(sock, DFS_OP_DATA, 0, request_id, buffer, bytes_read);
+        if (sent < 0) {
+            perror("Failed to send data");
+            free(buffer);
+            return -1;
+        }
+        total_bytes_sent += bytes_read;
+    }
+    free(buffer);
+    if (dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0) {
+        return -1;
+    }
+    return total_bytes_sent;
+}
+
+//pwrite_full: Writes a whole buffer at `offset`, looping over short writes.
+static int pwrite_full(int fd, const void* buffer, size_t length, off_t offset) {
+    const char *p = buffer;
+    while (length > 0) {
+        ssize_t n = pwrite(fd, p, length, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+//pread_full: Reads a whole buffer at `offset`; a file ending early counts as an error.
+static int pread_full(int fd, void* buffer, size_t length, off_t offset) {
+    char *p = buffer;
+    while (length > 0) {
+        ssize_t n = pread(fd, p, length, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            errno = EIO;
+            return -1;
+        }
+        p += n;
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+//block_length: Returns the content length of block `index`; only the last block can be short.
+static uint32_t block_length(uint64_t size, uint32_t count, uint32_t index) {
+    if (index + 1 < count) {
+        return DFS_COMPRESS_BLOCK_SIZE;
+    }
+    return (uint32_t)(size - (uint64_t)index * DFS_COMPRESS_BLOCK_SIZE);
+}
+
+//write_pack: Compresses the first `size` bytes of `source` into `fd`, reading it block by block.
+//returns the pack size or -1; a source that ends early counts as an error.
+static long long write_pack(int fd, int source, uint64_t size, int codec) {
+    uint32_t count = (uint32_t)((size + DFS_COMPRESS_BLOCK_SIZE - 1) / DFS_COMPRESS_BLOCK_SIZE);
+    size_t index_size = (size_t)count * 4;
+    unsigned char *header = malloc(PACK_HEADER_SIZE + index_size);
+    unsigned char *block = malloc(DFS_COMPRESS_BLOCK_SIZE);
+    unsigned char *out = malloc(DFS_COMPRESS_BOUND(DFS_COMPRESS_BLOCK_SIZE));
+    if (!header || !block || !out) {
+        free(header);
+        free(block);
+        free(out);
+        return -1;
+    }
+    memcpy(header, DFS_PACK_MAGIC, sizeof(DFS_PACK_MAGIC) - 1);
+    unsigned char *p = header + sizeof(DFS_PACK_MAGIC) - 1;
+    *p++ = (unsigned char)codec;
+    put_u32(p, DFS_COMPRESS_BLOCK_SIZE);
+    put_u64(p + 4, size);
+    put_u32(p + 12, count);
+
+    long long position = PACK_HEADER_SIZE + index_size;
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < count; i++) {
+        uint32_t length = block_length(size, count, i);
+        if (pread_full(source, block, length, (off_t)i * DFS_COMPRESS_BLOCK_SIZE) < 0) {
+            ok = false;
+            break;
+        }
+        size_t n = dfs_compress_block(codec, block, length, out, DFS_COMPRESS_BOUND(length));
+        if (n != 0) {
+            put_u32(header + PACK_HEADER_SIZE + (size_t)i * 4, (uint32_t)n);
+            ok = pwrite_full(fd, out, n, position) == 0;
+        } else {
+            n = length;
+            put_u32(header + PACK_HEADER_SIZE + (size_t)i * 4, length | DFS_PACK_RAW);
+            ok = pwrite_full(fd, block, n, position) == 0;
+        }
+        position += n;
+    }
+    ok = ok && pwrite_full(fd, header, PACK_HEADER_SIZE + index_size, 0) == 0;
+    free(header);
+    free(block);
+    free(out);
+    return ok ? position : -1;
+}
+
+//dfs_pack_file: Replaces the plain file at `path` by a pack if that makes it smaller.
+//the file is read with pread, so one truncated meanwhile fails the pack instead of faulting. the pack is written
+//next to the file under a hidden name of its own and renamed over it, so readers see either the plain file or the
+//whole pack. a file replaced by a newer upload while it was being packed is left to that upload.
+int dfs_pack_file(const char* path, int codec, int* packed, unsigned long long* raw_size, unsigned long long* pack_size) {
+    *packed = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    *raw_size = st.st_size;
+    *pack_size = st.st_size;
+    if (!S_ISREG(st.st_mode) || st.st_size == 0 || fgetxattr(fd, DFS_PACK_XATTR, NULL, 0) >= 0) {
+        //nothing to gain, or packed already
+        close(fd);
+        return 0;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char temp_path[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    int dir_length = slash != NULL ? (int)(slash - path + 1) : 0;
+    snprintf(temp_path, sizeof(temp_path), "%.*s.%s.pack.XXXXXX", dir_length, path, path + dir_length);
+    int out_fd = mkostemp(temp_path, O_CLOEXEC);
+    long long size = -1;
+    if (out_fd >= 0 && fchmod(out_fd, 0644) == 0) {
+        size = write_pack(out_fd, fd, st.st_size, codec);
+        if (size >= 0 && (fsetxattr(out_fd, DFS_PACK_XATTR, "1", 1, 0) < 0 || fsync(out_fd) < 0)) {
+            size = -1;
+        }
+    }
+    if (out_fd >= 0 && close(out_fd) < 0) {
+        size = -1;
+    }
+    int saved_errno = errno;
+    close(fd);
+    if (size < 0) {
+        if (out_fd >= 0) {
+            unlink(temp_path);
+        }
+        errno = saved_errno;
+        return -1;
+    }
+    if ((unsigned long long)size >= *raw_size) {
+        unlink(temp_path);
+        return 0;
+    }
+
+    struct stat now;
+    if (stat(path, &now) < 0 || now.st_ino != st.st_ino || now.st_dev != st.st_dev ||
+        now.st_size != st.st_size || now.st_mtim.tv_sec != st.st_mtim.tv_sec || now.st_mtim.tv_nsec != st.st_mtim.tv_nsec) {
+        unlink(temp_path);
+        return 0;
+    }
+    if (rename(temp_path, path) < 0) {
+        saved_errno = errno;
+        unlink(temp_path);
+        errno = saved_errno;
+        return -1;
+    }
+    *packed = 1;
+    *pack_size = size;
+    return 0;
+}
+
+//read_pack: Reads and checks the header and index of the pack open on `fd`, marked or not.
+//returns NULL with errno 0 if it does not start like a pack.
+static struct dfs_pack* read_pack(int fd) {
+    unsigned char header[PACK_HEADER_SIZE];
+    ssize_t n = pread(fd, header, sizeof(header), 0);
+    if (n != (ssize_t)sizeof(header) || memcmp(header, DFS_PACK_MAGIC, sizeof(DFS_PACK_MAGIC) - 1) != 0) {
+        errno = 0;
+        return NULL;
+    }
+    const unsigned char *p = header + sizeof(DFS_PACK_MAGIC) - 1;
+    int codec = p[0];
+    uint32_t block_size = get_u32(p + 1);
+    uint64_t size = get_u64(p + 5);
+    uint32_t count = get_u32(p + 13);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return NULL;
+    }
+    if (codec != DFS_CODEC_LZ || block_size != DFS_COMPRESS_BLOCK_SIZE ||
+        (uint64_t)count != (size + DFS_COMPRESS_BLOCK_SIZE - 1) / DFS_COMPRESS_BLOCK_SIZE ||
+        (uint64_t)count * 4 > (uint64_t)st.st_size) {
+        errno = EIO;
+        return NULL;
+    }
+
+    struct dfs_pack *pack = calloc(1, sizeof(*pack));
+    unsigned char *index = malloc((size_t)count * 4 + 1);
+    if (pack) {
+        pack->offsets = malloc(((size_t)count + 1) * sizeof(uint64_t));
+        pack->stored = malloc((size_t)count * sizeof(uint32_t) + 1);
+        pack->block = malloc(DFS_COMPRESS_BLOCK_SIZE + DFS_COMPRESS_PAYLOAD_MAX);
+    }
+    if (!pack || !index || !pack->offsets || !pack->stored || !pack->block) {
+        free(index);
+        if (pack) {
+            free(pack->offsets);
+            free(pack->stored);
+            free(pack->block);
+            free(pack);
+        }
+        errno = ENOMEM;
+        return NULL;
+    }
+    pack->payload = pack->block + DFS_COMPRESS_BLOCK_SIZE;
+    pack->fd = fd;
+    pack->codec = codec;
+    pack->size = size;
+    pack->count = count;
+    pack->cached = -1;
+
+    bool ok = pread_full(fd, index, (size_t)count * 4, PACK_HEADER_SIZE) == 0;
+    uint64_t position = PACK_HEADER_SIZE + (uint64_t)count * 4;
+    for (uint32_t i = 0; ok && i < count; i++) {
+        uint32_t stored = get_u32(index + (size_t)i * 4);
+        uint32_t length = block_length(size, count, i);
+        uint32_t bytes = stored & ~DFS_PACK_RAW;
+        if ((stored & DFS_PACK_RAW) ? bytes != length : bytes == 0 || bytes > DFS_COMPRESS_BOUND(length)) {
+            ok = false;
+        }
+        pack->stored[i] = stored;
+        pack->offsets[i] = position;
+        position += bytes;
+    }
+    pack->offsets[count] = position;
+    free(index);
+    if (!ok || position != (uint64_t)st.st_size) {
+        pack->fd = -1;
+        dfs_pack_close(pack);
+        errno = EIO;
+        return NULL;
+    }
+    return pack;
+}
+
+//load_block: Decodes block `index` into pack->block unless it is there already.
+static int load_block(struct dfs_pack* pack, uint32_t index) {
+    if (pack->cached == (long)index) {
+        return 0;
+    }
+    uint32_t length = block_length(pack->size, pack->count, index);
+    uint32_t stored = pack->stored[index];
+    if (stored & DFS_PACK_RAW) {
+        if (pread_full(pack->fd, pack->block, length, pack->offsets[index]) < 0) {
+            pack->cached = -1;
+            return -1;
+        }
+    } else {
+        pack->cached = -1;
+        if (pread_full(pack->fd, pack->payload, stored, pack->offsets[index]) < 0) {
+            return -1;
+        }
+        if (dfs_decompress_block(pack->codec, pack->payload, stored, pack->block, length) != (long)length) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    pack->cached = index;
+    return 0;
+}
+
+//dfs_pack_pread: Reads content from a pack like pread() reads a file; at most one block per call.
+ssize_t dfs_pack_pread(struct dfs_pack* pack, void* buffer, size_t length, uint64_t offset) {
+    if (offset >= pack->size || length == 0) {
+        return 0;
+    }
+    uint32_t index = (uint32_t)(offset / DFS_COMPRESS_BLOCK_SIZE);
+    if (load_block(pack, index) < 0) {
+        return -1;
+    }
+    size_t inner = offset - (uint64_t)index * DFS_COMPRESS_BLOCK_SIZE;
+    size_t available = block_length(pack->size, pack->count, index) - inner;
+    size_t n = length < available ? length : available;
+    memcpy(buffer, pack->block + inner, n);
+    return (ssize_t)n;
+}
+
+//dfs_pack_send_block: Sends block `index` as one DATA frame.
+long long dfs_pack_send_block(int sock, struct dfs_pack* pack, uint32_t index, uint32_t request_id, int codec) {
+    uint32_t length = block_length(pack->size, pack->count, index);
+    uint32_t stored = pack->stored[index];
+    if (codec != DFS_CODEC_NONE && codec == pack->codec && !(stored & DFS_PACK_RAW)) {
+        //the stored block is already the body of a compressed frame
+        unsigned char *payload = pack->payload;
+        if (pread_full(pack->fd, payload + DFS_COMPRESS_HEADER_SIZE, stored, pack->offsets[index]) < 0) {
+            return -1;
+        }
+        payload[0] = (unsigned char)pack->codec;
+        put_u32(payload + 1, length);
+        if (dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_COMPRESSED, request_id, payload, stored + DFS_COMPRESS_HEADER_SIZE) < 0) {
+            return -1;
+        }
+        return length;
+    }
+    if (load_block(pack, index) < 0) {
+        return -1;
+    }
+    uint32_t n = stored & DFS_PACK_RAW ? 0 : dfs_compress_payload(codec, pack->block, length, pack->payload);
+    int sent = n != 0 ? dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_COMPRESSED, request_id, pack->payload, n)
+                      : dfs_send_frame(sock, DFS_OP_DATA, 0, request_id, pack->block, length);
+    return sent < 0 ? -1 : (long long)length;
+}
+
+//dfs_pack_close: Closes the pack's file and frees it.
+//dfs_pack_open: Reads and checks the header and index of a pack; a file without the mark is a plain file.
+struct dfs_pack* dfs_pack_open(int fd) {
+    if (fgetxattr(fd, DFS_PACK_XATTR, NULL, 0) < 0) {
+        errno = 0;
+        return NULL;
+    }
+    struct dfs_pack *pack = read_pack(fd);
+    if (pack == NULL && errno == 0) {
+        //marked but not a pack: damaged
+        errno = EIO;
+    }
+    return pack;
+}
+
+//mark_pack: nftw() callback marking every unmarked file below the root that reads as a pack.
+static int mark_pack(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)ftw;
+    if (type != FTW_F || !S_ISREG(st->st_mode)) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    int pack_fd = fgetxattr(fd, DFS_PACK_XATTR, NULL, 0) < 0 ? dup(fd) : -1;
+    struct dfs_pack *pack = pack_fd >= 0 ? read_pack(pack_fd) : NULL;
+    if (pack != NULL) {
+        if (fsetxattr(fd, DFS_PACK_XATTR, "1", 1, 0) == 0) {
+            marked_packs++;
+        } else {
+            mark_failed = true;
+        }
+        dfs_pack_close(pack);
+    } else if (pack_fd >= 0) {
+        close(pack_fd);
+    }
+    close(fd);
+    return 0;
+}
+
+//dfs_pack_mark_tree: Marks the packs below `root` written before packs were marked, unless `marker` says it is done.
+long dfs_pack_mark_tree(const char* root, const char* marker) {
+    if (access(marker, F_OK) == 0) {
+        return 0;
+    }
+    marked_packs = 0;
+    mark_failed = false;
+    if (nftw(root, mark_pack, 32, FTW_PHYS) != 0 && errno != ENOENT) {
+        return -1;
+    }
+    if (mark_failed) {
+        //the packs left unmarked read as plain files until a later start marks them
+        errno = ENOTSUP;
+        return -1;
+    }
+    int fd = open(marker, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    close(fd);
+    return marked_packs;
+}
+
+void dfs_pack_close(struct dfs_pack* pack) {
+    if (pack == NULL) {
+        return;
+    }
+    if (pack->fd >= 0) {
+        close(pack->fd);
+    }
+    free(pack->offsets);
+    free(pack->stored);
+    free(pack->block);
+    free(pack);
+}
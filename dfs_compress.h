@@ -0,0 +1,99 @@
+//dfs_compress.h
+//this header declares the block compression used on the wire and for Stext's files at rest.
+//data is compressed in blocks of DFS_COMPRESS_BLOCK_SIZE bytes, each on its own, so any block can be decoded
+//without the ones before it. the built-in codec "lz" is an LZ77 coder in the style of LZ4: byte-aligned
+//literal runs and matches, no entropy coding, fast enough to keep up with a network link. every block names
+//its codec, so codecs from libraries such as zstd can be added without changing the formats.
+//
+//on the wire a client and Smain agree on a codec with DFS_OP_COMPRESS. a DATA frame flagged
+//DFS_FLAG_COMPRESSED then carries one block: the codec (1 byte), the decoded length (32 bit big endian) and the
+//compressed bytes. a request flagged DFS_FLAG_COMPRESSED asks for its reply stream to be compressed.
+//
+//at rest a file is replaced by a pack: a header, the stored length of every block, and the blocks. a pack is
+//told apart from a stored file by the extended attribute DFS_PACK_XATTR, never by its content, so a file that
+//happens to start like a pack is served as it was stored. readers go through dfs_chunk_open(), which serves
+//packs like plain files.
+#ifndef DFS_COMPRESS_H
+#define DFS_COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+//codecs
+#define DFS_CODEC_NONE 0
+#define DFS_CODEC_LZ 1
+
+//bytes of data per block, and the most a block can grow when it does not compress
+#define DFS_COMPRESS_BLOCK_SIZE 65536
+#define DFS_COMPRESS_BOUND(length) ((length) + (length) / 255 + 16)
+//a compressed frame's payload: codec, decoded length, compressed block
+#define DFS_COMPRESS_HEADER_SIZE 5
+#define DFS_COMPRESS_PAYLOAD_MAX (DFS_COMPRESS_HEADER_SIZE + DFS_COMPRESS_BOUND(DFS_COMPRESS_BLOCK_SIZE))
+//first bytes of every pack, and the extended attribute every pack carries
+#define DFS_PACK_MAGIC "DFS-PACK 1\n"
+#define DFS_PACK_XATTR "user.dfs.pack"
+
+//running totals of this process, for ratio and throughput reports
+struct dfs_compress_stats {
+    unsigned long long compressed_blocks;
+    unsigned long long compress_in;        //bytes given to the compressor
+    unsigned long long compress_out;       //bytes it produced, counting blocks stored as they were
+    unsigned long long compress_us;
+    unsigned long long decompressed_blocks;
+    unsigned long long decompress_in;
+    unsigned long long decompress_out;
+    unsigned long long decompress_us;
+};
+void dfs_compress_get_stats(struct dfs_compress_stats* out);
+
+//codec names ("none", "lz"); dfs_codec_parse() returns -1 for an unknown name.
+//dfs_codec_choose() picks the first codec of the comma-separated `offered` list that `allowed` names too.
+const char* dfs_codec_name(int codec);
+int dfs_codec_parse(const char* name);
+int dfs_codec_choose(const char* offered, const char* allowed);
+
+//block codec. dfs_compress_block() returns the compressed length, or 0 if the block does not get smaller;
+//`out` holds DFS_COMPRESS_BOUND(length) bytes. dfs_decompress_block() returns the decoded length or -1.
+size_t dfs_compress_block(int codec, const void* data, size_t length, void* out, size_t capacity);
+long dfs_decompress_block(int codec, const void* data, size_t length, void* out, size_t capacity);
+
+//compressed DATA frame payloads. dfs_compress_payload() returns the payload length, or 0 if the block is
+//better sent as a plain frame; `out` holds DFS_COMPRESS_PAYLOAD_MAX bytes. dfs_decompress_payload() decodes a
+//payload into `out` and returns the decoded length or -1.
+uint32_t dfs_compress_payload(int codec, const void* data, uint32_t length, unsigned char* out);
+long dfs_decompress_payload(const unsigned char* payload, uint32_t length, void* out, size_t capacity);
+//dfs_send_compressed_stream() sends everything readable from `fd` as a stream of compressed frames (plain
+//where a block does not compress) followed by an END frame. returns the bytes read from `fd` or -1.
+long long dfs_send_compressed_stream(int sock, int fd, uint32_t request_id, int codec);
+
+//packs
+struct dfs_pack {
+    int fd;
+    int codec;
+    uint64_t size;             //bytes of content
+    uint32_t count;            //blocks
+    uint64_t *offsets;         //position of every block in the pack, and the end of the last
+    uint32_t *stored;          //stored length of every block; DFS_PACK_RAW marks a block kept uncompressed
+    unsigned char *block;      //last decoded block
+    long cached;               //its index, -1 for none
+    unsigned char *payload;    //a stored block read back, behind room for a frame payload header
+};
+#define DFS_PACK_RAW 0x80000000u
+
+//dfs_pack_file() replaces the plain file at `path` by a pack; uploads pack their private file before it is
+//renamed into place. a file that does not shrink is left alone and reported with `*packed` 0. `raw_size` and
+//`pack_size` receive the sizes before and after.
+int dfs_pack_file(const char* path, int codec, int* packed, unsigned long long* raw_size, unsigned long long* pack_size);
+//dfs_pack_open() takes over `fd` if it holds a pack and returns it; NULL with errno 0 if it is a plain file.
+//dfs_pack_mark_tree() marks the packs below `root` written before packs carried DFS_PACK_XATTR, once: it keeps
+//`marker` once done and does nothing while it exists. returns the number of packs marked or -1.
+struct dfs_pack* dfs_pack_open(int fd);
+long dfs_pack_mark_tree(const char* root, const char* marker);
+ssize_t dfs_pack_pread(struct dfs_pack* pack, void* buffer, size_t length, uint64_t offset);
+//dfs_pack_send_block() sends block `index` as one DATA frame, straight from the pack if it is stored with
+//`codec`, compressed or plain otherwise. returns the bytes of content sent or -1.
+long long dfs_pack_send_block(int sock, struct dfs_pack* pack, uint32_t index, uint32_t request_id, int codec);
+void dfs_pack_close(struct dfs_pack* pack);
+
+#endif
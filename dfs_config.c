@@ -0,0 +1,192 @@
+//dfs_config.c
+//this file implements the runtime configuration declared in dfs_config.h.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "dfs_frame.h"
+#include "dfs_xfer.h"
+#include "dfs_config.h"
+
+//longest line of a configuration file
+#define CONFIG_LINE_MAX 1024
+
+static struct dfs_net_config net_config = {
+    DFS_SMAIN_DEFAULT_PORT, DFS_SPDF_DEFAULT_PORT, DFS_STEXT_DEFAULT_PORT, DFS_DEFAULT_LISTEN_BACKLOG,
+    0, 0, 1, 0, DFS_DATA_CHUNK_SIZE
+};
+
+//trim: Strips leading and trailing white space in place.
+static char* trim(char* text) {
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char)text[length - 1])) {
+        text[--length] = '\0';
+    }
+    return text;
+}
+
+//apply_file: Copies the settings of one pass over the file into the environment: the lines of `program`'s
+//section (`sectioned` set) or the lines outside any section. returns the number of settings or -1 on a bad line.
+static int apply_file(FILE* file, const char* path, const char* program, int sectioned) {
+    char line[CONFIG_LINE_MAX];
+    int in_section = 0;
+    int matches = 0;
+    int count = 0;
+    int number = 0;
+    rewind(file);
+    while (fgets(line, sizeof(line), file)) {
+        number++;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        char *text = trim(line);
+        if (*text == '\0') {
+            continue;
+        }
+        if (*text == '[') {
+            char *end = strchr(text, ']');
+            if (!end || end[1] != '\0') {
+                fprintf(stderr, "%s:%d: invalid section line\n", path, number);
+                return -1;
+            }
+            *end = '\0';
+            in_section = 1;
+            matches = strcasecmp(trim(text + 1), program) == 0;
+            continue;
+        }
+        char *equals = strchr(text, '=');
+        if (!equals) {
+            fprintf(stderr, "%s:%d: expected KEY=value\n", path, number);
+            return -1;
+        }
+        *equals = '\0';
+        char *key = trim(text);
+        char *value = trim(equals + 1);
+        for (char *p = key; *p; p++) {
+            if (!isalnum((unsigned char)*p) && *p != '_') {
+                fprintf(stderr, "%s:%d: invalid key %s\n", path, number, key);
+                return -1;
+            }
+        }
+        if (*key == '\0') {
+            fprintf(stderr, "%s:%d: missing key\n", path, number);
+            return -1;
+        }
+        if (sectioned ? (in_section && matches) : !in_section) {
+            setenv(key, value, 0);
+            count++;
+        }
+    }
+    return count;
+}
+
+//load_file: Copies the settings of the configuration file into the environment, section lines first so they
+//take precedence over the lines outside a section.
+static int load_file(const char* program) {
+    const char *path = getenv("DFS_CONFIG");
+    char default_path[PATH_MAX];
+    if (!path || *path == '\0') {
+        const char *home = getenv("HOME");
+        if (!home) {
+            struct passwd *pw = getpwuid(getuid());
+            home = pw ? pw->pw_dir : "/";
+        }
+        snprintf(default_path, sizeof(default_path), "%s/%s", home, DFS_CONFIG_DEFAULT_FILE);
+        path = default_path;
+        if (access(path, F_OK) < 0) {
+            return 0;
+        }
+    }
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    //the whole file is checked before anything is applied
+    int count = apply_file(file, path, "", 1) < 0 ? -1 : apply_file(file, path, program, 1);
+    if (count >= 0) {
+        int global = apply_file(file, path, program, 0);
+        count = global < 0 ? -1 : count + global;
+    }
+    fclose(file);
+    return count;
+}
+
+//env_number: Returns an environment variable as a number with an optional K, M or G suffix, or `fallback` if it
+//is unset or invalid or outside minimum..maximum.
+static long env_number(const char* name, long fallback, long minimum, long maximum) {
+    const char *text = getenv(name);
+    if (!text || *text == '\0') {
+        return fallback;
+    }
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (*end == 'K' || *end == 'k') {
+        value *= 1024;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        value *= 1024 * 1024;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        value *= 1024 * 1024 * 1024L;
+        end++;
+    }
+    if (errno != 0 || end == text || *end != '\0' || value < minimum || value > maximum) {
+        fprintf(stderr, "Ignoring invalid %s=%s\n", name, text);
+        return fallback;
+    }
+    return value;
+}
+
+//dfs_config_load: Reads the configuration file and the network settings of the environment.
+int dfs_config_load(const char* program) {
+    int count = load_file(program);
+
+    net_config.smain_port = env_number("DFS_SMAIN_PORT", DFS_SMAIN_DEFAULT_PORT, 1, 65535);
+    net_config.spdf_port = env_number("DFS_SPDF_PORT", DFS_SPDF_DEFAULT_PORT, 1, 65535);
+    net_config.stext_port = env_number("DFS_STEXT_PORT", DFS_STEXT_DEFAULT_PORT, 1, 65535);
+    net_config.listen_backlog = env_number("DFS_LISTEN_BACKLOG", DFS_DEFAULT_LISTEN_BACKLOG, 1, INT_MAX);
+    net_config.send_buffer = env_number("DFS_SO_SNDBUF", 0, 0, INT_MAX);
+    net_config.receive_buffer = env_number("DFS_SO_RCVBUF", 0, 0, INT_MAX);
+    net_config.nodelay = env_number("DFS_TCP_NODELAY", 1, 0, 1);
+    net_config.cork = env_number("DFS_TCP_CORK", 0, 0, 1);
+    net_config.data_chunk = env_number("DFS_DATA_CHUNK", DFS_DATA_CHUNK_SIZE, DFS_DATA_CHUNK_SIZE, DFS_DATA_CHUNK_MAX);
+
+    dfs_set_data_chunk_size(net_config.data_chunk);
+    dfs_xfer_set_cork(net_config.cork);
+    return count;
+}
+
+const struct dfs_net_config* dfs_config_net(void) {
+    return &net_config;
+}
+
+//dfs_config_tune_socket: Applies the configured buffer sizes and TCP_NODELAY.
+void dfs_config_tune_socket(int sock) {
+    if (net_config.send_buffer > 0 && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &net_config.send_buffer, sizeof(int)) < 0) {
+        perror("Failed to set SO_SNDBUF");
+    }
+    if (net_config.receive_buffer > 0 && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &net_config.receive_buffer, sizeof(int)) < 0) {
+        perror("Failed to set SO_RCVBUF");
+    }
+    int one = 1;
+    if (net_config.nodelay) {
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+}
@@ -0,0 +1,49 @@
+//dfs_config.h
+//this header declares the runtime configuration shared by Smain, Spdf, Stext and client24s.
+//every setting is one of the DFS_* environment variables the programs read. dfs_config_load() first copies the
+//settings of a configuration file into the environment without replacing variables that are already set, so the
+//environment overrides the file. the file holds KEY=value lines; '#' starts a comment, and lines below a
+//[Program] line only apply to that program and override the lines outside a section:
+//    DFS_SO_RCVBUF=4M
+//    [Spdf]
+//    DFS_POOL_WORKERS=16
+//the network settings (ports, listen backlog, socket buffers, Nagle and cork, data chunk size) are read here;
+//the other modules keep reading their own variables.
+#ifndef DFS_CONFIG_H
+#define DFS_CONFIG_H
+
+#include <stddef.h>
+
+//file read when DFS_CONFIG is not set, relative to the home directory
+#define DFS_CONFIG_DEFAULT_FILE ".dfs.conf"
+
+//defaults used when DFS_SMAIN_PORT / DFS_SPDF_PORT / DFS_STEXT_PORT / DFS_LISTEN_BACKLOG are not set
+#define DFS_SMAIN_DEFAULT_PORT 3001
+#define DFS_SPDF_DEFAULT_PORT 3002
+#define DFS_STEXT_DEFAULT_PORT 3003
+#define DFS_DEFAULT_LISTEN_BACKLOG 128
+
+//network settings of this process
+struct dfs_net_config {
+    int smain_port;
+    int spdf_port;
+    int stext_port;
+    int listen_backlog;
+    int send_buffer;       //SO_SNDBUF in bytes, 0 keeps the kernel's autotuning
+    int receive_buffer;    //SO_RCVBUF in bytes, 0 keeps the kernel's autotuning
+    int nodelay;           //TCP_NODELAY on every connection
+    int cork;              //TCP_CORK around every file sent, so headers and payloads fill whole segments
+    size_t data_chunk;     //payload size of the buffered loops, see dfs_data_chunk_size()
+};
+
+//dfs_config_load() reads the configuration file for `program` ("Smain", "Spdf", ...) and the network settings.
+//call it first thing in main(). returns the number of settings taken from the file, or -1 if the file named by
+//DFS_CONFIG cannot be read or holds an invalid line (the environment alone is used then).
+int dfs_config_load(const char* program);
+const struct dfs_net_config* dfs_config_net(void);
+
+//dfs_config_tune_socket() applies the socket buffer sizes and TCP_NODELAY to a connection, or to a listening
+//socket before listen(), whose connections then start with its buffer sizes
+void dfs_config_tune_socket(int sock);
+
+#endif
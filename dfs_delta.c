@@ -0,0 +1,676 @@
+//dfs_delta.c
+//this file implements the upload exchange declared in dfs_delta.h.
+//the server looks chunks up in its chunk store (when it deduplicates) and in the current version of the target.
+//the chunks of a plain target are found by cutting it the way the client cut its file; as the query and the
+//upload that follows it both need them, the lists of the last few targets are cached, keyed by their inode,
+//size and modification time.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dfs_delta.h"
+#include "dfs_frame.h"
+#include "dfs_xfer.h"
+
+//targets whose chunk lists are kept between a query and its upload
+#define DELTA_CACHE_SLOTS 8
+
+//the request's stream: DATA frames on a socket, or their payloads in a file
+struct delta_input {
+    int fd;
+    int framed;
+    uint64_t frame_left;   //payload bytes of the current frame not yet read
+    bool last;             //the current frame ends the stream
+    bool ended;            //the whole stream has been read
+    bool broken;           //the connection failed or the sender aborted; there is nothing left to read
+    char *error;
+    size_t error_capacity;
+};
+
+//one cached chunk list of a plain target
+struct delta_cache_slot {
+    char path[PATH_MAX];
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned long long used;
+    struct dfs_chunk_recipe *recipe;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct delta_cache_slot cache[DELTA_CACHE_SLOTS];
+static unsigned long long cache_clock = 0;
+
+//next_frame: Reads the header of the stream's next frame. returns -1 if the stream is over or broken.
+static int next_frame(struct delta_input* in) {
+    struct dfs_frame frame;
+    if (dfs_recv_header(in->fd, &frame) < 0) {
+        in->broken = true;
+        snprintf(in->error, in->error_capacity, "Connection lost during transfer");
+        return -1;
+    }
+    if (frame.opcode == DFS_OP_STATUS) {
+        //the sender aborted the stream
+        char message[DFS_MAX_CONTROL_PAYLOAD] = {0};
+        uint32_t keep = frame.length < sizeof(message) - 1 ? frame.length : sizeof(message) - 1;
+        in->broken = true;
+        if (dfs_read_full(in->fd, message, keep) < 0 || dfs_skip_payload(in->fd, frame.length - keep) < 0) {
+            snprintf(in->error, in->error_capacity, "Connection lost during transfer");
+        } else {
+            snprintf(in->error, in->error_capacity, "%s", message);
+        }
+        return -1;
+    }
+    if (frame.opcode != DFS_OP_DATA) {
+        in->broken = true;
+        snprintf(in->error, in->error_capacity, "Unexpected %s frame inside data stream", dfs_opcode_name(frame.opcode));
+        return -1;
+    }
+    if (frame.flags & DFS_FLAG_COMPRESSED) {
+        in->broken = true;
+        snprintf(in->error, in->error_capacity, "Compressed data is not supported in delta uploads");
+        return -1;
+    }
+    in->frame_left = frame.length;
+    in->last = frame.flags & DFS_FLAG_END;
+    in->ended = in->last && frame.length == 0;
+    return 0;
+}
+
+//input_read: Reads exactly `length` bytes of the stream.
+static int input_read(struct delta_input* in, void* buffer, size_t length) {
+    unsigned char *p = buffer;
+    while (length > 0) {
+        if (in->broken || in->ended) {
+            if (!in->broken) {
+                snprintf(in->error, in->error_capacity, "Upload stream is shorter than its chunk list");
+            }
+            return -1;
+        }
+        if (!in->framed) {
+            ssize_t n = read(in->fd, p, length);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                in->ended = true;
+                continue;
+            }
+            p += n;
+            length -= n;
+            continue;
+        }
+        if (in->frame_left == 0) {
+            if (next_frame(in) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        size_t take = length < in->frame_left ? length : in->frame_left;
+        if (dfs_read_full(in->fd, p, take) < 0) {
+            in->broken = true;
+            snprintf(in->error, in->error_capacity, "Connection lost during transfer");
+            return -1;
+        }
+        p += take;
+        length -= take;
+        in->frame_left -= take;
+        in->ended = in->frame_left == 0 && in->last;
+    }
+    return 0;
+}
+
+//input_finish: Consumes the rest of the stream. returns -1 if anything was left, or the stream broke.
+static int input_finish(struct delta_input* in) {
+    bool extra = false;
+    if (!in->framed) {
+        char byte;
+        extra = !in->ended && read(in->fd, &byte, 1) > 0;
+    }
+    while (in->framed && !in->ended && !in->broken) {
+        if (in->frame_left > 0) {
+            if (dfs_skip_payload(in->fd, in->frame_left) < 0) {
+                in->broken = true;
+                snprintf(in->error, in->error_capacity, "Connection lost during transfer");
+                break;
+            }
+            extra = true;
+            in->frame_left = 0;
+            in->ended = in->last;
+        } else if (next_frame(in) < 0) {
+            break;
+        }
+    }
+    if (in->broken) {
+        return -1;
+    }
+    if (extra) {
+        snprintf(in->error, in->error_capacity, "Upload stream is longer than its chunk list");
+        return -1;
+    }
+    return 0;
+}
+
+//parse_size: Reads a file size argument.
+static int parse_size(const char* text, uint64_t* size) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || text[0] == '-') {
+        return -1;
+    }
+    *size = value;
+    return 0;
+}
+
+static void free_recipe(struct dfs_chunk_recipe* recipe) {
+    dfs_chunk_release(recipe, 0);
+}
+
+//read_list: Reads the chunk list of a `size` byte file and, with `sent` set, the flag of every chunk.
+static struct dfs_chunk_recipe* read_list(struct delta_input* in, uint64_t size, unsigned char** sent) {
+    struct dfs_chunk_recipe *recipe = calloc(1, sizeof(*recipe));
+    size_t capacity = size / DFS_CHUNK_MIN_SIZE + 1;
+    if (recipe == NULL || (recipe->chunks = malloc(capacity * sizeof(*recipe->chunks))) == NULL ||
+        (sent && (*sent = malloc(capacity)) == NULL)) {
+        snprintf(in->error, in->error_capacity, "Out of memory");
+        free_recipe(recipe);
+        return NULL;
+    }
+    recipe->size = size;
+
+    uint64_t offset = 0;
+    while (offset < size) {
+        unsigned char record[DFS_DELTA_RECORD_SIZE];
+        if (input_read(in, record, sizeof(record)) < 0) {
+            break;
+        }
+        unsigned char *length_bytes = record + DFS_SHA256_SIZE;
+        uint32_t length = (uint32_t)length_bytes[0] << 24 | (uint32_t)length_bytes[1] << 16 | (uint32_t)length_bytes[2] << 8 | length_bytes[3];
+        unsigned char flag = record[DFS_SHA256_SIZE + 4];
+        //the bounds keep a malformed list from asking for unbounded memory
+        if (length == 0 || length > DFS_CHUNK_MAX_SIZE || length > size - offset || flag > 1 ||
+            (length < DFS_CHUNK_MIN_SIZE && length != size - offset) || recipe->count == capacity) {
+            snprintf(in->error, in->error_capacity, "Invalid chunk list");
+            break;
+        }
+        struct dfs_chunk_entry *entry = &recipe->chunks[recipe->count];
+        memcpy(entry->digest, record, DFS_SHA256_SIZE);
+        entry->length = length;
+        entry->offset = offset;
+        if (sent) {
+            (*sent)[recipe->count] = flag;
+        }
+        recipe->count++;
+        offset += length;
+    }
+    if (offset < size) {
+        free_recipe(recipe);
+        if (sent) {
+            free(*sent);
+            *sent = NULL;
+        }
+        return NULL;
+    }
+    return recipe;
+}
+
+//copy_recipe: Duplicates a chunk list.
+static struct dfs_chunk_recipe* copy_recipe(const struct dfs_chunk_recipe* recipe) {
+    struct dfs_chunk_recipe *copy = malloc(sizeof(*copy));
+    if (copy == NULL) {
+        return NULL;
+    }
+    *copy = *recipe;
+    copy->chunks = malloc((recipe->count > 0 ? recipe->count : 1) * sizeof(*copy->chunks));
+    if (copy->chunks == NULL) {
+        free(copy);
+        return NULL;
+    }
+    memcpy(copy->chunks, recipe->chunks, recipe->count * sizeof(*copy->chunks));
+    return copy;
+}
+
+//target_chunks: Returns the chunks of the current version of `target`, or NULL if there is none.
+static struct dfs_chunk_recipe* target_chunks(const char* target) {
+    struct dfs_chunk_recipe *recipe = dfs_chunk_hold(target);
+    if (recipe != NULL) {
+        return recipe;
+    }
+    int fd = open(target, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    struct delta_cache_slot *victim = &cache[0];
+    for (int i = 0; i < DELTA_CACHE_SLOTS; i++) {
+        struct delta_cache_slot *slot = &cache[i];
+        if (slot->recipe != NULL && slot->dev == st.st_dev && slot->ino == st.st_ino && slot->size == st.st_size &&
+            slot->mtime.tv_sec == st.st_mtim.tv_sec && slot->mtime.tv_nsec == st.st_mtim.tv_nsec && strcmp(slot->path, target) == 0) {
+            slot->used = ++cache_clock;
+            recipe = copy_recipe(slot->recipe);
+            pthread_mutex_unlock(&cache_lock);
+            close(fd);
+            return recipe;
+        }
+        if (slot->used < victim->used) {
+            victim = slot;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    recipe = dfs_chunk_scan(fd);
+    close(fd);
+    struct dfs_chunk_recipe *copy = recipe != NULL ? copy_recipe(recipe) : NULL;
+    if (copy != NULL) {
+        pthread_mutex_lock(&cache_lock);
+        free_recipe(victim->recipe);
+        snprintf(victim->path, sizeof(victim->path), "%s", target);
+        victim->dev = st.st_dev;
+        victim->ino = st.st_ino;
+        victim->size = st.st_size;
+        victim->mtime = st.st_mtim;
+        victim->used = ++cache_clock;
+        victim->recipe = copy;
+        pthread_mutex_unlock(&cache_lock);
+    }
+    return recipe;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const struct dfs_chunk_entry *x = *(const struct dfs_chunk_entry* const*)a;
+    const struct dfs_chunk_entry *y = *(const struct dfs_chunk_entry* const*)b;
+    return memcmp(x->digest, y->digest, DFS_SHA256_SIZE);
+}
+
+//index_chunks: Sorts pointers to the chunks of a list by digest, for find_chunk().
+static const struct dfs_chunk_entry** index_chunks(const struct dfs_chunk_recipe* recipe) {
+    const struct dfs_chunk_entry **index = malloc((recipe->count > 0 ? recipe->count : 1) * sizeof(*index));
+    if (index != NULL) {
+        for (size_t i = 0; i < recipe->count; i++) {
+            index[i] = &recipe->chunks[i];
+        }
+        qsort(index, recipe->count, sizeof(*index), compare_entries);
+    }
+    return index;
+}
+
+//find_chunk: Looks a digest up in an index made by index_chunks().
+static const struct dfs_chunk_entry* find_chunk(const struct dfs_chunk_entry** index, size_t count, const unsigned char* digest) {
+    if (index == NULL) {
+        return NULL;
+    }
+    struct dfs_chunk_entry key;
+    const struct dfs_chunk_entry *key_pointer = &key;
+    memcpy(key.digest, digest, DFS_SHA256_SIZE);
+    const struct dfs_chunk_entry **found = bsearch(&key_pointer, index, count, sizeof(*index), compare_entries);
+    return found != NULL ? *found : NULL;
+}
+
+//format_ranges: Writes the answer naming the missing chunks as index ranges.
+//ranges separated by fewer than `gap` chunks the server has are merged, and the gap grows until the answer fits.
+static void format_ranges(const unsigned char* missing, size_t count, char* out, size_t capacity) {
+    for (size_t gap = 1; ; gap *= 2) {
+        size_t used = snprintf(out, capacity, "%s", DFS_DELTA_MISSING);
+        bool any = false;
+        bool fits = true;
+        size_t i = 0;
+        while (i < count && fits) {
+            if (!missing[i]) {
+                i++;
+                continue;
+            }
+            size_t first = i;
+            size_t last = i;
+            size_t j = i + 1;
+            while (j < count) {
+                if (missing[j]) {
+                    last = j++;
+                    continue;
+                }
+                size_t k = j;
+                while (k < count && !missing[k]) {
+                    k++;
+                }
+                if (k == count || k - j >= gap) {
+                    break;
+                }
+                j = k;
+            }
+            i = last + 1;
+            int n = first == last ? snprintf(out + used, capacity - used, "%s%zu", any ? "," : "", first)
+                                  : snprintf(out + used, capacity - used, "%s%zu-%zu", any ? "," : "", first, last);
+            if (n < 0 || used + n >= capacity) {
+                fits = false;
+            } else {
+                used += n;
+            }
+            any = true;
+        }
+        if (!any) {
+            snprintf(out, capacity, "%snone", DFS_DELTA_MISSING);
+            return;
+        }
+        if (fits) {
+            return;
+        }
+    }
+}
+
+//dfs_delta_query: Answers which chunks of an upload the server lacks.
+int dfs_delta_query(int in_fd, int framed, const char* target, const char* size_text, const char* sha256_hex, char* answer, size_t capacity) {
+    struct delta_input in = {.fd = in_fd, .framed = framed, .error = answer, .error_capacity = capacity};
+    uint64_t size;
+    unsigned char digest[DFS_SHA256_SIZE];
+    if (parse_size(size_text, &size) < 0 || dfs_sha256_parse(sha256_hex, digest) < 0) {
+        input_finish(&in);
+        snprintf(answer, capacity, "Invalid upload");
+        return -1;
+    }
+    struct dfs_chunk_recipe *recipe = read_list(&in, size, NULL);
+    if (recipe == NULL) {
+        char error[DFS_MAX_CONTROL_PAYLOAD];
+        snprintf(error, sizeof(error), "%s", answer);
+        input_finish(&in);
+        snprintf(answer, capacity, "%s", error);
+        return -1;
+    }
+    if (input_finish(&in) < 0) {
+        free_recipe(recipe);
+        return -1;
+    }
+
+    //the target may hold this very file
+    struct dfs_chunk_recipe *old = target_chunks(target);
+    bool stored = old != NULL && old->size == recipe->size && old->count == recipe->count &&
+                  memcmp(old->sha256, digest, DFS_SHA256_SIZE) == 0;
+    for (size_t i = 0; stored && i < recipe->count; i++) {
+        stored = old->chunks[i].length == recipe->chunks[i].length &&
+                 memcmp(old->chunks[i].digest, recipe->chunks[i].digest, DFS_SHA256_SIZE) == 0;
+    }
+    int result = 0;
+    if (stored) {
+        snprintf(answer, capacity, "%s", DFS_DELTA_STORED);
+    } else {
+        const struct dfs_chunk_entry **index = old != NULL ? index_chunks(old) : NULL;
+        bool dedup = dfs_chunk_dedup_enabled();
+        unsigned char *missing = malloc(recipe->count > 0 ? recipe->count : 1);
+        if (missing == NULL) {
+            snprintf(answer, capacity, "Out of memory");
+            result = -1;
+        } else {
+            for (size_t i = 0; i < recipe->count; i++) {
+                const unsigned char *chunk = recipe->chunks[i].digest;
+                missing[i] = !(dedup && dfs_chunk_has(chunk)) && find_chunk(index, old != NULL ? old->count : 0, chunk) == NULL;
+            }
+            format_ranges(missing, recipe->count, answer, capacity < DFS_DELTA_ANSWER_SIZE ? capacity : DFS_DELTA_ANSWER_SIZE);
+        }
+        free(missing);
+        free(index);
+    }
+    free_recipe(old);
+    free_recipe(recipe);
+    return result;
+}
+
+//dfs_delta_apply: Receives an upload of the chunks the server lacks and assembles the file.
+int dfs_delta_apply(int in_fd, int framed, struct dfs_stage* stage, const char* size_text, const char* sha256_hex, int wait_ms,
+                    struct dfs_delta_stats* stats, char* error_message, size_t error_capacity) {
+    struct delta_input in = {.fd = in_fd, .framed = framed, .error = error_message, .error_capacity = error_capacity};
+    memset(stats, 0, sizeof(*stats));
+    uint64_t size;
+    unsigned char expected[DFS_SHA256_SIZE];
+    if (parse_size(size_text, &size) < 0 || dfs_sha256_parse(sha256_hex, expected) < 0) {
+        input_finish(&in);
+        snprintf(error_message, error_capacity, "Invalid upload");
+        return -1;
+    }
+    unsigned char *sent = NULL;
+    struct dfs_chunk_recipe *recipe = read_list(&in, size, &sent);
+    if (recipe == NULL) {
+        char error[DFS_MAX_CONTROL_PAYLOAD];
+        snprintf(error, sizeof(error), "%s", error_message);
+        input_finish(&in);
+        snprintf(error_message, error_capacity, "%s", error);
+        return -1;
+    }
+
+    //a deduplicating server keeps the file as a recipe, any other assembles it in the staging area
+    bool dedup = dfs_chunk_dedup_enabled();
+    int result = 0;
+    unsigned char *buffer = malloc(DFS_CHUNK_MAX_SIZE);
+    if (buffer == NULL) {
+        snprintf(error_message, error_capacity, "Out of memory");
+        result = -1;
+    } else if (!dedup && dfs_stage_open(stage, 0, wait_ms) < 0) {
+        snprintf(error_message, error_capacity, "%s", errno == EBUSY ? "upload already in progress" : strerror(errno));
+        result = -1;
+    }
+
+    //chunks the client left out come from the store or from the current version of the target,
+    //which is only opened once a chunk needs it
+    bool old_opened = false;
+    struct dfs_chunk_recipe *old = NULL;
+    const struct dfs_chunk_entry **old_index = NULL;
+    struct dfs_chunk_file old_file = {.fd = -1};
+    struct dfs_chunk_stats chunk_stats = {0};
+    struct dfs_sha256 whole;
+    dfs_sha256_init(&whole);
+    size_t referenced = 0;
+    for (size_t i = 0; result == 0 && i < recipe->count; i++) {
+        const struct dfs_chunk_entry *entry = &recipe->chunks[i];
+        if (sent[i]) {
+            if (input_read(&in, buffer, entry->length) < 0) {
+                result = -1;
+                break;
+            }
+            stats->sent_chunks++;
+            stats->sent_bytes += entry->length;
+        } else if (!dedup || dfs_chunk_read(entry->digest, buffer, entry->length) < 0) {
+            if (!old_opened) {
+                old_opened = true;
+                old = target_chunks(stage->target);
+                if (old != NULL && dfs_chunk_open(&old_file, stage->target) == 0) {
+                    old_index = index_chunks(old);
+                }
+            }
+            const struct dfs_chunk_entry *source = find_chunk(old_index, old != NULL ? old->count : 0, entry->digest);
+            if (source == NULL || source->length != entry->length ||
+                dfs_chunk_pread(&old_file, buffer, entry->length, source->offset) != (ssize_t)entry->length) {
+                snprintf(error_message, error_capacity, "Chunk %zu is no longer stored", i);
+                result = -1;
+                break;
+            }
+        }
+
+        //every chunk is checked, whether it was received or found on the server
+        unsigned char digest[DFS_SHA256_SIZE];
+        struct dfs_sha256 ctx;
+        dfs_sha256_init(&ctx);
+        dfs_sha256_update(&ctx, buffer, entry->length);
+        dfs_sha256_final(&ctx, digest);
+        if (memcmp(digest, entry->digest, DFS_SHA256_SIZE) != 0) {
+            snprintf(error_message, error_capacity, sent[i] ? "Chunk %zu does not match its digest" : "Chunk %zu is no longer stored", i);
+            result = -1;
+            break;
+        }
+        dfs_sha256_update(&whole, buffer, entry->length);
+
+        if (dedup) {
+            if (dfs_chunk_ref(entry->digest, buffer, entry->length, &chunk_stats) < 0) {
+                snprintf(error_message, error_capacity, "Failed to store chunk: %s", strerror(errno));
+                result = -1;
+                break;
+            }
+            referenced++;
+        } else if (dfs_write_full(stage->fd, buffer, entry->length) < 0 || dfs_stage_advance(stage, entry->length) < 0) {
+            snprintf(error_message, error_capacity, "Failed to write file");
+            result = -1;
+            break;
+        }
+    }
+    stats->chunks = recipe->count;
+    stats->bytes = recipe->size;
+    stats->new_chunks = chunk_stats.new_chunks;
+
+    //the stream is read to its end either way; its first error is the one reported
+    char first_error[DFS_MAX_CONTROL_PAYLOAD];
+    snprintf(first_error, sizeof(first_error), "%s", error_message);
+    if (input_finish(&in) < 0 && result == 0) {
+        result = -1;
+    } else if (result < 0) {
+        snprintf(error_message, error_capacity, "%s", first_error);
+    }
+
+    if (result == 0) {
+        dfs_sha256_final(&whole, recipe->sha256);
+        if (memcmp(recipe->sha256, expected, DFS_SHA256_SIZE) != 0) {
+            snprintf(error_message, error_capacity, "File does not match its SHA-256");
+            result = -1;
+        }
+    }
+    if (result == 0 && dedup) {
+        if (dfs_chunk_save_recipe(stage->target, recipe) < 0) {
+            snprintf(error_message, error_capacity, "Failed to store file: %s", strerror(errno));
+            result = -1;
+        }
+    } else if (result == 0) {
+        //a recipe left from a deduplicating run is replaced like any file, and its chunks released
+        dfs_chunk_lock(stage->target);
+        struct dfs_chunk_recipe *old_recipe = dfs_chunk_hold(stage->target);
+        if (dfs_stage_commit(stage) < 0) {
+            snprintf(error_message, error_capacity, "Failed to store file: %s", strerror(errno));
+            result = -1;
+        }
+        dfs_chunk_release(old_recipe, result == 0);
+        dfs_chunk_unlock(stage->target);
+    }
+    if (result < 0 && dedup) {
+        dfs_chunk_unref(recipe, referenced);
+    } else if (result < 0) {
+        //what was assembled is a prefix of the file and stays staged, so the upload can be resumed
+        dfs_stage_close(stage);
+    }
+
+    if (old_opened) {
+        dfs_chunk_close(&old_file);
+    }
+    free(old_index);
+    free_recipe(old);
+    free_recipe(recipe);
+    free(sent);
+    free(buffer);
+    return result;
+}
+
+//dfs_delta_send_list: Sends the chunk list of an upload as DATA frames.
+int dfs_delta_send_list(int sock, uint32_t request_id, const struct dfs_chunk_recipe* recipe, const unsigned char* sent) {
+    size_t capacity = DFS_DATA_CHUNK_SIZE - DFS_DATA_CHUNK_SIZE % DFS_DELTA_RECORD_SIZE;
+    unsigned char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        return -1;
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < recipe->count; i++) {
+        unsigned char *record = buffer + used;
+        uint32_t length = recipe->chunks[i].length;
+        memcpy(record, recipe->chunks[i].digest, DFS_SHA256_SIZE);
+        record[DFS_SHA256_SIZE] = length >> 24;
+        record[DFS_SHA256_SIZE + 1] = length >> 16;
+        record[DFS_SHA256_SIZE + 2] = length >> 8;
+        record[DFS_SHA256_SIZE + 3] = length;
+        record[DFS_SHA256_SIZE + 4] = sent != NULL && sent[i];
+        used += DFS_DELTA_RECORD_SIZE;
+        if (used == capacity || i + 1 == recipe->count) {
+            if (dfs_send_frame(sock, DFS_OP_DATA, 0, request_id, buffer, used) < 0) {
+                free(buffer);
+                return -1;
+            }
+            used = 0;
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+//dfs_delta_send_chunks: Sends the data of the chunks marked in `sent`, joining neighbours into one sendfile() run.
+//returns the number of bytes sent or -1 on error.
+long long dfs_delta_send_chunks(int sock, uint32_t request_id, int fd, const struct dfs_chunk_recipe* recipe, const unsigned char* sent) {
+    long long total_bytes_sent = 0;
+    size_t i = 0;
+    while (i < recipe->count) {
+        if (!sent[i]) {
+            i++;
+            continue;
+        }
+        uint64_t offset = recipe->chunks[i].offset;
+        uint64_t length = 0;
+        while (i < recipe->count && sent[i]) {
+            length += recipe->chunks[i++].length;
+        }
+        long long n = dfs_sendfile_frames(sock, fd, offset, length, request_id);
+        if (n < 0 || (uint64_t)n != length) {
+            return -1;
+        }
+        total_bytes_sent += n;
+    }
+    return total_bytes_sent;
+}
+
+//dfs_delta_parse_answer: Reads the server's answer to DFS_OP_UFILE_CHUNKS into one flag per chunk.
+int dfs_delta_parse_answer(const char* answer, unsigned char* sent, size_t count) {
+    if (strcmp(answer, DFS_DELTA_STORED) == 0) {
+        return 1;
+    }
+    size_t prefix = strlen(DFS_DELTA_MISSING);
+    if (strncmp(answer, DFS_DELTA_MISSING, prefix) != 0) {
+        return -1;
+    }
+    memset(sent, 0, count);
+    const char *p = answer + prefix;
+    if (strcmp(p, "none") == 0) {
+        return 0;
+    }
+    while (*p != '\0') {
+        char *end;
+        unsigned long long first = strtoull(p, &end, 10);
+        unsigned long long last = first;
+        if (end == p) {
+            return -1;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtoull(p, &end, 10);
+            if (end == p) {
+                return -1;
+            }
+        }
+        if (first > last || last >= count) {
+            return -1;
+        }
+        memset(sent + first, 1, last - first + 1);
+        p = end;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+//dfs_delta.h
+//this header declares the upload exchange that sends only the data a server does not already have.
+//the client cuts the file into content-defined chunks (see dfs_chunk.h) and sends their list with
+//DFS_OP_UFILE_CHUNKS; the server answers which of them it cannot find, either in its chunk store or in the
+//current version of the target. the client then sends DFS_OP_UFILE_DELTA with the list again, marking the chunks
+//it includes, followed by their data. the server assembles the file from the chunks it had and the ones it
+//received, checks every chunk and the whole file against their SHA-256 digests, and moves it into place.
+//both requests carry the file name, the destination, the file size and the hex SHA-256 of the whole file.
+#ifndef DFS_DELTA_H
+#define DFS_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dfs_chunk.h"
+#include "dfs_stage.h"
+
+//one entry of a chunk list: the digest, the chunk length (32 bit big endian) and 1 if its data follows the list.
+//every chunk but the last is at least DFS_CHUNK_MIN_SIZE and at most DFS_CHUNK_MAX_SIZE bytes long.
+#define DFS_DELTA_RECORD_SIZE (DFS_SHA256_SIZE + 5)
+//answers to DFS_OP_UFILE_CHUNKS: the target already holds the file, or the chunks to send as index ranges,
+//e.g. "Chunks missing: 0-3,7" or "Chunks missing: none"
+#define DFS_DELTA_STORED "File already stored"
+#define DFS_DELTA_MISSING "Chunks missing: "
+//longest answer; a list of ranges that does not fit is coarsened, asking for some chunks the server has
+#define DFS_DELTA_ANSWER_SIZE 960
+
+//what a delta upload moved
+struct dfs_delta_stats {
+    unsigned long long chunks;
+    unsigned long long sent_chunks;      //chunks whose data came over the connection
+    unsigned long long bytes;
+    unsigned long long sent_bytes;
+    unsigned long long new_chunks;       //chunks added to the chunk store
+};
+
+//client side: the list goes first, for DFS_OP_UFILE_DELTA followed by the chunks it marks; `sent` holds one
+//flag per chunk, NULL for the list of DFS_OP_UFILE_CHUNKS. neither sends the END frame.
+int dfs_delta_send_list(int sock, uint32_t request_id, const struct dfs_chunk_recipe* recipe, const unsigned char* sent);
+long long dfs_delta_send_chunks(int sock, uint32_t request_id, int fd, const struct dfs_chunk_recipe* recipe, const unsigned char* sent);
+//dfs_delta_parse_answer() fills `sent` from the answer to DFS_OP_UFILE_CHUNKS.
+//returns 1 if the server already has the file, 0 if `sent` was filled and -1 for a malformed answer.
+int dfs_delta_parse_answer(const char* answer, unsigned char* sent, size_t count);
+
+//server side. `in` is either the client's socket carrying the DATA frames of the request (`framed` set) or a file
+//holding their payloads. the whole stream is consumed, also on failure, so the connection stays in sync.
+//dfs_delta_query() writes the answer to DFS_OP_UFILE_CHUNKS for `target` into `answer`.
+int dfs_delta_query(int in, int framed, const char* target, const char* size_text, const char* sha256_hex, char* answer, size_t capacity);
+//dfs_delta_apply() receives a DFS_OP_UFILE_DELTA upload into `stage`, waiting up to `wait_ms` milliseconds for
+//an upload of the same target that is still running. with the chunk store deduplicating, the file is saved as
+//a recipe instead. returns 0 once the file is in place, or -1 with the reason in `error_message`.
+int dfs_delta_apply(int in, int framed, struct dfs_stage* stage, const char* size_text, const char* sha256_hex, int wait_ms,
+                    struct dfs_delta_stats* stats, char* error_message, size_t error_capacity);
+
+#endif
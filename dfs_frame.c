@@ -0,0 +1,483 @@
+//dfs_frame.c
+//this file implements the framing protocol declared in dfs_frame.h: header encoding, request/status frames
+//and the helpers used to stream file data as a sequence of DATA frames.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "dfs_frame.h"
+#include "dfs_compress.h"
+
+//payload size of the buffered loops
+static size_t data_chunk_size = DFS_DATA_CHUNK_SIZE;
+//error statuses the thread has sent, see dfs_status_errors_sent()
+static __thread unsigned long status_errors_sent = 0;
+
+//dfs_set_data_chunk_size: Sets the chunk size, clamped to DFS_DATA_CHUNK_SIZE..DFS_DATA_CHUNK_MAX.
+//compressed blocks are decoded into chunk buffers, so a chunk never gets smaller than a block.
+void dfs_set_data_chunk_size(size_t bytes) {
+    data_chunk_size = bytes < DFS_DATA_CHUNK_SIZE ? DFS_DATA_CHUNK_SIZE : bytes > DFS_DATA_CHUNK_MAX ? DFS_DATA_CHUNK_MAX : bytes;
+}
+
+size_t dfs_data_chunk_size(void) {
+    return data_chunk_size;
+}
+
+//dfs_read_full: Reads exactly `length` bytes, retrying on short reads and EINTR.
+//returns 0 on success and -1 on error or if the peer closed the connection early.
+int dfs_read_full(int fd, void* buffer, size_t length) {
+    char *p = buffer;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+//dfs_write_full: Writes exactly `length` bytes, retrying on short writes and EINTR.
+int dfs_write_full(int fd, const void* buffer, size_t length) {
+    const char *p = buffer;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+//helpers to store and load big-endian integers in the header
+static void put_u16(unsigned char* p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint16_t get_u16(const unsigned char* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+//dfs_encode_header: Serializes a frame header into `out`, which must hold DFS_FRAME_HEADER_SIZE bytes.
+//layout: magic(2) version(1) opcode(1) flags(2) reserved(2) request_id(4) length(4), all big-endian.
+void dfs_encode_header(unsigned char* out, uint8_t opcode, uint16_t flags, uint32_t request_id, uint32_t length) {
+    put_u16(out, DFS_FRAME_MAGIC);
+    out[2] = DFS_FRAME_VERSION;
+    out[3] = opcode;
+    put_u16(out + 4, flags);
+    put_u16(out + 6, 0);
+    put_u32(out + 8, request_id);
+    put_u32(out + 12, length);
+}
+
+//dfs_decode_header: Parses a serialized header and validates its magic number and version.
+//returns 0 on success and -1 if the bytes are not a frame this build understands.
+int dfs_decode_header(const unsigned char* in, struct dfs_frame* frame) {
+    if (get_u16(in) != DFS_FRAME_MAGIC || in[2] != DFS_FRAME_VERSION) {
+        return -1;
+    }
+    frame->version = in[2];
+    frame->opcode = in[3];
+    frame->flags = get_u16(in + 4);
+    frame->request_id = get_u32(in + 8);
+    frame->length = get_u32(in + 12);
+    return 0;
+}
+
+//dfs_send_frame: Sends one header plus payload with a single gathered write.
+int dfs_send_frame(int fd, uint8_t opcode, uint16_t flags, uint32_t request_id, const void* payload, uint32_t length) {
+    unsigned char header[DFS_FRAME_HEADER_SIZE];
+    dfs_encode_header(header, opcode, flags, request_id, length);
+
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = payload ? length : 0;
+
+    size_t remaining = iov[0].iov_len + iov[1].iov_len;
+    struct iovec *v = iov;
+    int count = 2;
+    while (remaining > 0) {
+        ssize_t n = writev(fd, v, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        remaining -= n;
+        //advance past whatever was written
+        while (count > 0 && (size_t)n >= v->iov_len) {
+            n -= v->iov_len;
+            v++;
+            count--;
+        }
+        if (count > 0) {
+            v->iov_base = (char*)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+//dfs_recv_header: Reads and decodes the next frame header from a socket.
+int dfs_recv_header(int fd, struct dfs_frame* frame) {
+    unsigned char header[DFS_FRAME_HEADER_SIZE];
+    if (dfs_read_full(fd, header, sizeof(header)) < 0) {
+        return -1;
+    }
+    if (dfs_decode_header(header, frame) < 0) {
+        fprintf(stderr, "Received malformed frame header\n");
+        return -1;
+    }
+    return 0;
+}
+
+//dfs_recv_control: Reads a complete request or status frame into `payload` and NUL-terminates it.
+//frames larger than `capacity - 1` are rejected so a peer cannot make us buffer a data stream.
+int dfs_recv_control(int fd, struct dfs_frame* frame, char* payload, size_t capacity) {
+    if (dfs_recv_header(fd, frame) < 0) {
+        return -1;
+    }
+    if (frame->length >= capacity) {
+        fprintf(stderr, "Control frame too large: %u bytes\n", frame->length);
+        return -1;
+    }
+    if (dfs_read_full(fd, payload, frame->length) < 0) {
+        return -1;
+    }
+    payload[frame->length] = '\0';
+    return 0;
+}
+
+//dfs_skip_payload: Reads and discards `length` payload bytes.
+int dfs_skip_payload(int fd, uint64_t length) {
+    char buffer[4096];
+    while (length > 0) {
+        size_t chunk = length < sizeof(buffer) ? length : sizeof(buffer);
+        if (dfs_read_full(fd, buffer, chunk) < 0) {
+            return -1;
+        }
+        length -= chunk;
+    }
+    return 0;
+}
+
+//dfs_next_request_id: Returns a fresh request id for frames originated by this process.
+//threads of one process draw ids at once, so the counter is atomic and no two requests share an id.
+uint32_t dfs_next_request_id(void) {
+    static uint32_t next_id = 0;
+    return __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+}
+
+//dfs_send_request: Sends a request frame whose payload is the NUL-separated argument list.
+//arg2 may be NULL for commands that take a single argument.
+int dfs_send_request(int fd, uint8_t opcode, uint32_t request_id, const char* arg1, const char* arg2) {
+    const char *args[2] = {arg1, arg2};
+    return dfs_send_request_args(fd, opcode, request_id, args, arg2 ? 2 : 1);
+}
+
+//dfs_send_request_args: Sends a request frame carrying `count` arguments, at most DFS_MAX_ARGS.
+int dfs_send_request_args(int fd, uint8_t opcode, uint32_t request_id, const char* const* args, int count) {
+    return dfs_send_request_flags(fd, opcode, 0, request_id, args, count);
+}
+
+//dfs_send_request_flags: Sends a request frame with `flags` set, such as DFS_FLAG_COMPRESSED.
+int dfs_send_request_flags(int fd, uint8_t opcode, uint16_t flags, uint32_t request_id, const char* const* args, int count) {
+    char payload[DFS_MAX_CONTROL_PAYLOAD];
+    size_t length = 0;
+
+    for (int i = 0; i < count && i < DFS_MAX_ARGS && args[i]; i++) {
+        size_t arg_length = strlen(args[i]) + 1;
+        if (length + arg_length > sizeof(payload)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(payload + length, args[i], arg_length);
+        length += arg_length;
+    }
+    return dfs_send_frame(fd, opcode, flags, request_id, payload, length);
+}
+
+//dfs_parse_args: Splits a NUL-separated request payload into at most `max_args` strings.
+//the payload must already be NUL-terminated (dfs_recv_control guarantees this). returns the argument count.
+int dfs_parse_args(char* payload, uint32_t length, char** args, int max_args) {
+    int count = 0;
+    uint32_t offset = 0;
+    while (offset < length && count < max_args) {
+        args[count++] = payload + offset;
+        offset += strlen(payload + offset) + 1;
+    }
+    for (int i = count; i < max_args; i++) {
+        args[i] = NULL;
+    }
+    return count;
+}
+
+//dfs_parse_range: Reads the optional offset and length arguments of a ranged dfile request.
+//the range is clipped to a file of `size` bytes; without a length it runs to the end of the file.
+//returns 0, or -1 if an argument is not a number or the offset lies past the end of the file.
+int dfs_parse_range(char** args, int count, uint64_t size, uint64_t* offset, uint64_t* length) {
+    unsigned long long values[2] = {0, size};
+    for (int i = 0; i < count && i < 2; i++) {
+        char *end;
+        errno = 0;
+        values[i] = strtoull(args[i], &end, 10);
+        if (errno != 0 || end == args[i] || *end != '\0' || args[i][0] == '-') {
+            return -1;
+        }
+    }
+    if (values[0] > size) {
+        return -1;
+    }
+    *offset = values[0];
+    *length = values[1] < size - values[0] ? values[1] : size - values[0];
+    return 0;
+}
+
+//dfs_send_status: Sends a STATUS frame carrying a human readable message.
+int dfs_send_status(int fd, uint32_t request_id, int ok, const char* message) {
+    if (!ok) {
+        status_errors_sent++;
+    }
+    return dfs_send_frame(fd, DFS_OP_STATUS, ok ? 0 : DFS_FLAG_ERROR, request_id, message, strlen(message));
+}
+
+//dfs_status_errors_sent: Returns how many error statuses the calling thread has sent.
+unsigned long dfs_status_errors_sent(void) {
+    return status_errors_sent;
+}
+
+//dfs_opcode_name: Returns the command name for an opcode, used for logging.
+const char* dfs_opcode_name(uint8_t opcode) {
+    switch (opcode) {
+        case DFS_OP_UFILE: return "ufile";
+        case DFS_OP_DFILE: return "dfile";
+        case DFS_OP_RMFILE: return "rmfile";
+        case DFS_OP_DTAR: return "dtar";
+        case DFS_OP_DISPLAY: return "display";
+        case DFS_OP_UFILE_QUERY: return "ufile query";
+        case DFS_OP_UFILE_RESUME: return "ufile resume";
+        case DFS_OP_UFILE_PART: return "ufile part";
+        case DFS_OP_UFILE_COMMIT: return "ufile commit";
+        case DFS_OP_UFILE_CHUNKS: return "ufile chunks";
+        case DFS_OP_UFILE_DELTA: return "ufile delta";
+        case DFS_OP_COMPRESS: return "compress";
+        case DFS_OP_DATA: return "data";
+        case DFS_OP_STATUS: return "status";
+        default: return "unknown";
+    }
+}
+
+//dfs_send_stream_from_fd: Sends everything readable from `fd` as DATA frames followed by an END frame.
+//returns the number of payload bytes sent or -1 on error.
+long long dfs_send_stream_from_fd(int sock, int fd, uint32_t request_id) {
+    size_t chunk_size = data_chunk_size;
+    char *buffer = malloc(chunk_size);
+    if (!buffer) {
+        return -1;
+    }
+    long long total_bytes_sent = 0;
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd, buffer, chunk_size)) != 0) {
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to read data");
+            free(buffer);
+            dfs_send_status(sock, request_id, 0, "Failed to read file");
+            return -1;
+        }
+        if (dfs_send_frame(sock, DFS_OP_DATA, 0, request_id, buffer, bytes_read) < 0) {
+            perror("Failed to send data");
+            free(buffer);
+            return -1;
+        }
+        total_bytes_sent += bytes_read;
+    }
+    free(buffer);
+    if (dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0) {
+        return -1;
+    }
+    return total_bytes_sent;
+}
+
+//pwrite_full: Writes a whole buffer at `offset`, looping over short writes.
+static int pwrite_full(int fd, const void* buffer, size_t length, off_t offset) {
+    const char *p = buffer;
+    while (length > 0) {
+        ssize_t n = pwrite(fd, p, length, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+//recv_stream: Receives a stream of DATA frames into `fd`, at the file position or, if `position` is set,
+//with pwrite() at *position, which is advanced past every payload written. `progress`, if set, is atomically
+//increased by every payload byte written so another thread can report on the transfer.
+//compressed frames are decoded first; positions, progress and the total count decoded bytes.
+static long long recv_stream(int sock, int fd, off_t* position, unsigned long long* progress, char* error_message, size_t error_capacity) {
+    size_t chunk_size = data_chunk_size;
+    char *buffer = malloc(chunk_size);
+    unsigned char *payload = NULL;
+    if (!buffer) {
+        return -1;
+    }
+    long long total_bytes = 0;
+    int write_failed = 0;
+    struct dfs_frame frame;
+
+    while (1) {
+        if (dfs_recv_header(sock, &frame) < 0) {
+            free(buffer);
+            free(payload);
+            if (error_message) {
+                snprintf(error_message, error_capacity, "Connection lost during transfer");
+            }
+            return -1;
+        }
+        if (frame.opcode == DFS_OP_STATUS) {
+            //the sender aborted the stream
+            char message[DFS_MAX_CONTROL_PAYLOAD] = {0};
+            uint32_t keep = frame.length < sizeof(message) - 1 ? frame.length : sizeof(message) - 1;
+            if (dfs_read_full(sock, message, keep) < 0 || dfs_skip_payload(sock, frame.length - keep) < 0) {
+                free(buffer);
+                free(payload);
+                return -1;
+            }
+            if (error_message) {
+                snprintf(error_message, error_capacity, "%s", message);
+            }
+            free(buffer);
+            free(payload);
+            return -1;
+        }
+        if (frame.opcode != DFS_OP_DATA) {
+            fprintf(stderr, "Unexpected %s frame inside data stream\n", dfs_opcode_name(frame.opcode));
+            free(buffer);
+            free(payload);
+            return -1;
+        }
+
+        if (frame.flags & DFS_FLAG_COMPRESSED) {
+            if (payload == NULL) {
+                payload = malloc(DFS_COMPRESS_PAYLOAD_MAX);
+            }
+            long decoded = -1;
+            if (payload == NULL || frame.length > DFS_COMPRESS_PAYLOAD_MAX || dfs_read_full(sock, payload, frame.length) < 0 ||
+                (decoded = dfs_decompress_payload(payload, frame.length, buffer, chunk_size)) < 0) {
+                fprintf(stderr, "Failed to receive compressed data\n");
+                if (error_message) {
+                    snprintf(error_message, error_capacity, "Corrupt compressed data");
+                }
+                free(buffer);
+                free(payload);
+                return -1;
+            }
+            if (!write_failed && fd >= 0) {
+                if ((position ? pwrite_full(fd, buffer, decoded, *position) : dfs_write_full(fd, buffer, decoded)) < 0) {
+                    perror("Failed to write file");
+                    write_failed = 1;
+                } else {
+                    if (position) {
+                        *position += decoded;
+                    }
+                    if (progress) {
+                        __atomic_add_fetch(progress, decoded, __ATOMIC_RELAXED);
+                    }
+                }
+            }
+            total_bytes += decoded;
+        }
+        uint32_t remaining = frame.flags & DFS_FLAG_COMPRESSED ? 0 : frame.length;
+        while (remaining > 0) {
+            size_t chunk = remaining < chunk_size ? remaining : chunk_size;
+            if (dfs_read_full(sock, buffer, chunk) < 0) {
+                free(buffer);
+                free(payload);
+                return -1;
+            }
+            if (!write_failed && fd >= 0) {
+                if ((position ? pwrite_full(fd, buffer, chunk, *position) : dfs_write_full(fd, buffer, chunk)) < 0) {
+                    perror("Failed to write file");
+                    write_failed = 1;
+                } else {
+                    if (position) {
+                        *position += chunk;
+                    }
+                    if (progress) {
+                        __atomic_add_fetch(progress, chunk, __ATOMIC_RELAXED);
+                    }
+                }
+            }
+            remaining -= chunk;
+            total_bytes += chunk;
+        }
+        if (frame.flags & DFS_FLAG_END) {
+            break;
+        }
+    }
+    free(buffer);
+    free(payload);
+    if (write_failed) {
+        if (error_message) {
+            snprintf(error_message, error_capacity, "Failed to write file");
+        }
+        return -1;
+    }
+    return total_bytes;
+}
+
+//dfs_recv_stream_to_fd: Receives a stream of DATA frames and writes the payloads to `fd`.
+//the whole stream is always consumed, even after a local write error, so the connection stays in sync.
+//if the sender aborts with an error STATUS frame its message is copied into `error_message`.
+//returns the number of payload bytes received or -1 on error.
+long long dfs_recv_stream_to_fd(int sock, int fd, char* error_message, size_t error_capacity) {
+    return recv_stream(sock, fd, NULL, NULL, error_message, error_capacity);
+}
+
+//dfs_recv_stream_at: Receives a stream of DATA frames and writes the payloads with pwrite() from *position on.
+//several threads can fill different parts of one file this way. *position always ends up after the last byte
+//written, also after a failure, so an interrupted range can be requested again from there.
+long long dfs_recv_stream_at(int sock, int fd, off_t* position, unsigned long long* progress, char* error_message, size_t error_capacity) {
+    return recv_stream(sock, fd, position, progress, error_message, error_capacity);
+}
@@ -0,0 +1,95 @@
+//dfs_frame.h
+//this header defines the length-prefixed binary framing protocol shared by Smain, Spdf, Stext and client24s.
+//every message on the wire is a fixed 16 byte header followed by exactly `length` bytes of payload,
+//so commands and file data never depend on how the kernel happens to split reads.
+#ifndef DFS_FRAME_H
+#define DFS_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+//wire format constants
+#define DFS_FRAME_MAGIC 0xDF5F
+#define DFS_FRAME_VERSION 1
+#define DFS_FRAME_HEADER_SIZE 16
+//largest payload accepted for request and status frames; data frames are streamed and have no such limit
+#define DFS_MAX_CONTROL_PAYLOAD 4096
+//payload size used when a sender chunks a stream of unknown length, and the buffer size of the buffered loops;
+//dfs_set_data_chunk_size() raises it at run time up to DFS_DATA_CHUNK_MAX
+#define DFS_DATA_CHUNK_SIZE 65536
+#define DFS_DATA_CHUNK_MAX (16 * 1024 * 1024)
+//maximum number of string arguments carried by a request frame
+#define DFS_MAX_ARGS 4
+//status sent in reply to a dfile request naming a byte range: length, offset and size of the whole file
+#define DFS_RANGE_STATUS_FORMAT "Range accepted: %llu bytes at offset %llu of %llu"
+
+//opcodes: requests sent by a client (or by Smain to Spdf/Stext) and the frames sent in reply
+enum dfs_opcode {
+    DFS_OP_UFILE = 1,
+    DFS_OP_DFILE = 2,
+    DFS_OP_RMFILE = 3,
+    DFS_OP_DTAR = 4,
+    DFS_OP_DISPLAY = 5,
+    DFS_OP_UFILE_QUERY = 6,    //how many bytes of an upload the server has staged
+    DFS_OP_UFILE_RESUME = 7,   //resumable upload continuing at a given offset
+    DFS_OP_UFILE_PART = 8,     //one part of a parallel upload, written at a given offset
+    DFS_OP_UFILE_COMMIT = 9,   //moves a parallel upload into place once all its parts arrived
+    DFS_OP_UFILE_CHUNKS = 10,  //which chunks of an upload the server lacks (see dfs_delta.h)
+    DFS_OP_UFILE_DELTA = 11,   //upload sending only the chunks the server lacks
+    DFS_OP_COMPRESS = 12,      //agrees on the codec for compressed transfers (see dfs_compress.h)
+    DFS_OP_DATA = 0x40,
+    DFS_OP_STATUS = 0x41
+};
+
+//frame flags
+#define DFS_FLAG_END 0x0001    //last frame of a data stream
+#define DFS_FLAG_ERROR 0x0002  //status frame reports a failure
+#define DFS_FLAG_CURSOR 0x0004 //END frame of a listing page carries the cursor of the next page
+#define DFS_FLAG_COMPRESSED 0x0008 //DATA frame carries a compressed block; on a request, asks for a compressed reply
+
+//decoded frame header
+struct dfs_frame {
+    uint8_t version;
+    uint8_t opcode;
+    uint16_t flags;
+    uint32_t request_id;
+    uint32_t length;
+};
+
+//data chunk size of this process, DFS_DATA_CHUNK_SIZE unless configured (see dfs_config.h)
+void dfs_set_data_chunk_size(size_t bytes);
+size_t dfs_data_chunk_size(void);
+
+//low level helpers that loop until the whole buffer has been transferred
+int dfs_read_full(int fd, void* buffer, size_t length);
+int dfs_write_full(int fd, const void* buffer, size_t length);
+
+//frame encoding and decoding
+void dfs_encode_header(unsigned char* out, uint8_t opcode, uint16_t flags, uint32_t request_id, uint32_t length);
+int dfs_decode_header(const unsigned char* in, struct dfs_frame* frame);
+int dfs_send_frame(int fd, uint8_t opcode, uint16_t flags, uint32_t request_id, const void* payload, uint32_t length);
+int dfs_recv_header(int fd, struct dfs_frame* frame);
+int dfs_recv_control(int fd, struct dfs_frame* frame, char* payload, size_t capacity);
+int dfs_skip_payload(int fd, uint64_t length);
+
+//request and status helpers
+uint32_t dfs_next_request_id(void);
+int dfs_send_request(int fd, uint8_t opcode, uint32_t request_id, const char* arg1, const char* arg2);
+int dfs_send_request_args(int fd, uint8_t opcode, uint32_t request_id, const char* const* args, int count);
+int dfs_send_request_flags(int fd, uint8_t opcode, uint16_t flags, uint32_t request_id, const char* const* args, int count);
+int dfs_parse_args(char* payload, uint32_t length, char** args, int max_args);
+int dfs_parse_range(char** args, int count, uint64_t size, uint64_t* offset, uint64_t* length);
+int dfs_send_status(int fd, uint32_t request_id, int ok, const char* message);
+//error statuses sent by the calling thread, which request metrics compare before and after a request
+unsigned long dfs_status_errors_sent(void);
+const char* dfs_opcode_name(uint8_t opcode);
+
+//stream helpers: a stream is a run of DATA frames terminated by a frame carrying DFS_FLAG_END,
+//or cut short by a STATUS frame carrying DFS_FLAG_ERROR. relaying a stream between sockets lives in dfs_xfer.h.
+//the receiving helpers decode DATA frames carrying DFS_FLAG_COMPRESSED and count the decoded bytes.
+long long dfs_send_stream_from_fd(int sock, int fd, uint32_t request_id);
+long long dfs_recv_stream_to_fd(int sock, int fd, char* error_message, size_t error_capacity);
+long long dfs_recv_stream_at(int sock, int fd, off_t* position, unsigned long long* progress, char* error_message, size_t error_capacity);
+
+#endif
@@ -0,0 +1,751 @@
+//dfs_index.c
+//this file implements the metadata index declared in dfs_index.h.
+//files are kept in a hash table keyed by their path below the root, and each directory keeps an array of
+//its files so a listing never touches the disk. the index is saved as a text snapshot (one
+//"size mtime_ns checksum path" line per file) and every later change is appended to an update log, so a
+//restart only reads the two files, stat()s the tree and checksums the files that changed while it was down.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dfs_index.h"
+
+#define INDEX_MIN_BUCKETS 1024
+//updates kept in the shared ring of a forking server; a process that falls further behind rescans the tree
+#define INDEX_SHARED_SLOTS 1024
+#define INDEX_READ_SIZE (256 * 1024)
+
+struct index_dir;
+
+struct index_entry {
+    struct index_entry *next;      //hash chain
+    struct index_dir *dir;
+    size_t dir_slot;               //position in dir->files
+    uint32_t hash;
+    struct dfs_index_info info;
+    char *name;                    //points into path, after the last '/'
+    char path[];                   //relative to the root
+};
+
+struct index_dir {
+    struct index_dir *next;
+    uint32_t hash;
+    struct index_entry **files;
+    size_t count;
+    size_t capacity;
+    char path[];
+};
+
+struct index_table {
+    struct index_entry **entries;
+    size_t entry_buckets;
+    long entry_count;
+    struct index_dir **dirs;
+    size_t dir_buckets;
+    long dir_count;
+    unsigned long long bytes;
+};
+
+//one update published to the other processes of a forking server
+struct shared_update {
+    uint64_t seq;
+    char op;                       //'+' for a written file, '-' for a removed one
+    struct dfs_index_info info;
+    char path[PATH_MAX];
+};
+
+struct shared_journal {
+    pthread_mutex_t lock;
+    uint64_t next_seq;
+    struct shared_update slots[INDEX_SHARED_SLOTS];
+};
+
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct index_table index_table;
+static bool index_ready = false;
+static char index_root[PATH_MAX];
+static size_t index_root_length;
+static int index_log_fd = -1;
+static struct shared_journal *index_shared = NULL;
+static uint64_t index_applied = 0;
+
+//state of the tree walk, which nftw() gives no way to pass
+static struct index_table *walk_table;
+static struct index_table *walk_previous;
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+//crc_init: Builds the slicing-by-8 tables for the reflected CRC-32 polynomial.
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xff];
+        }
+    }
+}
+
+//dfs_index_crc32: Continues a CRC-32 over `length` more bytes; start with 0.
+uint32_t dfs_index_crc32(uint32_t crc, const void* data, size_t length) {
+    pthread_once(&crc_once, crc_init);
+    const unsigned char *p = data;
+    crc = ~crc;
+    while (length >= 8) {
+        uint32_t low = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t high = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc_table[7][low & 0xff] ^ crc_table[6][(low >> 8) & 0xff] ^ crc_table[5][(low >> 16) & 0xff] ^ crc_table[4][low >> 24] ^
+              crc_table[3][high & 0xff] ^ crc_table[2][(high >> 8) & 0xff] ^ crc_table[1][(high >> 16) & 0xff] ^ crc_table[0][high >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+//checksum_file: Computes the CRC-32 of a file's contents. returns 0 on success and -1 on error.
+static int checksum_file(const char* path, uint32_t* checksum) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    char *buffer = malloc(INDEX_READ_SIZE);
+    if (!buffer) {
+        close(fd);
+        return -1;
+    }
+    uint32_t crc = 0;
+    ssize_t n;
+    while ((n = read(fd, buffer, INDEX_READ_SIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        crc = dfs_index_crc32(crc, buffer, n);
+    }
+    free(buffer);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    *checksum = crc;
+    return 0;
+}
+
+//hash_path: FNV-1a hash of `length` bytes of a path.
+static uint32_t hash_path(const char* path, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)path[i]) * 16777619u;
+    }
+    return h;
+}
+
+//relative_path: Turns a path below the root into its key: no leading '/', no "." parts and no doubled '/'.
+//returns 0 on success and -1 if the path is outside the root or climbs out of it with "..".
+static int relative_path(const char* path, char* out, size_t size) {
+    if (strncmp(path, index_root, index_root_length) != 0 || (path[index_root_length] != '/' && path[index_root_length] != '\0')) {
+        return -1;
+    }
+    const char *p = path + index_root_length;
+    size_t length = 0;
+    while (*p) {
+        while (*p == '/') {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+        const char *end = strchrnul(p, '/');
+        size_t part = end - p;
+        if (part == 2 && p[0] == '.' && p[1] == '.') {
+            return -1;
+        }
+        if (!(part == 1 && p[0] == '.')) {
+            if (length + part + 2 > size) {
+                return -1;
+            }
+            if (length) {
+                out[length++] = '/';
+            }
+            memcpy(out + length, p, part);
+            length += part;
+        }
+        p = end;
+    }
+    out[length] = '\0';
+    return 0;
+}
+
+//table_init: Allocates the buckets of an empty table. returns 0 on success and -1 if memory runs out.
+static int table_init(struct index_table* t) {
+    memset(t, 0, sizeof(*t));
+    t->entries = calloc(INDEX_MIN_BUCKETS, sizeof(*t->entries));
+    t->dirs = calloc(INDEX_MIN_BUCKETS, sizeof(*t->dirs));
+    if (!t->entries || !t->dirs) {
+        free(t->entries);
+        free(t->dirs);
+        return -1;
+    }
+    t->entry_buckets = INDEX_MIN_BUCKETS;
+    t->dir_buckets = INDEX_MIN_BUCKETS;
+    return 0;
+}
+
+//table_free: Releases a table and everything in it.
+static void table_free(struct index_table* t) {
+    for (size_t i = 0; i < t->entry_buckets; i++) {
+        struct index_entry *e = t->entries[i];
+        while (e) {
+            struct index_entry *next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    for (size_t i = 0; i < t->dir_buckets; i++) {
+        struct index_dir *d = t->dirs[i];
+        while (d) {
+            struct index_dir *next = d->next;
+            free(d->files);
+            free(d);
+            d = next;
+        }
+    }
+    free(t->entries);
+    free(t->dirs);
+    memset(t, 0, sizeof(*t));
+}
+
+//table_find: Returns the entry of a relative path, or NULL.
+static struct index_entry* table_find(const struct index_table* t, const char* path) {
+    uint32_t h = hash_path(path, strlen(path));
+    for (struct index_entry *e = t->entries[h & (t->entry_buckets - 1)]; e; e = e->next) {
+        if (e->hash == h && strcmp(e->path, path) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+//table_find_dir: Returns the record of the directory named by the first `length` bytes of `path`,
+//creating it if `create` is set. returns NULL if it does not exist or memory runs out.
+static struct index_dir* table_find_dir(struct index_table* t, const char* path, size_t length, bool create) {
+    uint32_t h = hash_path(path, length);
+    for (struct index_dir *d = t->dirs[h & (t->dir_buckets - 1)]; d; d = d->next) {
+        if (d->hash == h && strncmp(d->path, path, length) == 0 && d->path[length] == '\0') {
+            return d;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    if ((size_t)t->dir_count >= t->dir_buckets) {
+        size_t buckets = t->dir_buckets * 2;
+        struct index_dir **dirs = calloc(buckets, sizeof(*dirs));
+        if (dirs) {
+            for (size_t i = 0; i < t->dir_buckets; i++) {
+                struct index_dir *d = t->dirs[i];
+                while (d) {
+                    struct index_dir *next = d->next;
+                    d->next = dirs[d->hash & (buckets - 1)];
+                    dirs[d->hash & (buckets - 1)] = d;
+                    d = next;
+                }
+            }
+            free(t->dirs);
+            t->dirs = dirs;
+            t->dir_buckets = buckets;
+        }
+    }
+
+    struct index_dir *d = calloc(1, sizeof(*d) + length + 1);
+    if (!d) {
+        return NULL;
+    }
+    memcpy(d->path, path, length);
+    d->hash = h;
+    d->next = t->dirs[h & (t->dir_buckets - 1)];
+    t->dirs[h & (t->dir_buckets - 1)] = d;
+    t->dir_count++;
+    return d;
+}
+
+//table_remove: Drops a relative path from a table if it is there.
+static void table_remove(struct index_table* t, const char* path) {
+    uint32_t h = hash_path(path, strlen(path));
+    struct index_entry **link = &t->entries[h & (t->entry_buckets - 1)];
+    while (*link && ((*link)->hash != h || strcmp((*link)->path, path) != 0)) {
+        link = &(*link)->next;
+    }
+    struct index_entry *e = *link;
+    if (!e) {
+        return;
+    }
+    *link = e->next;
+
+    //the directory's last file takes the removed one's place
+    struct index_dir *d = e->dir;
+    struct index_entry *last = d->files[--d->count];
+    d->files[e->dir_slot] = last;
+    last->dir_slot = e->dir_slot;
+
+    t->entry_count--;
+    t->bytes -= e->info.size;
+    free(e);
+}
+
+//table_put: Adds a relative path to a table or replaces what it records. returns 0 on success and -1 if memory runs out.
+static int table_put(struct index_table* t, const char* path, const struct dfs_index_info* info) {
+    struct index_entry *e = table_find(t, path);
+    if (e) {
+        t->bytes += info->size - e->info.size;
+        e->info = *info;
+        return 0;
+    }
+
+    const char *slash = strrchr(path, '/');
+    size_t dir_length = slash ? (size_t)(slash - path) : 0;
+    struct index_dir *d = table_find_dir(t, path, dir_length, true);
+    if (!d) {
+        return -1;
+    }
+    if (d->count == d->capacity) {
+        size_t capacity = d->capacity ? d->capacity * 2 : 16;
+        struct index_entry **files = realloc(d->files, capacity * sizeof(*files));
+        if (!files) {
+            return -1;
+        }
+        d->files = files;
+        d->capacity = capacity;
+    }
+
+    if ((size_t)t->entry_count >= t->entry_buckets) {
+        size_t buckets = t->entry_buckets * 2;
+        struct index_entry **entries = calloc(buckets, sizeof(*entries));
+        if (entries) {
+            for (size_t i = 0; i < t->entry_buckets; i++) {
+                struct index_entry *old = t->entries[i];
+                while (old) {
+                    struct index_entry *next = old->next;
+                    old->next = entries[old->hash & (buckets - 1)];
+                    entries[old->hash & (buckets - 1)] = old;
+                    old = next;
+                }
+            }
+            free(t->entries);
+            t->entries = entries;
+            t->entry_buckets = buckets;
+        }
+    }
+
+    size_t length = strlen(path);
+    e = malloc(sizeof(*e) + length + 1);
+    if (!e) {
+        return -1;
+    }
+    memcpy(e->path, path, length + 1);
+    e->name = e->path + (slash ? dir_length + 1 : 0);
+    e->hash = hash_path(path, length);
+    e->info = *info;
+    e->dir = d;
+    e->dir_slot = d->count;
+    d->files[d->count++] = e;
+    e->next = t->entries[e->hash & (t->entry_buckets - 1)];
+    t->entries[e->hash & (t->entry_buckets - 1)] = e;
+    t->entry_count++;
+    t->bytes += info->size;
+    return 0;
+}
+
+//set_type: Records the extension of a file name in its info.
+static void set_type(struct dfs_index_info* info, const char* path) {
+    const char *name = strrchr(path, '/');
+    const char *dot = strrchr(name ? name + 1 : path, '.');
+    snprintf(info->type, sizeof(info->type), "%s", dot && dot[1] ? dot : "");
+}
+
+//parse_record: Reads "size mtime_ns checksum path" into `info` and returns the path, or NULL if the line is malformed.
+static char* parse_record(char* line, struct dfs_index_info* info) {
+    int consumed = 0;
+    if (sscanf(line, "%" SCNu64 " %" SCNd64 " %" SCNu32 " %n", &info->size, &info->mtime_ns, &info->checksum, &consumed) != 3 || consumed == 0) {
+        return NULL;
+    }
+    char *path = line + consumed;
+    path[strcspn(path, "\n")] = '\0';
+    if (!*path) {
+        return NULL;
+    }
+    set_type(info, path);
+    return path;
+}
+
+//load_saved: Reads the snapshot and then replays the update log written since it was taken.
+static void load_saved(struct index_table* t) {
+    char file[PATH_MAX + 16];
+    char *line = NULL;
+    size_t capacity = 0;
+    struct dfs_index_info info;
+
+    snprintf(file, sizeof(file), "%s.index", index_root);
+    FILE *in = fopen(file, "re");
+    if (in) {
+        while (getline(&line, &capacity, in) > 0) {
+            char *path = parse_record(line, &info);
+            if (path) {
+                table_put(t, path, &info);
+            }
+        }
+        fclose(in);
+    }
+
+    snprintf(file, sizeof(file), "%s.index.log", index_root);
+    in = fopen(file, "re");
+    if (in) {
+        while (getline(&line, &capacity, in) > 0) {
+            if (line[0] == '+' && line[1] == ' ') {
+                char *path = parse_record(line + 2, &info);
+                if (path) {
+                    table_put(t, path, &info);
+                }
+            } else if (line[0] == '-' && line[1] == ' ') {
+                line[strcspn(line, "\n")] = '\0';
+                table_remove(t, line + 2);
+            }
+        }
+        fclose(in);
+    }
+    free(line);
+}
+
+//save_snapshot: Writes the table as the new snapshot and starts an empty update log.
+static void save_snapshot(const struct index_table* t) {
+    char file[PATH_MAX + 16];
+    char temp[PATH_MAX + 16];
+    snprintf(file, sizeof(file), "%s.index", index_root);
+    snprintf(temp, sizeof(temp), "%s.index.tmp", index_root);
+
+    FILE *out = fopen(temp, "we");
+    if (!out) {
+        perror("Failed to save index");
+        return;
+    }
+    for (size_t i = 0; i < t->entry_buckets; i++) {
+        for (struct index_entry *e = t->entries[i]; e; e = e->next) {
+            fprintf(out, "%" PRIu64 " %" PRId64 " %" PRIu32 " %s\n", e->info.size, e->info.mtime_ns, e->info.checksum, e->path);
+        }
+    }
+    if (fclose(out) != 0 || rename(temp, file) != 0) {
+        perror("Failed to save index");
+        unlink(temp);
+        return;
+    }
+
+    snprintf(file, sizeof(file), "%s.index.log", index_root);
+    if (index_log_fd >= 0) {
+        close(index_log_fd);
+    }
+    index_log_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+}
+
+//append_log: Appends one update to the log so the next start sees it even if the snapshot is not rewritten.
+static void append_log(char op, const char* path, const struct dfs_index_info* info) {
+    if (index_log_fd < 0) {
+        return;
+    }
+    char line[PATH_MAX + 96];
+    int length;
+    if (op == '+') {
+        length = snprintf(line, sizeof(line), "+ %" PRIu64 " %" PRId64 " %" PRIu32 " %s\n", info->size, info->mtime_ns, info->checksum, path);
+    } else {
+        length = snprintf(line, sizeof(line), "- %s\n", path);
+    }
+    if (length > 0 && (size_t)length < sizeof(line) && write(index_log_fd, line, length) != length) {
+        perror("Failed to log index update");
+    }
+}
+
+//file_info: Fills `info` from a stat() result, reusing `known`'s checksum if the file has not changed since.
+static int file_info(const char* path, const struct stat* st, const struct dfs_index_info* known, struct dfs_index_info* info) {
+    info->size = st->st_size;
+    info->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    if (known && known->size == info->size && known->mtime_ns == info->mtime_ns) {
+        info->checksum = known->checksum;
+    } else if (checksum_file(path, &info->checksum) < 0) {
+        return -1;
+    }
+    set_type(info, path);
+    return 0;
+}
+
+//walk_visit: nftw() callback adding each regular file below the root to the table being built.
+static int walk_visit(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)ftw;
+    struct stat target;
+    if (type == FTW_SL) {
+        //symlinks to files are served like the files, as open() follows them
+        if (stat(path, &target) != 0) {
+            return 0;
+        }
+        st = &target;
+    } else if (type != FTW_F) {
+        return 0;
+    }
+    if (!S_ISREG(st->st_mode)) {
+        return 0;
+    }
+
+    char relative[PATH_MAX];
+    if (relative_path(path, relative, sizeof(relative)) < 0 || relative[0] == '\0') {
+        return 0;
+    }
+    struct index_entry *known = walk_previous ? table_find(walk_previous, relative) : NULL;
+    struct dfs_index_info info;
+    if (file_info(path, st, known ? &known->info : NULL, &info) == 0) {
+        table_put(walk_table, relative, &info);
+    }
+    return 0;
+}
+
+//scan_tree: Rebuilds the table from the directory tree, taking unchanged checksums from the current table.
+//the caller holds the write lock.
+static int scan_tree(void) {
+    struct index_table fresh;
+    if (table_init(&fresh) < 0) {
+        return -1;
+    }
+    walk_table = &fresh;
+    walk_previous = &index_table;
+    if (nftw(index_root, walk_visit, 32, FTW_PHYS) != 0 && errno != ENOENT) {
+        perror("Failed to index files");
+    }
+    walk_table = NULL;
+    walk_previous = NULL;
+    table_free(&index_table);
+    index_table = fresh;
+    return 0;
+}
+
+//dfs_index_build: Indexes the tree below `root`. see dfs_index.h.
+long dfs_index_build(const char* root) {
+    size_t length = strlen(root);
+    while (length > 1 && root[length - 1] == '/') {
+        length--;
+    }
+    if (length == 0 || length >= sizeof(index_root)) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&index_lock);
+    memcpy(index_root, root, length);
+    index_root[length] = '\0';
+    index_root_length = length;
+
+    if (index_ready) {
+        table_free(&index_table);
+        index_ready = false;
+    }
+    if (table_init(&index_table) < 0) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
+    }
+    load_saved(&index_table);
+    if (scan_tree() < 0) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
+    }
+    save_snapshot(&index_table);
+    index_ready = true;
+    long files = index_table.entry_count;
+    pthread_rwlock_unlock(&index_lock);
+    return files;
+}
+
+//dfs_index_share_updates: Creates the ring through which forked processes pass on their updates.
+int dfs_index_share_updates(void) {
+    struct shared_journal *shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return -1;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    shared->next_seq = 0;
+    index_shared = shared;
+    index_applied = 0;
+    return 0;
+}
+
+//catch_up: Applies the updates other processes published since this one last looked.
+//the caller holds the write lock and the ring's mutex.
+static void catch_up(void) {
+    uint64_t next = index_shared->next_seq;
+    if (next - index_applied > INDEX_SHARED_SLOTS) {
+        //the ring has wrapped past updates this process never saw
+        scan_tree();
+        index_applied = next;
+        return;
+    }
+    for (; index_applied < next; index_applied++) {
+        struct shared_update *u = &index_shared->slots[index_applied % INDEX_SHARED_SLOTS];
+        if (u->op == '+') {
+            table_put(&index_table, u->path, &u->info);
+        } else {
+            table_remove(&index_table, u->path);
+        }
+    }
+}
+
+//sync_shared: Brings this process's table up to date with the shared ring, if there is one.
+static void sync_shared(void) {
+    if (!index_shared || __atomic_load_n(&index_shared->next_seq, __ATOMIC_ACQUIRE) == index_applied) {
+        return;
+    }
+    pthread_rwlock_wrlock(&index_lock);
+    pthread_mutex_lock(&index_shared->lock);
+    catch_up();
+    pthread_mutex_unlock(&index_shared->lock);
+    pthread_rwlock_unlock(&index_lock);
+}
+
+//dfs_index_refresh: Applies the updates published by other processes.
+void dfs_index_refresh(void) {
+    sync_shared();
+}
+
+//record_update: Applies an update to the table, the update log and the shared ring.
+static void record_update(char op, const char* relative, const struct dfs_index_info* info) {
+    pthread_rwlock_wrlock(&index_lock);
+    if (index_shared) {
+        pthread_mutex_lock(&index_shared->lock);
+        catch_up();
+    }
+    if (op == '+') {
+        table_put(&index_table, relative, info);
+    } else {
+        table_remove(&index_table, relative);
+    }
+    append_log(op, relative, info);
+    if (index_shared) {
+        struct shared_update *u = &index_shared->slots[index_shared->next_seq % INDEX_SHARED_SLOTS];
+        u->seq = index_shared->next_seq;
+        u->op = op;
+        if (info) {
+            u->info = *info;
+        }
+        snprintf(u->path, sizeof(u->path), "%s", relative);
+        __atomic_store_n(&index_shared->next_seq, index_shared->next_seq + 1, __ATOMIC_RELEASE);
+        index_applied = index_shared->next_seq;
+        pthread_mutex_unlock(&index_shared->lock);
+    }
+    pthread_rwlock_unlock(&index_lock);
+}
+
+//dfs_index_lookup: Looks a path up in the index. see dfs_index.h.
+int dfs_index_lookup(const char* path, struct dfs_index_info* info) {
+    char relative[PATH_MAX];
+    if (!index_ready || relative_path(path, relative, sizeof(relative)) < 0) {
+        return -1;
+    }
+    sync_shared();
+    pthread_rwlock_rdlock(&index_lock);
+    struct index_entry *e = table_find(&index_table, relative);
+    if (e && info) {
+        *info = e->info;
+    }
+    pthread_rwlock_unlock(&index_lock);
+    return e ? 1 : 0;
+}
+
+//dfs_index_update: Records the current size, time and checksum of a file that was just written.
+//returns 0 on success and -1 if the file is not below the root or cannot be read.
+int dfs_index_update(const char* path) {
+    char relative[PATH_MAX];
+    struct stat st;
+    struct dfs_index_info info;
+    if (!index_ready || relative_path(path, relative, sizeof(relative)) < 0 || relative[0] == '\0') {
+        return -1;
+    }
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || file_info(path, &st, NULL, &info) < 0) {
+        //whatever is there is not a file the index can describe
+        record_update('-', relative, NULL);
+        return -1;
+    }
+    record_update('+', relative, &info);
+    return 0;
+}
+
+//dfs_index_remove: Forgets a file that was removed.
+void dfs_index_remove(const char* path) {
+    char relative[PATH_MAX];
+    if (index_ready && relative_path(path, relative, sizeof(relative)) == 0 && relative[0] != '\0') {
+        record_update('-', relative, NULL);
+    }
+}
+
+//dfs_index_covers: Returns 1 if listings of `dir` can be served from the index.
+int dfs_index_covers(const char* dir) {
+    char relative[PATH_MAX];
+    return index_ready && relative_path(dir, relative, sizeof(relative)) == 0;
+}
+
+//dfs_index_next: Returns the next indexed file of a directory. see dfs_index.h.
+//the position is an offset into the directory's array, so a file removed during a listing may cause
+//another to be skipped, much as readdir() gives no guarantee for entries changed while it runs.
+int dfs_index_next(const char* dir, const char* extension, size_t* position, char* name, size_t name_size) {
+    char relative[PATH_MAX];
+    if (!index_ready || relative_path(dir, relative, sizeof(relative)) < 0) {
+        return -1;
+    }
+    sync_shared();
+    size_t extension_length = strlen(extension);
+    int found = 0;
+    pthread_rwlock_rdlock(&index_lock);
+    struct index_dir *d = table_find_dir(&index_table, relative, strlen(relative), false);
+    while (d && *position < d->count) {
+        const char *candidate = d->files[(*position)++]->name;
+        size_t length = strlen(candidate);
+        if (length > extension_length && length < name_size && strcmp(candidate + length - extension_length, extension) == 0) {
+            memcpy(name, candidate, length + 1);
+            found = 1;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+    return found;
+}
+
+//dfs_index_get_stats: Reports how many files and bytes the index holds.
+void dfs_index_get_stats(struct dfs_index_stats* out) {
+    sync_shared();
+    pthread_rwlock_rdlock(&index_lock);
+    out->files = index_table.entry_count;
+    out->directories = index_table.dir_count;
+    out->bytes = index_table.bytes;
+    pthread_rwlock_unlock(&index_lock);
+}
@@ -0,0 +1,53 @@
+//dfs_index.h
+//this header declares the metadata index of the files a server stores. the index is built from the storage
+//directory at startup, kept up to date by ufile and rmfile, and saved next to the directory, so listings,
+//existence checks and size lookups are answered from memory instead of opendir()/stat() calls.
+#ifndef DFS_INDEX_H
+#define DFS_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//what the index records about each regular file
+struct dfs_index_info {
+    uint64_t size;
+    int64_t mtime_ns;      //modification time in nanoseconds since the epoch
+    uint32_t checksum;     //CRC-32 of the contents
+    char type[16];         //extension including the dot, e.g. ".pdf"; empty if the name has none
+};
+
+struct dfs_index_stats {
+    long files;
+    long directories;
+    unsigned long long bytes;
+};
+
+//dfs_index_build() indexes every regular file below `root`. checksums are reused from the snapshot saved
+//by the previous run (root + ".index", plus the update log root + ".index.log") for files whose size and
+//modification time are unchanged, and computed for the rest. returns the number of files or -1 on error.
+long dfs_index_build(const char* root);
+
+//in a server that forks a process per client, dfs_index_share_updates() lets every process see the updates
+//made by the others; it must be called after dfs_index_build() and before the first fork.
+int dfs_index_share_updates(void);
+//dfs_index_refresh() applies the updates other processes published; the forking parent calls it before each
+//fork so children start from a current index.
+void dfs_index_refresh(void);
+
+//dfs_index_lookup() returns 1 and fills `info` if `path` is an indexed file, 0 if the index knows it does
+//not exist, and -1 if the path is outside the indexed root and the caller must ask the file system.
+int dfs_index_lookup(const char* path, struct dfs_index_info* info);
+
+//record a file that was just written, or forget one that was removed
+int dfs_index_update(const char* path);
+void dfs_index_remove(const char* path);
+
+//dfs_index_next() walks the indexed files directly inside directory `dir` whose names end in `extension`.
+//`position` starts at 0. returns 1 with the next name, 0 at the end and -1 if `dir` is not indexed.
+int dfs_index_covers(const char* dir);
+int dfs_index_next(const char* dir, const char* extension, size_t* position, char* name, size_t name_size);
+
+void dfs_index_get_stats(struct dfs_index_stats* out);
+uint32_t dfs_index_crc32(uint32_t crc, const void* data, size_t length);
+
+#endif
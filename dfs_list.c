@@ -0,0 +1,354 @@
+//dfs_list.c
+//this file implements the directory lister declared in dfs_list.h.
+//a page in directory order is produced while the directory is read; a sorted page keeps the best
+//`page_size` names seen so far in a heap and sorts only those at the end.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dfs_frame.h"
+#include "dfs_index.h"
+#include "dfs_list.h"
+
+//dfs_list_order_name: Returns the option value naming a sort order.
+const char* dfs_list_order_name(enum dfs_list_order order) {
+    switch (order) {
+        case DFS_LIST_ASCENDING: return "asc";
+        case DFS_LIST_DESCENDING: return "desc";
+        default: return "none";
+    }
+}
+
+//dfs_list_parse_options: Parses a display option string; a NULL or empty string selects the defaults.
+//sorted listings always come in pages, of DFS_LIST_DEFAULT_PAGE names unless another size is given.
+//returns 0 on success and -1 if the string is malformed.
+int dfs_list_parse_options(const char* text, struct dfs_list_options* options) {
+    options->order = DFS_LIST_UNSORTED;
+    options->page_size = 0;
+    options->after[0] = '\0';
+
+    const char *p = text ? text : "";
+    while (*p) {
+        //the cursor takes the rest of the string
+        if (strncmp(p, "after=", 6) == 0) {
+            if (strlen(p + 6) >= sizeof(options->after)) {
+                return -1;
+            }
+            strcpy(options->after, p + 6);
+            break;
+        }
+
+        const char *comma = strchr(p, ',');
+        size_t length = comma ? (size_t)(comma - p) : strlen(p);
+        if (length > 5 && strncmp(p, "page=", 5) == 0) {
+            char *end;
+            errno = 0;
+            long page_size = strtol(p + 5, &end, 10);
+            if (errno != 0 || end != p + length || page_size < 1 || page_size > DFS_LIST_MAX_PAGE) {
+                return -1;
+            }
+            options->page_size = page_size;
+        } else if (length == 9 && strncmp(p, "sort=none", 9) == 0) {
+            options->order = DFS_LIST_UNSORTED;
+        } else if (length == 8 && strncmp(p, "sort=asc", 8) == 0) {
+            options->order = DFS_LIST_ASCENDING;
+        } else if (length == 9 && strncmp(p, "sort=desc", 9) == 0) {
+            options->order = DFS_LIST_DESCENDING;
+        } else {
+            return -1;
+        }
+        p += length;
+        if (*p == ',') {
+            p++;
+        }
+    }
+
+    if (options->order != DFS_LIST_UNSORTED && options->page_size == 0) {
+        options->page_size = DFS_LIST_DEFAULT_PAGE;
+    }
+    return 0;
+}
+
+//dfs_list_format_options: Writes an option string asking for the page of `options` that follows `after`.
+//`after` may be NULL or empty for a first page.
+void dfs_list_format_options(const struct dfs_list_options* options, const char* after, char* out, size_t size) {
+    int length = 0;
+    if (options->page_size > 0) {
+        length = snprintf(out, size, "page=%ld,", options->page_size);
+    }
+    if (length < 0 || (size_t)length >= size) {
+        length = 0;
+    }
+    snprintf(out + length, size - length, "sort=%s%s%s", dfs_list_order_name(options->order), after && *after ? ",after=" : "", after && *after ? after : "");
+}
+
+//dfs_list_compare: Compares two names in listing order; negative if `a` is listed first.
+int dfs_list_compare(enum dfs_list_order order, const char* a, const char* b) {
+    switch (order) {
+        case DFS_LIST_ASCENDING: return strcmp(a, b);
+        case DFS_LIST_DESCENDING: return strcmp(b, a);
+        default: return 0;
+    }
+}
+
+//dfs_list_open: Starts reading a directory. returns 0 on success and -1 if it cannot be opened.
+int dfs_list_open(struct dfs_list_iter* it, const char* path, const char* extension) {
+    it->dir = NULL;
+    it->indexed = dfs_index_covers(path);
+    it->position = 0;
+    if (!it->indexed) {
+        it->dir = opendir(path);
+        if (!it->dir) {
+            return -1;
+        }
+    }
+    it->extension = extension;
+    snprintf(it->path, sizeof(it->path), "%s", path);
+    return 0;
+}
+
+//dfs_list_next: Returns the next regular file whose name ends in the iterator's extension, or NULL at the end.
+//the name is valid until the next call.
+const char* dfs_list_next(struct dfs_list_iter* it) {
+    if (it->indexed) {
+        return dfs_index_next(it->path, it->extension, &it->position, it->name, sizeof(it->name)) == 1 ? it->name : NULL;
+    }
+    size_t extension_length = strlen(it->extension);
+    struct dirent *ent;
+    while ((ent = readdir(it->dir)) != NULL) {
+        size_t name_length = strlen(ent->d_name);
+        if (name_length <= extension_length || strcmp(ent->d_name + name_length - extension_length, it->extension) != 0) {
+            continue;
+        }
+        //d_type saves a stat() per entry on file systems that report it; symlinks are followed like stat() does
+        if (ent->d_type == DT_REG) {
+            return ent->d_name;
+        }
+        if (ent->d_type != DT_UNKNOWN && ent->d_type != DT_LNK) {
+            continue;
+        }
+        char file_path[PATH_MAX];
+        struct stat st;
+        if (snprintf(file_path, sizeof(file_path), "%s/%s", it->path, ent->d_name) < (int)sizeof(file_path) &&
+            stat(file_path, &st) == 0 && S_ISREG(st.st_mode)) {
+            return ent->d_name;
+        }
+    }
+    return NULL;
+}
+
+//dfs_list_close: Finishes reading a directory.
+void dfs_list_close(struct dfs_list_iter* it) {
+    if (it->dir) {
+        closedir(it->dir);
+        it->dir = NULL;
+    }
+}
+
+//heap_sift_down: Restores the heap below `i`; the root is the name listed last among those kept.
+static void heap_sift_down(char** heap, long size, long i, enum dfs_list_order order) {
+    while (1) {
+        long worst = i;
+        long left = 2 * i + 1;
+        long right = left + 1;
+        if (left < size && dfs_list_compare(order, heap[left], heap[worst]) > 0) {
+            worst = left;
+        }
+        if (right < size && dfs_list_compare(order, heap[right], heap[worst]) > 0) {
+            worst = right;
+        }
+        if (worst == i) {
+            return;
+        }
+        char *t = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = t;
+        i = worst;
+    }
+}
+
+//heap_sift_up: Moves a newly added name up to its place in the heap.
+static void heap_sift_up(char** heap, long i, enum dfs_list_order order) {
+    while (i > 0) {
+        long parent = (i - 1) / 2;
+        if (dfs_list_compare(order, heap[i], heap[parent]) <= 0) {
+            return;
+        }
+        char *t = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = t;
+        i = parent;
+    }
+}
+
+//list_sorted_page: Lists the first `page_size` names after the cursor in sorted order.
+//only the names that may still be on the page are kept, so memory is bounded by the page size.
+static long list_sorted_page(struct dfs_list_iter* it, const struct dfs_list_options* options, dfs_list_emit emit, void* ctx, char* cursor, size_t cursor_size) {
+    char **heap = malloc(options->page_size * sizeof(*heap));
+    if (!heap) {
+        return 0;
+    }
+    long size = 0;
+    bool more = false;
+    const char *name;
+    while ((name = dfs_list_next(it)) != NULL) {
+        if (options->after[0] && dfs_list_compare(options->order, name, options->after) <= 0) {
+            continue;
+        }
+        if (size < options->page_size) {
+            char *copy = strdup(name);
+            if (!copy) {
+                break;
+            }
+            heap[size] = copy;
+            heap_sift_up(heap, size++, options->order);
+            continue;
+        }
+        //the page is full: the name either replaces the last one kept or belongs to a later page
+        more = true;
+        if (dfs_list_compare(options->order, name, heap[0]) < 0) {
+            char *copy = strdup(name);
+            if (!copy) {
+                break;
+            }
+            free(heap[0]);
+            heap[0] = copy;
+            heap_sift_down(heap, size, 0, options->order);
+        }
+    }
+
+    //taking the root off the heap repeatedly yields the page from its last name to its first
+    for (long end = size - 1; end > 0; end--) {
+        char *t = heap[0];
+        heap[0] = heap[end];
+        heap[end] = t;
+        heap_sift_down(heap, end, 0, options->order);
+    }
+
+    long count = 0;
+    while (count < size && emit(ctx, heap[count]) == 0) {
+        count++;
+    }
+    if ((more || count < size) && count > 0) {
+        snprintf(cursor, cursor_size, "%s", heap[count - 1]);
+    }
+    for (long i = 0; i < size; i++) {
+        free(heap[i]);
+    }
+    free(heap);
+    return count;
+}
+
+//dfs_list_directory: Lists one page of a directory. see dfs_list.h.
+long dfs_list_directory(const char* path, const char* extension, const struct dfs_list_options* options, dfs_list_emit emit, void* ctx, char* cursor, size_t cursor_size) {
+    cursor[0] = '\0';
+    struct dfs_list_iter it;
+    if (dfs_list_open(&it, path, extension) < 0) {
+        return 0;
+    }
+
+    long count = 0;
+    if (options->order != DFS_LIST_UNSORTED) {
+        count = list_sorted_page(&it, options, emit, ctx, cursor, cursor_size);
+    } else {
+        //in directory order the cursor counts the names already listed
+        long skip = options->after[0] ? strtol(options->after, NULL, 10) : 0;
+        long seen = 0;
+        const char *name;
+        while ((name = dfs_list_next(&it)) != NULL) {
+            if (seen++ < skip) {
+                continue;
+            }
+            if (options->page_size > 0 && count == options->page_size) {
+                snprintf(cursor, cursor_size, "%ld", skip + count);
+                break;
+            }
+            if (emit(ctx, name) < 0) {
+                break;
+            }
+            count++;
+        }
+    }
+    dfs_list_close(&it);
+    return count;
+}
+
+//dfs_list_writer_init: Prepares a writer that sends listing frames to a socket.
+void dfs_list_writer_init(struct dfs_list_writer* w, int sock, uint32_t request_id) {
+    w->sock = sock;
+    w->request_id = request_id;
+    w->send_frame = NULL;
+    w->target = NULL;
+    w->length = 0;
+    w->failed = 0;
+    w->count = 0;
+}
+
+//writer_send: Sends one DATA frame to wherever the writer's listing goes.
+static int writer_send(struct dfs_list_writer* w, uint16_t flags, const char* payload, uint32_t length) {
+    if (w->send_frame) {
+        return w->send_frame(w->target, flags, w->request_id, payload, length);
+    }
+    return dfs_send_frame(w->sock, DFS_OP_DATA, flags, w->request_id, payload, length);
+}
+
+//dfs_list_writer_add: Adds one name to the listing; matches dfs_list_emit so it can be handed to dfs_list_directory().
+int dfs_list_writer_add(void* writer, const char* name) {
+    struct dfs_list_writer *w = writer;
+    size_t length = strlen(name);
+    if (length + 1 > sizeof(w->buffer)) {
+        return 0;
+    }
+    if (w->length + length + 1 > sizeof(w->buffer) && dfs_list_writer_flush(w) < 0) {
+        return -1;
+    }
+    memcpy(w->buffer + w->length, name, length);
+    w->buffer[w->length + length] = '\n';
+    w->length += length + 1;
+    w->count++;
+    return 0;
+}
+
+//dfs_list_writer_flush: Sends the names gathered so far as one DATA frame.
+int dfs_list_writer_flush(struct dfs_list_writer* w) {
+    if (w->failed) {
+        return -1;
+    }
+    if (w->length == 0) {
+        return 0;
+    }
+    if (writer_send(w, 0, w->buffer, w->length) < 0) {
+        w->failed = 1;
+        return -1;
+    }
+    w->length = 0;
+    return 0;
+}
+
+//dfs_list_writer_end: Sends the remaining names and the END frame, carrying `cursor` if it is not empty.
+int dfs_list_writer_end(struct dfs_list_writer* w, const char* cursor) {
+    if (dfs_list_writer_flush(w) < 0) {
+        return -1;
+    }
+    if (cursor && *cursor) {
+        return writer_send(w, DFS_FLAG_END | DFS_FLAG_CURSOR, cursor, strlen(cursor));
+    }
+    return writer_send(w, DFS_FLAG_END, NULL, 0);
+}
+
+//dfs_list_stream: Sends one page of a directory listing as a complete stream.
+//returns the number of names sent or -1 on error.
+long long dfs_list_stream(int sock, uint32_t request_id, const char* path, const char* extension, const struct dfs_list_options* options) {
+    struct dfs_list_writer w;
+    char cursor[PATH_MAX];
+    dfs_list_writer_init(&w, sock, request_id);
+    dfs_list_directory(path, extension, options, dfs_list_writer_add, &w, cursor, sizeof(cursor));
+    if (dfs_list_writer_end(&w, cursor) < 0) {
+        return -1;
+    }
+    return w.count;
+}
@@ -0,0 +1,89 @@
+//dfs_list.h
+//this header declares the directory lister used by display. names are produced one at a time and sent in
+//bounded frames, and a page of a sorted listing is picked with a heap the size of the page, so listing
+//a directory costs the same memory whether it holds ten files or a hundred thousand.
+#ifndef DFS_LIST_H
+#define DFS_LIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dirent.h>
+
+//listing frames stay below DFS_MAX_CONTROL_PAYLOAD so relays can read each one whole
+#define DFS_LIST_FRAME_SIZE 4000
+//page size used for sorted listings when none is requested, and the largest page a server will build
+#define DFS_LIST_DEFAULT_PAGE 5000
+#define DFS_LIST_MAX_PAGE 10000
+
+//order in which names are listed
+enum dfs_list_order {
+    DFS_LIST_UNSORTED,     //directory order
+    DFS_LIST_ASCENDING,    //by name, a to z
+    DFS_LIST_DESCENDING    //by name, z to a
+};
+
+//display options, carried as the request's optional second argument "page=N,sort=none|asc|desc,after=CURSOR".
+//after= comes last and takes the rest of the string, so a cursor may contain any character.
+//in a sorted listing the cursor is the last name already listed; in directory order it is the number of
+//names already listed (Smain keeps one count per server, separated by ':').
+struct dfs_list_options {
+    enum dfs_list_order order;
+    long page_size;          //0 lists everything
+    char after[PATH_MAX];    //empty for the first page
+};
+
+//iterator over the regular files in a directory whose names end in `extension`.
+//directories covered by the metadata index (dfs_index.h) are listed from memory instead of with readdir().
+struct dfs_list_iter {
+    DIR *dir;
+    const char *extension;
+    char path[PATH_MAX];
+    bool indexed;
+    size_t position;
+    char name[NAME_MAX + 1];
+};
+
+//called for each listed name; returns 0 to continue and -1 to stop the listing
+typedef int (*dfs_list_emit)(void* ctx, const char* name);
+
+//packs names into DATA frames of at most DFS_LIST_FRAME_SIZE bytes, one name per line.
+//frames go to `sock`, or to `send_frame` when it is set (e.g. to queue them on a non-blocking connection).
+struct dfs_list_writer {
+    int sock;
+    uint32_t request_id;
+    int (*send_frame)(void* target, uint16_t flags, uint32_t request_id, const char* payload, uint32_t length);
+    void *target;
+    char buffer[DFS_LIST_FRAME_SIZE];
+    size_t length;
+    int failed;
+    long long count;
+};
+
+//options
+int dfs_list_parse_options(const char* text, struct dfs_list_options* options);
+void dfs_list_format_options(const struct dfs_list_options* options, const char* after, char* out, size_t size);
+const char* dfs_list_order_name(enum dfs_list_order order);
+int dfs_list_compare(enum dfs_list_order order, const char* a, const char* b);
+
+//reading a directory
+int dfs_list_open(struct dfs_list_iter* it, const char* path, const char* extension);
+const char* dfs_list_next(struct dfs_list_iter* it);
+void dfs_list_close(struct dfs_list_iter* it);
+
+//dfs_list_directory() lists one page of `path` as selected by `options`, calling `emit` for each name.
+//`cursor` receives the cursor of the next page, or an empty string when nothing is left.
+//returns the number of names listed; a missing directory lists nothing.
+long dfs_list_directory(const char* path, const char* extension, const struct dfs_list_options* options, dfs_list_emit emit, void* ctx, char* cursor, size_t cursor_size);
+
+//writing listing frames
+void dfs_list_writer_init(struct dfs_list_writer* w, int sock, uint32_t request_id);
+int dfs_list_writer_add(void* writer, const char* name);
+int dfs_list_writer_flush(struct dfs_list_writer* w);
+int dfs_list_writer_end(struct dfs_list_writer* w, const char* cursor);
+
+//dfs_list_stream() sends one page of a listing as a complete stream: DATA frames, then an END frame
+//that carries the next page's cursor (flagged DFS_FLAG_CURSOR) if more names are left.
+long long dfs_list_stream(int sock, uint32_t request_id, const char* path, const char* extension, const struct dfs_list_options* options);
+
+#endif
@@ -0,0 +1,452 @@
+//dfs_metrics.c
+//this file implements the request metrics and the HTTP endpoint declared in dfs_metrics.h.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/tcp.h>
+#include <linux/sockios.h>
+
+#include "dfs_frame.h"
+#include "dfs_metrics.h"
+
+//commands are counted by opcode; anything above DFS_OP_COMPRESS counts as opcode 0, "unknown"
+#define METRICS_COMMANDS (DFS_OP_COMPRESS + 1)
+//upper bounds of the latency buckets in microseconds, from 100 us to 30 s
+#define METRICS_BUCKETS 17
+static const unsigned long long bucket_bounds_us[METRICS_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 30000000
+};
+static const char *error_names[DFS_METRICS_ERROR_TYPES] = {"rejected", "client_lost", "backend"};
+
+//states of tcp_info.tcpi_state after the client sent its FIN or a reset
+#define METRICS_TCP_CLOSE 7
+#define METRICS_TCP_CLOSE_WAIT 8
+
+//longest HTTP request read from a scraper
+#define METRICS_REQUEST_MAX 4096
+
+//latency histogram; the buckets are not cumulative until they are printed
+struct metrics_histogram {
+    unsigned long long buckets[METRICS_BUCKETS + 1];
+    unsigned long long count;
+    unsigned long long sum_us;
+};
+
+//counters shared by every process of the server
+struct metrics_shared {
+    unsigned long long requests[METRICS_COMMANDS];
+    unsigned long long received_bytes[METRICS_COMMANDS];
+    unsigned long long sent_bytes[METRICS_COMMANDS];
+    unsigned long long errors[METRICS_COMMANDS][DFS_METRICS_ERROR_TYPES];
+    struct metrics_histogram latency[METRICS_COMMANDS];
+    long long active_connections;
+    unsigned long long connections;
+    struct metrics_histogram backend_connect[DFS_METRICS_MAX_BACKENDS];
+    unsigned long long backend_connect_failures[DFS_METRICS_MAX_BACKENDS];
+};
+
+static struct metrics_shared *shared = NULL;
+static const char *program_name = "";
+static const char *backend_names[DFS_METRICS_MAX_BACKENDS];
+static int backend_ports[DFS_METRICS_MAX_BACKENDS];
+static int backend_count = 0;
+static dfs_metrics_source sources[DFS_METRICS_MAX_SOURCES];
+static int source_count = 0;
+static int listen_fd = -1;
+//request the calling thread is serving, for dfs_metrics_fail(NULL, ...)
+static __thread struct dfs_metrics_request *current_request = NULL;
+
+//now_us: Returns a monotonic clock in microseconds.
+static unsigned long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//observe: Adds one duration to a histogram.
+static void observe(struct metrics_histogram* histogram, unsigned long long duration_us) {
+    int bucket = 0;
+    while (bucket < METRICS_BUCKETS && duration_us > bucket_bounds_us[bucket]) {
+        bucket++;
+    }
+    __atomic_add_fetch(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum_us, duration_us, __ATOMIC_RELAXED);
+}
+
+//socket_bytes: Reads how many bytes the application has read from and written to a TCP socket so far, from the
+//kernel's totals less what still waits in the queues. returns the connection state, or -1 if it is unknown.
+static int socket_bytes(int sock, unsigned long long* received, unsigned long long* sent) {
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    if (sock < 0 || getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &length) < 0) {
+        *received = *sent = 0;
+        return -1;
+    }
+    int unread = 0;
+    int unacked = 0;
+    ioctl(sock, SIOCINQ, &unread);
+    ioctl(sock, SIOCOUTQ, &unacked);
+    *received = info.tcpi_bytes_received - (unsigned long long)unread;
+    *sent = info.tcpi_bytes_acked + (unsigned long long)unacked;
+    return info.tcpi_state;
+}
+
+//dfs_metrics_add_backend: Names a storage server whose connects are timed.
+void dfs_metrics_add_backend(const char* name, int port) {
+    if (backend_count < DFS_METRICS_MAX_BACKENDS) {
+        backend_names[backend_count] = name;
+        backend_ports[backend_count] = port;
+        backend_count++;
+    }
+}
+
+//dfs_metrics_add_source: Adds a function that writes more counters into every scrape.
+void dfs_metrics_add_source(dfs_metrics_source source) {
+    if (source_count < DFS_METRICS_MAX_SOURCES) {
+        sources[source_count++] = source;
+    }
+}
+
+//dfs_metrics_begin: Takes the connection's byte counts before the next request is read.
+void dfs_metrics_begin(struct dfs_metrics_request* request, int sock) {
+    memset(request, 0, sizeof(*request));
+    request->failure = -1;
+    if (shared) {
+        socket_bytes(sock, &request->received_bytes, &request->sent_bytes);
+    }
+}
+
+//dfs_metrics_start: Starts the clock of a request whose frame has been read.
+void dfs_metrics_start(struct dfs_metrics_request* request, uint8_t opcode) {
+    request->active = 1;
+    request->opcode = opcode < METRICS_COMMANDS ? opcode : 0;
+    request->started_us = now_us();
+    request->status_errors = dfs_status_errors_sent();
+    current_request = request;
+}
+
+//dfs_metrics_fail: Marks a request as failed, keeping the first reason.
+void dfs_metrics_fail(struct dfs_metrics_request* request, enum dfs_metrics_error type) {
+    if (!request) {
+        request = current_request;
+    }
+    if (request && request->active && request->failure < 0) {
+        request->failure = type;
+    }
+}
+
+//dfs_metrics_end: Records a request. a client that reset the connection, or closed it while the request failed,
+//counts as lost rather than as the error the server answered with.
+void dfs_metrics_end(struct dfs_metrics_request* request, int sock) {
+    if (!request->active) {
+        return;
+    }
+    request->active = 0;
+    if (current_request == request) {
+        current_request = NULL;
+    }
+    if (!shared) {
+        return;
+    }
+    unsigned long long duration_us = now_us() - request->started_us;
+    unsigned long long received = 0;
+    unsigned long long sent = 0;
+    int state = socket_bytes(sock, &received, &sent);
+    int failure = request->failure;
+    if (failure < 0 && dfs_status_errors_sent() != request->status_errors) {
+        failure = DFS_METRICS_REJECTED;
+    }
+    if (failure != DFS_METRICS_BACKEND && (state == METRICS_TCP_CLOSE || (state == METRICS_TCP_CLOSE_WAIT && failure >= 0))) {
+        failure = DFS_METRICS_CLIENT_LOST;
+    }
+
+    int command = request->opcode;
+    __atomic_add_fetch(&shared->requests[command], 1, __ATOMIC_RELAXED);
+    if (received > request->received_bytes) {
+        __atomic_add_fetch(&shared->received_bytes[command], received - request->received_bytes, __ATOMIC_RELAXED);
+    }
+    if (sent > request->sent_bytes) {
+        __atomic_add_fetch(&shared->sent_bytes[command], sent - request->sent_bytes, __ATOMIC_RELAXED);
+    }
+    if (failure >= 0) {
+        __atomic_add_fetch(&shared->errors[command][failure], 1, __ATOMIC_RELAXED);
+    }
+    observe(&shared->latency[command], duration_us);
+}
+
+void dfs_metrics_connection_opened(void) {
+    if (shared) {
+        __atomic_add_fetch(&shared->active_connections, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shared->connections, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void dfs_metrics_connection_closed(void) {
+    if (shared) {
+        __atomic_sub_fetch(&shared->active_connections, 1, __ATOMIC_RELAXED);
+    }
+}
+
+//dfs_metrics_backend_connect: Records a connect to a storage server, failed or not.
+void dfs_metrics_backend_connect(int port, unsigned long long duration_us, int ok) {
+    if (!shared) {
+        return;
+    }
+    for (int i = 0; i < backend_count; i++) {
+        if (backend_ports[i] == port) {
+            if (ok) {
+                observe(&shared->backend_connect[i], duration_us);
+            } else {
+                __atomic_add_fetch(&shared->backend_connect_failures[i], 1, __ATOMIC_RELAXED);
+            }
+            return;
+        }
+    }
+}
+
+void dfs_metrics_describe(FILE* out, const char* name, const char* type, const char* help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void dfs_metrics_print(FILE* out, const char* name, const char* labels, double value) {
+    if (labels && *labels) {
+        fprintf(out, "%s{%s} %.15g\n", name, labels, value);
+    } else {
+        fprintf(out, "%s %.15g\n", name, value);
+    }
+}
+
+//print_histogram: Writes the samples of one histogram with the given labels.
+static void print_histogram(FILE* out, const char* name, const char* labels, const struct metrics_histogram* histogram) {
+    unsigned long long cumulative = 0;
+    for (int i = 0; i <= METRICS_BUCKETS; i++) {
+        cumulative += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (i < METRICS_BUCKETS) {
+            fprintf(out, "%s_bucket{%s,le=\"%g\"} %llu\n", name, labels, bucket_bounds_us[i] / 1e6, cumulative);
+        } else {
+            fprintf(out, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels, cumulative);
+        }
+    }
+    fprintf(out, "%s_sum{%s} %.6f\n", name, labels, __atomic_load_n(&histogram->sum_us, __ATOMIC_RELAXED) / 1e6);
+    fprintf(out, "%s_count{%s} %llu\n", name, labels, __atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+}
+
+//command_label: Writes the label of a command, its name with underscores for spaces.
+static void command_label(char* label, size_t capacity, int command) {
+    snprintf(label, capacity, "command=\"%s\"", dfs_opcode_name(command));
+    for (char *p = label; *p; p++) {
+        if (*p == ' ') {
+            *p = '_';
+        }
+    }
+}
+
+//write_metrics: Writes every counter in the text format; commands appear once they were requested.
+static void write_metrics(FILE* out) {
+    char labels[128];
+    dfs_metrics_describe(out, "dfs_server_info", "gauge", "Server program exposing these metrics.");
+    snprintf(labels, sizeof(labels), "program=\"%s\"", program_name);
+    dfs_metrics_print(out, "dfs_server_info", labels, 1);
+
+    dfs_metrics_describe(out, "dfs_requests_total", "counter", "Requests served, by command.");
+    for (int c = 0; c < METRICS_COMMANDS; c++) {
+        unsigned long long requests = __atomic_load_n(&shared->requests[c], __ATOMIC_RELAXED);
+        if (requests > 0) {
+            command_label(labels, sizeof(labels), c);
+            dfs_metrics_print(out, "dfs_requests_total", labels, requests);
+        }
+    }
+    dfs_metrics_describe(out, "dfs_received_bytes_total", "counter", "Bytes read from clients, frames included, by command.");
+    for (int c = 0; c < METRICS_COMMANDS; c++) {
+        if (__atomic_load_n(&shared->requests[c], __ATOMIC_RELAXED) > 0) {
+            command_label(labels, sizeof(labels), c);
+            dfs_metrics_print(out, "dfs_received_bytes_total", labels, __atomic_load_n(&shared->received_bytes[c], __ATOMIC_RELAXED));
+        }
+    }
+    dfs_metrics_describe(out, "dfs_sent_bytes_total", "counter", "Bytes written to clients, frames included, by command.");
+    for (int c = 0; c < METRICS_COMMANDS; c++) {
+        if (__atomic_load_n(&shared->requests[c], __ATOMIC_RELAXED) > 0) {
+            command_label(labels, sizeof(labels), c);
+            dfs_metrics_print(out, "dfs_sent_bytes_total", labels, __atomic_load_n(&shared->sent_bytes[c], __ATOMIC_RELAXED));
+        }
+    }
+    dfs_metrics_describe(out, "dfs_request_errors_total", "counter", "Failed requests, by command and type.");
+    for (int c = 0; c < METRICS_COMMANDS; c++) {
+        if (__atomic_load_n(&shared->requests[c], __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
+        for (int e = 0; e < DFS_METRICS_ERROR_TYPES; e++) {
+            command_label(labels, sizeof(labels), c);
+            size_t length = strlen(labels);
+            snprintf(labels + length, sizeof(labels) - length, ",type=\"%s\"", error_names[e]);
+            dfs_metrics_print(out, "dfs_request_errors_total", labels, __atomic_load_n(&shared->errors[c][e], __ATOMIC_RELAXED));
+        }
+    }
+    dfs_metrics_describe(out, "dfs_request_duration_seconds", "histogram", "Time from reading a request to writing the end of its reply.");
+    for (int c = 0; c < METRICS_COMMANDS; c++) {
+        if (__atomic_load_n(&shared->requests[c], __ATOMIC_RELAXED) > 0) {
+            command_label(labels, sizeof(labels), c);
+            print_histogram(out, "dfs_request_duration_seconds", labels, &shared->latency[c]);
+        }
+    }
+
+    dfs_metrics_describe(out, "dfs_connections_active", "gauge", "Client connections open.");
+    dfs_metrics_print(out, "dfs_connections_active", "", __atomic_load_n(&shared->active_connections, __ATOMIC_RELAXED));
+    dfs_metrics_describe(out, "dfs_connections_total", "counter", "Client connections accepted.");
+    dfs_metrics_print(out, "dfs_connections_total", "", __atomic_load_n(&shared->connections, __ATOMIC_RELAXED));
+
+    if (backend_count > 0) {
+        dfs_metrics_describe(out, "dfs_backend_connect_seconds", "histogram", "Time to open a connection to a storage server.");
+        for (int i = 0; i < backend_count; i++) {
+            snprintf(labels, sizeof(labels), "backend=\"%s\"", backend_names[i]);
+            print_histogram(out, "dfs_backend_connect_seconds", labels, &shared->backend_connect[i]);
+        }
+        dfs_metrics_describe(out, "dfs_backend_connect_failures_total", "counter", "Connections to a storage server that failed to open.");
+        for (int i = 0; i < backend_count; i++) {
+            snprintf(labels, sizeof(labels), "backend=\"%s\"", backend_names[i]);
+            dfs_metrics_print(out, "dfs_backend_connect_failures_total", labels, __atomic_load_n(&shared->backend_connect_failures[i], __ATOMIC_RELAXED));
+        }
+    }
+
+    for (int i = 0; i < source_count; i++) {
+        sources[i](out);
+    }
+}
+
+//serve_scrape: Answers one HTTP request on the endpoint.
+static void serve_scrape(int sock) {
+    char request[METRICS_REQUEST_MAX];
+    size_t length = 0;
+    //the request line and headers end with an empty line; nothing after them is read
+    while (length < sizeof(request) - 1) {
+        ssize_t n = recv(sock, request + length, sizeof(request) - 1 - length, 0);
+        if (n <= 0) {
+            return;
+        }
+        length += n;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+            break;
+        }
+    }
+
+    char *body = NULL;
+    size_t body_length = 0;
+    const char *status = "404 Not Found";
+    FILE *out = open_memstream(&body, &body_length);
+    if (!out) {
+        return;
+    }
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0) {
+        status = "200 OK";
+        write_metrics(out);
+    } else {
+        fprintf(out, "Not found; the metrics are at /metrics\n");
+    }
+    fclose(out);
+
+    char header[256];
+    int header_length = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, body_length);
+    if (send(sock, header, header_length, MSG_NOSIGNAL) == header_length) {
+        dfs_write_full(sock, body, body_length);
+    }
+    free(body);
+}
+
+//serve_endpoint: Thread that answers scrapes one at a time.
+static void* serve_endpoint(void* arg) {
+    (void)arg;
+    while (1) {
+        int sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("Metrics endpoint accept");
+                sleep(1);
+            }
+            continue;
+        }
+        //a scraper that stops reading must not hold up the next one
+        struct timeval timeout = {5, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve_scrape(sock);
+        close(sock);
+    }
+    return NULL;
+}
+
+//close_in_child: Keeps the endpoint's socket out of forked client processes.
+static void close_in_child(void) {
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+//dfs_metrics_start_server: Maps the shared counters and starts the endpoint if DFS_METRICS_PORT is set.
+int dfs_metrics_start_server(const char* program) {
+    program_name = program;
+    struct metrics_shared *counters = mmap(NULL, sizeof(*counters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (counters == MAP_FAILED) {
+        perror("Failed to map the metrics");
+        return -1;
+    }
+    shared = counters;
+
+    const char *port_text = getenv("DFS_METRICS_PORT");
+    if (!port_text || *port_text == '\0') {
+        return 0;
+    }
+    int port = atoi(port_text);
+    if (port < 1 || port > 65535) {
+        fprintf(stderr, "Ignoring invalid DFS_METRICS_PORT=%s\n", port_text);
+        return -1;
+    }
+
+    //the endpoint only listens on the loopback interface
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Failed to create the metrics socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 16) < 0) {
+        perror("Failed to open the metrics endpoint");
+        close(fd);
+        return -1;
+    }
+    listen_fd = fd;
+    pthread_atfork(NULL, NULL, close_in_child);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve_endpoint, NULL) != 0) {
+        perror("Failed to start the metrics endpoint");
+        close_in_child();
+        return -1;
+    }
+    pthread_detach(thread);
+    printf("Metrics are served at http://127.0.0.1:%d/metrics\n", port);
+    return 0;
+}
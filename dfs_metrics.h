@@ -0,0 +1,65 @@
+//dfs_metrics.h
+//this header declares the request metrics of Smain, Spdf and Stext and the HTTP endpoint that exposes them in the
+//Prometheus text format. every server counts its requests per command, the bytes they moved in and out, their
+//latency, their errors by type and its open connections; Smain also times its connects to Spdf and Stext.
+//the counters live in shared memory, so the processes Smain forks for its clients add to the same totals.
+//with DFS_METRICS_PORT set, GET /metrics on that port of 127.0.0.1 returns them together with the counters of
+//the other modules that the program adds through a source function.
+#ifndef DFS_METRICS_H
+#define DFS_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+//most storage servers whose connects are timed
+#define DFS_METRICS_MAX_BACKENDS 4
+//most source functions a program can add
+#define DFS_METRICS_MAX_SOURCES 4
+
+//ways a request can fail
+enum dfs_metrics_error {
+    DFS_METRICS_REJECTED,      //answered with an error status
+    DFS_METRICS_CLIENT_LOST,   //the client hung up before the request was served
+    DFS_METRICS_BACKEND,       //Spdf or Stext could not be reached
+    DFS_METRICS_ERROR_TYPES
+};
+
+//one request being measured. dfs_metrics_begin() takes the connection's byte counts before the request is read,
+//dfs_metrics_start() starts the clock once its frame is in and dfs_metrics_end() records it once the reply is
+//written. a request also fails if it sent an error status with dfs_send_status().
+struct dfs_metrics_request {
+    int active;
+    uint8_t opcode;
+    int failure;                       //a dfs_metrics_error, or -1
+    unsigned long long started_us;
+    unsigned long long received_bytes; //bytes the connection had read and written when the request began
+    unsigned long long sent_bytes;
+    unsigned long status_errors;       //dfs_status_errors_sent() when the request began
+};
+
+//a source writes the counters of other modules into a scrape with dfs_metrics_describe() and dfs_metrics_print()
+typedef void (*dfs_metrics_source)(FILE* out);
+
+//dfs_metrics_start_server() maps the counters and, with DFS_METRICS_PORT set, starts the endpoint on a thread.
+//call it before forking and add the backends and sources first. returns 0, or -1 if the endpoint failed to start.
+void dfs_metrics_add_backend(const char* name, int port);
+void dfs_metrics_add_source(dfs_metrics_source source);
+int dfs_metrics_start_server(const char* program);
+
+//requests. dfs_metrics_fail() marks a request as failed; with `request` NULL it marks the request the calling
+//thread started last, for code that has no handle on it. the first failure of a request is the one counted.
+void dfs_metrics_begin(struct dfs_metrics_request* request, int sock);
+void dfs_metrics_start(struct dfs_metrics_request* request, uint8_t opcode);
+void dfs_metrics_fail(struct dfs_metrics_request* request, enum dfs_metrics_error type);
+void dfs_metrics_end(struct dfs_metrics_request* request, int sock);
+
+//client connections and storage server connects
+void dfs_metrics_connection_opened(void);
+void dfs_metrics_connection_closed(void);
+void dfs_metrics_backend_connect(int port, unsigned long long duration_us, int ok);
+
+//helpers for sources: a metric's HELP and TYPE lines, then one sample per label set ("" for none)
+void dfs_metrics_describe(FILE* out, const char* name, const char* type, const char* help);
+void dfs_metrics_print(FILE* out, const char* name, const char* labels, double value);
+
+#endif
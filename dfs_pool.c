@@ -0,0 +1,233 @@
+//dfs_pool.c
+//this file implements the worker thread pool declared in dfs_pool.h: a fixed set of threads
+//consuming ready sockets from a bounded ring buffer, an epoll loop that accepts connections and parks
+//idle ones between requests, plus queue-depth and service-time metrics.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "dfs_pool.h"
+#include "dfs_config.h"
+#include "dfs_metrics.h"
+
+//a queued connection and the time its request became ready
+struct pool_job {
+    int client_socket;
+    unsigned long long queued_at_us;
+};
+
+struct dfs_pool {
+    dfs_pool_handler handler;
+    int epoll_fd;  //idle connections wait here for their next request; -1 until dfs_pool_serve() runs
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct pool_job *queue;
+    int head;
+    int count;
+    struct dfs_pool_stats stats;
+};
+
+//now_us: Returns a monotonic timestamp in microseconds.
+static unsigned long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//pool_worker: Takes connections off the queue and serves one request from each.
+static void* pool_worker(void* arg) {
+    struct dfs_pool *pool = arg;
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->count == 0) {
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        }
+        struct pool_job job = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->stats.queue_capacity;
+        pool->count--;
+        pool->stats.queue_depth = pool->count;
+        pool->stats.busy_workers++;
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->lock);
+
+        unsigned long long started_us = now_us();
+        int served = pool->handler(job.client_socket) == 0;
+        unsigned long long service_us = now_us() - started_us;
+
+        //park the connection until its next request, or close it
+        int keep_open = 0;
+        if (served) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+            ev.data.fd = job.client_socket;
+            keep_open = epoll_ctl(pool->epoll_fd, EPOLL_CTL_MOD, job.client_socket, &ev) == 0;
+        }
+        if (!keep_open) {
+            close(job.client_socket);
+            dfs_metrics_connection_closed();
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->stats.busy_workers--;
+        if (!keep_open) {
+            pool->stats.open_connections--;
+        }
+        if (!served) {
+            //the peer closed an idle connection; there is no request to account for
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+        pool->stats.completed++;
+        pool->stats.total_wait_us += started_us - job.queued_at_us;
+        pool->stats.total_service_us += service_us;
+        if (service_us > pool->stats.max_service_us) {
+            pool->stats.max_service_us = service_us;
+        }
+        struct dfs_pool_stats stats = pool->stats;
+        pthread_mutex_unlock(&pool->lock);
+
+        printf("Served request in %.3f ms (queue depth %u, max %u, busy workers %u/%u, open connections %u, avg service %.3f ms)\n",
+               service_us / 1000.0, stats.queue_depth, stats.max_queue_depth, stats.busy_workers, stats.workers,
+               stats.open_connections, stats.total_service_us / 1000.0 / stats.completed);
+    }
+    return NULL;
+}
+
+//dfs_pool_create: Allocates the queue and starts `workers` threads.
+//returns NULL if the pool could not be created.
+struct dfs_pool* dfs_pool_create(int workers, int queue_capacity, dfs_pool_handler handler) {
+    if (workers < 1 || queue_capacity < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct dfs_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool || !(pool->queue = calloc(queue_capacity, sizeof(struct pool_job)))) {
+        free(pool);
+        return NULL;
+    }
+    pool->handler = handler;
+    pool->epoll_fd = -1;
+    pool->stats.queue_capacity = queue_capacity;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        int err = pthread_create(&thread, NULL, pool_worker, pool);
+        if (err != 0) {
+            fprintf(stderr, "Failed to start worker thread: %s\n", strerror(err));
+            if (pool->stats.workers == 0) {
+                free(pool->queue);
+                free(pool);
+                return NULL;
+            }
+            break;
+        }
+        pthread_detach(thread);
+        pool->stats.workers++;
+    }
+    return pool;
+}
+
+//pool_submit: Queues a connection with a pending request for the workers.
+//when the queue is full the caller waits, leaving further connections in the listen backlog.
+static int pool_submit(struct dfs_pool* pool, int client_socket) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == (int)pool->stats.queue_capacity) {
+        pthread_cond_wait(&pool->not_full, &pool->lock);
+    }
+    int tail = (pool->head + pool->count) % pool->stats.queue_capacity;
+    pool->queue[tail].client_socket = client_socket;
+    pool->queue[tail].queued_at_us = now_us();
+    pool->count++;
+    pool->stats.queue_depth = pool->count;
+    if (pool->stats.queue_depth > pool->stats.max_queue_depth) {
+        pool->stats.max_queue_depth = pool->stats.queue_depth;
+    }
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+//dfs_pool_serve: Accepts connections and queues every connection whose next request has arrived.
+//each connection is registered one-shot, so it is queued once per request and re-armed by the worker.
+void dfs_pool_serve(struct dfs_pool* pool, int server_fd) {
+    pool->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (pool->epoll_fd < 0) {
+        perror("epoll_create1");
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = server_fd;
+    if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return;
+    }
+
+    struct epoll_event events[64];
+    while (1) {
+        int n = epoll_wait(pool->epoll_fd, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd != server_fd) {
+                //an idle connection has a request (or was closed by the peer)
+                pool_submit(pool, events[i].data.fd);
+                continue;
+            }
+            int client_socket = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client_socket < 0) {
+                perror("accept");
+                continue;
+            }
+            dfs_config_tune_socket(client_socket);
+            ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+            ev.data.fd = client_socket;
+            if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) < 0) {
+                perror("epoll_ctl");
+                close(client_socket);
+                continue;
+            }
+            pthread_mutex_lock(&pool->lock);
+            pool->stats.open_connections++;
+            pthread_mutex_unlock(&pool->lock);
+            dfs_metrics_connection_opened();
+        }
+    }
+}
+
+//dfs_pool_get_stats: Copies the pool's current metrics.
+void dfs_pool_get_stats(struct dfs_pool* pool, struct dfs_pool_stats* out) {
+    pthread_mutex_lock(&pool->lock);
+    *out = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+//env_positive: Returns the positive integer value of an environment variable, or `fallback`.
+static int env_positive(const char* name, int fallback) {
+    const char *value = getenv(name);
+    int parsed = value ? atoi(value) : 0;
+    return parsed > 0 ? parsed : fallback;
+}
+
+//dfs_pool_config_from_env: Reads DFS_POOL_WORKERS and DFS_POOL_QUEUE.
+void dfs_pool_config_from_env(int* workers, int* queue_capacity) {
+    *workers = env_positive("DFS_POOL_WORKERS", DFS_POOL_DEFAULT_WORKERS);
+    *queue_capacity = env_positive("DFS_POOL_QUEUE", DFS_POOL_DEFAULT_QUEUE);
+}
@@ -0,0 +1,43 @@
+//dfs_pool.h
+//this header declares the worker thread pool used by Spdf and Stext. the accept loop hands each connection
+//to a bounded queue and a fixed number of worker threads serve them, so a slow upload no longer blocks
+//every other request routed from Smain. connections are kept open between requests: an idle connection
+//waits in epoll rather than on a worker, and is queued again when its next request arrives.
+#ifndef DFS_POOL_H
+#define DFS_POOL_H
+
+//defaults used when DFS_POOL_WORKERS / DFS_POOL_QUEUE are not set
+#define DFS_POOL_DEFAULT_WORKERS 8
+#define DFS_POOL_DEFAULT_QUEUE 64
+
+//called on a worker thread to serve one request from a queued connection.
+//returns 0 after serving a request, keeping the connection open for the next one,
+//and -1 if no request could be read, in which case the pool closes the connection.
+typedef int (*dfs_pool_handler)(int client_socket);
+
+//snapshot of the pool's metrics
+struct dfs_pool_stats {
+    unsigned int workers;
+    unsigned int queue_capacity;
+    unsigned int open_connections;   //connections accepted and not yet closed
+    unsigned int queue_depth;        //connections waiting for a worker right now
+    unsigned int max_queue_depth;    //high-water mark of queue_depth
+    unsigned int busy_workers;
+    unsigned long long completed;         //requests served
+    unsigned long long total_wait_us;     //time spent queued, summed over completed requests
+    unsigned long long total_service_us;  //time spent in the handler, summed over completed requests
+    unsigned long long max_service_us;
+};
+
+struct dfs_pool;
+
+//dfs_pool_create() starts the workers; dfs_pool_serve() runs the accept loop and only returns on error.
+//the accept loop waits while the queue is full, leaving new connections in the listen backlog.
+struct dfs_pool* dfs_pool_create(int workers, int queue_capacity, dfs_pool_handler handler);
+void dfs_pool_serve(struct dfs_pool* pool, int server_fd);
+void dfs_pool_get_stats(struct dfs_pool* pool, struct dfs_pool_stats* out);
+
+//reads the worker count and queue capacity from the environment, falling back to the defaults
+void dfs_pool_config_from_env(int* workers, int* queue_capacity);
+
+#endif
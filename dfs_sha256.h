@@ -0,0 +1,31 @@
+//dfs_sha256.h
+//this header declares the SHA-256 implementation used to address stored chunks by their contents and to
+//compare files between the client and the servers without sending them.
+#ifndef DFS_SHA256_H
+#define DFS_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DFS_SHA256_SIZE 32
+//length of a digest written as lowercase hex, without the terminating NUL
+#define DFS_SHA256_HEX_SIZE 64
+
+//running state of one digest
+struct dfs_sha256 {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+};
+
+void dfs_sha256_init(struct dfs_sha256* ctx);
+void dfs_sha256_update(struct dfs_sha256* ctx, const void* data, size_t length);
+void dfs_sha256_final(struct dfs_sha256* ctx, unsigned char digest[DFS_SHA256_SIZE]);
+
+//dfs_sha256_hex() writes a digest as DFS_SHA256_HEX_SIZE hex digits plus a NUL
+void dfs_sha256_hex(const unsigned char digest[DFS_SHA256_SIZE], char* out);
+//dfs_sha256_parse() reads a digest written by dfs_sha256_hex(); returns -1 if `hex` is not one
+int dfs_sha256_parse(const char* hex, unsigned char digest[DFS_SHA256_SIZE]);
+
+#endif
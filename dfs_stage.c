@@ -0,0 +1,408 @@
+//dfs_stage.c
+//this file implements the staging area for resumable uploads declared in dfs_stage.h.
+//the checkpoint is only written after the data it covers has been flushed with fdatasync(), so after a crash
+//the staging file always holds at least as many bytes as the checkpoint claims.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dfs_frame.h"
+#include "dfs_stage.h"
+
+#define STAGE_LOCK_POLL_MS 50
+
+//make_parent_directories: Creates every missing directory above a file path.
+static int make_parent_directories(const char* path) {
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s", path);
+    for (char *p = strchr(temp + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(temp, 0755) < 0 && errno != EEXIST) {
+            return -1;
+        }
+        *p = '/';
+    }
+    return 0;
+}
+
+//dfs_stage_init: Works out the staging and checkpoint paths of an upload target.
+int dfs_stage_init(struct dfs_stage* s, const char* root, const char* target) {
+    size_t root_length = strlen(root);
+    const char *relative = target + root_length;
+    if (strncmp(target, root, root_length) != 0 || relative[0] != '/' || strstr(relative, "/../") ||
+        (strlen(relative) >= 3 && strcmp(relative + strlen(relative) - 3, "/..") == 0)) {
+        return -1;
+    }
+    if (snprintf(s->target, sizeof(s->target), "%s", target) >= (int)sizeof(s->target) ||
+        snprintf(s->path, sizeof(s->path), "%s.staging%s", root, relative) >= (int)sizeof(s->path) ||
+        snprintf(s->checkpoint, sizeof(s->checkpoint), "%s.offset", s->path) >= (int)sizeof(s->checkpoint)) {
+        return -1;
+    }
+    s->fd = -1;
+    s->offset = 0;
+    s->committed = 0;
+    s->part = 0;
+    return 0;
+}
+
+//dfs_stage_query: Returns the checkpointed offset, or 0 if the checkpoint is missing or not backed by data.
+uint64_t dfs_stage_query(const struct dfs_stage* s) {
+    FILE *in = fopen(s->checkpoint, "re");
+    if (!in) {
+        return 0;
+    }
+    unsigned long long offset = 0;
+    if (fscanf(in, "%llu", &offset) != 1) {
+        offset = 0;
+    }
+    fclose(in);
+
+    struct stat st;
+    if (stat(s->path, &st) < 0 || (unsigned long long)st.st_size < offset) {
+        return 0;
+    }
+    return offset;
+}
+
+//save_checkpoint: Flushes the staged data and then records `offset` as safely staged.
+static int save_checkpoint(struct dfs_stage* s, uint64_t offset) {
+    if (fdatasync(s->fd) < 0) {
+        return -1;
+    }
+    char temp[PATH_MAX + 8];
+    snprintf(temp, sizeof(temp), "%s.tmp", s->checkpoint);
+    FILE *out = fopen(temp, "we");
+    if (!out) {
+        return -1;
+    }
+    fprintf(out, "%llu\n", (unsigned long long)offset);
+    if (fclose(out) != 0 || rename(temp, s->checkpoint) < 0) {
+        unlink(temp);
+        return -1;
+    }
+    s->committed = offset;
+    return 0;
+}
+
+//dfs_stage_open: Opens the staging file to continue an upload at `offset`.
+int dfs_stage_open(struct dfs_stage* s, uint64_t offset, int wait_ms) {
+    if (make_parent_directories(s->path) < 0) {
+        return -1;
+    }
+    s->fd = open(s->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (s->fd < 0) {
+        return -1;
+    }
+    //the lock belongs to this open file and goes away with it, even if the process dies
+    int waited_ms = 0;
+    while (flock(s->fd, LOCK_EX | LOCK_NB) < 0 && errno == EWOULDBLOCK && waited_ms < wait_ms) {
+        usleep(STAGE_LOCK_POLL_MS * 1000);
+        waited_ms += STAGE_LOCK_POLL_MS;
+    }
+    if (flock(s->fd, LOCK_EX | LOCK_NB) < 0) {
+        close(s->fd);
+        s->fd = -1;
+        errno = EBUSY;
+        return -1;
+    }
+
+    uint64_t staged = dfs_stage_query(s);
+    if (offset > staged) {
+        close(s->fd);
+        s->fd = -1;
+        errno = ERANGE;
+        return -1;
+    }
+    //a restart from an earlier offset moves the checkpoint back before the data is cut off
+    s->committed = staged;
+    if ((offset < staged && save_checkpoint(s, offset) < 0) || ftruncate(s->fd, offset) < 0 || lseek(s->fd, offset, SEEK_SET) < 0) {
+        int saved_errno = errno;
+        close(s->fd);
+        s->fd = -1;
+        errno = saved_errno;
+        return -1;
+    }
+    s->offset = offset;
+    s->committed = offset;
+    return 0;
+}
+
+//dfs_stage_advance: Accounts for bytes written and checkpoints each full chunk.
+int dfs_stage_advance(struct dfs_stage* s, uint64_t length) {
+    s->offset += length;
+    if (s->offset - s->committed >= DFS_STAGE_CHUNK_SIZE) {
+        return save_checkpoint(s, s->offset);
+    }
+    return 0;
+}
+
+//dfs_stage_receive: Receives a stream of DATA frames into the staging file. see dfs_stage.h.
+//writes are cut at chunk boundaries so each checkpoint falls on one.
+long long dfs_stage_receive(int sock, struct dfs_stage* s, char* error_message, size_t error_capacity) {
+    size_t chunk_size = dfs_data_chunk_size();
+    char *buffer = malloc(chunk_size);
+    if (!buffer) {
+        return -1;
+    }
+    long long total_bytes = 0;
+    int write_failed = 0;
+    struct dfs_frame frame;
+
+    while (1) {
+        if (dfs_recv_header(sock, &frame) < 0) {
+            free(buffer);
+            if (error_message) {
+                snprintf(error_message, error_capacity, "Connection lost during transfer");
+            }
+            return -1;
+        }
+        if (frame.opcode == DFS_OP_STATUS) {
+            //the sender aborted the stream
+            char message[DFS_MAX_CONTROL_PAYLOAD] = {0};
+            uint32_t keep = frame.length < sizeof(message) - 1 ? frame.length : sizeof(message) - 1;
+            free(buffer);
+            if (dfs_read_full(sock, message, keep) < 0 || dfs_skip_payload(sock, frame.length - keep) < 0) {
+                return -1;
+            }
+            if (error_message) {
+                snprintf(error_message, error_capacity, "%s", message);
+            }
+            return -1;
+        }
+        if (frame.opcode != DFS_OP_DATA) {
+            fprintf(stderr, "Unexpected %s frame inside data stream\n", dfs_opcode_name(frame.opcode));
+            free(buffer);
+            return -1;
+        }
+        if (frame.flags & DFS_FLAG_COMPRESSED) {
+            //staged uploads are resumed by byte offset, so their frames must be plain data
+            fprintf(stderr, "Compressed data is not supported in resumable uploads\n");
+            free(buffer);
+            if (error_message) {
+                snprintf(error_message, error_capacity, "Compressed data is not supported in resumable uploads");
+            }
+            return -1;
+        }
+
+        uint32_t remaining = frame.length;
+        while (remaining > 0) {
+            uint64_t chunk_left = DFS_STAGE_CHUNK_SIZE - (s->offset - s->committed);
+            size_t chunk = remaining < chunk_size ? remaining : chunk_size;
+            if (chunk > chunk_left) {
+                chunk = chunk_left;
+            }
+            if (dfs_read_full(sock, buffer, chunk) < 0) {
+                free(buffer);
+                if (error_message) {
+                    snprintf(error_message, error_capacity, "Connection lost during transfer");
+                }
+                return -1;
+            }
+            if (!write_failed && (dfs_write_full(s->fd, buffer, chunk) < 0 || dfs_stage_advance(s, chunk) < 0)) {
+                perror("Failed to write staged file");
+                write_failed = 1;
+            }
+            remaining -= chunk;
+            total_bytes += chunk;
+        }
+        if (frame.flags & DFS_FLAG_END) {
+            break;
+        }
+    }
+    free(buffer);
+    if (write_failed) {
+        if (error_message) {
+            snprintf(error_message, error_capacity, "Failed to write file");
+        }
+        return -1;
+    }
+    return total_bytes;
+}
+
+//dfs_stage_commit: Moves the staging file over the target once the upload is complete.
+int dfs_stage_commit(struct dfs_stage* s) {
+    if (fsync(s->fd) < 0 || rename(s->path, s->target) < 0) {
+        int saved_errno = errno;
+        dfs_stage_close(s);
+        errno = saved_errno;
+        return -1;
+    }
+    unlink(s->checkpoint);
+    close(s->fd);
+    s->fd = -1;
+    return 0;
+}
+
+//dfs_stage_close: Closes the staging file, checkpointing what was written since the last chunk,
+//so a dropped connection does not cost the partial chunk; the staged data stays for a resume.
+void dfs_stage_close(struct dfs_stage* s) {
+    if (s->fd >= 0) {
+        if (!s->part && s->offset > s->committed && save_checkpoint(s, s->offset) < 0) {
+            perror("Failed to save upload checkpoint");
+        }
+        close(s->fd);
+        s->fd = -1;
+    }
+}
+
+//use_parts: Points the stage at the assembly file and parts log of a parallel upload.
+static int use_parts(struct dfs_stage* s, const char* token) {
+    size_t length = strlen(token);
+    if (length == 0 || length > 32 || strspn(token, "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ") != length) {
+        errno = EINVAL;
+        return -1;
+    }
+    char staging[PATH_MAX];
+    snprintf(staging, sizeof(staging), "%s", s->path);
+    if (snprintf(s->path, sizeof(s->path), "%s.%s.upload", staging, token) >= (int)sizeof(s->path) ||
+        snprintf(s->checkpoint, sizeof(s->checkpoint), "%s.%s.parts", staging, token) >= (int)sizeof(s->checkpoint)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    s->part = 1;
+    return 0;
+}
+
+//dfs_stage_open_part: Opens the assembly file of a parallel upload to write one part.
+int dfs_stage_open_part(struct dfs_stage* s, const char* token, uint64_t offset) {
+    if (use_parts(s, token) < 0 || make_parent_directories(s->path) < 0) {
+        return -1;
+    }
+    s->fd = open(s->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (s->fd < 0) {
+        return -1;
+    }
+    s->offset = offset;
+    s->committed = offset;
+    return 0;
+}
+
+//dfs_stage_receive_part: Receives one part of a parallel upload at its offset.
+long long dfs_stage_receive_part(int sock, struct dfs_stage* s, char* error_message, size_t error_capacity) {
+    off_t position = s->offset;
+    long long total_bytes = dfs_recv_stream_at(sock, s->fd, &position, NULL, error_message, error_capacity);
+    s->offset = position;
+    return total_bytes;
+}
+
+//dfs_stage_finish_part: Flushes a received part and appends its range to the parts log.
+//the log is opened for appending, so parts finishing at the same time in other threads or processes never mix.
+int dfs_stage_finish_part(struct dfs_stage* s) {
+    int saved_errno = 0;
+    if (fdatasync(s->fd) < 0) {
+        saved_errno = errno;
+    } else {
+        char line[64];
+        int length = snprintf(line, sizeof(line), "%llu %llu\n", (unsigned long long)s->committed, (unsigned long long)(s->offset - s->committed));
+        int log_fd = open(s->checkpoint, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (log_fd < 0 || dfs_write_full(log_fd, line, length) < 0 || fdatasync(log_fd) < 0) {
+            saved_errno = errno;
+        }
+        if (log_fd >= 0) {
+            close(log_fd);
+        }
+    }
+    close(s->fd);
+    s->fd = -1;
+    errno = saved_errno;
+    return saved_errno ? -1 : 0;
+}
+
+//compare_parts: Orders logged parts by offset.
+static int compare_parts(const void* a, const void* b) {
+    const unsigned long long *x = a;
+    const unsigned long long *y = b;
+    return x[0] < y[0] ? -1 : x[0] > y[0];
+}
+
+//parts_cover: Returns 1 if the ranges in the parts log leave no gap in [0, size), 0 if they do and -1 on error.
+static int parts_cover(const char* log_path, uint64_t size) {
+    FILE *in = fopen(log_path, "re");
+    if (!in) {
+        return errno == ENOENT ? size == 0 : -1;
+    }
+    unsigned long long (*parts)[2] = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    unsigned long long offset, length;
+    while (fscanf(in, "%llu %llu", &offset, &length) == 2) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            void *grown = realloc(parts, capacity * sizeof(*parts));
+            if (!grown) {
+                free(parts);
+                fclose(in);
+                return -1;
+            }
+            parts = grown;
+        }
+        parts[count][0] = offset;
+        parts[count][1] = offset + length;
+        count++;
+    }
+    fclose(in);
+
+    qsort(parts, count, sizeof(*parts), compare_parts);
+    unsigned long long covered = 0;
+    for (size_t i = 0; i < count && parts[i][0] <= covered; i++) {
+        if (parts[i][1] > covered) {
+            covered = parts[i][1];
+        }
+    }
+    free(parts);
+    return covered >= size;
+}
+
+//dfs_stage_commit_parts: Moves a fully assembled parallel upload over the target.
+int dfs_stage_commit_parts(struct dfs_stage* s, const char* token, uint64_t size) {
+    if (use_parts(s, token) < 0) {
+        return -1;
+    }
+    int covered = parts_cover(s->checkpoint, size);
+    if (covered <= 0) {
+        if (covered == 0) {
+            errno = EAGAIN;
+        }
+        return -1;
+    }
+
+    //an empty file has no parts, so its assembly file may not exist yet
+    if (make_parent_directories(s->path) < 0) {
+        return -1;
+    }
+    s->fd = open(s->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (s->fd < 0 || fstat(s->fd, &st) < 0) {
+        int saved_errno = errno;
+        if (s->fd >= 0) {
+            close(s->fd);
+            s->fd = -1;
+        }
+        errno = saved_errno;
+        return -1;
+    }
+    if ((uint64_t)st.st_size > size) {
+        close(s->fd);
+        s->fd = -1;
+        errno = EINVAL;
+        return -1;
+    }
+    if (fsync(s->fd) < 0 || rename(s->path, s->target) < 0) {
+        int saved_errno = errno;
+        close(s->fd);
+        s->fd = -1;
+        errno = saved_errno;
+        return -1;
+    }
+    unlink(s->checkpoint);
+    close(s->fd);
+    s->fd = -1;
+    return 0;
+}
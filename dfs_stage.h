@@ -0,0 +1,72 @@
+//dfs_stage.h
+//this header declares the staging area used by resumable uploads. a resumable upload is written to a staging
+//file next to the storage directory (root + ".staging", mirroring the tree below root), and every
+//DFS_STAGE_CHUNK_SIZE bytes the data is flushed to disk and the offset saved in a checkpoint file. a client whose
+//connection dropped asks for that offset and sends only the rest; once the stream ends the staging file is renamed
+//over the target, so readers see either the old file or the complete new one.
+//a parallel upload sends the parts of one file over several connections instead. every part is written with
+//pwrite() into an assembly file named after the upload's token, and once flushed its range is appended to a
+//parts log; the commit renames the assembly file over the target only if the logged parts cover the whole file.
+#ifndef DFS_STAGE_H
+#define DFS_STAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+//bytes written between two checkpoints
+#define DFS_STAGE_CHUNK_SIZE (4 * 1024 * 1024)
+//how long a blocking server waits for an interrupted upload of the same file to notice it is over
+#define DFS_STAGE_LOCK_WAIT_MS 3000
+
+//one staged upload
+struct dfs_stage {
+    char target[PATH_MAX];        //where the file goes once complete
+    char path[PATH_MAX];          //staging file
+    char checkpoint[PATH_MAX];    //holds the staged offset
+    int fd;
+    uint64_t offset;              //bytes in the staging file
+    uint64_t committed;           //bytes covered by the last checkpoint; where a part starts
+    int part;                     //the stage receives one part of a parallel upload
+};
+
+//dfs_stage_init() locates the staging files of `target`, which must lie below `root`. returns 0 or -1.
+int dfs_stage_init(struct dfs_stage* s, const char* root, const char* target);
+
+//dfs_stage_query() returns how many bytes of the target are safely staged; 0 if none.
+uint64_t dfs_stage_query(const struct dfs_stage* s);
+
+//dfs_stage_open() opens the staging file to continue at `offset`, discarding anything staged after it.
+//an upload of the same target that is still running (e.g. one whose client just vanished) is waited for up to
+//`wait_ms` milliseconds; after that it fails with EBUSY. fails with ERANGE if `offset` is past the staged data.
+int dfs_stage_open(struct dfs_stage* s, uint64_t offset, int wait_ms);
+
+//dfs_stage_advance() accounts for `length` bytes just written to s->fd and saves a checkpoint once a chunk is full
+int dfs_stage_advance(struct dfs_stage* s, uint64_t length);
+
+//dfs_stage_receive() writes a stream of DATA frames to the staging file, checkpointing every chunk.
+//it has the same contract as dfs_recv_stream_to_fd(); staged data survives a failure.
+long long dfs_stage_receive(int sock, struct dfs_stage* s, char* error_message, size_t error_capacity);
+
+//dfs_stage_commit() moves the complete staging file over the target and forgets the checkpoint
+int dfs_stage_commit(struct dfs_stage* s);
+
+//dfs_stage_open_part() opens the assembly file of the parallel upload `token` to write a part from `offset` on.
+//tokens are 1 to 32 letters and digits chosen by the client. fails with EINVAL for a malformed token.
+int dfs_stage_open_part(struct dfs_stage* s, const char* token, uint64_t offset);
+
+//dfs_stage_receive_part() writes a stream of DATA frames with pwrite() from the part's offset on
+long long dfs_stage_receive_part(int sock, struct dfs_stage* s, char* error_message, size_t error_capacity);
+
+//dfs_stage_finish_part() flushes the part received and logs its range, then closes it
+int dfs_stage_finish_part(struct dfs_stage* s);
+
+//dfs_stage_commit_parts() moves the assembly file of `token` over the target once its logged parts cover
+//`size` bytes. fails with EAGAIN if parts are missing and EINVAL if the file is larger than `size`.
+int dfs_stage_commit_parts(struct dfs_stage* s, const char* token, uint64_t size);
+
+//dfs_stage_close() stops writing, checkpoints everything written so far and keeps it for a later resume.
+//an unfinished part is not logged, so it has to be sent again.
+void dfs_stage_close(struct dfs_stage* s);
+
+#endif
@@ -0,0 +1,1379 @@
+//dfs_tar.c
+//this file implements the streaming tar writer declared in dfs_tar.h.
+//headers, padding and small files are gathered in one buffer and flushed as a single write or frame,
+//while large file bodies go from the page cache to the output with sendfile().
+//names that do not fit the ustar fields, and sizes of 8 GiB or more, are carried in pax extended headers.
+//reader threads stat, open and read the entries ahead of the thread writing the archive, which emits them
+//in the order of the walk. a compressed archive is cut into blocks that worker threads deflate into gzip
+//members while the tree is walked further; the walking thread writes the members in order, so the output
+//does not depend on how many threads read or compressed it.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dfs_frame.h"
+#include "dfs_xfer.h"
+#include "dfs_tar.h"
+#include "dfs_chunk.h"
+#include "dfs_sha256.h"
+
+//largest size an 11 digit octal field can hold
+#define USTAR_MAX_SIZE 077777777777LL
+
+//room for a compressed block: deflate's bound plus the gzip header and trailer
+#define GZIP_MEMBER_CAPACITY (DFS_TAR_GZIP_BLOCK_SIZE + DFS_TAR_GZIP_BLOCK_SIZE / 1000 + 1024)
+
+//compression settings, from dfs_tar_configure()
+static int tar_threads = DFS_TAR_DEFAULT_THREADS;
+static int tar_level = DFS_TAR_DEFAULT_LEVEL;
+static int tar_readers = DFS_TAR_DEFAULT_READERS;
+
+//states of a compression job
+enum job_state {
+    JOB_FREE,
+    JOB_QUEUED,
+    JOB_DONE,
+    JOB_FAILED
+};
+
+//one block of the archive and its gzip member
+struct tar_job {
+    char *in;
+    size_t in_length;
+    unsigned char *out;
+    size_t out_length;
+    enum job_state state;
+};
+
+//compresses the blocks of one archive. jobs are numbered in archive order and job n uses slot
+//n % job_count; a slot is reused only after its previous member was written, so members leave in order.
+struct tar_compressor {
+    int threads;
+    int job_count;
+    struct tar_job jobs[2 * DFS_TAR_MAX_THREADS];
+    unsigned long long submitted;   //jobs queued
+    unsigned long long taken;       //jobs a worker has started
+    unsigned long long written;     //members written to the output
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t workers[DFS_TAR_MAX_THREADS];
+    int started_workers;
+    z_stream stream;                //used by the walking thread when there are no workers
+};
+
+//where the archive goes: DATA frames on a socket, or raw bytes on a descriptor
+struct tar_sink {
+    int fd;
+    int framed;
+    uint32_t request_id;
+    char *buffer;
+    size_t capacity;
+    size_t used;
+    long long total;                //bytes of archive
+    long long output;               //bytes written to `fd`, which are compressed with a compressor
+    struct tar_compressor *compressor;
+    const struct dfs_tar_options *options;
+    char *manifest;                 //the new manifest of an archive made against a manifest
+    size_t manifest_length;
+    size_t manifest_capacity;
+    struct dfs_tar_summary summary;
+};
+
+//a client's record of one file
+struct manifest_file {
+    const char *name;
+    int64_t mtime_ns;
+    uint64_t size;
+    unsigned char sha256[DFS_SHA256_SIZE];
+    int seen;                       //set by the writer when the walk finds the file
+};
+
+//a client's manifest, with a hash table of its paths
+struct dfs_tar_manifest {
+    char *text;                     //the manifest as received; records point into it
+    struct manifest_file *files;
+    long count;
+    long *slots;                    //indexes into `files`, -1 for an empty slot
+    size_t slot_count;              //a power of two
+};
+
+//dfs_tar_configure: Sets the compression threads (0 for one per CPU), the gzip level and the reader threads.
+void dfs_tar_configure(int threads, int level, int readers) {
+    tar_threads = threads >= 0 ? threads : DFS_TAR_DEFAULT_THREADS;
+    if (tar_threads > DFS_TAR_MAX_THREADS) {
+        tar_threads = DFS_TAR_MAX_THREADS;
+    }
+    tar_level = level >= 1 && level <= 9 ? level : DFS_TAR_DEFAULT_LEVEL;
+    tar_readers = readers >= 0 ? readers : DFS_TAR_DEFAULT_READERS;
+    if (tar_readers > DFS_TAR_MAX_THREADS) {
+        tar_readers = DFS_TAR_MAX_THREADS;
+    }
+}
+
+//env_int: Returns the integer value of an environment variable, or `fallback` if it is not set.
+static int env_int(const char* name, int fallback) {
+    const char *value = getenv(name);
+    return value ? atoi(value) : fallback;
+}
+
+//dfs_tar_config_from_env: Reads DFS_TAR_THREADS, DFS_TAR_LEVEL and DFS_TAR_READERS.
+void dfs_tar_config_from_env(void) {
+    dfs_tar_configure(env_int("DFS_TAR_THREADS", DFS_TAR_DEFAULT_THREADS), env_int("DFS_TAR_LEVEL", DFS_TAR_DEFAULT_LEVEL),
+                      env_int("DFS_TAR_READERS", DFS_TAR_DEFAULT_READERS));
+}
+
+//dfs_tar_parse_options: Reads the comma-separated options of a dtar request.
+int dfs_tar_parse_options(const char* text, struct dfs_tar_options* options) {
+    memset(options, 0, sizeof(*options));
+    options->since = -1;
+    char copy[DFS_MAX_CONTROL_PAYLOAD];
+    snprintf(copy, sizeof(copy), "%s", text ? text : "");
+    char *saved;
+    for (char *option = strtok_r(copy, ",", &saved); option; option = strtok_r(NULL, ",", &saved)) {
+        char *end;
+        if (strcmp(option, "gz") == 0 || strcmp(option, "gzip") == 0) {
+            options->format = DFS_TAR_GZIP;
+        } else if (strcmp(option, "none") == 0) {
+            options->format = DFS_TAR_PLAIN;
+        } else if (strncmp(option, "since=", 6) == 0) {
+            options->since = strtoll(option + 6, &end, 10);
+            if (end == option + 6 || *end != '\0' || options->since < 0) {
+                return -1;
+            }
+        } else if (strcmp(option, "manifest") == 0) {
+            options->send_manifest = 1;
+        } else {
+            return -1;
+        }
+    }
+    //a manifest already tells which files are new, so a time on top of it would only hide changes
+    return options->since >= 0 && options->send_manifest ? -1 : 0;
+}
+
+//manifest_hash: FNV-1a hash of a path.
+static uint64_t manifest_hash(const char* name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash = (hash ^ *p) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+//manifest_find: Returns the manifest's record of `name`, or NULL.
+static struct manifest_file* manifest_find(const struct dfs_tar_manifest* manifest, const char* name) {
+    if (!manifest || manifest->count == 0) {
+        return NULL;
+    }
+    for (size_t slot = manifest_hash(name) & (manifest->slot_count - 1); manifest->slots[slot] >= 0; slot = (slot + 1) & (manifest->slot_count - 1)) {
+        struct manifest_file *file = &manifest->files[manifest->slots[slot]];
+        if (strcmp(file->name, name) == 0) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+//dfs_tar_free_manifest: Frees a parsed manifest.
+void dfs_tar_free_manifest(struct dfs_tar_manifest* manifest) {
+    if (manifest) {
+        free(manifest->text);
+        free(manifest->files);
+        free(manifest->slots);
+        free(manifest);
+    }
+}
+
+//dfs_tar_read_manifest: Reads and parses a manifest; an empty one stands for a client that has no files yet.
+struct dfs_tar_manifest* dfs_tar_read_manifest(int fd) {
+    struct dfs_tar_manifest *manifest = calloc(1, sizeof(*manifest));
+    if (!manifest) {
+        return NULL;
+    }
+
+    //read it all; the records point into the text
+    size_t length = 0;
+    size_t capacity = 0;
+    while (1) {
+        if (length + 1 >= capacity) {
+            capacity = capacity ? 2 * capacity : 65536;
+            char *text = capacity <= DFS_TAR_MANIFEST_MAX ? realloc(manifest->text, capacity) : NULL;
+            if (!text) {
+                dfs_tar_free_manifest(manifest);
+                return NULL;
+            }
+            manifest->text = text;
+        }
+        ssize_t n = read(fd, manifest->text + length, capacity - length - 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            dfs_tar_free_manifest(manifest);
+            return NULL;
+        }
+        if (n == 0) {
+            break;
+        }
+        length += n;
+    }
+    manifest->text[length] = '\0';
+
+    long lines = 0;
+    for (size_t i = 0; i < length; i++) {
+        lines += manifest->text[i] == '\n';
+    }
+    manifest->files = calloc(lines + 1, sizeof(*manifest->files));
+    manifest->slot_count = 16;
+    while (manifest->slot_count < 2 * (size_t)lines) {
+        manifest->slot_count *= 2;
+    }
+    manifest->slots = malloc(manifest->slot_count * sizeof(*manifest->slots));
+    if (!manifest->files || !manifest->slots) {
+        dfs_tar_free_manifest(manifest);
+        return NULL;
+    }
+    memset(manifest->slots, 0xff, manifest->slot_count * sizeof(*manifest->slots));
+
+    //the first line names the format; every other line records one file
+    char *saved;
+    int valid = 1;
+    int first = 1;
+    for (char *line = strtok_r(manifest->text, "\n", &saved); line && valid; line = strtok_r(NULL, "\n", &saved)) {
+        if (first) {
+            valid = strcmp(line, DFS_TAR_MANIFEST_MAGIC) == 0;
+            first = 0;
+            continue;
+        }
+        struct manifest_file *file = &manifest->files[manifest->count];
+        long long mtime_ns;
+        unsigned long long size;
+        char hex[DFS_SHA256_HEX_SIZE + 1];
+        int name_start = 0;
+        if (sscanf(line, "%lld %llu %64s %n", &mtime_ns, &size, hex, &name_start) != 3 || name_start == 0 ||
+            line[name_start] == '\0' || dfs_sha256_parse(hex, file->sha256) < 0) {
+            valid = 0;
+            break;
+        }
+        file->name = line + name_start;
+        file->mtime_ns = mtime_ns;
+        file->size = size;
+        if (manifest_find(manifest, file->name)) {
+            continue;
+        }
+        size_t slot = manifest_hash(file->name) & (manifest->slot_count - 1);
+        while (manifest->slots[slot] >= 0) {
+            slot = (slot + 1) & (manifest->slot_count - 1);
+        }
+        manifest->slots[slot] = manifest->count++;
+    }
+    if (!valid) {
+        dfs_tar_free_manifest(manifest);
+        errno = EINVAL;
+        return NULL;
+    }
+    return manifest;
+}
+
+//dfs_tar_recv_manifest: Receives a client's manifest into memory and parses it.
+int dfs_tar_recv_manifest(int sock, struct dfs_tar_options* options, char* error_message, size_t error_capacity) {
+    int fd = memfd_create("dfs-manifest", MFD_CLOEXEC);
+    if (fd < 0) {
+        snprintf(error_message, error_capacity, "Failed to receive manifest: %s", strerror(errno));
+        return -1;
+    }
+    long long received = dfs_recv_stream_to_fd(sock, fd, error_message, error_capacity);
+    if (received < 0) {
+        close(fd);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_SET);
+    options->manifest = dfs_tar_read_manifest(fd);
+    close(fd);
+    if (!options->manifest) {
+        snprintf(error_message, error_capacity, "Invalid manifest");
+        return -1;
+    }
+    return 0;
+}
+
+//gzip_block: Deflates one block into a complete gzip member. returns its length, or 0 on failure.
+static size_t gzip_block(z_stream* stream, const char* data, size_t length, unsigned char* out) {
+    if (deflateReset(stream) != Z_OK) {
+        return 0;
+    }
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = length;
+    stream->next_out = out;
+    stream->avail_out = GZIP_MEMBER_CAPACITY;
+    if (deflate(stream, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+    return GZIP_MEMBER_CAPACITY - stream->avail_out;
+}
+
+//gzip_init: Prepares a deflate stream that writes gzip members.
+static int gzip_init(z_stream* stream) {
+    memset(stream, 0, sizeof(*stream));
+    //15 window bits, plus 16 for a gzip header and trailer instead of a zlib one
+    return deflateInit2(stream, tar_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK ? 0 : -1;
+}
+
+//compress_worker: Thread that compresses queued jobs, oldest first, until the compressor stops.
+static void* compress_worker(void* arg) {
+    struct tar_compressor *c = arg;
+    z_stream stream;
+    int ready = gzip_init(&stream) == 0;
+
+    pthread_mutex_lock(&c->lock);
+    while (1) {
+        while (!c->stop && c->taken == c->submitted) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        }
+        if (c->taken == c->submitted) {
+            break;
+        }
+        struct tar_job *job = &c->jobs[c->taken % c->job_count];
+        c->taken++;
+        pthread_mutex_unlock(&c->lock);
+
+        job->out_length = ready ? gzip_block(&stream, job->in, job->in_length, job->out) : 0;
+
+        pthread_mutex_lock(&c->lock);
+        job->state = job->out_length > 0 ? JOB_DONE : JOB_FAILED;
+        pthread_cond_broadcast(&c->cond);
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (ready) {
+        deflateEnd(&stream);
+    }
+    return NULL;
+}
+
+//compressor_close: Stops the workers and frees a compressor.
+static void compressor_close(struct tar_compressor* c) {
+    pthread_mutex_lock(&c->lock);
+    c->stop = 1;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    for (int i = 0; i < c->started_workers; i++) {
+        pthread_join(c->workers[i], NULL);
+    }
+    for (int i = 0; i < c->job_count; i++) {
+        free(c->jobs[i].in);
+        free(c->jobs[i].out);
+    }
+    if (c->threads == 1) {
+        deflateEnd(&c->stream);
+    }
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    free(c);
+}
+
+//compressor_open: Creates a compressor with the configured number of threads.
+//a single thread compresses on the walking thread itself, without workers.
+static struct tar_compressor* compressor_open(void) {
+    struct tar_compressor *c = calloc(1, sizeof(*c));
+    if (!c) {
+        return NULL;
+    }
+    c->threads = tar_threads;
+    if (c->threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        c->threads = cpus < 1 ? 1 : cpus > DFS_TAR_THREAD_CAP ? DFS_TAR_THREAD_CAP : (int)cpus;
+    }
+    //two jobs per worker keep every worker busy while the walking thread fills the next block
+    c->job_count = c->threads == 1 ? 1 : 2 * c->threads;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    int failed = c->threads == 1 && gzip_init(&c->stream) < 0;
+    if (failed) {
+        c->threads = 0;
+    }
+    for (int i = 0; i < c->job_count && !failed; i++) {
+        //without workers the sink's own buffer is compressed in place
+        c->jobs[i].in = c->threads > 1 ? malloc(DFS_TAR_GZIP_BLOCK_SIZE) : NULL;
+        c->jobs[i].out = malloc(GZIP_MEMBER_CAPACITY);
+        failed = (c->threads > 1 && !c->jobs[i].in) || !c->jobs[i].out;
+    }
+    for (int i = 0; c->threads > 1 && i < c->threads && !failed; i++) {
+        failed = pthread_create(&c->workers[i], NULL, compress_worker, c) != 0;
+        c->started_workers += !failed;
+    }
+    if (failed) {
+        compressor_close(c);
+        return NULL;
+    }
+    return c;
+}
+
+//sink_output: Writes finished bytes to the destination, as one DATA frame when framed.
+static int sink_output(struct tar_sink* sink, const void* data, size_t length) {
+    int result = sink->framed
+        ? dfs_send_frame(sink->fd, DFS_OP_DATA, 0, sink->request_id, data, length)
+        : dfs_write_full(sink->fd, data, length);
+    sink->output += length;
+    return result;
+}
+
+//compressor_write: Waits for the members before job number `end` and writes them in order.
+static int compressor_write(struct tar_sink* sink, unsigned long long end) {
+    struct tar_compressor *c = sink->compressor;
+    while (c->written < end) {
+        struct tar_job *job = &c->jobs[c->written % c->job_count];
+        pthread_mutex_lock(&c->lock);
+        while (job->state == JOB_QUEUED) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        }
+        pthread_mutex_unlock(&c->lock);
+        if (job->state == JOB_FAILED || sink_output(sink, job->out, job->out_length) < 0) {
+            return -1;
+        }
+        job->state = JOB_FREE;
+        c->written++;
+    }
+    return 0;
+}
+
+//compressor_submit: Hands the sink's buffer to the compressor and takes an empty block in exchange.
+static int compressor_submit(struct tar_sink* sink) {
+    struct tar_compressor *c = sink->compressor;
+    struct tar_job *job = &c->jobs[c->submitted % c->job_count];
+    if (c->threads == 1) {
+        size_t length = gzip_block(&c->stream, sink->buffer, sink->used, job->out);
+        return length > 0 ? sink_output(sink, job->out, length) : -1;
+    }
+
+    //the slot's previous member has to be written before the slot is reused
+    if (c->submitted >= (unsigned long long)c->job_count && compressor_write(sink, c->submitted - c->job_count + 1) < 0) {
+        return -1;
+    }
+    char *empty = job->in;
+    job->in = sink->buffer;
+    job->in_length = sink->used;
+    sink->buffer = empty;
+
+    pthread_mutex_lock(&c->lock);
+    job->state = JOB_QUEUED;
+    c->submitted++;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+//ustar header layout
+struct ustar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+//sink_flush: Sends the buffered bytes, as one DATA frame when framed, or queues them for compression.
+static int sink_flush(struct tar_sink* sink) {
+    if (sink->used == 0) {
+        return 0;
+    }
+    int result = sink->compressor ? compressor_submit(sink) : sink_output(sink, sink->buffer, sink->used);
+    sink->used = 0;
+    return result;
+}
+
+//sink_write: Appends bytes to the buffer, flushing whenever it fills up.
+static int sink_write(struct tar_sink* sink, const void* data, size_t length) {
+    const char *p = data;
+    while (length > 0) {
+        size_t chunk = sink->capacity - sink->used;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(sink->buffer + sink->used, p, chunk);
+        sink->used += chunk;
+        sink->total += chunk;
+        p += chunk;
+        length -= chunk;
+        if (sink->used == sink->capacity && sink_flush(sink) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//sink_zeros: Appends `length` zero bytes.
+static int sink_zeros(struct tar_sink* sink, size_t length) {
+    static const char zeros[DFS_TAR_BLOCK_SIZE];
+    while (length > 0) {
+        size_t chunk = length < sizeof(zeros) ? length : sizeof(zeros);
+        if (sink_write(sink, zeros, chunk) < 0) {
+            return -1;
+        }
+        length -= chunk;
+    }
+    return 0;
+}
+
+//sink_pad: Pads the archive to a multiple of `unit` bytes.
+static int sink_pad(struct tar_sink* sink, size_t unit) {
+    size_t remainder = sink->total % unit;
+    return remainder ? sink_zeros(sink, unit - remainder) : 0;
+}
+
+//sink_file: Appends `size` bytes of a file, the first `head_length` of which a reader already loaded into `head`.
+//large bodies bypass the buffer and go out with sendfile().
+//if the file shrank since it was stat()ed, the missing bytes are zeros so the archive stays well formed.
+//files kept as chunk recipes are read through the chunk store, so the archive holds their contents.
+//a compressed archive reads every body straight into the blocks handed to the compressor.
+static int sink_file(struct tar_sink* sink, struct dfs_chunk_file* file, uint64_t size, const char* name, const char* head, size_t head_length) {
+    uint64_t done = 0;
+    if (head_length > 0) {
+        if (sink_write(sink, head, head_length) < 0) {
+            return -1;
+        }
+        done = head_length;
+    }
+    if (sink->compressor) {
+        while (done < size) {
+            size_t chunk = sink->capacity - sink->used;
+            if (chunk > size - done) {
+                chunk = size - done;
+            }
+            ssize_t n = dfs_chunk_pread(file, sink->buffer + sink->used, chunk, done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+            sink->used += n;
+            sink->total += n;
+            if (sink->used == sink->capacity && sink_flush(sink) < 0) {
+                return -1;
+            }
+        }
+    } else if (size - done <= DFS_TAR_INLINE_LIMIT) {
+        char body[DFS_TAR_INLINE_LIMIT];
+        size_t got = 0;
+        while (done + got < size) {
+            ssize_t n = dfs_chunk_pread(file, body + got, size - done - got, done + got);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            got += n;
+        }
+        if (sink_write(sink, body, got) < 0) {
+            return -1;
+        }
+        done += got;
+    } else {
+        if (sink_flush(sink) < 0) {
+            return -1;
+        }
+        while (done < size) {
+            uint64_t chunk = size - done;
+            if (sink->framed && chunk > DFS_SENDFILE_FRAME_SIZE) {
+                chunk = DFS_SENDFILE_FRAME_SIZE;
+            }
+            if (sink->framed) {
+                unsigned char header[DFS_FRAME_HEADER_SIZE];
+                dfs_encode_header(header, DFS_OP_DATA, 0, sink->request_id, chunk);
+                if (send(sink->fd, header, sizeof(header), MSG_MORE | MSG_NOSIGNAL) != sizeof(header)) {
+                    return -1;
+                }
+            }
+            long long n = dfs_chunk_sendfile(sink->fd, file, done, chunk);
+            if (n < 0) {
+                return -1;
+            }
+            done += n;
+            sink->total += n;
+            sink->output += n;
+            if ((uint64_t)n < chunk) {
+                //the file ended early; complete the frame that was announced
+                if (sink->framed) {
+                    char zeros[4096] = {0};
+                    uint64_t missing = chunk - n;
+                    while (missing > 0) {
+                        size_t part = missing < sizeof(zeros) ? missing : sizeof(zeros);
+                        if (dfs_write_full(sink->fd, zeros, part) < 0) {
+                            return -1;
+                        }
+                        missing -= part;
+                    }
+                    sink->total += chunk - n;
+                    sink->output += chunk - n;
+                    done += chunk - n;
+                }
+                break;
+            }
+        }
+    }
+    if (done < size) {
+        fprintf(stderr, "%s: file shrank by %llu bytes; padding with zeros\n", name, (unsigned long long)(size - done));
+        if (sink_zeros(sink, size - done) < 0) {
+            return -1;
+        }
+    }
+    return sink_pad(sink, DFS_TAR_BLOCK_SIZE);
+}
+
+//put_octal: Writes `value` as a NUL-terminated, zero-padded octal number filling a header field.
+static void put_octal(char* field, size_t width, unsigned long long value) {
+    snprintf(field, width, "%0*llo", (int)width - 1, value);
+}
+
+//split_name: Fits a path into the ustar name and prefix fields, splitting at a '/'.
+//returns 0 on success and -1 if the path needs a pax header.
+static int split_name(struct ustar_header* h, const char* path) {
+    size_t length = strlen(path);
+    if (length <= sizeof(h->name)) {
+        memcpy(h->name, path, length);
+        return 0;
+    }
+    for (const char *slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t prefix_length = slash - path;
+        size_t name_length = length - prefix_length - 1;
+        if (prefix_length <= sizeof(h->prefix) && name_length > 0 && name_length <= sizeof(h->name)) {
+            memcpy(h->prefix, path, prefix_length);
+            memcpy(h->name, slash + 1, name_length);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//pax_record: Appends one "length key=value\n" record; the length counts its own digits.
+static size_t pax_record(char* out, size_t capacity, size_t used, const char* key, const char* value) {
+    size_t body = strlen(key) + strlen(value) + 3;
+    size_t total = body + 1;
+    while (snprintf(NULL, 0, "%zu", total) + body != total) {
+        total++;
+    }
+    if (used + total < capacity) {
+        snprintf(out + used, capacity - used, "%zu %s=%s\n", total, key, value);
+        used += total;
+    }
+    return used;
+}
+
+//write_header: Emits the header block(s) of one entry, preceded by a pax header when needed.
+static int write_header(struct tar_sink* sink, const char* path, const struct stat* st, char typeflag, const char* linkname) {
+    struct ustar_header h;
+    memset(&h, 0, sizeof(h));
+    unsigned long long size = typeflag == '0' ? (unsigned long long)st->st_size : 0;
+
+    //collect the values that do not fit the ustar fields
+    char pax[2 * PATH_MAX + 128];
+    size_t pax_length = 0;
+    if (split_name(&h, path) < 0) {
+        memset(h.name, 0, sizeof(h.name));
+        memset(h.prefix, 0, sizeof(h.prefix));
+        pax_length = pax_record(pax, sizeof(pax), pax_length, "path", path);
+        //keep a readable, truncated name for tools without pax support
+        snprintf(h.name, sizeof(h.name), "%s", path);
+    }
+    if (linkname && strlen(linkname) > sizeof(h.linkname)) {
+        pax_length = pax_record(pax, sizeof(pax), pax_length, "linkpath", linkname);
+    }
+    if (size > USTAR_MAX_SIZE) {
+        char value[32];
+        snprintf(value, sizeof(value), "%llu", size);
+        pax_length = pax_record(pax, sizeof(pax), pax_length, "size", value);
+    }
+
+    if (pax_length > 0) {
+        struct ustar_header x;
+        memset(&x, 0, sizeof(x));
+        snprintf(x.name, sizeof(x.name), "./PaxHeaders/%.80s", strrchr(path, '/') ? strrchr(path, '/') + 1 : path);
+        put_octal(x.mode, sizeof(x.mode), 0644);
+        put_octal(x.uid, sizeof(x.uid), 0);
+        put_octal(x.gid, sizeof(x.gid), 0);
+        put_octal(x.size, sizeof(x.size), pax_length);
+        put_octal(x.mtime, sizeof(x.mtime), st->st_mtime);
+        x.typeflag = 'x';
+        memcpy(x.magic, "ustar", 6);
+        memcpy(x.version, "00", 2);
+        memset(x.checksum, ' ', sizeof(x.checksum));
+        unsigned int sum = 0;
+        for (size_t i = 0; i < sizeof(x); i++) {
+            sum += ((unsigned char *)&x)[i];
+        }
+        snprintf(x.checksum, sizeof(x.checksum), "%06o", sum);
+        if (sink_write(sink, &x, sizeof(x)) < 0 || sink_write(sink, pax, pax_length) < 0 || sink_pad(sink, DFS_TAR_BLOCK_SIZE) < 0) {
+            return -1;
+        }
+    }
+
+    put_octal(h.mode, sizeof(h.mode), st->st_mode & 07777);
+    put_octal(h.uid, sizeof(h.uid), st->st_uid & 07777777);
+    put_octal(h.gid, sizeof(h.gid), st->st_gid & 07777777);
+    put_octal(h.size, sizeof(h.size), size > USTAR_MAX_SIZE ? 0 : size);
+    put_octal(h.mtime, sizeof(h.mtime), st->st_mtime > 0 ? (unsigned long long)st->st_mtime : 0);
+    h.typeflag = typeflag;
+    if (linkname) {
+        memcpy(h.linkname, linkname, strnlen(linkname, sizeof(h.linkname)));
+    }
+    memcpy(h.magic, "ustar", 6);
+    memcpy(h.version, "00", 2);
+
+    //the checksum is computed with its own field filled with spaces
+    memset(h.checksum, ' ', sizeof(h.checksum));
+    unsigned int sum = 0;
+    for (size_t i = 0; i < sizeof(h); i++) {
+        sum += ((unsigned char *)&h)[i];
+    }
+    snprintf(h.checksum, sizeof(h.checksum), "%06o", sum);
+    return sink_write(sink, &h, sizeof(h));
+}
+
+//skip_dots: scandir() filter that drops "." and "..".
+static int skip_dots(const struct dirent* ent) {
+    return strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0;
+}
+
+//one directory being listed by the walk
+struct tar_dir {
+    char path[PATH_MAX];
+    char name[PATH_MAX];
+    struct dirent **entries;
+    int count;
+    int next;
+};
+
+//depth-first walk of the tree in name order, yielding entries one by one
+struct tar_walk {
+    struct tar_dir *dirs;
+    int depth;
+    int capacity;
+};
+
+//one entry of the archive and what a reader loaded for it
+struct tar_entry {
+    char path[PATH_MAX];          //on disk
+    char name[PATH_MAX];          //in the archive
+    enum job_state state;
+    int found;                    //lstat() succeeded
+    struct stat st;
+    int opened;
+    int open_errno;
+    struct dfs_chunk_file file;
+    char *head;                   //first bytes of a regular file, DFS_TAR_PREFETCH_LIMIT bytes of room
+    size_t head_length;
+    char target[PATH_MAX];        //target of a symlink
+    int has_target;
+    int selected;                 //goes into the archive; an incremental archive leaves out unchanged files
+    int hashed;                   //`sha256` holds the digest of the contents, for the new manifest
+    unsigned char sha256[DFS_SHA256_SIZE];
+};
+
+//reader threads loading the entries ahead of the writer. entries are numbered in archive order and entry n
+//uses slot n % slot_count; a slot is filled again only after the writer has written its previous entry.
+struct tar_readers {
+    int threads;
+    int slot_count;
+    struct tar_entry *entries;
+    unsigned long long submitted;   //entries queued
+    unsigned long long taken;       //entries a reader has started
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t workers[DFS_TAR_MAX_THREADS];
+    int started_workers;
+    const struct dfs_tar_options *options;
+};
+
+//walk_push: Starts listing the directory `path`, named `name` in the archive.
+//a directory that cannot be listed is reported and archived without its contents.
+static void walk_push(struct tar_walk* walk, const char* path, const char* name) {
+    if (walk->depth == walk->capacity) {
+        int capacity = walk->capacity ? 2 * walk->capacity : 16;
+        struct tar_dir *dirs = realloc(walk->dirs, capacity * sizeof(*dirs));
+        if (!dirs) {
+            perror(path);
+            return;
+        }
+        walk->dirs = dirs;
+        walk->capacity = capacity;
+    }
+    struct tar_dir *dir = &walk->dirs[walk->depth];
+    dir->count = scandir(path, &dir->entries, skip_dots, alphasort);
+    if (dir->count < 0) {
+        perror(path);
+        return;
+    }
+    snprintf(dir->path, sizeof(dir->path), "%s", path);
+    snprintf(dir->name, sizeof(dir->name), "%s", name);
+    dir->next = 0;
+    walk->depth++;
+}
+
+//walk_next: Fills in the path and name of the next entry and returns 1, or returns 0 at the end of the tree.
+//a directory's contents follow the directory itself, as in `tar -cf - -C root .`.
+static int walk_next(struct tar_walk* walk, struct tar_entry* entry) {
+    while (walk->depth > 0) {
+        struct tar_dir *dir = &walk->dirs[walk->depth - 1];
+        if (dir->next == dir->count) {
+            free(dir->entries);
+            walk->depth--;
+            continue;
+        }
+        struct dirent *ent = dir->entries[dir->next++];
+        snprintf(entry->path, sizeof(entry->path), "%s/%s", dir->path, ent->d_name);
+        snprintf(entry->name, sizeof(entry->name), "%s/%s", dir->name, ent->d_name);
+        int is_dir = ent->d_type == DT_DIR;
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = lstat(entry->path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        free(ent);
+        if (is_dir) {
+            walk_push(walk, entry->path, entry->name);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+//walk_free: Releases the listings of a walk that stopped early.
+static void walk_free(struct tar_walk* walk) {
+    while (walk->depth > 0) {
+        struct tar_dir *dir = &walk->dirs[--walk->depth];
+        while (dir->next < dir->count) {
+            free(dir->entries[dir->next++]);
+        }
+        free(dir->entries);
+    }
+    free(walk->dirs);
+}
+
+//entry_hash: Computes the SHA-256 of a loaded file or symlink, reading a large file through the head buffer.
+static void entry_hash(struct tar_entry* entry) {
+    struct dfs_sha256 ctx;
+    dfs_sha256_init(&ctx);
+    if (entry->has_target) {
+        dfs_sha256_update(&ctx, entry->target, strlen(entry->target));
+    } else if (entry->file.size <= DFS_TAR_PREFETCH_LIMIT) {
+        dfs_sha256_update(&ctx, entry->head, entry->head_length);
+    } else {
+        uint64_t done = 0;
+        while (done < entry->file.size) {
+            size_t chunk = entry->file.size - done < DFS_TAR_PREFETCH_LIMIT ? entry->file.size - done : DFS_TAR_PREFETCH_LIMIT;
+            ssize_t n = dfs_chunk_pread(&entry->file, entry->head, chunk, done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                //the file shrank while it was read; it goes into the archive without a record
+                return;
+            }
+            dfs_sha256_update(&ctx, entry->head, n);
+            done += n;
+        }
+    }
+    dfs_sha256_final(&ctx, entry->sha256);
+    entry->hashed = 1;
+}
+
+//entry_record: Returns the manifest's record of an entry and whether the entry matches it in size and
+//modification time, in which case it counts as unchanged and takes the record's digest.
+static struct manifest_file* entry_record(struct tar_entry* entry, const struct dfs_tar_options* options, int* unchanged) {
+    uint64_t size = entry->has_target ? strlen(entry->target) : entry->file.size;
+    int64_t mtime_ns = (int64_t)entry->st.st_mtim.tv_sec * 1000000000 + entry->st.st_mtim.tv_nsec;
+    struct manifest_file *record = manifest_find(options->manifest, entry->name);
+    *unchanged = record && record->size == size && record->mtime_ns == mtime_ns;
+    if (*unchanged) {
+        memcpy(entry->sha256, record->sha256, DFS_SHA256_SIZE);
+        entry->hashed = 1;
+    }
+    return record;
+}
+
+//entry_load: Stats an entry and opens it; a small file is read completely and the start of a large
+//one is read ahead into the page cache, so the writer does not wait for the disk.
+//for an incremental archive it also decides whether the entry is needed. against a manifest a file whose
+//size and modification time match its record is unchanged; one whose size matches but whose time does not
+//is compared by its digest, so a file that was only touched is not sent again. every file sent is hashed
+//for the new manifest.
+static void entry_load(struct tar_entry* entry, const struct dfs_tar_options* options) {
+    entry->found = lstat(entry->path, &entry->st) == 0;
+    entry->opened = 0;
+    entry->head_length = 0;
+    entry->has_target = 0;
+    entry->hashed = 0;
+    entry->selected = 1;
+    if (!entry->found) {
+        return;
+    }
+    int incremental = options->since >= 0 || options->manifest;
+    if (incremental && !S_ISREG(entry->st.st_mode) && !S_ISLNK(entry->st.st_mode)) {
+        //directories are created by extracting the files in them
+        entry->selected = 0;
+        return;
+    }
+    if (options->since >= 0 && entry->st.st_mtime < options->since) {
+        entry->selected = 0;
+        return;
+    }
+
+    struct manifest_file *record = NULL;
+    int unchanged = 0;
+    if (S_ISREG(entry->st.st_mode)) {
+        if (dfs_chunk_open(&entry->file, entry->path) < 0) {
+            entry->open_errno = errno;
+            return;
+        }
+        entry->opened = 1;
+        if (options->manifest && (record = entry_record(entry, options, &unchanged), unchanged)) {
+            dfs_chunk_close(&entry->file);
+            entry->opened = 0;
+            entry->selected = 0;
+            return;
+        }
+        if (!entry->head && !(entry->head = malloc(DFS_TAR_PREFETCH_LIMIT))) {
+            //without a buffer the writer reads the file itself, and it cannot be recorded
+            return;
+        }
+        if (entry->file.size > DFS_TAR_PREFETCH_LIMIT) {
+            if (entry->file.fd >= 0) {
+                posix_fadvise(entry->file.fd, 0, DFS_TAR_READAHEAD_BYTES, POSIX_FADV_WILLNEED);
+            }
+        } else {
+            while (entry->head_length < entry->file.size) {
+                ssize_t n = dfs_chunk_pread(&entry->file, entry->head + entry->head_length, entry->file.size - entry->head_length, entry->head_length);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    break;
+                }
+                entry->head_length += n;
+            }
+        }
+        //a small file that shrank while it was read goes into the archive without a record
+        int complete = entry->file.size > DFS_TAR_PREFETCH_LIMIT || entry->head_length == entry->file.size;
+        if (options->manifest && complete) {
+            entry_hash(entry);
+        }
+    } else if (S_ISLNK(entry->st.st_mode)) {
+        ssize_t n = readlink(entry->path, entry->target, sizeof(entry->target) - 1);
+        if (n < 0) {
+            return;
+        }
+        entry->target[n] = '\0';
+        entry->has_target = 1;
+        if (options->manifest && (record = entry_record(entry, options, &unchanged), unchanged)) {
+            entry->selected = 0;
+            return;
+        }
+        if (options->manifest) {
+            entry_hash(entry);
+        }
+    }
+
+    //a file that only got a new modification time is not sent again
+    if (record && entry->hashed && record->size == (entry->has_target ? strlen(entry->target) : entry->file.size) &&
+        memcmp(record->sha256, entry->sha256, DFS_SHA256_SIZE) == 0) {
+        entry->selected = 0;
+        if (entry->opened) {
+            dfs_chunk_close(&entry->file);
+            entry->opened = 0;
+        }
+    }
+}
+
+//entry_release: Closes the file a reader opened for an entry.
+static void entry_release(struct tar_entry* entry) {
+    if (entry->opened) {
+        dfs_chunk_close(&entry->file);
+        entry->opened = 0;
+    }
+}
+
+//manifest_add: Appends one record to the new manifest an archive ends with.
+static int manifest_add(struct tar_sink* sink, struct tar_entry* entry) {
+    char hex[DFS_SHA256_HEX_SIZE + 1];
+    char line[PATH_MAX + 128];
+    uint64_t size = entry->has_target ? strlen(entry->target) : entry->file.size;
+    int64_t mtime_ns = (int64_t)entry->st.st_mtim.tv_sec * 1000000000 + entry->st.st_mtim.tv_nsec;
+    dfs_sha256_hex(entry->sha256, hex);
+    int length = snprintf(line, sizeof(line), "%lld %llu %s %s\n", (long long)mtime_ns, (unsigned long long)size, hex, entry->name);
+    if (length < 0 || (size_t)length >= sizeof(line)) {
+        return 0;
+    }
+    if (sink->manifest_length + length > sink->manifest_capacity) {
+        size_t capacity = sink->manifest_capacity ? 2 * sink->manifest_capacity : 65536;
+        while (capacity < sink->manifest_length + length) {
+            capacity *= 2;
+        }
+        char *manifest = realloc(sink->manifest, capacity);
+        if (!manifest) {
+            return -1;
+        }
+        sink->manifest = manifest;
+        sink->manifest_capacity = capacity;
+    }
+    memcpy(sink->manifest + sink->manifest_length, line, length);
+    sink->manifest_length += length;
+    return 0;
+}
+
+//write_entry: Emits one loaded entry. against a manifest, every file found is recorded in the new
+//manifest whether it is sent or not; a name with a newline cannot be recorded and is always sent.
+static int write_entry(struct tar_sink* sink, struct tar_entry* entry) {
+    if (!entry->found) {
+        return 0;
+    }
+    if (sink->options->manifest) {
+        struct manifest_file *record = manifest_find(sink->options->manifest, entry->name);
+        if (record) {
+            record->seen = 1;
+        }
+        if (entry->hashed && !strchr(entry->name, '\n') && manifest_add(sink, entry) < 0) {
+            return -1;
+        }
+    }
+    if (!entry->selected) {
+        sink->summary.unchanged += S_ISREG(entry->st.st_mode) || S_ISLNK(entry->st.st_mode);
+        return 0;
+    }
+    sink->summary.files += S_ISREG(entry->st.st_mode) || S_ISLNK(entry->st.st_mode);
+    if (S_ISDIR(entry->st.st_mode)) {
+        char name[PATH_MAX];
+        snprintf(name, sizeof(name), "%s/", entry->name);
+        return write_header(sink, name, &entry->st, '5', NULL);
+    }
+    if (S_ISREG(entry->st.st_mode)) {
+        if (!entry->opened) {
+            fprintf(stderr, "%s: %s\n", entry->path, strerror(entry->open_errno));
+            return 0;
+        }
+        entry->st.st_size = entry->file.size;
+        if (write_header(sink, entry->name, &entry->st, '0', NULL) < 0) {
+            return -1;
+        }
+        return sink_file(sink, &entry->file, entry->st.st_size, entry->path, entry->head, entry->head_length);
+    }
+    if (S_ISLNK(entry->st.st_mode) && entry->has_target) {
+        return write_header(sink, entry->name, &entry->st, '2', entry->target);
+    }
+    //sockets, fifos and devices are left out, as they cannot hold stored files
+    return 0;
+}
+
+//write_text_entry: Emits a regular file made of `length` bytes of `text`, dated now.
+static int write_text_entry(struct tar_sink* sink, const char* name, const char* text, size_t length) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFREG | 0644;
+    st.st_uid = geteuid();
+    st.st_gid = getegid();
+    st.st_size = length;
+    st.st_mtime = time(NULL);
+    if (write_header(sink, name, &st, '0', NULL) < 0 || sink_write(sink, text, length) < 0) {
+        return -1;
+    }
+    return sink_pad(sink, DFS_TAR_BLOCK_SIZE);
+}
+
+//write_manifest: Ends an archive made against a manifest with the paths that were deleted since and the
+//new manifest, which the client sends with its next request.
+static int write_manifest(struct tar_sink* sink) {
+    const struct dfs_tar_manifest *old = sink->options->manifest;
+    char *deleted = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    for (long i = 0; i < old->count; i++) {
+        if (old->files[i].seen) {
+            continue;
+        }
+        size_t name_length = strlen(old->files[i].name);
+        if (length + name_length + 1 > capacity) {
+            capacity = 2 * (length + name_length + 1) + 4096;
+            char *grown = realloc(deleted, capacity);
+            if (!grown) {
+                free(deleted);
+                return -1;
+            }
+            deleted = grown;
+        }
+        memcpy(deleted + length, old->files[i].name, name_length);
+        deleted[length + name_length] = '\n';
+        length += name_length + 1;
+        sink->summary.deleted++;
+    }
+    int result = write_text_entry(sink, DFS_TAR_DELETED_NAME, deleted ? deleted : "", length);
+    free(deleted);
+    if (result < 0) {
+        return -1;
+    }
+
+    //the new manifest starts with its format line
+    char *manifest = malloc(sizeof(DFS_TAR_MANIFEST_MAGIC) + sink->manifest_length);
+    if (!manifest) {
+        return -1;
+    }
+    memcpy(manifest, DFS_TAR_MANIFEST_MAGIC "\n", sizeof(DFS_TAR_MANIFEST_MAGIC));
+    if (sink->manifest_length > 0) {
+        memcpy(manifest + sizeof(DFS_TAR_MANIFEST_MAGIC), sink->manifest, sink->manifest_length);
+    }
+    result = write_text_entry(sink, DFS_TAR_MANIFEST_NAME, manifest, sizeof(DFS_TAR_MANIFEST_MAGIC) + sink->manifest_length);
+    free(manifest);
+    return result;
+}
+
+//reader_thread: Thread that loads queued entries, oldest first, until the readers stop.
+static void* reader_thread(void* arg) {
+    struct tar_readers *r = arg;
+    pthread_mutex_lock(&r->lock);
+    while (1) {
+        while (!r->stop && r->taken == r->submitted) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        if (r->taken == r->submitted) {
+            break;
+        }
+        struct tar_entry *entry = &r->entries[r->taken % r->slot_count];
+        r->taken++;
+        pthread_mutex_unlock(&r->lock);
+
+        entry_load(entry, r->options);
+
+        pthread_mutex_lock(&r->lock);
+        entry->state = JOB_DONE;
+        pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+//readers_close: Stops the reader threads, closes the files of entries not written and frees the readers.
+static void readers_close(struct tar_readers* r) {
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    for (int i = 0; i < r->started_workers; i++) {
+        pthread_join(r->workers[i], NULL);
+    }
+    for (int i = 0; i < r->slot_count; i++) {
+        entry_release(&r->entries[i]);
+        free(r->entries[i].head);
+    }
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(r->entries);
+    free(r);
+}
+
+//readers_open: Starts the configured number of reader threads. without threads the writer loads
+//every entry itself just before writing it.
+static struct tar_readers* readers_open(const struct dfs_tar_options* options) {
+    struct tar_readers *r = calloc(1, sizeof(*r));
+    if (!r) {
+        return NULL;
+    }
+    r->options = options;
+    r->threads = tar_readers;
+    r->slot_count = r->threads > 0 ? DFS_TAR_ENTRIES_PER_READER * r->threads : 1;
+    r->entries = calloc(r->slot_count, sizeof(*r->entries));
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    int failed = !r->entries;
+    for (int i = 0; i < r->threads && !failed; i++) {
+        failed = pthread_create(&r->workers[i], NULL, reader_thread, r) != 0;
+        r->started_workers += !failed;
+    }
+    if (failed) {
+        if (!r->entries) {
+            r->slot_count = 0;
+        }
+        readers_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+//readers_submit: Queues the next entry of the walk, which walk_next() put in its slot.
+static void readers_submit(struct tar_readers* r) {
+    struct tar_entry *entry = &r->entries[r->submitted % r->slot_count];
+    if (r->threads == 0) {
+        entry_load(entry, r->options);
+        entry->state = JOB_DONE;
+        r->submitted++;
+        r->taken++;
+        return;
+    }
+    pthread_mutex_lock(&r->lock);
+    entry->state = JOB_QUEUED;
+    r->submitted++;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+//readers_wait: Returns entry number `index` once a reader has loaded it.
+static struct tar_entry* readers_wait(struct tar_readers* r, unsigned long long index) {
+    struct tar_entry *entry = &r->entries[index % r->slot_count];
+    pthread_mutex_lock(&r->lock);
+    while (entry->state != JOB_DONE) {
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return entry;
+}
+
+//add_tree: Archives `root` (named "." in the archive) and everything below it, in name order.
+//the walk stays up to a window of entries ahead of the writer while the readers load them, and the
+//writer emits them strictly in walk order, so the archive is the same whatever the number of readers.
+//an incremental archive has no directory entries, and one made against a manifest ends with the new manifest.
+static int add_tree(struct tar_sink* sink, const char* root, const struct stat* root_st) {
+    int incremental = sink->options->since >= 0 || sink->options->manifest;
+    if (!incremental && write_header(sink, "./", root_st, '5', NULL) < 0) {
+        return -1;
+    }
+    struct tar_readers *r = readers_open(sink->options);
+    if (!r) {
+        return -1;
+    }
+    struct tar_walk walk = {NULL, 0, 0};
+    walk_push(&walk, root, ".");
+
+    int result = 0;
+    unsigned long long written = 0;
+    while (result == 0) {
+        //refill the window; a slot is free once its previous entry has been written
+        while (r->submitted - written < (unsigned long long)r->slot_count && walk_next(&walk, &r->entries[r->submitted % r->slot_count])) {
+            readers_submit(r);
+        }
+        if (written == r->submitted) {
+            break;
+        }
+        struct tar_entry *entry = readers_wait(r, written);
+        result = write_entry(sink, entry);
+        entry_release(entry);
+        entry->state = JOB_FREE;
+        written++;
+    }
+    walk_free(&walk);
+    readers_close(r);
+    if (result == 0 && sink->options->manifest) {
+        result = write_manifest(sink);
+    }
+    free(sink->manifest);
+    return result;
+}
+
+//write_archive: Writes the complete archive of `root` into a sink, as `options` ask.
+static long long write_archive(struct tar_sink* sink, const char* root, const struct dfs_tar_options* options) {
+    struct dfs_tar_options defaults;
+    if (!options) {
+        dfs_tar_parse_options(NULL, &defaults);
+        options = &defaults;
+    }
+    sink->options = options;
+    struct stat st;
+    if (stat(root, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return -1;
+    }
+    if (options->format == DFS_TAR_GZIP) {
+        sink->compressor = compressor_open();
+        if (!sink->compressor) {
+            return -1;
+        }
+    }
+    sink->capacity = sink->compressor ? DFS_TAR_GZIP_BLOCK_SIZE : DFS_DATA_CHUNK_SIZE;
+    sink->buffer = malloc(sink->capacity);
+    if (!sink->buffer) {
+        if (sink->compressor) {
+            compressor_close(sink->compressor);
+        }
+        return -1;
+    }
+    //two zero blocks end the archive, then the last record is filled up
+    int result = add_tree(sink, root, &st);
+    if (result == 0) {
+        result = sink_zeros(sink, 2 * DFS_TAR_BLOCK_SIZE);
+    }
+    if (result == 0) {
+        result = sink_pad(sink, DFS_TAR_RECORD_SIZE);
+    }
+    if (result == 0) {
+        result = sink_flush(sink);
+    }
+    if (sink->compressor) {
+        if (result == 0) {
+            result = compressor_write(sink, sink->compressor->submitted);
+        }
+        compressor_close(sink->compressor);
+    }
+    free(sink->buffer);
+    sink->summary.archive_bytes = sink->total;
+    return result < 0 ? -1 : sink->output;
+}
+
+//dfs_tar_stream: Streams the archive of `root` to a socket as DATA frames followed by an END frame.
+long long dfs_tar_stream(int sock, uint32_t request_id, const char* root) {
+    return dfs_tar_stream_options(sock, request_id, root, NULL, NULL);
+}
+
+//dfs_tar_write: Writes the raw archive of `root` to a descriptor.
+long long dfs_tar_write(int fd, const char* root) {
+    return dfs_tar_write_options(fd, root, NULL, NULL);
+}
+
+//dfs_tar_stream_options: Streams the archive of `root` as `options` ask, followed by an END frame.
+long long dfs_tar_stream_options(int sock, uint32_t request_id, const char* root, const struct dfs_tar_options* options, struct dfs_tar_summary* summary) {
+    struct tar_sink sink = {.fd = sock, .framed = 1, .request_id = request_id};
+    long long total_bytes = write_archive(&sink, root, options);
+    if (summary) {
+        *summary = sink.summary;
+    }
+    if (total_bytes < 0) {
+        dfs_send_status(sock, request_id, 0, "Failed to create tar file");
+        return -1;
+    }
+    if (dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0) {
+        return -1;
+    }
+    return total_bytes;
+}
+
+//dfs_tar_write_options: Writes the archive of `root` as `options` ask to a descriptor.
+long long dfs_tar_write_options(int fd, const char* root, const struct dfs_tar_options* options, struct dfs_tar_summary* summary) {
+    struct tar_sink sink = {.fd = fd};
+    long long total_bytes = write_archive(&sink, root, options);
+    if (summary) {
+        *summary = sink.summary;
+    }
+    return total_bytes;
+}
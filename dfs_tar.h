@@ -0,0 +1,91 @@
+//dfs_tar.h
+//this header declares the built-in tar writer used by dtar. it walks a directory tree and streams
+//ustar headers plus file bodies straight to a socket or pipe, so no archive is ever written to disk
+//and the first bytes reach the client while the tree is still being walked.
+//reader threads stat and read files ahead of the single thread that writes the archive, and a compressed
+//archive is compressed block by block on several threads; the writer emits everything in walk order, so
+//the archive does not depend on how many threads built it.
+#ifndef DFS_TAR_H
+#define DFS_TAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//tar block and record sizes; archives are padded to a whole record like GNU tar's default output
+#define DFS_TAR_BLOCK_SIZE 512
+#define DFS_TAR_RECORD_SIZE 10240
+//files up to this size are copied into the outgoing buffer; larger bodies are sent with sendfile()
+#define DFS_TAR_INLINE_LIMIT 32768
+//readers load files up to this size completely, and ask the kernel to read ahead the start of larger ones
+#define DFS_TAR_PREFETCH_LIMIT (128 * 1024)
+#define DFS_TAR_READAHEAD_BYTES (4 * 1024 * 1024)
+//entries the walk stays ahead of the writer, per reader thread
+#define DFS_TAR_ENTRIES_PER_READER 8
+
+//archive formats: a plain tar, or a tar compressed as gzip (.tar.gz)
+#define DFS_TAR_PLAIN 0
+#define DFS_TAR_GZIP 1
+//bytes of archive per compressed block; every block becomes one gzip member, so blocks compress independently
+#define DFS_TAR_GZIP_BLOCK_SIZE (256 * 1024)
+//defaults used when DFS_TAR_THREADS / DFS_TAR_LEVEL are not set; 0 threads means one per CPU up to the default cap
+#define DFS_TAR_DEFAULT_THREADS 0
+#define DFS_TAR_THREAD_CAP 4
+#define DFS_TAR_MAX_THREADS 16
+#define DFS_TAR_DEFAULT_LEVEL 6
+#define DFS_TAR_DEFAULT_READERS 4
+
+//dfs_tar_stream() sends the archive of `root` as DATA frames followed by an END frame;
+//on failure it ends the stream with an error status frame if the socket is still usable.
+//dfs_tar_write() writes the raw archive bytes to `fd`, e.g. a pipe.
+//entries are named "./path" relative to `root`, matching `tar -cf - -C root .`.
+//both return the number of archive bytes written or -1 on error.
+long long dfs_tar_stream(int sock, uint32_t request_id, const char* root);
+long long dfs_tar_write(int fd, const char* root);
+
+//what a client asked for: the format, and for an incremental archive the time or manifest it is relative to.
+//an incremental archive holds only the regular files and symlinks that are new or changed, without
+//directory entries. against a manifest it ends with DFS_TAR_DELETED_NAME, listing the manifest's paths that
+//no longer exist one per line, and DFS_TAR_MANIFEST_NAME, the manifest of every file now in the tree.
+struct dfs_tar_manifest;
+struct dfs_tar_options {
+    int format;                          //DFS_TAR_PLAIN or DFS_TAR_GZIP
+    long long since;                     //only entries modified at or after this time (seconds), -1 for all
+    int send_manifest;                   //the client sends its manifest as a data stream after the OK status
+    struct dfs_tar_manifest *manifest;   //the manifest received, NULL if there is none
+};
+
+//a manifest is text: a DFS_TAR_MANIFEST_MAGIC line, then one "<mtime ns> <size> <sha256> <path>" line per file
+#define DFS_TAR_MANIFEST_MAGIC "DFS-MANIFEST 1"
+#define DFS_TAR_MANIFEST_NAME "./.dfs-manifest"
+#define DFS_TAR_DELETED_NAME "./.dfs-deleted"
+//largest manifest a server accepts
+#define DFS_TAR_MANIFEST_MAX (256 * 1024 * 1024)
+
+//dfs_tar_parse_options() reads a comma-separated option list such as "gz,since=1700000000" or "manifest";
+//NULL means a plain, complete archive. returns -1 for an unknown or conflicting option.
+int dfs_tar_parse_options(const char* text, struct dfs_tar_options* options);
+//dfs_tar_recv_manifest() receives the manifest stream that follows a request with `send_manifest` set and
+//stores it in `options`. on failure it fills `error_message` and returns -1.
+int dfs_tar_recv_manifest(int sock, struct dfs_tar_options* options, char* error_message, size_t error_capacity);
+//dfs_tar_read_manifest() parses a manifest from a descriptor, from its current position; NULL on error.
+struct dfs_tar_manifest* dfs_tar_read_manifest(int fd);
+void dfs_tar_free_manifest(struct dfs_tar_manifest* manifest);
+
+//what an archive held, for the servers' logs
+struct dfs_tar_summary {
+    long long archive_bytes;   //size of the uncompressed archive
+    long files;                //regular files and symlinks in the archive
+    long unchanged;            //files an incremental archive left out
+    long deleted;              //paths of the manifest that no longer exist
+};
+
+//like dfs_tar_stream() and dfs_tar_write(), with options. they return the bytes written, compressed or not,
+//and fill `summary` if it is not NULL.
+long long dfs_tar_stream_options(int sock, uint32_t request_id, const char* root, const struct dfs_tar_options* options, struct dfs_tar_summary* summary);
+long long dfs_tar_write_options(int fd, const char* root, const struct dfs_tar_options* options, struct dfs_tar_summary* summary);
+//dfs_tar_configure() sets the compression threads, the gzip level (1-9) and the reader threads (0 to read
+//on the writing thread); dfs_tar_config_from_env() reads them from DFS_TAR_THREADS, DFS_TAR_LEVEL and DFS_TAR_READERS.
+void dfs_tar_configure(int threads, int level, int readers);
+void dfs_tar_config_from_env(void);
+
+#endif
@@ -0,0 +1,600 @@
+//dfs_uring.c
+//this file implements the io_uring transfer engine declared in dfs_uring.h.
+//the rings are set up with the raw io_uring_setup/io_uring_enter/io_uring_register system calls.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "dfs_frame.h"
+#include "dfs_compress.h"
+#include "dfs_uring.h"
+
+//a buffer holds room for a frame header in front of its payload
+#define BUFFER_SIZE (DFS_FRAME_HEADER_SIZE + DFS_URING_CHUNK_SIZE)
+
+//operations, kept in the upper half of an operation's user_data with the buffer index in the lower half
+#define OP_RECV 1
+#define OP_WRITE 2
+#define OP_READ 3
+#define OP_SEND 4
+
+struct dfs_uring {
+    int fd;
+    int depth;
+    int fixed;                     //the buffers are registered with the ring
+    unsigned char *buffers;        //depth buffers of BUFFER_SIZE bytes
+    unsigned pending;              //operations queued since the last io_uring_enter()
+
+    //submission queue
+    void *sq_map;
+    size_t sq_map_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    //completion queue; shares sq_map when the kernel offers IORING_FEAT_SINGLE_MMAP
+    void *cq_map;
+    size_t cq_map_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+//engine configuration and counters
+static enum dfs_io_engine io_engine = DFS_IO_BLOCKING;
+static int ring_depth = DFS_URING_DEFAULT_DEPTH;
+static struct dfs_uring_stats stats;
+
+//ring of each thread, released by the key's destructor when the thread exits
+static __thread struct dfs_uring *thread_ring;
+static __thread int thread_ring_failed;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static int unavailable_reported;
+
+//dfs_uring_configure: Selects the engine and the number of buffers of every ring.
+void dfs_uring_configure(enum dfs_io_engine engine, int depth) {
+    io_engine = engine;
+    ring_depth = depth > 0 ? depth : DFS_URING_DEFAULT_DEPTH;
+    if (ring_depth > DFS_URING_MAX_DEPTH) {
+        ring_depth = DFS_URING_MAX_DEPTH;
+    }
+}
+
+//dfs_uring_config_from_env: Reads DFS_IO_ENGINE and DFS_URING_DEPTH.
+void dfs_uring_config_from_env(void) {
+    const char *engine = getenv("DFS_IO_ENGINE");
+    const char *depth = getenv("DFS_URING_DEPTH");
+    dfs_uring_configure(engine ? dfs_uring_parse_engine(engine) : DFS_IO_BLOCKING, depth ? atoi(depth) : DFS_URING_DEFAULT_DEPTH);
+}
+
+enum dfs_io_engine dfs_uring_engine(void) {
+    return io_engine;
+}
+
+//dfs_uring_parse_engine: Maps "uring" (or "io_uring") to DFS_IO_URING; anything else is the blocking engine.
+enum dfs_io_engine dfs_uring_parse_engine(const char* name) {
+    if (name && (strcmp(name, "uring") == 0 || strcmp(name, "io_uring") == 0)) {
+        return DFS_IO_URING;
+    }
+    return DFS_IO_BLOCKING;
+}
+
+const char* dfs_uring_engine_name(enum dfs_io_engine engine) {
+    return engine == DFS_IO_URING ? "io_uring" : "blocking";
+}
+
+//dfs_uring_destroy: Unmaps the queues and closes the ring.
+void dfs_uring_destroy(struct dfs_uring* ring) {
+    if (!ring) {
+        return;
+    }
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring->buffers);
+    free(ring);
+}
+
+//dfs_uring_create: Sets up a ring with `depth` buffers and registers the buffers when the kernel allows it.
+//returns NULL with errno set if io_uring is unavailable.
+struct dfs_uring* dfs_uring_create(int depth) {
+    struct dfs_uring *ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->fd = -1;
+    ring->depth = depth > 0 && depth <= DFS_URING_MAX_DEPTH ? depth : DFS_URING_DEFAULT_DEPTH;
+
+    //every buffer has at most two operations queued at once (recv and write, or read then send)
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, 2 * ring->depth, &params);
+    if (ring->fd < 0) {
+        int saved_errno = errno;
+        dfs_uring_destroy(ring);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) {
+            ring->sq_map_size = ring->cq_map_size;
+        }
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        dfs_uring_destroy(ring);
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            dfs_uring_destroy(ring);
+            return NULL;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        dfs_uring_destroy(ring);
+        return NULL;
+    }
+
+    unsigned char *sq = ring->sq_map;
+    unsigned char *cq = ring->cq_map;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    void *buffers;
+    if (posix_memalign(&buffers, 4096, (size_t)ring->depth * BUFFER_SIZE) != 0) {
+        dfs_uring_destroy(ring);
+        errno = ENOMEM;
+        return NULL;
+    }
+    ring->buffers = buffers;
+    //registered buffers stay pinned, which saves mapping them for every read and write. they count against
+    //RLIMIT_MEMLOCK on older kernels; without them the ring uses plain reads and writes
+    struct iovec iov[DFS_URING_MAX_DEPTH];
+    for (int i = 0; i < ring->depth; i++) {
+        iov[i].iov_base = ring->buffers + (size_t)i * BUFFER_SIZE;
+        iov[i].iov_len = BUFFER_SIZE;
+    }
+    ring->fixed = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, ring->depth) == 0;
+    __atomic_add_fetch(&stats.rings, 1, __ATOMIC_RELAXED);
+    return ring;
+}
+
+//release_thread_ring: Key destructor freeing the ring of an exiting thread.
+static void release_thread_ring(void* ring) {
+    dfs_uring_destroy(ring);
+}
+
+static void create_ring_key(void) {
+    pthread_key_create(&ring_key, release_thread_ring);
+}
+
+//dfs_uring_thread: Returns the calling thread's ring, creating it on first use.
+struct dfs_uring* dfs_uring_thread(void) {
+    if (io_engine != DFS_IO_URING || thread_ring_failed) {
+        return NULL;
+    }
+    if (!thread_ring) {
+        pthread_once(&ring_key_once, create_ring_key);
+        thread_ring = dfs_uring_create(ring_depth);
+        if (!thread_ring) {
+            //report once per process, then keep the blocking engine on this thread
+            if (!__atomic_exchange_n(&unavailable_reported, 1, __ATOMIC_RELAXED)) {
+                fprintf(stderr, "io_uring is unavailable (%s), using blocking I/O\n", strerror(errno));
+            }
+            thread_ring_failed = 1;
+            return NULL;
+        }
+        pthread_setspecific(ring_key, thread_ring);
+    }
+    return thread_ring;
+}
+
+//buffer: Returns buffer `index` of the ring.
+static unsigned char* buffer(struct dfs_uring* ring, int index) {
+    return ring->buffers + (size_t)index * BUFFER_SIZE;
+}
+
+//queue_operation: Fills the next submission queue entry. the queue has room for two operations per buffer,
+//which is the most the transfers below keep in flight.
+static struct io_uring_sqe* queue_operation(struct dfs_uring* ring, uint8_t opcode, int fd, void* address, uint32_t length, uint64_t offset, int op, int index) {
+    unsigned tail = *ring->sq_tail;
+    unsigned slot = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)address;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = ((uint64_t)op << 32) | (uint32_t)index;
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    __atomic_add_fetch(&stats.submissions, 1, __ATOMIC_RELAXED);
+    return sqe;
+}
+
+//queue_file_io: Queues a read or write of a buffer's payload area at `offset` of `fd`.
+static struct io_uring_sqe* queue_file_io(struct dfs_uring* ring, int write, int fd, int index, uint32_t length, uint64_t offset) {
+    unsigned char *address = buffer(ring, index) + DFS_FRAME_HEADER_SIZE;
+    uint8_t opcode = write ? (ring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE) : (ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ);
+    struct io_uring_sqe *sqe = queue_operation(ring, opcode, fd, address, length, offset, write ? OP_WRITE : OP_READ, index);
+    if (ring->fixed) {
+        sqe->buf_index = index;
+    }
+    return sqe;
+}
+
+//enter: Submits the queued operations and waits until at least `wait` completions are available.
+static int enter(struct dfs_uring* ring, unsigned wait) {
+    while (ring->pending > 0 || wait > 0) {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        __atomic_add_fetch(&stats.enters, 1, __ATOMIC_RELAXED);
+        ring->pending -= submitted;
+        if (ring->pending == 0) {
+            return 0;
+        }
+        wait = 0;
+    }
+    return 0;
+}
+
+//next_completion: Takes the next completion off the queue. returns 0, or -1 if none is available.
+static int next_completion(struct dfs_uring* ring, int* op, int* index, int* result) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    *op = cqe->user_data >> 32;
+    *index = (uint32_t)cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//state of an upload: operations in flight per buffer and the outcome of the last recv
+struct recv_state {
+    int in_flight[DFS_URING_MAX_DEPTH];
+    uint32_t length[DFS_URING_MAX_DEPTH];  //bytes of the write queued on each buffer
+    int recv_result;
+    int recv_done;
+    int write_failed;
+    int busy;           //operations in flight on all buffers
+};
+
+//reap_upload: Waits for and handles completions of an upload until `until_recv` is 0 or the pending recv is done,
+//and at least `want_free` is 0 or a buffer is free. returns a free buffer, or -1 with until_recv / want_free unset.
+static int reap_upload(struct dfs_uring* ring, struct recv_state* state, int until_recv, int want_free) {
+    while (1) {
+        if (!until_recv || state->recv_done) {
+            if (!want_free) {
+                return -1;
+            }
+            for (int i = 0; i < ring->depth; i++) {
+                if (state->in_flight[i] == 0) {
+                    return i;
+                }
+            }
+        }
+        if (enter(ring, 1) < 0) {
+            return -2;
+        }
+        int op, index, result;
+        while (next_completion(ring, &op, &index, &result) == 0) {
+            state->in_flight[index]--;
+            state->busy--;
+            if (op == OP_RECV) {
+                state->recv_result = result;
+                state->recv_done = 1;
+            } else if (op == OP_WRITE && result != -ECANCELED && result != (int)state->length[index] && !state->write_failed) {
+                fprintf(stderr, "Failed to write file: %s\n", result < 0 ? strerror(-result) : "short write");
+                state->write_failed = 1;
+            }
+        }
+    }
+}
+
+//drain_upload: Waits for every operation of an upload to complete.
+static int drain_upload(struct dfs_uring* ring, struct recv_state* state) {
+    while (state->busy > 0) {
+        if (enter(ring, 1) < 0) {
+            return -1;
+        }
+        int op, index, result;
+        while (next_completion(ring, &op, &index, &result) == 0) {
+            state->in_flight[index]--;
+            state->busy--;
+            if (op == OP_WRITE && result != -ECANCELED && result != (int)state->length[index]) {
+                state->write_failed = 1;
+            }
+        }
+    }
+    return 0;
+}
+
+//dfs_uring_recv_stream: Receives a stream of DATA frames into `fd`.
+//each payload chunk is received into a free buffer by a recv linked to the write of that buffer, so the file is
+//written while the next chunk is received. recvs are queued one at a time, since the socket is read in order.
+//like dfs_recv_stream_to_fd() the whole stream is consumed after a write error.
+long long dfs_uring_recv_stream(struct dfs_uring* ring, int sock, int fd, char* error_message, size_t error_capacity) {
+    struct recv_state state;
+    memset(&state, 0, sizeof(state));
+    off_t start = fd >= 0 ? lseek(fd, 0, SEEK_CUR) : 0;
+    uint64_t position = start > 0 ? start : 0;
+    long long total_bytes = 0;
+    unsigned char *payload = NULL;
+    const char *failure = NULL;
+    struct dfs_frame frame;
+
+    while (failure == NULL) {
+        if (dfs_recv_header(sock, &frame) < 0) {
+            failure = "Connection lost during transfer";
+            break;
+        }
+        if (frame.opcode == DFS_OP_STATUS) {
+            //the sender aborted the stream
+            char message[DFS_MAX_CONTROL_PAYLOAD] = {0};
+            uint32_t keep = frame.length < sizeof(message) - 1 ? frame.length : sizeof(message) - 1;
+            if (dfs_read_full(sock, message, keep) < 0 || dfs_skip_payload(sock, frame.length - keep) < 0) {
+                snprintf(message, sizeof(message), "Connection lost during transfer");
+            }
+            drain_upload(ring, &state);
+            free(payload);
+            if (error_message) {
+                snprintf(error_message, error_capacity, "%s", message);
+            }
+            return -1;
+        }
+        if (frame.opcode != DFS_OP_DATA) {
+            fprintf(stderr, "Unexpected %s frame inside data stream\n", dfs_opcode_name(frame.opcode));
+            failure = "Connection lost during transfer";
+            break;
+        }
+
+        if (frame.flags & DFS_FLAG_COMPRESSED) {
+            //a compressed block is read and decoded here, then written from a buffer like a received chunk
+            int index = reap_upload(ring, &state, 0, 1);
+            if (payload == NULL) {
+                payload = malloc(DFS_COMPRESS_PAYLOAD_MAX);
+            }
+            long decoded = -1;
+            if (index < 0 || payload == NULL || frame.length > DFS_COMPRESS_PAYLOAD_MAX || dfs_read_full(sock, payload, frame.length) < 0 ||
+                (decoded = dfs_decompress_payload(payload, frame.length, buffer(ring, index) + DFS_FRAME_HEADER_SIZE, DFS_URING_CHUNK_SIZE)) < 0) {
+                fprintf(stderr, "Failed to receive compressed data\n");
+                failure = "Corrupt compressed data";
+                break;
+            }
+            if (!state.write_failed && fd >= 0 && decoded > 0) {
+                queue_file_io(ring, 1, fd, index, decoded, position);
+                state.length[index] = decoded;
+                state.in_flight[index]++;
+                state.busy++;
+                if (enter(ring, 0) < 0) {
+                    failure = "Failed to write file";
+                    break;
+                }
+            }
+            position += decoded;
+            total_bytes += decoded;
+        }
+        uint32_t remaining = frame.flags & DFS_FLAG_COMPRESSED ? 0 : frame.length;
+        while (remaining > 0) {
+            uint32_t chunk = remaining < DFS_URING_CHUNK_SIZE ? remaining : DFS_URING_CHUNK_SIZE;
+            int index = reap_upload(ring, &state, 0, 1);
+            if (index < 0) {
+                failure = "Connection lost during transfer";
+                break;
+            }
+            //the write only starts once the recv filled the buffer; a short recv cancels it
+            int write = !state.write_failed && fd >= 0;
+            struct io_uring_sqe *sqe = queue_operation(ring, IORING_OP_RECV, sock, buffer(ring, index) + DFS_FRAME_HEADER_SIZE, chunk, 0, OP_RECV, index);
+            sqe->msg_flags = MSG_WAITALL;
+            state.in_flight[index]++;
+            state.busy++;
+            if (write) {
+                sqe->flags |= IOSQE_IO_LINK;
+                queue_file_io(ring, 1, fd, index, chunk, position);
+                state.length[index] = chunk;
+                state.in_flight[index]++;
+                state.busy++;
+            }
+            state.recv_done = 0;
+            if (reap_upload(ring, &state, 1, 0) == -2 || state.recv_result != (int)chunk) {
+                failure = "Connection lost during transfer";
+                break;
+            }
+            position += chunk;
+            remaining -= chunk;
+            total_bytes += chunk;
+        }
+        if (frame.flags & DFS_FLAG_END) {
+            break;
+        }
+    }
+
+    if (drain_upload(ring, &state) < 0 && failure == NULL) {
+        failure = "Failed to write file";
+    }
+    free(payload);
+    if (failure == NULL && state.write_failed) {
+        failure = "Failed to write file";
+    }
+    if (failure != NULL) {
+        if (error_message) {
+            snprintf(error_message, error_capacity, "%s", failure);
+        }
+        return -1;
+    }
+    if (fd >= 0) {
+        lseek(fd, position, SEEK_SET);
+    }
+    __atomic_add_fetch(&stats.received_bytes, total_bytes, __ATOMIC_RELAXED);
+    return total_bytes;
+}
+
+//buffer states of a download
+#define BUFFER_FREE 0
+#define BUFFER_READING 1
+#define BUFFER_READY 2
+#define BUFFER_SENDING 3
+
+//dfs_uring_send_stream: Sends a file range as a complete stream, one DATA frame per buffer.
+//reads run ahead into every free buffer while one send at a time drains the buffers in file order.
+//if the file shrinks while being sent, the frame is padded with zeros and an error status ends the stream.
+long long dfs_uring_send_stream(struct dfs_uring* ring, int sock, int fd, off_t offset, long long length, uint32_t request_id) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+    off_t end = st.st_size;
+    if (length >= 0 && offset + length < end) {
+        end = offset + length;
+    }
+    uint64_t chunks = offset < end ? (end - offset + DFS_URING_CHUNK_SIZE - 1) / DFS_URING_CHUNK_SIZE : 0;
+
+    int state[DFS_URING_MAX_DEPTH] = {0};
+    uint32_t expected[DFS_URING_MAX_DEPTH];
+    int busy = 0;
+    uint64_t read_next = 0;        //next chunk to read
+    uint64_t send_next = 0;        //next chunk to send
+    uint64_t truncated = chunks;   //first chunk the file ended in, chunks if none
+    int failed = 0;
+
+    while (send_next < chunks && !failed) {
+        //read ahead into every free buffer; chunk i always uses buffer i % depth, which keeps the order
+        while (read_next < chunks && read_next < send_next + ring->depth) {
+            int index = read_next % ring->depth;
+            uint64_t start = offset + read_next * DFS_URING_CHUNK_SIZE;
+            expected[index] = end - start < DFS_URING_CHUNK_SIZE ? end - start : DFS_URING_CHUNK_SIZE;
+            queue_file_io(ring, 0, fd, index, expected[index], start);
+            state[index] = BUFFER_READING;
+            busy++;
+            read_next++;
+        }
+        int index = send_next % ring->depth;
+        if (state[index] == BUFFER_READY) {
+            unsigned char *frame = buffer(ring, index);
+            dfs_encode_header(frame, DFS_OP_DATA, 0, request_id, expected[index]);
+            struct io_uring_sqe *sqe = queue_operation(ring, IORING_OP_SEND, sock, frame, DFS_FRAME_HEADER_SIZE + expected[index], 0, OP_SEND, index);
+            sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            state[index] = BUFFER_SENDING;
+            busy++;
+        }
+
+        if (enter(ring, 1) < 0) {
+            failed = 1;
+            break;
+        }
+        int op, done, result;
+        while (next_completion(ring, &op, &done, &result) == 0) {
+            busy--;
+            if (op == OP_READ) {
+                if (result < 0) {
+                    failed = 1;
+                } else if ((uint32_t)result < expected[done]) {
+                    //the file ended early: the frame keeps its length, padded with zeros. reads complete within
+                    //the window of depth chunks from send_next, so the buffer tells which chunk this was
+                    memset(buffer(ring, done) + DFS_FRAME_HEADER_SIZE + result, 0, expected[done] - result);
+                    uint64_t chunk = send_next + (done - send_next % ring->depth + ring->depth) % ring->depth;
+                    if (chunk < truncated) {
+                        truncated = chunk;
+                    }
+                }
+                state[done] = BUFFER_READY;
+            } else {
+                if (result != (int)(DFS_FRAME_HEADER_SIZE + expected[done])) {
+                    failed = 1;
+                }
+                state[done] = BUFFER_FREE;
+                if (send_next == truncated) {
+                    //every frame up to the short one went out; the stream stops there
+                    failed = 1;
+                }
+                send_next++;
+            }
+        }
+    }
+
+    //a failed transfer still waits for its reads and sends, since they use the buffers
+    while (busy > 0) {
+        if (enter(ring, 1) < 0) {
+            break;
+        }
+        int op, done, result;
+        while (next_completion(ring, &op, &done, &result) == 0) {
+            busy--;
+        }
+    }
+    if (truncated < chunks) {
+        dfs_send_status(sock, request_id, 0, "File changed while being sent");
+        return -1;
+    }
+    if (failed || dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0) {
+        return -1;
+    }
+    long long total_bytes_sent = end > offset ? end - offset : 0;
+    __atomic_add_fetch(&stats.sent_bytes, total_bytes_sent, __ATOMIC_RELAXED);
+    return total_bytes_sent;
+}
+
+//dfs_uring_get_stats: Copies the engine's counters.
+void dfs_uring_get_stats(struct dfs_uring_stats* out) {
+    out->rings = __atomic_load_n(&stats.rings, __ATOMIC_RELAXED);
+    out->submissions = __atomic_load_n(&stats.submissions, __ATOMIC_RELAXED);
+    out->enters = __atomic_load_n(&stats.enters, __ATOMIC_RELAXED);
+    out->received_bytes = __atomic_load_n(&stats.received_bytes, __ATOMIC_RELAXED);
+    out->sent_bytes = __atomic_load_n(&stats.sent_bytes, __ATOMIC_RELAXED);
+}
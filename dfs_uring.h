@@ -0,0 +1,59 @@
+//dfs_uring.h
+//this header declares the optional io_uring engine Spdf and Stext can use for the file I/O of plain uploads and
+//downloads instead of the blocking calls of dfs_frame.h and dfs_xfer.h.
+//every worker thread owns a ring with a set of registered buffers. an upload queues the recv of each payload
+//chunk linked to the write of that chunk, so the file is written while the next chunk is received; a download
+//reads chunks ahead of the socket and sends them in order, one frame per buffer. completions are reaped in
+//batches with the next submissions, so one io_uring_enter() call does the work of several blocking calls.
+//the ring is driven through the raw system calls and <linux/io_uring.h>; no library is needed. where the kernel
+//has no io_uring the servers keep the blocking engine.
+#ifndef DFS_URING_H
+#define DFS_URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+//buffers per ring (operations in flight) when DFS_URING_DEPTH is not set, and the most allowed
+#define DFS_URING_DEFAULT_DEPTH 8
+#define DFS_URING_MAX_DEPTH 64
+//payload bytes per buffer; a download sends one DATA frame per buffer
+#define DFS_URING_CHUNK_SIZE (128 * 1024)
+
+//engines for file transfers
+enum dfs_io_engine {
+    DFS_IO_BLOCKING,   //read/write/sendfile loops of dfs_frame.h and dfs_xfer.h
+    DFS_IO_URING       //batched io_uring submissions
+};
+
+//running totals of this process, to see how much batching the engine achieves
+struct dfs_uring_stats {
+    unsigned long long rings;          //rings created
+    unsigned long long submissions;    //operations queued
+    unsigned long long enters;         //io_uring_enter() calls that submitted or waited for them
+    unsigned long long received_bytes; //payload bytes of uploads
+    unsigned long long sent_bytes;     //payload bytes of downloads
+};
+
+//engine configuration, applied before the first transfer
+void dfs_uring_configure(enum dfs_io_engine engine, int depth);
+void dfs_uring_config_from_env(void);
+enum dfs_io_engine dfs_uring_engine(void);
+enum dfs_io_engine dfs_uring_parse_engine(const char* name);
+const char* dfs_uring_engine_name(enum dfs_io_engine engine);
+
+//rings. dfs_uring_thread() returns the calling thread's ring, created on first use and freed when the thread
+//exits, or NULL when the blocking engine is configured or io_uring is unavailable.
+struct dfs_uring;
+struct dfs_uring* dfs_uring_create(int depth);
+void dfs_uring_destroy(struct dfs_uring* ring);
+struct dfs_uring* dfs_uring_thread(void);
+
+//dfs_uring_recv_stream() is dfs_recv_stream_to_fd() on a ring: `fd` is written from its current offset on, and
+//is left positioned after the last byte. dfs_uring_send_stream() is dfs_sendfile_stream() on a ring.
+long long dfs_uring_recv_stream(struct dfs_uring* ring, int sock, int fd, char* error_message, size_t error_capacity);
+long long dfs_uring_send_stream(struct dfs_uring* ring, int sock, int fd, off_t offset, long long length, uint32_t request_id);
+
+void dfs_uring_get_stats(struct dfs_uring_stats* out);
+
+#endif
@@ -0,0 +1,370 @@
+//dfs_xfer.c
+//this file implements the zero-copy transfer engine declared in dfs_xfer.h.
+//sendfile() is used for file to socket transfers and splice() through a pipe for socket to socket relays.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "dfs_frame.h"
+#include "dfs_xfer.h"
+
+//pipe used by splice(), created lazily once per thread and reused for every relay
+static __thread int relay_pipe[2] = {-1, -1};
+
+//relay configuration and counters
+static enum dfs_relay_mode relay_mode = DFS_RELAY_SPLICE;
+static int relay_pipe_size = 0;
+static int cork_streams = 0;
+static struct dfs_relay_stats local_stats;
+static struct dfs_relay_stats *relay_stats = &local_stats;
+
+//dfs_xfer_set_relay_mode: Selects how payloads are moved between sockets.
+void dfs_xfer_set_relay_mode(enum dfs_relay_mode mode) {
+    relay_mode = mode;
+}
+
+//dfs_xfer_set_cork: Selects whether file streams are sent on a corked socket, so the frame headers and
+//payloads leave in full segments rather than as the calls happen to split them.
+void dfs_xfer_set_cork(int on) {
+    cork_streams = on;
+}
+
+//dfs_xfer_cork: Corks or uncorks a socket when cork is set.
+void dfs_xfer_cork(int sock, int on) {
+    if (cork_streams) {
+        setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    }
+}
+
+//dfs_xfer_set_pipe_size: Sets the capacity requested for relay pipes; 0 keeps the kernel default.
+//a larger pipe lets each splice() call move more bytes.
+void dfs_xfer_set_pipe_size(int bytes) {
+    relay_pipe_size = bytes > 0 ? bytes : 0;
+}
+
+//dfs_xfer_get_relay_mode: Returns the configured relay mode.
+enum dfs_relay_mode dfs_xfer_get_relay_mode(void) {
+    return relay_mode;
+}
+
+//dfs_xfer_parse_relay_mode: Maps "splice" or "copy" to a relay mode, defaulting to splice.
+enum dfs_relay_mode dfs_xfer_parse_relay_mode(const char* name) {
+    if (name && strcmp(name, "copy") == 0) {
+        return DFS_RELAY_COPY;
+    }
+    return DFS_RELAY_SPLICE;
+}
+
+//dfs_xfer_relay_mode_name: Returns the configuration name of a relay mode.
+const char* dfs_xfer_relay_mode_name(enum dfs_relay_mode mode) {
+    return mode == DFS_RELAY_COPY ? "copy" : "splice";
+}
+
+//dfs_xfer_share_stats: Places the relay counters in an anonymous shared mapping.
+//call it before forking so every child process updates the same totals.
+int dfs_xfer_share_stats(void) {
+    struct dfs_relay_stats *shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return -1;
+    }
+    *shared = *relay_stats;
+    relay_stats = shared;
+    return 0;
+}
+
+//dfs_xfer_count: Adds bytes moved by a caller's own relay loop (e.g. Smain's event loop) to the counters.
+void dfs_xfer_count(unsigned long long spliced_bytes, unsigned long long copied_bytes) {
+    if (spliced_bytes) {
+        __atomic_add_fetch(&relay_stats->spliced_bytes, spliced_bytes, __ATOMIC_RELAXED);
+    }
+    if (copied_bytes) {
+        __atomic_add_fetch(&relay_stats->copied_bytes, copied_bytes, __ATOMIC_RELAXED);
+    }
+}
+
+//dfs_xfer_get_stats: Copies the current relay counters.
+void dfs_xfer_get_stats(struct dfs_relay_stats* out) {
+    out->spliced_bytes = __atomic_load_n(&relay_stats->spliced_bytes, __ATOMIC_RELAXED);
+    out->copied_bytes = __atomic_load_n(&relay_stats->copied_bytes, __ATOMIC_RELAXED);
+    out->splice_fallbacks = __atomic_load_n(&relay_stats->splice_fallbacks, __ATOMIC_RELAXED);
+}
+
+//copy_payload: Buffered fallback that moves `length` bytes from one descriptor to another.
+static int copy_payload(int source_fd, int dest_fd, uint64_t length) {
+    size_t chunk_size = dfs_data_chunk_size();
+    char *buffer = malloc(chunk_size);
+    if (!buffer) {
+        return -1;
+    }
+    while (length > 0) {
+        size_t chunk = length < chunk_size ? length : chunk_size;
+        if (dfs_read_full(source_fd, buffer, chunk) < 0 || dfs_write_full(dest_fd, buffer, chunk) < 0) {
+            free(buffer);
+            return -1;
+        }
+        length -= chunk;
+        __atomic_add_fetch(&relay_stats->copied_bytes, chunk, __ATOMIC_RELAXED);
+    }
+    free(buffer);
+    return 0;
+}
+
+//copy_file_range_to_socket: Buffered fallback for sendfile() using positional reads.
+//returns the number of bytes sent, which is short only if the file ended early, or -1 on error.
+static long long copy_file_range_to_socket(int sock, int fd, off_t offset, uint64_t length) {
+    size_t chunk_size = dfs_data_chunk_size();
+    char *buffer = malloc(chunk_size);
+    if (!buffer) {
+        return -1;
+    }
+    uint64_t sent = 0;
+    while (sent < length) {
+        size_t chunk = length - sent < chunk_size ? length - sent : chunk_size;
+        ssize_t n = pread(fd, buffer, chunk, offset + sent);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            free(buffer);
+            return n < 0 ? -1 : (long long)sent;
+        }
+        if (dfs_write_full(sock, buffer, n) < 0) {
+            free(buffer);
+            return -1;
+        }
+        sent += n;
+    }
+    free(buffer);
+    return sent;
+}
+
+//dfs_sendfile_range: Copies `length` bytes of `fd` starting at `offset` to `out_fd` with sendfile(),
+//falling back to positional reads when the kernel refuses. the file offset of `fd` is not changed.
+//returns the number of bytes sent, which is short only if the file ended early, or -1 on error.
+long long dfs_sendfile_range(int out_fd, int fd, off_t offset, uint64_t length) {
+    uint64_t sent = 0;
+    while (sent < length) {
+        off_t position = offset + sent;
+        ssize_t n = sendfile(out_fd, fd, &position, length - sent);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EINVAL || errno == ENOSYS) && sent == 0) {
+                return copy_file_range_to_socket(out_fd, fd, offset, length);
+            }
+            perror("sendfile failed");
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+//reset_relay_pipe: Discards the thread's pipe after a failed splice so stale bytes never leak into the next relay.
+static void reset_relay_pipe(void) {
+    if (relay_pipe[0] >= 0) {
+        close(relay_pipe[0]);
+        close(relay_pipe[1]);
+    }
+    relay_pipe[0] = relay_pipe[1] = -1;
+}
+
+//dfs_sendfile_frames: Sends `length` bytes of `fd` starting at `offset` as DATA frames without an END frame.
+//a negative `length` means "to the end of the file". each frame header is followed by sendfile() for its payload.
+//if the file shrinks while being sent, the frame is padded with zeros to keep the stream in sync and an error
+//status is sent. returns the number of file bytes sent or -1 on error.
+long long dfs_sendfile_frames(int sock, int fd, off_t offset, long long length, uint32_t request_id) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+    off_t end = st.st_size;
+    if (length >= 0 && offset + length < end) {
+        end = offset + length;
+    }
+
+    long long total_bytes_sent = 0;
+    while (offset < end) {
+        uint32_t frame_length = end - offset < DFS_SENDFILE_FRAME_SIZE ? end - offset : DFS_SENDFILE_FRAME_SIZE;
+        unsigned char header[DFS_FRAME_HEADER_SIZE];
+        dfs_encode_header(header, DFS_OP_DATA, 0, request_id, frame_length);
+        if (send(sock, header, sizeof(header), MSG_MORE | MSG_NOSIGNAL) != sizeof(header)) {
+            return -1;
+        }
+
+        //move the payload with sendfile, dropping to the buffered loop if the kernel refuses
+        long long frame_sent = dfs_sendfile_range(sock, fd, offset, frame_length);
+        if (frame_sent < 0) {
+            return -1;
+        }
+        offset += frame_sent;
+        total_bytes_sent += frame_sent;
+
+        //the file ended early: pad the frame and abort the stream
+        if (frame_sent < frame_length) {
+            char zeros[4096] = {0};
+            uint32_t missing = frame_length - frame_sent;
+            while (missing > 0) {
+                uint32_t chunk = missing < sizeof(zeros) ? missing : sizeof(zeros);
+                if (dfs_write_full(sock, zeros, chunk) < 0) {
+                    return -1;
+                }
+                missing -= chunk;
+            }
+            dfs_send_status(sock, request_id, 0, "File changed while being sent");
+            return -1;
+        }
+    }
+    return total_bytes_sent;
+}
+
+//dfs_sendfile_stream: Sends a file range as a complete stream: DATA frames followed by an END frame.
+//descriptors that are not regular files (pipes, sockets) are streamed with the buffered loop.
+long long dfs_sendfile_stream(int sock, int fd, off_t offset, long long length, uint32_t request_id) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return dfs_send_stream_from_fd(sock, fd, request_id);
+    }
+
+    dfs_xfer_cork(sock, 1);
+    long long total_bytes_sent = dfs_sendfile_frames(sock, fd, offset, length, request_id);
+    if (total_bytes_sent >= 0 && dfs_send_frame(sock, DFS_OP_DATA, DFS_FLAG_END, request_id, NULL, 0) < 0) {
+        total_bytes_sent = -1;
+    }
+    //uncorking pushes out the END frame
+    dfs_xfer_cork(sock, 0);
+    return total_bytes_sent;
+}
+
+//dfs_xfer_open_pipe: Creates a pipe for splicing and applies the configured capacity.
+int dfs_xfer_open_pipe(int pipe_fds[2], int nonblocking) {
+    if (pipe2(pipe_fds, O_CLOEXEC | (nonblocking ? O_NONBLOCK : 0)) < 0) {
+        pipe_fds[0] = pipe_fds[1] = -1;
+        return -1;
+    }
+    if (relay_pipe_size > 0 && fcntl(pipe_fds[1], F_SETPIPE_SZ, relay_pipe_size) < 0) {
+        //keep the default capacity, e.g. when the size exceeds /proc/sys/fs/pipe-max-size
+        perror("Failed to resize relay pipe");
+    }
+    return 0;
+}
+
+//dfs_splice_payload: Moves exactly `length` bytes from a socket to another descriptor through the thread's pipe.
+//in copy mode, or if splice() is not supported for these descriptors, the buffered loop is used instead.
+int dfs_splice_payload(int source_sock, int dest_fd, uint64_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    if (relay_mode == DFS_RELAY_COPY) {
+        return copy_payload(source_sock, dest_fd, length);
+    }
+    if (relay_pipe[0] < 0 && dfs_xfer_open_pipe(relay_pipe, 0) < 0) {
+        __atomic_add_fetch(&relay_stats->splice_fallbacks, 1, __ATOMIC_RELAXED);
+        return copy_payload(source_sock, dest_fd, length);
+    }
+
+    uint64_t moved = 0;
+    while (moved < length) {
+        //fill the pipe from the source socket
+        ssize_t in = splice(source_sock, NULL, relay_pipe[1], NULL, length - moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL && moved == 0) {
+                __atomic_add_fetch(&relay_stats->splice_fallbacks, 1, __ATOMIC_RELAXED);
+                return copy_payload(source_sock, dest_fd, length);
+            }
+            reset_relay_pipe();
+            return -1;
+        }
+        if (in == 0) {
+            //the source closed before the payload was complete
+            reset_relay_pipe();
+            return -1;
+        }
+
+        //drain the pipe into the destination
+        while (in > 0) {
+            ssize_t out = splice(relay_pipe[0], NULL, dest_fd, NULL, in, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out < 0 && errno == EINTR) {
+                continue;
+            }
+            if (out <= 0) {
+                reset_relay_pipe();
+                return -1;
+            }
+            in -= out;
+            moved += out;
+            __atomic_add_fetch(&relay_stats->spliced_bytes, out, __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
+//dfs_relay_stream: Forwards a stream from one socket to another, rewriting the request id.
+//frame headers are read and rewritten in user space while payloads are moved by dfs_splice_payload.
+//when `forward_end` is zero the terminating END flag is dropped so several streams can be merged into one.
+//an error STATUS frame from the source ends the relay; it is forwarded only when `forward_end` is set.
+//returns the number of payload bytes relayed or -1 on error.
+long long dfs_relay_stream(int source_sock, int dest_sock, uint32_t request_id, int forward_end) {
+    long long total_bytes = 0;
+    struct dfs_frame frame;
+
+    while (1) {
+        if (dfs_recv_header(source_sock, &frame) < 0) {
+            return -1;
+        }
+        if (frame.opcode != DFS_OP_DATA && frame.opcode != DFS_OP_STATUS) {
+            fprintf(stderr, "Unexpected %s frame inside relayed stream\n", dfs_opcode_name(frame.opcode));
+            return -1;
+        }
+        int is_error = frame.opcode == DFS_OP_STATUS;
+        int is_last = is_error || (frame.flags & DFS_FLAG_END);
+        int forward = !is_error || forward_end;
+        uint16_t flags = frame.flags;
+        if (!forward_end) {
+            flags &= ~DFS_FLAG_END;
+        }
+
+        if (forward && (frame.length > 0 || (is_last && forward_end))) {
+            unsigned char header[DFS_FRAME_HEADER_SIZE];
+            dfs_encode_header(header, frame.opcode, flags, request_id, frame.length);
+            if (send(dest_sock, header, sizeof(header), MSG_NOSIGNAL | (frame.length > 0 ? MSG_MORE : 0)) != sizeof(header)) {
+                return -1;
+            }
+        }
+        if (forward) {
+            if (dfs_splice_payload(source_sock, dest_sock, frame.length) < 0) {
+                return -1;
+            }
+        } else if (dfs_skip_payload(source_sock, frame.length) < 0) {
+            return -1;
+        }
+        if (!is_error) {
+            total_bytes += frame.length;
+        }
+        if (is_last) {
+            return is_error ? -1 : total_bytes;
+        }
+    }
+}
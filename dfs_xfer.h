@@ -0,0 +1,54 @@
+//dfs_xfer.h
+//this header declares the zero-copy transfer engine used for bulk data: sendfile() moves file pages straight
+//into a socket and splice() moves socket payloads through a pipe, so the data never enters user space.
+//every function falls back to a buffered read/write loop when the kernel refuses the zero-copy path.
+#ifndef DFS_XFER_H
+#define DFS_XFER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+//largest DATA frame emitted by the sendfile path; one header per 16 MiB is negligible overhead
+#define DFS_SENDFILE_FRAME_SIZE (16 * 1024 * 1024)
+
+//how socket to socket relays move payload bytes
+enum dfs_relay_mode {
+    DFS_RELAY_SPLICE,  //splice through a pipe, falling back to copying if the kernel refuses
+    DFS_RELAY_COPY     //always copy through a user space buffer
+};
+
+//running totals of relayed payload bytes, split by the path that moved them
+struct dfs_relay_stats {
+    unsigned long long spliced_bytes;
+    unsigned long long copied_bytes;
+    unsigned long long splice_fallbacks;
+};
+
+//relay configuration, applied before the first relay
+void dfs_xfer_set_relay_mode(enum dfs_relay_mode mode);
+void dfs_xfer_set_pipe_size(int bytes);
+void dfs_xfer_set_cork(int on);
+enum dfs_relay_mode dfs_xfer_parse_relay_mode(const char* name);
+const char* dfs_xfer_relay_mode_name(enum dfs_relay_mode mode);
+
+//used by callers that drive splice() themselves, such as Smain's epoll event loop
+enum dfs_relay_mode dfs_xfer_get_relay_mode(void);
+int dfs_xfer_open_pipe(int pipe_fds[2], int nonblocking);
+
+//relay counters; dfs_xfer_share_stats() moves them to shared memory so forked children add to one set
+int dfs_xfer_share_stats(void);
+void dfs_xfer_get_stats(struct dfs_relay_stats* out);
+void dfs_xfer_count(unsigned long long spliced_bytes, unsigned long long copied_bytes);
+
+//file to socket. with cork set, dfs_sendfile_stream() corks the socket for the whole stream;
+//dfs_xfer_cork() does the same for callers sending a stream themselves and does nothing without it
+void dfs_xfer_cork(int sock, int on);
+long long dfs_sendfile_range(int out_fd, int fd, off_t offset, uint64_t length);
+long long dfs_sendfile_frames(int sock, int fd, off_t offset, long long length, uint32_t request_id);
+long long dfs_sendfile_stream(int sock, int fd, off_t offset, long long length, uint32_t request_id);
+
+//socket to socket
+int dfs_splice_payload(int source_sock, int dest_fd, uint64_t length);
+long long dfs_relay_stream(int source_sock, int dest_sock, uint32_t request_id, int forward_end);
+
+#endif
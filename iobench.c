@@ -0,0 +1,329 @@
+//iobench.c
+//this program compares the file I/O engines of Spdf and Stext: the blocking engine (dfs_recv_stream_to_fd() and
+//dfs_sendfile_stream()) against the io_uring engine of dfs_uring.h.
+//for every file size and concurrency level it runs that many loopback TCP connections at once. on each one a
+//peer thread streams a file in DATA frames and a server thread stores it with the engine (upload), or the server
+//thread sends a file with the engine and the peer discards it (download). it prints one line per run.
+//usage: iobench [directory] [sizes] [concurrency levels], e.g. iobench /tmp 64K,1M,16M 1,4,16
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dfs_frame.h"
+#include "dfs_xfer.h"
+#include "dfs_uring.h"
+
+//defaults for the command line arguments
+#define DEFAULT_SIZES "64K,1M,16M,64M"
+#define DEFAULT_CONCURRENCY "1,4,16"
+#define MAX_LEVELS 16
+#define MAX_CONNECTIONS 256
+//bytes every run moves, spread over its connections, and the fewest transfers per connection
+#define RUN_BYTES (256ULL << 20)
+#define MIN_TRANSFERS 4
+
+//operations measured
+enum bench_op {
+    BENCH_UPLOAD,
+    BENCH_DOWNLOAD
+};
+
+//one connection of a run
+struct bench_connection {
+    int server_socket;
+    int peer_socket;
+    enum bench_op op;
+    const char *source;            //file sent by the peer (upload) or the server (download)
+    char destination[PATH_MAX];    //file written by the server of an upload
+    int transfers;
+    int failed;
+    pthread_barrier_t *barrier;
+};
+
+//function prototypes
+int function_to_parse_list(const char* text, unsigned long long* values, int capacity, int sizes);
+int function_to_create_source(const char* path, unsigned long long size);
+int function_to_connect_pair(int listen_fd, int* server_socket, int* peer_socket);
+void* function_to_run_server(void* arg);
+void* function_to_run_peer(void* arg);
+int function_to_run(enum dfs_io_engine engine, enum bench_op op, const char* directory, const char* source, unsigned long long size, int connections);
+double function_to_get_seconds(void);
+
+//main function: Creates the source files and runs every combination of engine, operation, size and concurrency.
+int main(int argc, char* argv[]) {
+    const char *directory = argc > 1 ? argv[1] : "/tmp";
+    unsigned long long sizes[MAX_LEVELS];
+    unsigned long long levels[MAX_LEVELS];
+    int size_count = function_to_parse_list(argc > 2 ? argv[2] : DEFAULT_SIZES, sizes, MAX_LEVELS, 1);
+    int level_count = function_to_parse_list(argc > 3 ? argv[3] : DEFAULT_CONCURRENCY, levels, MAX_LEVELS, 0);
+    if (size_count <= 0 || level_count <= 0) {
+        fprintf(stderr, "usage: %s [directory] [sizes, e.g. %s] [concurrency levels, e.g. %s]\n", argv[0], DEFAULT_SIZES, DEFAULT_CONCURRENCY);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    //the io_uring engine must work here, otherwise there is nothing to compare
+    dfs_uring_config_from_env();
+    struct dfs_uring *probe = dfs_uring_create(DFS_URING_DEFAULT_DEPTH);
+    if (!probe) {
+        fprintf(stderr, "io_uring is unavailable: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    dfs_uring_destroy(probe);
+
+    printf("%-9s %-9s %10s %5s %9s %10s %10s %10s\n", "engine", "op", "size", "conc", "transfers", "MB/s", "ops/s", "enters/op");
+    for (int s = 0; s < size_count; s++) {
+        char source[PATH_MAX];
+        snprintf(source, sizeof(source), "%s/iobench-source-%llu", directory, sizes[s]);
+        if (function_to_create_source(source, sizes[s]) < 0) {
+            fprintf(stderr, "Failed to create %s: %s\n", source, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        for (int l = 0; l < level_count; l++) {
+            for (int op = BENCH_UPLOAD; op <= BENCH_DOWNLOAD; op++) {
+                //both engines run back to back, so they see the same page cache
+                if (function_to_run(DFS_IO_BLOCKING, op, directory, source, sizes[s], levels[l]) < 0 ||
+                    function_to_run(DFS_IO_URING, op, directory, source, sizes[s], levels[l]) < 0) {
+                    unlink(source);
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+        unlink(source);
+    }
+    return EXIT_SUCCESS;
+}
+
+//function to parse a comma-separated list of numbers; sizes may end in K, M or G.
+//returns the number of values, or -1 if the list is invalid.
+int function_to_parse_list(const char* text, unsigned long long* values, int capacity, int sizes) {
+    int count = 0;
+    const char *p = text;
+    while (*p) {
+        char *end;
+        errno = 0;
+        unsigned long long value = strtoull(p, &end, 10);
+        if (errno != 0 || end == p || count == capacity) {
+            return -1;
+        }
+        if (sizes && (*end == 'K' || *end == 'k')) {
+            value <<= 10;
+            end++;
+        } else if (sizes && (*end == 'M' || *end == 'm')) {
+            value <<= 20;
+            end++;
+        } else if (sizes && (*end == 'G' || *end == 'g')) {
+            value <<= 30;
+            end++;
+        }
+        if ((*end != ',' && *end != '\0') || (!sizes && (value == 0 || value > MAX_CONNECTIONS))) {
+            return -1;
+        }
+        values[count++] = value;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+//function to write a source file of `size` bytes of varying content
+int function_to_create_source(const char* path, unsigned long long size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    unsigned char block[65536];
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < sizeof(block); i++) {
+        seed = seed * 1103515245 + 12345;
+        block[i] = seed >> 16;
+    }
+    unsigned long long written = 0;
+    while (written < size) {
+        size_t chunk = size - written < sizeof(block) ? size - written : sizeof(block);
+        if (dfs_write_full(fd, block, chunk) < 0) {
+            close(fd);
+            return -1;
+        }
+        written += chunk;
+    }
+    return close(fd);
+}
+
+//function to open one loopback connection and return both of its ends
+int function_to_connect_pair(int listen_fd, int* server_socket, int* peer_socket) {
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    if (getsockname(listen_fd, (struct sockaddr*)&address, &address_length) < 0) {
+        return -1;
+    }
+    *peer_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (*peer_socket < 0) {
+        return -1;
+    }
+    if (connect(*peer_socket, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(*peer_socket);
+        return -1;
+    }
+    *server_socket = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (*server_socket < 0) {
+        close(*peer_socket);
+        return -1;
+    }
+    return 0;
+}
+
+//function run by the server thread of a connection: stores or sends the file with the configured engine,
+//on a ring created before the clock starts
+void* function_to_run_server(void* arg) {
+    struct bench_connection *c = arg;
+    struct dfs_uring *ring = dfs_uring_thread();
+    pthread_barrier_wait(c->barrier);
+    for (int i = 0; i < c->transfers && !c->failed; i++) {
+        if (c->op == BENCH_UPLOAD) {
+            int fd = open(c->destination, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0 || (ring ? dfs_uring_recv_stream(ring, c->server_socket, fd, NULL, 0) : dfs_recv_stream_to_fd(c->server_socket, fd, NULL, 0)) < 0) {
+                c->failed = 1;
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        } else {
+            int fd = open(c->source, O_RDONLY | O_CLOEXEC);
+            if (fd < 0 || (ring ? dfs_uring_send_stream(ring, c->server_socket, fd, 0, -1, i) : dfs_sendfile_stream(c->server_socket, fd, 0, -1, i)) < 0) {
+                c->failed = 1;
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    //unblock the peer if the run failed
+    shutdown(c->server_socket, SHUT_RDWR);
+    return NULL;
+}
+
+//function run by the peer thread of a connection: sends the file as an upload, or discards the download
+void* function_to_run_peer(void* arg) {
+    struct bench_connection *c = arg;
+    pthread_barrier_wait(c->barrier);
+    for (int i = 0; i < c->transfers; i++) {
+        if (c->op == BENCH_UPLOAD) {
+            int fd = open(c->source, O_RDONLY | O_CLOEXEC);
+            long long sent = fd >= 0 ? dfs_sendfile_stream(c->peer_socket, fd, 0, -1, i) : -1;
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (sent < 0) {
+                break;
+            }
+        } else if (dfs_recv_stream_to_fd(c->peer_socket, -1, NULL, 0) < 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+//function to run one combination and print its line. returns 0, or -1 if the run failed.
+int function_to_run(enum dfs_io_engine engine, enum bench_op op, const char* directory, const char* source, unsigned long long size, int connections) {
+    static struct bench_connection pairs[MAX_CONNECTIONS];
+    pthread_t threads[2 * MAX_CONNECTIONS];
+    pthread_barrier_t barrier;
+
+    //every connection repeats the transfer until the run has moved RUN_BYTES
+    unsigned long long per_connection = RUN_BYTES / connections;
+    int transfers = size > 0 ? (int)(per_connection / size) : MIN_TRANSFERS;
+    if (transfers < MIN_TRANSFERS) {
+        transfers = MIN_TRANSFERS;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, MAX_CONNECTIONS) < 0) {
+        perror("Failed to listen on the loopback interface");
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+        return -1;
+    }
+    int opened = 0;
+    for (; opened < connections; opened++) {
+        struct bench_connection *c = &pairs[opened];
+        memset(c, 0, sizeof(*c));
+        if (function_to_connect_pair(listen_fd, &c->server_socket, &c->peer_socket) < 0) {
+            perror("Failed to connect");
+            break;
+        }
+        c->op = op;
+        c->source = source;
+        c->transfers = transfers;
+        c->barrier = &barrier;
+        snprintf(c->destination, sizeof(c->destination), "%s/iobench-upload-%d", directory, opened);
+    }
+    close(listen_fd);
+    if (opened < connections) {
+        for (int i = 0; i < opened; i++) {
+            close(pairs[i].server_socket);
+            close(pairs[i].peer_socket);
+        }
+        return -1;
+    }
+
+    dfs_uring_configure(engine, 0);
+    struct dfs_uring_stats before, after;
+    dfs_uring_get_stats(&before);
+    pthread_barrier_init(&barrier, NULL, 2 * connections + 1);
+    for (int i = 0; i < connections; i++) {
+        pthread_create(&threads[2 * i], NULL, function_to_run_server, &pairs[i]);
+        pthread_create(&threads[2 * i + 1], NULL, function_to_run_peer, &pairs[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    double start = function_to_get_seconds();
+    for (int i = 0; i < 2 * connections; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = function_to_get_seconds() - start;
+    dfs_uring_get_stats(&after);
+    pthread_barrier_destroy(&barrier);
+
+    int failed = 0;
+    for (int i = 0; i < connections; i++) {
+        failed |= pairs[i].failed;
+        close(pairs[i].server_socket);
+        close(pairs[i].peer_socket);
+        unlink(pairs[i].destination);
+    }
+    if (failed) {
+        fprintf(stderr, "%s %s of %llu bytes failed\n", dfs_uring_engine_name(engine), op == BENCH_UPLOAD ? "upload" : "download", size);
+        return -1;
+    }
+
+    unsigned long long total = (unsigned long long)transfers * connections;
+    double enters = engine == DFS_IO_URING ? (double)(after.enters - before.enters) / total : 0.0;
+    printf("%-9s %-9s %10llu %5d %9llu %10.1f %10.1f %10.2f\n", dfs_uring_engine_name(engine), op == BENCH_UPLOAD ? "upload" : "download",
+           size, connections, total, seconds > 0 ? total * size / seconds / 1e6 : 0.0, seconds > 0 ? total / seconds : 0.0, enters);
+    fflush(stdout);
+    return 0;
+}
+
+//function to read a monotonic clock in seconds
+double function_to_get_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}